@@ -368,4 +368,14 @@
 
     __cdecl const char* Plugin_GetCommonVersionString(); //return cod4x version
     __cdecl level_locals_t* Plugin_GetLevelBase( );
-    __cdecl void Plugin_UpdatePlayername(unsigned int clientnumber, const char* newname);
\ No newline at end of file
+    __cdecl void Plugin_UpdatePlayername(unsigned int clientnumber, const char* newname);
+
+    //Persistent key value store shared with the KVSet / KVGet script functions. Keys are up to 63 characters, strings up to 255.
+    //Lookups never touch the disk, changes are written in the background. Getters return qfalse if the key is missing or has another type
+    __cdecl qboolean Plugin_KVS_SetInt(const char* key, int value);
+    __cdecl qboolean Plugin_KVS_SetFloat(const char* key, float value);
+    __cdecl qboolean Plugin_KVS_SetString(const char* key, const char* value);
+    __cdecl qboolean Plugin_KVS_GetInt(const char* key, int* value);
+    __cdecl qboolean Plugin_KVS_GetFloat(const char* key, float* value);
+    __cdecl qboolean Plugin_KVS_GetString(const char* key, char* buf, int size);
+    __cdecl qboolean Plugin_KVS_Remove(const char* key);
\ No newline at end of file
@@ -23,6 +23,7 @@
 
 
 #include <string.h>
+#include <ctype.h>
 
 #include "cmd.h"
 #include "cvar.h"
@@ -318,6 +319,7 @@ void __cdecl Cbuf_Execute_WrapperIW(int arg1, int arg2)
 typedef struct cmd_function_s
 {
 	struct cmd_function_s	*next;
+	struct cmd_function_s	*hashNext;
 	const char		*name;
 	const char		*helptext;
 	int			minPower;
@@ -328,6 +330,45 @@ typedef struct cmd_function_s
 
 static cmd_function_t *cmd_functions;
 
+#define CMD_HASH_SIZE		512
+static cmd_function_t *cmd_hashTable[CMD_HASH_SIZE];
+
+/*
+================
+Cmd_HashValue
+
+Case insensitive like Q_stricmp() so every spelling of a command ends up in the same chain
+================
+*/
+static int Cmd_HashValue( const char *name ) {
+	int		i;
+	long	hash;
+
+	hash = 0;
+	for(i = 0; name[i] != '\0'; i++) {
+		hash += (long)tolower((byte)name[i]) * (i + 119);
+	}
+	return hash & (CMD_HASH_SIZE -1);
+}
+
+/*
+============
+Cmd_FindCommand
+
+Returns the most recently added command which matches name case insensitive
+============
+*/
+static cmd_function_t *Cmd_FindCommand( const char *name, int hash ) {
+	cmd_function_t	*cmd;
+
+	for ( cmd = cmd_hashTable[hash] ; cmd ; cmd = cmd->hashNext ) {
+		if ( !Q_stricmp( name, cmd->name ) ) {
+			return cmd;
+		}
+	}
+	return NULL;
+}
+
 
 /*
 ============
@@ -337,9 +378,12 @@ Cmd_AddCommand
 qboolean Cmd_AddCommandGeneric( const char *cmd_name, const char* helptext, xcommand_t function, qboolean warn, int power ) {
 
 	cmd_function_t  *cmd;
+	int hash;
+
+	hash = Cmd_HashValue( cmd_name );
 
 	// fail if the command already exists
-	for ( cmd = cmd_functions ; cmd ; cmd = cmd->next ) {
+	for ( cmd = cmd_hashTable[hash] ; cmd ; cmd = cmd->hashNext ) {
 		if ( !strcmp( cmd_name, cmd->name )) {
 			// allow completion-only commands to be silently doubled
 			if ( function != NULL && warn) {
@@ -363,6 +407,8 @@ qboolean Cmd_AddCommandGeneric( const char *cmd_name, const char* helptext, xcom
 	cmd->minPower = power;
 	cmd->next = cmd_functions;
 	cmd_functions = cmd;
+	cmd->hashNext = cmd_hashTable[hash];
+	cmd_hashTable[hash] = cmd;
 	return qtrue;
 }
 
@@ -390,7 +436,7 @@ Cmd_RemoveCommand
 qboolean Cmd_RemoveCommand( const char *cmd_name ) {
 	cmd_function_t  *cmd, **back;
 
-	back = &cmd_functions;
+	back = &cmd_hashTable[Cmd_HashValue( cmd_name )];
 	while ( 1 ) {
 		cmd = *back;
 		if ( !cmd ) {
@@ -398,13 +444,20 @@ qboolean Cmd_RemoveCommand( const char *cmd_name ) {
 			return qfalse;
 		}
 		if ( !strcmp( cmd_name, cmd->name ) ) {
+			*back = cmd->hashNext;
+			break;
+		}
+		back = &cmd->hashNext;
+	}
+
+	for ( back = &cmd_functions ; *back ; back = &(*back)->next ) {
+		if ( *back == cmd ) {
 			*back = cmd->next;
-			Z_Free( cmd );
-			return qtrue;
+			break;
 		}
-		back = &cmd->next;
 	}
-	return qfalse;
+	Z_Free( cmd );
+	return qtrue;
 }
 
 
@@ -501,29 +554,27 @@ qboolean Cmd_SetPower(const char *cmd_name, int power)
     cmd_function_t *cmd;
     if(!cmd_name) return qfalse;
 
-    for(cmd = cmd_functions ; cmd ; cmd = cmd->next){
-        if(!Q_stricmp(cmd_name, cmd->name)){
-            if(cmd->minPower != power){
-                cmd->minPower = power;
-            }
-            return qtrue;
-        }
+    cmd = Cmd_FindCommand(cmd_name, Cmd_HashValue(cmd_name));
+    if(cmd == NULL){
+        return qfalse;
     }
-    return qfalse;
+    if(cmd->minPower != power){
+        cmd->minPower = power;
+    }
+    return qtrue;
 }
 
 int	Cmd_GetPower(const char* cmd_name)
 {
 
     cmd_function_t *cmd;
-    for(cmd = cmd_functions ; cmd ; cmd = cmd->next){
-        if(!Q_stricmp(cmd_name,cmd->name)){
 
-                if(!cmd->minPower) return 100;
-                else return cmd->minPower;
-        }
+    cmd = Cmd_FindCommand(cmd_name, Cmd_HashValue(cmd_name));
+    if(cmd == NULL){
+        return -1; //Don't exist
     }
-    return -1; //Don't exist
+    if(!cmd->minPower) return 100;
+    else return cmd->minPower;
 }
 
 void Cmd_ResetPower()
@@ -1030,7 +1081,7 @@ Cmd_CompleteArgument
 void Cmd_CompleteArgument( const char *command, char *args, int argNum ) {
 	cmd_function_t	*cmd;
 
-	for( cmd = cmd_functions; cmd; cmd = cmd->next ) {
+	for( cmd = cmd_hashTable[Cmd_HashValue( command )]; cmd; cmd = cmd->hashNext ) {
 		if( !Q_stricmp( command, cmd->name ) && cmd->complete ) {
 			cmd->complete( args, argNum );
 		}
@@ -1047,7 +1098,7 @@ Cmd_SetCommandCompletionFunc
 void Cmd_SetCommandCompletionFunc( const char *command, completionFunc_t complete ) {
 	cmd_function_t	*cmd;
 
-	for( cmd = cmd_functions; cmd; cmd = cmd->next ) {
+	for( cmd = cmd_hashTable[Cmd_HashValue( command )]; cmd; cmd = cmd->hashNext ) {
 		if( !Q_stricmp( command, cmd->name ) ) {
 			cmd->complete = complete;
 		}
@@ -1141,6 +1192,57 @@ static void Cmd_ListPower_f() {
 
 
 
+/*
+============
+Cmd_LegacyAliases
+
+Old command names which are still accepted. The hash of every name
+is computed on first use so lookups don't need a string compare per entry
+============
+*/
+typedef struct
+{
+	const char	*name;
+	const char	*replacement;
+	qboolean	deprecated;
+	int			hash;
+	int			replacementHash;
+}cmdAlias_t;
+
+static cmdAlias_t cmd_legacyAliases[] =
+{
+	{ "authChangePassword", "changePassword", qtrue },
+	{ "authSetAdmin", "AdminAddAdminWithPassword", qtrue },
+	{ "authUnsetAdmin", "AdminRemoveAdmin", qtrue },
+	{ "authListAdmins", "adminListAdmins", qtrue },
+	{ "cmdpowerlist", "AdminListCommands", qtrue },
+	{ "setCmdMinPower", "AdminChangeCommandPower", qtrue },
+	{ "kickid", "kick", qfalse },
+	{ NULL, NULL, qfalse }
+};
+
+static qboolean cmd_legacyAliasesHashed;
+
+static const cmdAlias_t *Cmd_FindLegacyAlias( const char *name, int hash )
+{
+	cmdAlias_t *alias;
+
+	if ( !cmd_legacyAliasesHashed ) {
+		for ( alias = cmd_legacyAliases ; alias->name ; alias++ ) {
+			alias->hash = Cmd_HashValue( alias->name );
+			alias->replacementHash = Cmd_HashValue( alias->replacement );
+		}
+		cmd_legacyAliasesHashed = qtrue;
+	}
+
+	for ( alias = cmd_legacyAliases ; alias->name ; alias++ ) {
+		if ( alias->hash == hash && !Q_stricmp( name, alias->name ) ) {
+			return alias;
+		}
+	}
+	return NULL;
+}
+
 /*
 ============
 Cmd_ExecuteString
@@ -1150,8 +1252,10 @@ A complete command line has been parsed, so try to execute it
 */
 void	Cmd_ExecuteString( const char *text )
 {
-	cmd_function_t	*cmd, **prev;
+	cmd_function_t	*cmd;
+	const cmdAlias_t *alias;
 	char arg0[MAX_TOKEN_CHARS];
+	int hash;
 
 	// execute the command line
 	Cmd_TokenizeString( text );
@@ -1166,57 +1270,27 @@ void	Cmd_ExecuteString( const char *text )
 	if(!Q_stricmpn(arg0, "dvar", 4))
 	{
 		arg0[0] = 'c';
-	}else if(!Q_stricmpn(arg0, "auth", 4)){
-		if(!Q_stricmp(arg0, "authChangePassword"))
-		{
-			Q_strncpyz(arg0, "changePassword", sizeof(arg0));
-			Com_PrintWarning(CON_CHANNEL_SYSTEM,"\"authchangePassword\" is deprecated and will be removed soon. Use \"changePassword\" instead\n");
-		}
-		else if(!Q_stricmp(arg0, "authSetAdmin"))
-		{
-			Q_strncpyz(arg0, "AdminAddAdminWithPassword", sizeof(arg0));
-			Com_PrintWarning(CON_CHANNEL_SYSTEM,"\"authSetAdmin\" is deprecated and will be removed soon. Use \"AdminAddAdminWithPassword\" instead\n");
-		}
-		else if(!Q_stricmp(arg0, "authUnsetAdmin"))
-		{
-			Q_strncpyz(arg0, "AdminRemoveAdmin", sizeof(arg0));
-			Com_PrintWarning(CON_CHANNEL_SYSTEM,"\"authUnsetAdmin\" is deprecated and will be removed soon. Use \"AdminRemoveAdmin\" instead\n");
-		}
-		else if(!Q_stricmp(arg0, "authListAdmins"))
-		{
-			Q_strncpyz(arg0, "adminListAdmins", sizeof(arg0));
-			Com_PrintWarning(CON_CHANNEL_SYSTEM,"\"authListAdmins\" is deprecated and will be removed soon. Use \"adminListAdmins\" instead\n");
+	}
+	hash = Cmd_HashValue( arg0 );
+
+	alias = Cmd_FindLegacyAlias( arg0, hash );
+	if ( alias ) {
+		if ( alias->deprecated ) {
+			Com_PrintWarning(CON_CHANNEL_SYSTEM,"\"%s\" is deprecated and will be removed soon. Use \"%s\" instead\n", alias->name, alias->replacement);
 		}
-	}else if(!Q_stricmp(arg0, "cmdpowerlist")){
-		Q_strncpyz(arg0, "AdminListCommands", sizeof(arg0));
-		Com_PrintWarning(CON_CHANNEL_SYSTEM,"\"cmdpowerlist\" is deprecated and will be removed soon. Use \"AdminListCommands\" instead\n");
-	}else if(!Q_stricmp(arg0, "setCmdMinPower")){
-		Q_strncpyz(arg0, "AdminChangeCommandPower", sizeof(arg0));
-		Com_PrintWarning(CON_CHANNEL_SYSTEM,"\"setCmdMinPower\" is deprecated and will be removed soon. Use \"AdminChangeCommandPower\" instead\n");
-	}else if(!Q_stricmp(arg0, "kickid")){
-		Q_strncpyz(arg0, "kick", sizeof(arg0));
+		Q_strncpyz(arg0, alias->replacement, sizeof(arg0));
+		hash = alias->replacementHash;
 	}
+
 	// check registered command functions
-	for ( prev = &cmd_functions ; *prev ; prev = &cmd->next ) {
-		cmd = *prev;
-		if ( !Q_stricmp( arg0, cmd->name ) ) {
-			// rearrange the links so that the command will be
-			// near the head of the list next time it is used
-			*prev = cmd->next;
-			cmd->next = cmd_functions;
-			cmd_functions = cmd;
-
-			// perform the action
-			if ( !cmd->function ) {
-				// let the cgame or game handle it
-				break;
-			} else {
-				cmd->function ();
-			}
-			Cmd_EndTokenizedString( );
-			return;
-		}
+	cmd = Cmd_FindCommand( arg0, hash );
+	if ( cmd && cmd->function ) {
+		// perform the action
+		cmd->function ();
+		Cmd_EndTokenizedString( );
+		return;
 	}
+	// a command without function is left to the cgame or game
 
 	// check cvars
 	if ( Cvar_Command() ) {
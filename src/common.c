@@ -83,6 +83,7 @@ cvar_t* useFastFile;
 cvar_t* com_developer;
 cvar_t* com_developer_script;
 cvar_t* com_logfile;
+cvar_t* com_logfileOverflow;
 cvar_t* com_sv_running;
 cvar_t* com_securemodevar;
 cvar_t* sv_webadmin;
@@ -136,9 +137,12 @@ typedef timedEventArg_t timedEventArgs_t[MAX_TIMEDEVENTARGS];
 
 
 #define MAX_QUEUED_EVENTS  256
-#define MAX_TIMED_EVENTS  1024
 #define MASK_QUEUED_EVENTS ( MAX_QUEUED_EVENTS - 1 )
+
+#define TIMEDEVENT_SLOTBITS 20
+#define MAX_TIMED_EVENTS  ( 1 << TIMEDEVENT_SLOTBITS )
 #define MASK_TIMED_EVENTS ( MAX_TIMED_EVENTS - 1 )
+#define MIN_TIMED_EVENTS  256
 
 typedef struct{
 	int evTime, evTriggerTime;
@@ -146,12 +150,29 @@ typedef struct{
 	void (*evFunction)();
 }timedSysEvent_t;
 
+/*
+Timed events live in slots which don't move. The pending ones are kept in a binary min-heap of slot numbers.
+A handle is the slot number combined with a generation counter so a stale handle can't cancel a newer event.
+*/
+typedef struct{
+	timedSysEvent_t ev;
+	unsigned int sequence; //Events with the same trigger time run in the order they were added
+	int heapIndex; //-1 if the slot is free
+	int generation;
+	int nextFree;
+}timedEventSlot_t;
+
 
 static sysEvent_t  eventQueue[ MAX_QUEUED_EVENTS ];
-static timedSysEvent_t  timedEventBuffer[ MAX_QUEUED_EVENTS ];
 static int         eventHead = 0;
 static int         eventTail = 0;
-static int         timedEventHead = 0;
+
+static timedEventSlot_t *timedEventSlots;
+static int         *timedEventHeap;
+static int         timedEventCapacity = 0;
+static int         timedEventCount = 0;
+static int         timedEventFree = -1;
+static unsigned int timedEventSequence = 0;
 
 
 void EventTimerTest(int time, int triggerTime, int value, char* s){
@@ -169,6 +190,156 @@ void CM_Shutdown();
 void Init_Watchdog();
 
 
+/*
+================
+Com_TimedEventBefore
+
+Heap order
+================
+*/
+static qboolean Com_TimedEventBefore(int slota, int slotb)
+{
+	timedEventSlot_t *a = &timedEventSlots[slota];
+	timedEventSlot_t *b = &timedEventSlots[slotb];
+
+	if(a->ev.evTriggerTime != b->ev.evTriggerTime)
+		return a->ev.evTriggerTime < b->ev.evTriggerTime;
+
+	return (int)(a->sequence - b->sequence) < 0;
+}
+
+static void Com_TimedEventHeapSet(int pos, int slot)
+{
+	timedEventHeap[pos] = slot;
+	timedEventSlots[slot].heapIndex = pos;
+}
+
+static void Com_TimedEventHeapUp(int pos)
+{
+	int slot = timedEventHeap[pos];
+	int parent;
+
+	while(pos > 0)
+	{
+		parent = (pos -1) / 2;
+		if(!Com_TimedEventBefore(slot, timedEventHeap[parent]))
+			break;
+
+		Com_TimedEventHeapSet(pos, timedEventHeap[parent]);
+		pos = parent;
+	}
+	Com_TimedEventHeapSet(pos, slot);
+}
+
+static void Com_TimedEventHeapDown(int pos)
+{
+	int slot = timedEventHeap[pos];
+	int child;
+
+	while((child = 2 * pos +1) < timedEventCount)
+	{
+		if(child +1 < timedEventCount && Com_TimedEventBefore(timedEventHeap[child +1], timedEventHeap[child]))
+			child++;
+
+		if(!Com_TimedEventBefore(timedEventHeap[child], slot))
+			break;
+
+		Com_TimedEventHeapSet(pos, timedEventHeap[child]);
+		pos = child;
+	}
+	Com_TimedEventHeapSet(pos, slot);
+}
+
+/*
+================
+Com_TimedEventGrow
+
+Doubles the number of slots
+================
+*/
+static qboolean Com_TimedEventGrow()
+{
+	timedEventSlot_t *newslots;
+	int *newheap;
+	int newcapacity, i;
+
+	if(timedEventCapacity >= MAX_TIMED_EVENTS)
+		return qfalse;
+
+	newcapacity = timedEventCapacity ? 2 * timedEventCapacity : MIN_TIMED_EVENTS;
+
+	newslots = realloc(timedEventSlots, newcapacity * sizeof(timedEventSlot_t));
+	if(newslots == NULL)
+		return qfalse;
+
+	timedEventSlots = newslots;
+
+	newheap = realloc(timedEventHeap, newcapacity * sizeof(int));
+	if(newheap == NULL)
+		return qfalse;
+
+	timedEventHeap = newheap;
+
+	for(i = newcapacity -1; i >= timedEventCapacity; i--)
+	{
+		timedEventSlots[i].heapIndex = -1;
+		timedEventSlots[i].generation = 0;
+		timedEventSlots[i].nextFree = timedEventFree;
+		timedEventFree = i;
+	}
+	timedEventCapacity = newcapacity;
+	return qtrue;
+}
+
+/*
+================
+Com_TimedEventSlotForHandle
+
+Returns -1 if the event has already been executed or cancelled
+================
+*/
+static int Com_TimedEventSlotForHandle(int handle)
+{
+	int slot;
+
+	if(handle < 0)
+		return -1;
+
+	slot = handle & MASK_TIMED_EVENTS;
+
+	if(slot >= timedEventCapacity || timedEventSlots[slot].heapIndex < 0 || timedEventSlots[slot].generation != (handle >> TIMEDEVENT_SLOTBITS))
+		return -1;
+
+	return slot;
+}
+
+/*
+================
+Com_TimedEventRemoveSlot
+
+Takes the event out of the heap and puts its slot back to the free list
+================
+*/
+static void Com_TimedEventRemoveSlot(int slot)
+{
+	int pos = timedEventSlots[slot].heapIndex;
+
+	timedEventCount--;
+	if(pos < timedEventCount)
+	{
+		Com_TimedEventHeapSet(pos, timedEventHeap[timedEventCount]);
+		if(pos > 0 && Com_TimedEventBefore(timedEventHeap[pos], timedEventHeap[(pos -1) / 2]))
+			Com_TimedEventHeapUp(pos);
+		else
+			Com_TimedEventHeapDown(pos);
+	}
+
+	timedEventSlots[slot].heapIndex = -1;
+	timedEventSlots[slot].generation = (timedEventSlots[slot].generation +1) & 0x7ff;
+	timedEventSlots[slot].nextFree = timedEventFree;
+	timedEventFree = slot;
+}
+
 /*
 ================
 Com_SetTimedEventCachelist
@@ -177,13 +348,15 @@ Com_SetTimedEventCachelist
 */
 void Com_MakeTimedEventArgCached(unsigned int index, unsigned int arg, unsigned int size){
 
-	if(index >= MAX_TIMED_EVENTS)
+	int slot = Com_TimedEventSlotForHandle(index);
+
+	if(slot < 0)
 		Com_Error(ERR_FATAL, "Com_MakeTimedEventArgCached: Bad index: %d", index);
 
 	if(arg >= MAX_TIMEDEVENTARGS)
 		Com_Error(ERR_FATAL, "Com_MakeTimedEventArgCached: Bad function argument number. Allowed range is 0 - %d arguments", MAX_TIMEDEVENTARGS);
 
-	timedSysEvent_t  *ev = &timedEventBuffer[index];
+	timedSysEvent_t  *ev = &timedEventSlots[slot].ev;
 	void *ptr = Z_Malloc(size);
 	Com_Memcpy(ptr, ev->evArguments[arg].arg.p, size);
 	ev->evArguments[arg].size = size;
@@ -195,52 +368,37 @@ void Com_MakeTimedEventArgCached(unsigned int index, unsigned int arg, unsigned
 ================
 Com_AddTimedEvent
 
+Returns a handle for Com_CancelTimedEvent or -1
 ================
 */
 int QDECL Com_AddTimedEvent( int delay, void *function, unsigned int argcount, ...)
 {
 	timedSysEvent_t  *ev;
-	int index;
+	timedEventSlot_t *eslot;
+	int slot;
 	int i;
 	int time;
-	int triggerTime;
 
-	if ( timedEventHead >= MAX_TIMED_EVENTS )
+	if(argcount > MAX_TIMEDEVENTARGS)
+	{
+		Com_Error(ERR_FATAL, "Com_AddTimedEvent: Bad number of function arguments. Allowed range is 0 - %d arguments", MAX_TIMEDEVENTARGS);
+		return -1;
+	}
+
+	if ( timedEventFree < 0 && !Com_TimedEventGrow() )
 	{
 		Com_PrintWarning(CON_CHANNEL_SYSTEM,"Com_AddTimedEvent: overflow - Lost one event\n");
 		// we are discarding an event, but don't leak memory
 		return -1;
 	}
 
-	index = timedEventHead;
+	slot = timedEventFree;
+	eslot = &timedEventSlots[slot];
+	timedEventFree = eslot->nextFree;
 
 	time = Sys_Milliseconds();
 
-	triggerTime = delay + time;
-
-	while(qtrue)
-	{
-		if(index > 0){
-
-			ev = &timedEventBuffer[index -1];
-
-			if(ev->evTriggerTime < triggerTime)
-			{
-				timedEventBuffer[index] = *ev;
-				index--;
-				continue;
-			}
-		}
-		break;
-	}
-
-	if(argcount > MAX_TIMEDEVENTARGS)
-	{
-		Com_Error(ERR_FATAL, "Com_AddTimedEvent: Bad number of function arguments. Allowed range is 0 - %d arguments", MAX_TIMEDEVENTARGS);
-		return -1;
-	}
-
-	ev = &timedEventBuffer[index];
+	ev = &eslot->ev;
 
 	va_list		argptr;
 	va_start(argptr, argcount);
@@ -256,10 +414,52 @@ int QDECL Com_AddTimedEvent( int delay, void *function, unsigned int argcount, .
 	va_end(argptr);
 
 	ev->evTime = time;
-	ev->evTriggerTime = triggerTime;
+	ev->evTriggerTime = delay + time;
 	ev->evFunction = function;
-	timedEventHead++;
-	return index;
+	eslot->sequence = timedEventSequence++;
+
+	timedEventHeap[timedEventCount] = slot;
+	timedEventCount++;
+	Com_TimedEventHeapUp(timedEventCount -1);
+
+	return (eslot->generation << TIMEDEVENT_SLOTBITS) | slot;
+}
+
+/*
+================
+Com_CancelTimedEvent
+
+Removes a pending event. Returns qfalse if it has already been executed or cancelled
+================
+*/
+qboolean Com_CancelTimedEvent( int handle )
+{
+	timedSysEvent_t *ev;
+	int slot, i;
+
+	slot = Com_TimedEventSlotForHandle(handle);
+	if(slot < 0)
+		return qfalse;
+
+	ev = &timedEventSlots[slot].ev;
+	for(i = 0; i < MAX_TIMEDEVENTARGS; i++)
+	{
+		if(ev->evArguments[i].size > 0){
+			Z_Free(ev->evArguments[i].arg.p);
+		}
+	}
+	Com_TimedEventRemoveSlot(slot);
+	return qtrue;
+}
+
+/*
+================
+Com_NumTimedEvents
+================
+*/
+int Com_NumTimedEvents( )
+{
+	return timedEventCount;
 }
 
 
@@ -319,15 +519,17 @@ Com_GetTimedEvent
 */
 timedSysEvent_t* Com_GetTimedEvent( int time )
 {
-	timedSysEvent_t  *ev;
+	static timedSysEvent_t  ev; //The slot can get reused by the event handler
+	int slot;
 
-	if(timedEventHead > 0)
+	if(timedEventCount > 0)
 	{
-		ev = &timedEventBuffer[timedEventHead - 1];
-		if(ev->evTriggerTime <= time)
+		slot = timedEventHeap[0];
+		if(timedEventSlots[slot].ev.evTriggerTime <= time)
 		{
-			timedEventHead--; //We have removed one event
-			return ev;
+			ev = timedEventSlots[slot].ev;
+			Com_TimedEventRemoveSlot(slot); //We have removed one event
+			return &ev;
 		}
 	}
 	return NULL;
@@ -427,6 +629,7 @@ Com_TimedEventLoop
 */
 void Com_TimedEventLoop( void ) {
 	timedSysEvent_t	*evt;
+	timedSysEvent_t	current;
 	int time = Sys_Milliseconds();
 	int i;
 
@@ -437,6 +640,8 @@ void Com_TimedEventLoop( void ) {
 		if ( !evt ) {
 			break;
 		}
+		current = *evt;
+		evt = &current;
 		//Execute the passed eventhandler
 		if(evt->evFunction)
 			evt->evFunction(evt->evArguments[0].arg, evt->evArguments[1].arg, evt->evArguments[2].arg, evt->evArguments[3].arg,
@@ -623,6 +828,7 @@ void Com_Quit_f( void ) {
 static void Com_InitCvars( void ){
     static const char* dedicatedEnum[] = {"listen server", "dedicated LAN server", "dedicated internet server", NULL};
     static const char* logfileEnum[] = {"disabled", "async file write", "sync file write", NULL};
+    static const char* logfileOverflowEnum[] = {"block", "drop", NULL};
 	mvabuf;
 
     char* s;
@@ -649,6 +855,7 @@ static void Com_InitCvars( void ){
     com_developer = Cvar_RegisterInt("developer", 0, 0, 2, 0, "Enable development options");
     com_developer_script = Cvar_RegisterBool ("developer_script", qfalse, 16, "Enable developer script comments");
     com_logfile = Cvar_RegisterEnum("logfile", logfileEnum, 0, 0, "Write to logfile");
+    com_logfileOverflow = Cvar_RegisterEnum("logfile_overflow", logfileOverflowEnum, 0, 0, "What happens with log messages when the logfile writer can not keep up. block waits for the writer, drop discards and counts them");
     com_logrcon = Cvar_RegisterBool("logrcon", 0, 0, "Write response of rcon commands to logfile");
     com_sv_running = Cvar_RegisterBool("sv_running", qfalse, 64, "Server is running");
     com_securemodevar = Cvar_RegisterBool("securemode", qfalse, CVAR_INIT, "CoD4 runs in secure mode which restricts execution of external scripts/programs and loading of unauthorized shared libraries/plugins. This is recommended in a shared hosting environment");
@@ -786,6 +993,7 @@ void Com_Init(char* commandLine){
     }
     Cmd_AddCommand ("quit", Com_Quit_f);
     Cmd_AddCommand ("writeconfig", Com_WriteConfig_f );
+    Cmd_AddCommand ("logstats", Com_LogfileStats_f );
 
 //    Com_AddLoggingCommands();
 //    HL2Rcon_AddSourceAdminCommands();
@@ -994,6 +1202,8 @@ __optimize3 void Com_Frame( void ) {
 		}
 		Sys_LeaveCriticalSection(CRITSECT_COM_ERROR);
 	}
+	/* Also ends a packet batch which an error has left open */
+	NET_ResetPacketBatch();
 	//
 	// main event loop
 	//
@@ -1367,6 +1577,12 @@ void QDECL Com_Error( int code, const char *fmt, ... ) {
 
 		Com_Printf(CON_CHANNEL_ERROR, "%s\n", l_errorMessage);
 
+		/* Worker threads with an abort frame report the error to the main thread themselves */
+		abortframe = (jmp_buf*)Sys_GetValue(2);
+		if(abortframe)
+		{
+			longjmp (*abortframe, -1);
+		}
 		Sys_ExitThread(-1);
 		return;
 	}
@@ -287,87 +287,159 @@ void QDECL Com_DPrintfLogfile( const char *fmt, ... ) {
 
 
 static volatile HANDLE wakelogfilewriter;
-static volatile DWORD logfilewriterworking;
-static volatile qboolean logwriterenabled;
 static volatile threadid_t logthreadid = -1;
+/* Handles the writer thread has to flush and close. A slot is set by Com_CloseLogFile and cleared by the writer once closed */
+static volatile DWORD closinglogfiles[8];
 
+#define LOGFILE_CLOSE_TIMEOUT 10000 //Milliseconds
 
-void* Com_WriteLogThread(void* null)
+static void Com_FlushLogFiles( )
 {
-	logwriterenabled = qtrue;
+	int i;
+	fileHandle_t h;
+
+	FS_WriteLogFlush(adminlogfile);
+	FS_WriteLogFlush(logfile);
+	FS_WriteLogFlush(debuglogfile);
+	FS_WriteLogFlush(enterleavelogfile);
+	FS_WriteLogFlush(gamelogfile);
 
-	while(logwriterenabled)
+	for(i = 0; i < ARRAY_COUNT(closinglogfiles); ++i)
+	{
+		h = Sys_InterlockedExchangeAdd(&closinglogfiles[i], 0);
+		if(h)
+		{
+			FS_CloseLogFile(h);
+			Sys_InterlockedCompareExchange(&closinglogfiles[i], 0, h);
+		}
+	}
+}
+
+void* Com_WriteLogThread(void* null)
+{
+	while(qtrue)
 	{
 		Sys_WaitForObject(wakelogfilewriter);
 		Sys_ResetEvent(wakelogfilewriter);
 
-		if(Sys_InterlockedIncrement(&logfilewriterworking) == 1)
-		{
-
-			FS_WriteLogFlush(adminlogfile);
-			FS_WriteLogFlush(logfile);
-			FS_WriteLogFlush(debuglogfile);
-			FS_WriteLogFlush(enterleavelogfile);
-			FS_WriteLogFlush(gamelogfile);
-		}
-		Sys_InterlockedDecrement(&logfilewriterworking);
+		Com_FlushLogFiles( );
 	}
-	logthreadid = -1;
-	_CloseHandle(wakelogfilewriter);
-	wakelogfilewriter = 0;
 	return NULL;
 }
 
+static qboolean Com_LogWriterRunning( )
+{
+	return logthreadid != -1;
+}
 
 void Com_CloseLogFile(volatile fileHandle_t* f)
 {
-	if(*f == 0)
+	int i;
+	unsigned int starttime;
+	fileHandle_t h = *f;
+
+	if(h == 0)
+	{
+		return;
+	}
+	/* No new messages get queued from here on */
+	*f = 0;
+
+	if(!Com_LogWriterRunning())
 	{
+		Sys_EnterCriticalSection(CRITSECT_LOGFILETHREAD);
+		FS_CloseLogFile(h);
+		Sys_LeaveCriticalSection(CRITSECT_LOGFILETHREAD);
 		return;
 	}
 
-	while(Sys_InterlockedIncrement(&logfilewriterworking) != 1) //Spin here until worker thread is ready
+	/* Hand the handle over to the writer thread which is the only one touching it from now on */
+	while(qtrue)
 	{
-		Sys_InterlockedDecrement(&logfilewriterworking);
-		Sys_SleepUSec(0);
+		for(i = 0; i < ARRAY_COUNT(closinglogfiles); ++i)
+		{
+			if(Sys_InterlockedCompareExchange(&closinglogfiles[i], h, 0) == 0)
+			{
+				break;
+			}
+		}
+		if(i < ARRAY_COUNT(closinglogfiles))
+		{
+			break;
+		}
+		Sys_SetEvent(wakelogfilewriter);
+		Sys_SleepUSec(1000);
+	}
+
+	/* Wait until the file is really closed. The filesystem can go down right after this */
+	starttime = Sys_Milliseconds();
+	while(Sys_InterlockedExchangeAdd(&closinglogfiles[i], 0) == h)
+	{
+		if(Sys_Milliseconds() - starttime > LOGFILE_CLOSE_TIMEOUT)
+		{
+			Sys_Print("Com_CloseLogFile: Timeout while waiting for the logfile writer\n");
+			return;
+		}
+		Sys_SetEvent(wakelogfilewriter);
+		Sys_SleepUSec(1000);
 	}
-	
-	FS_CloseLogFile(*f);
-	*f = 0;
-	Sys_InterlockedDecrement(&logfilewriterworking);
-	Sys_SetEvent(wakelogfilewriter);
 }
 
 fileHandle_t Com_OpenLogfile(const char* name, char mode)
 {
-	static threadid_t logthreadid = -1;
-	if(logthreadid == -1)
+	threadid_t tid;
+
+	if(logthreadid == -1 && wakelogfilewriter == 0)
 	{
-		wakelogfilewriter = Sys_CreateEvent(1, 1, "wakelogfilewriter");
-		Sys_CreateNewThread(Com_WriteLogThread, &logthreadid, NULL);
-		Sys_SetThreadName(logthreadid, "LogfileWriter");
+		wakelogfilewriter = Sys_CreateEvent(qtrue, qfalse, "wakelogfilewriter");
+		if(Sys_CreateNewThread(Com_WriteLogThread, &tid, NULL))
+		{
+			Sys_SetThreadName(tid, "LogfileWriter");
+			logthreadid = tid;
+		}else{
+			Sys_Print("Com_OpenLogfile: Failed to create the logfile writer thread. Logfiles get written synchronous\n");
+		}
 	}
 	return FS_OpenLogfile(name, mode);
 }
 
-
+/*
+Queues the message for the writer thread. If the ring of the logfile is full
+logfile_overflow decides whether the caller waits for the writer or the rest
+of the message gets dropped and counted
+*/
 int Com_WriteLog(const char* data, int ilen, fileHandle_t f)
 {
 	int len = ilen;
+	int l;
 
-	while(1){ //Spin here as long as we don't have enough space to put the message into the buffer
-
-		int l = FS_WriteLog(data, len, f);
+	while(qtrue)
+	{
+		l = FS_WriteLog(data, len, f);
 		data += l;
 		len -= l;
 
-		Sys_SetEvent(wakelogfilewriter);
+		if(!Com_LogWriterRunning())
+		{
+			Sys_EnterCriticalSection(CRITSECT_LOGFILETHREAD);
+			FS_WriteLogFlush(f);
+			Sys_LeaveCriticalSection(CRITSECT_LOGFILETHREAD);
+		}else{
+			Sys_SetEvent(wakelogfilewriter);
+		}
 
 		if(len == 0)
 		{
 			break;
-		}else{
-			Sys_SleepUSec(0);
+		}
+		if(com_logfileOverflow && com_logfileOverflow->integer == 1)
+		{
+			FS_WriteLogDropped(len, f);
+			break;
+		}
+		if(Com_LogWriterRunning())
+		{
+			Sys_SleepUSec(1000);
 		}
 	}
 	return ilen;
@@ -389,12 +461,38 @@ void Com_CloseLogFiles()
 
 	Com_CloseLogFile( &gamelogfile ); //possible duplicate because this happens in G_ShutdownGame
 
-	logwriterenabled = qfalse;
-
 	Sys_LeaveCriticalSection(CRITSECT_LOGFILE);
 
 }
 
+static void Com_PrintLogfileStats(fileHandle_t h)
+{
+	logfileStats_t stats;
+
+	if(!FS_GetLogfileStats(h, &stats))
+	{
+		return;
+	}
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "%s:\n", stats.name);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  pending %u / %u bytes, queued %u bytes, written %u bytes\n", stats.bytesPending, stats.bufferSize, stats.bytesQueued, stats.bytesWritten);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  dropped %u bytes in %u messages, write errors %u\n", stats.bytesDropped, stats.messagesDropped, stats.writeErrors);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  %u flushes, flush latency avg %u usec, max %u usec\n", stats.flushes, stats.flushUSecAvg, stats.flushUSecMax);
+}
+
+void Com_LogfileStats_f( )
+{
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "Logfile writer thread: %s, overflow policy: %s\n", Com_LogWriterRunning() ? "running" : "not running",
+		com_logfileOverflow && com_logfileOverflow->integer == 1 ? "drop" : "block");
+
+	Sys_EnterCriticalSection(CRITSECT_LOGFILE);
+	Com_PrintLogfileStats(logfile);
+	Com_PrintLogfileStats(adminlogfile);
+	Com_PrintLogfileStats(debuglogfile);
+	Com_PrintLogfileStats(enterleavelogfile);
+	Com_PrintLogfileStats(gamelogfile);
+	Sys_LeaveCriticalSection(CRITSECT_LOGFILE);
+}
+
 fileHandle_t Com_OpenGameLogfile(const char* name, char mode, qboolean sync)
 {
 	if ( !FS_Initialized()) {
@@ -162,6 +162,7 @@ void __cdecl Scr_EndLoadScripts( )
 void __cdecl Scr_FreeScripts( )
 {
 //  Hunk_CheckTempMemoryClear();
+  Scr_ProfileScriptsFreed( );
   if ( gScrCompilePub.script_loading )
   {
     gScrCompilePub.script_loading = 0;
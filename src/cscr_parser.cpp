@@ -298,6 +298,25 @@ unsigned int Scr_GetLineInfo(const char *buf, unsigned int sourcePos, int *col,
   return lineNum;
 }
 
+/*
+Line number starting with 1 of the statement in front of codePos or 0 if unknown
+*/
+unsigned int Scr_PrevCodePosLineNum(const char *codePos)
+{
+  unsigned int bufferIndex;
+  const char *startLine;
+  int col;
+
+  assert(gScrVarPub.developer);
+
+  if ( !codePos || codePos == &g_EndPos || !gScrVarPub.programBuffer || !Scr_IsInOpcodeMemory(codePos) )
+  {
+    return 0;
+  }
+  bufferIndex = Scr_GetSourceBuffer(codePos - 1);
+  return Scr_GetLineNumInternal(gScrParserPub.sourceBufferLookup[bufferIndex].sourceBuf, Scr_GetPrevSourcePos(codePos - 1, 0), &startLine, &col) + 1;
+}
+
 void Scr_PrintSourcePosSpreadSheet(conChannel_t channel, const char *filename, const char *buf, unsigned int sourcePos)
 {
   const char *s;
@@ -380,27 +399,36 @@ char *__cdecl Scr_ReadFile_FastFile(const char *filename, const char *extFilenam
 }
 
 
+/*
+Reads the already opened script file and closes it
+*/
+static char *Scr_ReadFile_LoadObjFromHandle(const char *extFilename, const char *codePos, bool archive, int f, int len)
+{
+  char *sourceBuf;
+
+/*
+  if ( !fs_gameDirVar && fs_gameDirVar->string[0] )
+  {
+    g_loadedImpureScript = 1;
+  }
+*/
+  sourceBuf = (char*)Hunk_AllocateTempMemoryHigh(len + 1);
+  FS_Read(sourceBuf, len, f);
+  sourceBuf[len] = 0;
+  FS_FCloseFile(f);
+  Scr_AddSourceBufferInternal(extFilename, codePos, sourceBuf, len, 1, archive);
+  return sourceBuf;
+}
+
 char *__cdecl Scr_ReadFile_LoadObj(const char *filename, const char *extFilename, const char *codePos, bool archive)
 {
   int len;
   int f;
-  char *sourceBuf;
 
   len = FS_FOpenFileByMode(extFilename, &f, FS_READ);
   if ( len >= 0 )
   {
-/*
-    if ( !fs_gameDirVar && fs_gameDirVar->string[0] )
-    {
-      g_loadedImpureScript = 1;
-    }
-*/
-    sourceBuf = (char*)Hunk_AllocateTempMemoryHigh(len + 1);
-    FS_Read(sourceBuf, len, f);
-    sourceBuf[len] = 0;
-    FS_FCloseFile(f);
-    Scr_AddSourceBufferInternal(extFilename, codePos, sourceBuf, len, 1, archive);
-    return sourceBuf;
+    return Scr_ReadFile_LoadObjFromHandle(extFilename, codePos, archive, f, len);
   }
   Scr_AddSourceBufferInternal(extFilename, codePos, 0, -1, 1, archive);
   return NULL;
@@ -411,15 +439,17 @@ char *__cdecl Scr_ReadFile_LoadObj(const char *filename, const char *extFilename
 char *__cdecl Scr_ReadFile(const char *filename, const char *extFilename, const char *codePos, bool archive)
 {
   int file;
+  int len;
 
 //  if ( fs_gameDirVar && fs_gameDirVar->string[0])
   {
-    if ( FS_FOpenFileRead(extFilename, &file) < 0 )
+    len = FS_FOpenFileRead(extFilename, &file);
+    if ( len < 0 )
     {
       return Scr_ReadFile_FastFile(filename, extFilename, codePos, archive);
     }
-    FS_FCloseFile(file);
-    return Scr_ReadFile_LoadObj(filename, extFilename, codePos, archive);
+    /* Keep the handle, opening the file again searches all paths once more */
+    return Scr_ReadFile_LoadObjFromHandle(extFilename, codePos, archive, file, len);
   }
 /* 
 Impure script locked mode here:
@@ -3,6 +3,7 @@ extern char g_EndPos;
 bool Scr_PrevCodePosFileNameMatches(const char *codePos, const char *fileName);
 const char * Scr_PrevCodePosFunctionName(const char *codePos);
 const char * Scr_PrevCodePosFileName(const char *codePos);
+unsigned int Scr_PrevCodePosLineNum(const char *codePos);
 void Scr_PrintPrevCodePosSpreadSheet(conChannel_t channel, const char *codePos, bool summary, bool functionSummary);
 void CompileError2(const char *codePos, const char *msg, ...);
 
@@ -5,6 +5,10 @@
 #include "sys_main.h"
 #include "cmd.h"
 #include "g_shared.h"
+#include "cscr_parser.h"
+#include "cscr_main.h"
+#include "sys_thread.h"
+#include "filesystem.h"
 #include <setjmp.h>
 
 int g_script_error_level;
@@ -619,6 +623,663 @@ void __cdecl VM_SetTime( )
   }
 }
 
+/*
+==============================================================================
+
+Script profiler
+
+VM_Execute lives in the game binary, so the VM can't be instrumented. Instead
+the ScriptProfiler thread wakes up every few hundred microseconds and copies the
+code positions of the VM frame stack while a script thread runs. Frames below
+the top hold the exact call sites. The top frame holds the position the VM
+stored last, which is the call site of the builtin while a builtin runs.
+The server thread takes the samples out of a ring, resolves every position
+once to file::function and line and aggregates them into a flat profile, a
+list of the hottest lines (this is where the time of builtin calls shows up)
+and collapsed stacks for flame graphs.
+Positions can only be resolved with the opcode lookup, which is only built
+when developer or logfile is enabled while the scripts get loaded.
+
+==============================================================================
+*/
+
+#define SCR_PROFILE_MAXDEPTH 31
+#define SCR_PROFILE_RINGSIZE 4096 //Has to be a power of two
+#define SCR_PROFILE_MAXFUNCS 4096
+#define SCR_PROFILE_FUNCHASHSIZE 1024
+#define SCR_PROFILE_POSHASHSIZE 32768 //Has to be a power of two
+#define SCR_PROFILE_LINEHASHSIZE 16384 //Has to be a power of two
+#define SCR_PROFILE_STACKHASHSIZE 16384 //Has to be a power of two
+#define SCR_PROFILE_DEFAULTINTERVAL 1000
+
+typedef struct
+{
+  unsigned int generation;
+  int depth;
+  const char *pos[SCR_PROFILE_MAXDEPTH];
+}scrProfileSample_t;
+
+typedef struct
+{
+  char name[MAX_QPATH + 64];
+  int self;
+  int total;
+  int lastSample; //Recursive calls count only once for total
+  int next;
+}scrProfileFunc_t;
+
+typedef struct
+{
+  const char *pos;
+  int func;
+  unsigned int line;
+}scrProfilePos_t;
+
+typedef struct
+{
+  int func;
+  unsigned int line;
+  int count;
+}scrProfileLine_t;
+
+typedef struct
+{
+  unsigned int hash;
+  int depth;
+  short funcs[SCR_PROFILE_MAXDEPTH];
+  int count;
+}scrProfileStack_t;
+
+typedef struct
+{
+  volatile qboolean active;
+  int interval;
+  qboolean threadStarted;
+  HANDLE wake;
+  HANDLE sampleDone;
+  volatile DWORD busy; /* Set while the sampler may touch the ring */
+  volatile unsigned int generation;
+
+  /* Written by the sampler thread */
+  scrProfileSample_t *ring;
+  volatile DWORD head;
+  volatile DWORD droppedSamples;
+  volatile DWORD idleSamples;
+
+  /* Server thread only */
+  volatile DWORD tail;
+  int numSamples;
+  int numFuncs;
+  int numPositions;
+  int numLines;
+  int numStacks;
+  int droppedStacks;
+  scrProfileFunc_t *funcs;
+  int funcHash[SCR_PROFILE_FUNCHASHSIZE];
+  scrProfilePos_t *positions;
+  scrProfileLine_t *lines;
+  scrProfileStack_t *stacks;
+  unsigned long long startTime;
+  unsigned long long runTime;
+  unsigned long long vmTime;
+}scrProfile_t;
+
+static scrProfile_t scr_profile;
+
+
+static void Scr_ProfileTakeSample( )
+{
+  scrProfileSample_t *sample;
+  DWORD head;
+  int count, i;
+
+  count = *(volatile int*)&gScrVmPub.function_count;
+  if ( count <= 0 )
+  {
+    Sys_InterlockedIncrement(&scr_profile.idleSamples);
+    return;
+  }
+  if ( count > SCR_PROFILE_MAXDEPTH )
+  {
+    count = SCR_PROFILE_MAXDEPTH;
+  }
+
+  head = scr_profile.head;
+  if ( head - Sys_InterlockedExchangeAdd(&scr_profile.tail, 0) >= SCR_PROFILE_RINGSIZE )
+  {
+    Sys_InterlockedIncrement(&scr_profile.droppedSamples);
+    return;
+  }
+  sample = &scr_profile.ring[head & (SCR_PROFILE_RINGSIZE -1)];
+  sample->generation = scr_profile.generation;
+  sample->depth = count;
+  /* function_frame_start[0] is the base frame of VM_Execute */
+  for ( i = 0; i < count; ++i )
+  {
+    sample->pos[i] = *(const char* volatile*)&gScrVmPub.function_frame_start[i +1].fs.pos;
+  }
+  Sys_InterlockedIncrement(&scr_profile.head);
+}
+
+static void* Scr_ProfileThread(void* arg)
+{
+  while ( true )
+  {
+    if ( !scr_profile.active )
+    {
+      Sys_WaitForObject(scr_profile.wake);
+      Sys_ResetEvent(scr_profile.wake);
+      continue;
+    }
+    Sys_SleepUSec(scr_profile.interval);
+    Sys_InterlockedIncrement(&scr_profile.busy);
+    if ( scr_profile.active )
+    {
+      Scr_ProfileTakeSample( );
+    }
+    Sys_InterlockedDecrement(&scr_profile.busy);
+    Sys_SetEvent(scr_profile.sampleDone);
+  }
+  return NULL;
+}
+
+static int Scr_ProfileFindFunc(const char *name)
+{
+  long hash;
+  int i;
+  scrProfileFunc_t *func;
+
+  hash = FS_HashFileName(name, SCR_PROFILE_FUNCHASHSIZE);
+  for ( i = scr_profile.funcHash[hash]; i >= 0; i = scr_profile.funcs[i].next )
+  {
+    if ( strcmp(scr_profile.funcs[i].name, name) == 0 )
+    {
+      return i;
+    }
+  }
+  if ( scr_profile.numFuncs >= SCR_PROFILE_MAXFUNCS )
+  {
+    return 0;
+  }
+  i = scr_profile.numFuncs++;
+  func = &scr_profile.funcs[i];
+  Com_Memset(func, 0, sizeof(*func));
+  Q_strncpyz(func->name, name, sizeof(func->name));
+  func->next = scr_profile.funcHash[hash];
+  scr_profile.funcHash[hash] = i;
+  return i;
+}
+
+/*
+Maps a code position to its function and line. Every position gets resolved only once
+*/
+static scrProfilePos_t* Scr_ProfileResolve(const char *pos)
+{
+  static scrProfilePos_t unknown;
+  scrProfilePos_t *entry;
+  unsigned int hash;
+  const char *funcline;
+  char name[MAX_QPATH + 64];
+  int i;
+
+  if ( !gScrVarPub.programBuffer || pos <= gScrVarPub.programBuffer || !Scr_IsInOpcodeMemory(pos) )
+  {
+    unknown.func = 0;
+    return &unknown;
+  }
+
+  hash = ((uintptr_t)pos * 2654435761u) & (SCR_PROFILE_POSHASHSIZE -1);
+  while ( scr_profile.positions[hash].pos != NULL )
+  {
+    if ( scr_profile.positions[hash].pos == pos )
+    {
+      return &scr_profile.positions[hash];
+    }
+    hash = (hash +1) & (SCR_PROFILE_POSHASHSIZE -1);
+  }
+  if ( scr_profile.numPositions >= SCR_PROFILE_POSHASHSIZE / 2 )
+  {
+    Com_Memset(scr_profile.positions, 0, SCR_PROFILE_POSHASHSIZE * sizeof(scrProfilePos_t));
+    scr_profile.numPositions = 0;
+    hash = ((uintptr_t)pos * 2654435761u) & (SCR_PROFILE_POSHASHSIZE -1);
+  }
+  entry = &scr_profile.positions[hash];
+  scr_profile.numPositions++;
+
+  /* The function name is the first line of the function, cut it at the parameter list */
+  funcline = Scr_PrevCodePosFunctionName(pos);
+  Com_sprintf(name, sizeof(name), "%s::", Scr_PrevCodePosFileName(pos));
+  i = strlen(name);
+  while ( *funcline && *funcline != '(' && i < (int)sizeof(name) -1 )
+  {
+    if ( *funcline != ' ' && *funcline != '\t' )
+    {
+      name[i++] = *funcline;
+    }
+    ++funcline;
+  }
+  name[i] = '\0';
+
+  entry->pos = pos;
+  entry->func = Scr_ProfileFindFunc(name);
+  entry->line = Scr_PrevCodePosLineNum(pos);
+  return entry;
+}
+
+static void Scr_ProfileAddLine(int func, unsigned int line)
+{
+  unsigned int hash, i;
+  scrProfileLine_t *entry;
+
+  hash = (func * 31 + line) * 2654435761u;
+  for ( i = 0; i < SCR_PROFILE_LINEHASHSIZE; ++i )
+  {
+    entry = &scr_profile.lines[(hash + i) & (SCR_PROFILE_LINEHASHSIZE -1)];
+    if ( entry->count == 0 )
+    {
+      if ( scr_profile.numLines >= SCR_PROFILE_LINEHASHSIZE / 2 )
+      {
+        return;
+      }
+      entry->func = func;
+      entry->line = line;
+      scr_profile.numLines++;
+    }
+    else if ( entry->func != func || entry->line != line )
+    {
+      continue;
+    }
+    entry->count++;
+    return;
+  }
+}
+
+static void Scr_ProfileAddStack(const short *funcs, int depth)
+{
+  unsigned int hash, i;
+  int j;
+  scrProfileStack_t *entry;
+
+  hash = depth;
+  for ( j = 0; j < depth; ++j )
+  {
+    hash = hash * 16777619u ^ funcs[j];
+  }
+  for ( i = 0; i < SCR_PROFILE_STACKHASHSIZE; ++i )
+  {
+    entry = &scr_profile.stacks[(hash + i) & (SCR_PROFILE_STACKHASHSIZE -1)];
+    if ( entry->count == 0 )
+    {
+      if ( scr_profile.numStacks >= SCR_PROFILE_STACKHASHSIZE / 2 )
+      {
+        scr_profile.droppedStacks++;
+        return;
+      }
+      entry->hash = hash;
+      entry->depth = depth;
+      Com_Memcpy(entry->funcs, funcs, depth * sizeof(short));
+      scr_profile.numStacks++;
+    }
+    else if ( entry->hash != hash || entry->depth != depth || memcmp(entry->funcs, funcs, depth * sizeof(short)) != 0 )
+    {
+      continue;
+    }
+    entry->count++;
+    return;
+  }
+}
+
+static void Scr_ProfileAddSample(const scrProfileSample_t *sample)
+{
+  short funcs[SCR_PROFILE_MAXDEPTH];
+  scrProfilePos_t *resolved;
+  scrProfileFunc_t *func;
+  int i;
+
+  scr_profile.numSamples++;
+
+  for ( i = 0; i < sample->depth; ++i )
+  {
+    resolved = Scr_ProfileResolve(sample->pos[i]);
+    funcs[i] = resolved->func;
+    func = &scr_profile.funcs[resolved->func];
+    if ( func->lastSample != scr_profile.numSamples )
+    {
+      func->lastSample = scr_profile.numSamples;
+      func->total++;
+    }
+  }
+  /* resolved is the innermost frame now */
+  scr_profile.funcs[resolved->func].self++;
+  Scr_ProfileAddLine(resolved->func, resolved->line);
+  Scr_ProfileAddStack(funcs, sample->depth);
+}
+
+/*
+Takes the pending samples out of the ring. Has to run before the program buffer gets freed
+*/
+static void Scr_ProfileCollect( )
+{
+  DWORD tail, head;
+  scrProfileSample_t *sample;
+
+  if ( scr_profile.ring == NULL )
+  {
+    return;
+  }
+  head = Sys_InterlockedExchangeAdd(&scr_profile.head, 0);
+  for ( tail = scr_profile.tail; tail != head; ++tail )
+  {
+    sample = &scr_profile.ring[tail & (SCR_PROFILE_RINGSIZE -1)];
+    if ( sample->generation == scr_profile.generation )
+    {
+      Scr_ProfileAddSample(sample);
+    }
+  }
+  Sys_InterlockedExchangeAdd(&scr_profile.tail, head - scr_profile.tail);
+}
+
+void Scr_ProfileScriptsFreed( )
+{
+  if ( scr_profile.ring == NULL )
+  {
+    return;
+  }
+  Scr_ProfileCollect( );
+  Com_Memset(scr_profile.positions, 0, SCR_PROFILE_POSHASHSIZE * sizeof(scrProfilePos_t));
+  scr_profile.numPositions = 0;
+  Sys_InterlockedIncrement((volatile DWORD*)&scr_profile.generation);
+}
+
+static void Scr_ProfileFree( )
+{
+  free(scr_profile.ring);
+  free(scr_profile.funcs);
+  free(scr_profile.positions);
+  free(scr_profile.lines);
+  free(scr_profile.stacks);
+  scr_profile.ring = NULL;
+  scr_profile.funcs = NULL;
+  scr_profile.positions = NULL;
+  scr_profile.lines = NULL;
+  scr_profile.stacks = NULL;
+}
+
+static void Scr_ProfileStart(int interval)
+{
+  threadid_t tid;
+
+  if ( scr_profile.active )
+  {
+    Com_Printf(CON_CHANNEL_DONT_FILTER, "Script profiler is already running\n");
+    return;
+  }
+  if ( !gScrVarPub.developer )
+  {
+    Com_PrintError(CON_CHANNEL_DONT_FILTER, "The script profiler requires developer or logfile to be enabled when the map gets loaded\n");
+    return;
+  }
+
+  Scr_ProfileFree( );
+  scr_profile.ring = (scrProfileSample_t*)malloc(SCR_PROFILE_RINGSIZE * sizeof(scrProfileSample_t));
+  scr_profile.funcs = (scrProfileFunc_t*)malloc(SCR_PROFILE_MAXFUNCS * sizeof(scrProfileFunc_t));
+  scr_profile.positions = (scrProfilePos_t*)calloc(SCR_PROFILE_POSHASHSIZE, sizeof(scrProfilePos_t));
+  scr_profile.lines = (scrProfileLine_t*)calloc(SCR_PROFILE_LINEHASHSIZE, sizeof(scrProfileLine_t));
+  scr_profile.stacks = (scrProfileStack_t*)calloc(SCR_PROFILE_STACKHASHSIZE, sizeof(scrProfileStack_t));
+  if ( !scr_profile.ring || !scr_profile.funcs || !scr_profile.positions || !scr_profile.lines || !scr_profile.stacks )
+  {
+    Scr_ProfileFree( );
+    Com_PrintError(CON_CHANNEL_DONT_FILTER, "Script profiler: Out of memory\n");
+    return;
+  }
+  scr_profile.numSamples = 0;
+  scr_profile.numPositions = 0;
+  scr_profile.numLines = 0;
+  scr_profile.numStacks = 0;
+  scr_profile.droppedStacks = 0;
+  scr_profile.droppedSamples = 0;
+  scr_profile.idleSamples = 0;
+  scr_profile.head = 0;
+  scr_profile.tail = 0;
+  scr_profile.runTime = 0;
+  scr_profile.vmTime = 0;
+  Com_Memset(scr_profile.funcHash, -1, sizeof(scr_profile.funcHash));
+  scr_profile.numFuncs = 0;
+  Scr_ProfileFindFunc("<unknown>");
+
+  if ( !scr_profile.threadStarted )
+  {
+    scr_profile.wake = Sys_CreateEvent(qtrue, qfalse, "scriptprofiler");
+    scr_profile.sampleDone = Sys_CreateEvent(qfalse, qfalse, "scriptprofilerdone");
+    if ( !scr_profile.wake || !scr_profile.sampleDone || Sys_CreateNewThread(Scr_ProfileThread, &tid, NULL) == qfalse )
+    {
+      Scr_ProfileFree( );
+      Com_PrintError(CON_CHANNEL_DONT_FILTER, "Script profiler: Failed to start the sampler thread\n");
+      return;
+    }
+    Sys_SetThreadName(tid, "ScriptProfiler");
+    scr_profile.threadStarted = qtrue;
+  }
+
+  scr_profile.interval = interval;
+  scr_profile.startTime = Sys_Microseconds();
+  scr_profile.active = qtrue;
+  Sys_SetEvent(scr_profile.wake);
+  Com_Printf(CON_CHANNEL_DONT_FILTER, "Script profiler started, one sample every %d usec\n", interval);
+}
+
+static void Scr_ProfileStop( )
+{
+  if ( !scr_profile.active )
+  {
+    Com_Printf(CON_CHANNEL_DONT_FILTER, "Script profiler is not running\n");
+    return;
+  }
+  /* The sampler can be past its active check already. Wait for it, the ring gets freed on the next start */
+  Sys_InterlockedCompareExchange((volatile DWORD*)&scr_profile.active, qfalse, qtrue);
+  while ( Sys_InterlockedExchangeAdd(&scr_profile.busy, 0) )
+  {
+    Sys_WaitForObject(scr_profile.sampleDone);
+  }
+  scr_profile.runTime += Sys_Microseconds() - scr_profile.startTime;
+  Scr_ProfileCollect( );
+  Com_Printf(CON_CHANNEL_DONT_FILTER, "Script profiler stopped, %d samples\n", scr_profile.numSamples);
+}
+
+static int Scr_ProfileCompareFuncs(const void *a, const void *b)
+{
+  const scrProfileFunc_t *fa = *(const scrProfileFunc_t**)a;
+  const scrProfileFunc_t *fb = *(const scrProfileFunc_t**)b;
+
+  if ( fb->self != fa->self )
+  {
+    return fb->self - fa->self;
+  }
+  return fb->total - fa->total;
+}
+
+static int Scr_ProfileCompareLines(const void *a, const void *b)
+{
+  return (*(const scrProfileLine_t**)b)->count - (*(const scrProfileLine_t**)a)->count;
+}
+
+static void Scr_ProfileDump(const char *name)
+{
+  scrProfileFunc_t **funcs;
+  scrProfileLine_t **lines;
+  scrProfileStack_t *stack;
+  fileHandle_t f;
+  unsigned long long runTime;
+  double usecPerSample;
+  char filename[MAX_QPATH];
+  char line[1024];
+  int i, j, numLines, taken, len;
+
+  if ( scr_profile.ring == NULL )
+  {
+    Com_Printf(CON_CHANNEL_DONT_FILTER, "No script profile recorded\n");
+    return;
+  }
+  if ( strstr(name, "..") || strchr(name, '/') || strchr(name, '\\') || strchr(name, ':') )
+  {
+    Com_PrintError(CON_CHANNEL_DONT_FILTER, "Invalid profile name %s\n", name);
+    return;
+  }
+
+  Scr_ProfileCollect( );
+
+  runTime = scr_profile.runTime;
+  if ( scr_profile.active )
+  {
+    runTime += Sys_Microseconds() - scr_profile.startTime;
+  }
+  taken = scr_profile.numSamples + scr_profile.idleSamples + scr_profile.droppedSamples;
+  usecPerSample = taken > 0 ? (double)runTime / taken : 0.0;
+
+  /* Tell why the profile is empty instead of writing empty files without a word */
+  if ( scr_profile.numSamples == 0 )
+  {
+    if ( !gScrVarPub.developer )
+    {
+      Com_PrintWarning(CON_CHANNEL_DONT_FILTER, "Script profile is empty: developer or logfile was disabled when the map got loaded\n");
+    }
+    else if ( taken == 0 )
+    {
+      Com_PrintWarning(CON_CHANNEL_DONT_FILTER, "Script profile is empty: no samples have been taken yet\n");
+    }
+    else
+    {
+      Com_PrintWarning(CON_CHANNEL_DONT_FILTER, "Script profile is empty: no script thread was running while sampling\n");
+    }
+  }
+  else if ( scr_profile.numFuncs <= 1 )
+  {
+    Com_PrintWarning(CON_CHANNEL_DONT_FILTER, "Script profile: none of the %d samples could be resolved to a script function\n", scr_profile.numSamples);
+  }
+
+  /* At least one element, malloc(0) may return NULL */
+  funcs = (scrProfileFunc_t**)malloc((scr_profile.numFuncs + 1) * sizeof(scrProfileFunc_t*));
+  lines = (scrProfileLine_t**)malloc((scr_profile.numLines + 1) * sizeof(scrProfileLine_t*));
+  if ( funcs == NULL || lines == NULL )
+  {
+    Com_PrintError(CON_CHANNEL_DONT_FILTER, "Script profile: Out of memory\n");
+    free(funcs);
+    free(lines);
+    return;
+  }
+  for ( i = 0; i < scr_profile.numFuncs; ++i )
+  {
+    funcs[i] = &scr_profile.funcs[i];
+  }
+  qsort(funcs, scr_profile.numFuncs, sizeof(funcs[0]), Scr_ProfileCompareFuncs);
+  for ( i = 0, numLines = 0; i < SCR_PROFILE_LINEHASHSIZE; ++i )
+  {
+    if ( scr_profile.lines[i].count > 0 )
+    {
+      lines[numLines++] = &scr_profile.lines[i];
+    }
+  }
+  qsort(lines, numLines, sizeof(lines[0]), Scr_ProfileCompareLines);
+
+  Com_Printf(CON_CHANNEL_DONT_FILTER, "Script profile: %.1f sec, %d samples in scripts, %d idle, %d dropped, ~%.0f usec per sample, VM time in thread resumes %llu msec\n",
+             runTime / 1000000.0, scr_profile.numSamples, scr_profile.idleSamples, scr_profile.droppedSamples, usecPerSample, scr_profile.vmTime / 1000);
+  Com_Printf(CON_CHANNEL_DONT_FILTER, "   self%%     self ms   total%%   total ms  function\n");
+  for ( i = 0; i < scr_profile.numFuncs && i < 20 && funcs[i]->total > 0; ++i )
+  {
+    Com_Printf(CON_CHANNEL_DONT_FILTER, "%7.2f %11.1f %7.2f %10.1f  %s\n", 100.0 * funcs[i]->self / (scr_profile.numSamples ? scr_profile.numSamples : 1),
+               funcs[i]->self * usecPerSample / 1000.0, 100.0 * funcs[i]->total / (scr_profile.numSamples ? scr_profile.numSamples : 1),
+               funcs[i]->total * usecPerSample / 1000.0, funcs[i]->name);
+  }
+  Com_Printf(CON_CHANNEL_DONT_FILTER, "Hottest lines (builtin calls are accounted to their line):\n");
+  for ( i = 0; i < numLines && i < 10; ++i )
+  {
+    Com_Printf(CON_CHANNEL_DONT_FILTER, "%7.2f %11.1f  %s:%u\n", 100.0 * lines[i]->count / (scr_profile.numSamples ? scr_profile.numSamples : 1),
+               lines[i]->count * usecPerSample / 1000.0, scr_profile.funcs[lines[i]->func].name, lines[i]->line);
+  }
+
+  /* Flat profile */
+  Com_sprintf(filename, sizeof(filename), "%s.txt", name);
+  f = FS_SV_FOpenFileWrite(filename);
+  if ( f )
+  {
+    len = Com_sprintf(line, sizeof(line), "samples %d idle %d dropped %d usecpersample %.1f\n\nself\tselfms\ttotal\ttotalms\tfunction\n",
+                      scr_profile.numSamples, scr_profile.idleSamples, scr_profile.droppedSamples, usecPerSample);
+    FS_Write(line, len, f);
+    for ( i = 0; i < scr_profile.numFuncs && funcs[i]->total > 0; ++i )
+    {
+      len = Com_sprintf(line, sizeof(line), "%d\t%.1f\t%d\t%.1f\t%s\n", funcs[i]->self, funcs[i]->self * usecPerSample / 1000.0,
+                        funcs[i]->total, funcs[i]->total * usecPerSample / 1000.0, funcs[i]->name);
+      FS_Write(line, len, f);
+    }
+    len = Com_sprintf(line, sizeof(line), "\nself\tselfms\tline\n");
+    FS_Write(line, len, f);
+    for ( i = 0; i < numLines; ++i )
+    {
+      len = Com_sprintf(line, sizeof(line), "%d\t%.1f\t%s:%u\n", lines[i]->count, lines[i]->count * usecPerSample / 1000.0,
+                        scr_profile.funcs[lines[i]->func].name, lines[i]->line);
+      FS_Write(line, len, f);
+    }
+    FS_FCloseFile(f);
+    Com_Printf(CON_CHANNEL_DONT_FILTER, "Wrote flat profile to %s\n", filename);
+  }
+
+  /* Collapsed stacks, outermost frame first: a;b;c count */
+  Com_sprintf(filename, sizeof(filename), "%s.folded", name);
+  f = FS_SV_FOpenFileWrite(filename);
+  if ( f )
+  {
+    for ( i = 0; i < SCR_PROFILE_STACKHASHSIZE; ++i )
+    {
+      stack = &scr_profile.stacks[i];
+      if ( stack->count == 0 )
+      {
+        continue;
+      }
+      for ( j = 0; j < stack->depth; ++j )
+      {
+        FS_Write(scr_profile.funcs[stack->funcs[j]].name, strlen(scr_profile.funcs[stack->funcs[j]].name), f);
+        FS_Write(j + 1 < stack->depth ? ";" : " ", 1, f);
+      }
+      len = Com_sprintf(line, sizeof(line), "%d\n", stack->count);
+      FS_Write(line, len, f);
+    }
+    FS_FCloseFile(f);
+    Com_Printf(CON_CHANNEL_DONT_FILTER, "Wrote collapsed stacks to %s%s\n", filename, scr_profile.droppedStacks ? " (some stacks were dropped)" : "");
+  }
+  free(funcs);
+  free(lines);
+}
+
+void Scr_Profile_f( )
+{
+  const char *cmd;
+  int interval;
+
+  cmd = Cmd_Argv(1);
+
+  if ( !Q_stricmp(cmd, "start") )
+  {
+    interval = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : SCR_PROFILE_DEFAULTINTERVAL;
+    if ( interval < 100 )
+    {
+      interval = 100;
+    }
+    Scr_ProfileStart(interval);
+  }
+  else if ( !Q_stricmp(cmd, "stop") )
+  {
+    Scr_ProfileStop( );
+  }
+  else if ( !Q_stricmp(cmd, "dump") )
+  {
+    Scr_ProfileDump(Cmd_Argc() > 2 ? Cmd_Argv(2) : "scriptprofile");
+  }
+  else
+  {
+    Com_Printf(CON_CHANNEL_DONT_FILTER, "Usage: scriptprofile <start [interval usec] | stop | dump [name]>\n");
+  }
+}
+
 void __cdecl Scr_RunCurrentThreads( )
 {
   int pre_time;
@@ -635,6 +1296,12 @@ void __cdecl Scr_RunCurrentThreads( )
 
     VM_SetTime();
     gScrExecuteTime += Sys_MillisecondsRaw() - pre_time;
+
+    if ( scr_profile.active )
+    {
+      scr_profile.vmTime += (Sys_MillisecondsRaw() - pre_time) * 1000;
+      Scr_ProfileCollect( );
+    }
   }
 }
 
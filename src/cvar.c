@@ -44,6 +44,7 @@
 cvar_t		*cvar_vars;
 cvar_t		*cvar_cheats;
 int		cvar_modifiedFlags;
+int		cvar_modificationCount;	// bumped on every change of any cvar's value or flags
 qboolean	cvar_archivedset = qfalse;
 qboolean	cheating_enabled;
 
@@ -86,6 +87,7 @@ void Cvar_AddFlags(cvar_t* var, unsigned short flags)
 {
 	Sys_EnterCriticalSection(CRITSECT_CVAR);
 	var->flags |= flags;
+	cvar_modificationCount++;
 	Sys_LeaveCriticalSection(CRITSECT_CVAR);
 }
 
@@ -93,6 +95,7 @@ void Cvar_ClearFlags(cvar_t* var, unsigned short flags)
 {
 	Sys_EnterCriticalSection(CRITSECT_CVAR);
 	var->flags &= ~flags;
+	cvar_modificationCount++;
 	Sys_LeaveCriticalSection(CRITSECT_CVAR);
 }
 
@@ -779,6 +782,7 @@ static cvar_t *Cvar_Register(const char* var_name, cvarType_t type, unsigned sho
 			var->latchedString = CopyString( value.string );
 	}
 	cvar_modifiedFlags |= var->flags;
+	cvar_modificationCount++;
 	Sys_LeaveCriticalSection(CRITSECT_CVAR);
 	return var;
 }
@@ -1003,6 +1007,7 @@ static int Cvar_SetVariant( cvar_t *var, CvarValue value ,qboolean force ) {
 	}
 	// note what types of cvars have been modified (userinfo, archive, serverinfo, systeminfo)
 	cvar_modifiedFlags |= var->flags;
+	cvar_modificationCount++;
 	var->modified = qtrue;
 	Sys_LeaveCriticalSection(CRITSECT_CVAR);
 	return 1;
@@ -120,6 +120,7 @@ typedef struct cvar_s {
 } cvar_t;
 
 
+extern int cvar_modificationCount;
 extern int cvar_modifiedFlags;
 
 #ifdef __cplusplus
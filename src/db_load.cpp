@@ -59,6 +59,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <sys/stat.h>
 
 
 #define XBLOCK_COUNT_IW3 9
@@ -66,7 +67,9 @@
 #define XBLOCK_COUNT XBLOCK_COUNT_IW3
 #define DM_MEMORY_PHYSICAL 2
 #define DEFLATE_BUFFER_SIZE 0x8000
-#define DBFILE_BUFFER_SIZE 0x80000
+#define DBFILE_CHUNK_SIZE 0x40000
+#define DBFILE_CHUNK_COUNT 8
+#define DBFILE_BUFFER_SIZE (DBFILE_CHUNK_SIZE * DBFILE_CHUNK_COUNT)
 #define FASTFILE_VERSION 5
 #define XASSET_ENTRY_POOL_SIZE 32768
 
@@ -95,7 +98,6 @@ volatile int g_totalExternalBytes;
 volatile int g_loadedExternalBytes;
 volatile int g_totalStreamBytes;
 bool g_trackLoadProgress;
-int g_totalWait;
 struct XBlock* g_streamBlocks;
 unsigned int g_streamDelayIndex;
 byte* g_streamPosArray[XBLOCK_COUNT];
@@ -538,6 +540,11 @@ struct DB_LoadData
   int deflateRemainingFileSize;
   int flags;
   int startTime;
+  unsigned long long ioWaitTime;
+  unsigned long long inflateTime;
+  byte *preloadData;
+  int preloadSize;
+  int preloadPos;
   bool abort;
   bool ateof;
   byte deflateBuffer[DEFLATE_BUFFER_SIZE];
@@ -735,6 +742,141 @@ void __stdcall DB_FileReadCompletionDummyCallback(long unsigned int dwErrorCode,
 }
 
 
+/*
+==============================================================================
+
+Fastfile read-ahead
+
+ReadFileEx() is only asynchronous on Windows. On Linux it is a plain read and the
+load used to alternate between reading a chunk and inflating it. The DBReadAhead
+thread keeps the compress buffer filled ahead of the inflate stage instead.
+Chunk n of the file lives in slot n % DBFILE_CHUNK_COUNT of the compress buffer.
+A slot can only be refilled once zlib is done with its chunk, which is the case
+for every chunk before the one handed to avail_in last.
+
+==============================================================================
+*/
+
+struct DB_ReadAhead
+{
+  HANDLE f;
+  char *buffer;
+  HANDLE wakeReader;
+  HANDLE chunkDone;
+  volatile DWORD limit; //Number of chunks the reader may have read, written by the loading thread
+  volatile DWORD readChunks; //Written by the reader
+  volatile DWORD error; //Error of chunk readChunks, 38 is end of file
+  volatile DWORD active;
+  volatile DWORD busy;
+  unsigned long long readTime;
+  bool threadStarted;
+};
+
+static DB_ReadAhead g_readAhead;
+
+/* Reads chunk readChunks. Returns false on end of file or error */
+static bool DB_ReadAheadChunk()
+{
+  struct _OVERLAPPED overlapped;
+  DWORD chunk;
+  DWORD err;
+  unsigned long long readStart;
+
+  chunk = g_readAhead.readChunks;
+
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.Offset = chunk * DBFILE_CHUNK_SIZE;
+
+  readStart = Sys_Microseconds();
+  if ( !_ReadFileEx(g_readAhead.f, &g_readAhead.buffer[(chunk % DBFILE_CHUNK_COUNT) * DBFILE_CHUNK_SIZE], DBFILE_CHUNK_SIZE, &overlapped, DB_FileReadCompletionDummyCallback) )
+  {
+    err = _GetLastError();
+    Sys_InterlockedExchangeAdd(&g_readAhead.error, err ? err : 30);
+    return false;
+  }
+  /* Windows runs the completion routine on this thread */
+  _SleepEx(-1, TRUE);
+  g_readAhead.readTime += Sys_Microseconds() - readStart;
+  Sys_InterlockedIncrement(&g_readAhead.readChunks);
+  return true;
+}
+
+static void* DB_ReadAheadThread(void* arg)
+{
+  while ( true )
+  {
+    Sys_WaitForObject(g_readAhead.wakeReader);
+
+    Sys_InterlockedIncrement(&g_readAhead.busy);
+    while ( Sys_InterlockedExchangeAdd(&g_readAhead.active, 0) && !g_readAhead.error )
+    {
+      if ( g_readAhead.readChunks >= Sys_InterlockedExchangeAdd(&g_readAhead.limit, 0) )
+      {
+        break;
+      }
+      DB_ReadAheadChunk();
+      Sys_SetEvent(g_readAhead.chunkDone);
+    }
+    Sys_InterlockedDecrement(&g_readAhead.busy);
+    Sys_SetEvent(g_readAhead.chunkDone);
+  }
+  return NULL;
+}
+
+/* Waits until the reader doesn't touch the file and the compress buffer anymore */
+static void DB_StopReadAhead()
+{
+  if ( !Sys_InterlockedExchangeAdd(&g_readAhead.active, 0) )
+  {
+    return;
+  }
+  Sys_InterlockedDecrement(&g_readAhead.active);
+  if ( g_readAhead.threadStarted )
+  {
+    while ( Sys_InterlockedExchangeAdd(&g_readAhead.busy, 0) )
+    {
+      Sys_WaitForObject(g_readAhead.chunkDone);
+    }
+  }
+}
+
+static void DB_StartReadAhead(HANDLE f, char *buffer)
+{
+  threadid_t tid;
+
+  /* A load aborted by Com_Error() doesn't get cancelled */
+  DB_StopReadAhead();
+
+  g_readAhead.f = f;
+  g_readAhead.buffer = buffer;
+  g_readAhead.limit = DBFILE_CHUNK_COUNT -1;
+  g_readAhead.readChunks = 0;
+  g_readAhead.error = 0;
+  g_readAhead.readTime = 0;
+  Sys_InterlockedIncrement(&g_readAhead.active);
+
+  if ( !g_readAhead.threadStarted )
+  {
+    g_readAhead.wakeReader = Sys_CreateEvent(qfalse, qfalse, "DBReadAheadWake");
+    g_readAhead.chunkDone = Sys_CreateEvent(qfalse, qfalse, "DBReadAheadDone");
+    if ( !g_readAhead.wakeReader || !g_readAhead.chunkDone )
+    {
+      Com_PrintWarning(CON_CHANNEL_FILES, "Failed to create fastfile read-ahead events. Reading synchronously\n");
+      return;
+    }
+    if ( Sys_CreateNewThread(DB_ReadAheadThread, &tid, NULL) == qfalse )
+    {
+      Com_PrintWarning(CON_CHANNEL_FILES, "Failed to start fastfile read-ahead thread. Reading synchronously\n");
+      return;
+    }
+    Sys_SetThreadName(tid, "DBReadAhead");
+    g_readAhead.threadStarted = true;
+  }
+  Sys_SetEvent(g_readAhead.wakeReader);
+}
+
+
+
 int __cdecl DB_AuthLoad_Inflate(struct z_stream_s *stream, int flush)
 {
   return inflate(stream, flush);
@@ -750,9 +892,320 @@ XAsset *__cdecl AllocLoad_FxElemVisStateSample()
   return (XAsset *)DB_AllocStreamPos(3);
 }
 
+/*
+==============================================================================
+
+Next map preload
+
+The zone of the next map can be read and inflated into a staging buffer on the
+DBPreload thread while the current match is still running. The fastfile holds
+the clipmap too, so this covers the BSP. DB_LoadXFile() then takes the data from
+the staging buffer instead of the file. Only the pointer fixups and the asset
+registration are left for the map change. A preload whose zone doesn't get
+loaded next is discarded and the zone gets loaded from the file as usual.
+
+==============================================================================
+*/
+
+enum
+{
+  DB_PRELOAD_IDLE,
+  DB_PRELOAD_RUNNING,
+  DB_PRELOAD_READY,
+  DB_PRELOAD_FAILED,
+  DB_PRELOAD_INUSE
+};
+
+struct DB_Preload
+{
+  char zoneName[64];
+  char ospath[MAX_OSPATH];
+  int maxBytes;
+  volatile DWORD state;
+  volatile DWORD cancel;
+  bool reported;
+  byte *data;
+  int size;
+  int fileSize;
+  time_t mtime;
+  int loadTime;
+  const char *failureReason;
+  HANDLE wake;
+  HANDLE done;
+  bool threadStarted;
+};
+
+static DB_Preload g_preload;
+
+int DB_BuildZoneFilePath(const char* zoneName, char* oFilename, int maxlen);
+
+/* Returns NULL on success or the reason of the failure */
+static const char* DB_PreloadZoneInternal()
+{
+  FILE *f;
+  struct stat st;
+  byte *fileBuffer;
+  byte magic[8];
+  unsigned int version;
+  XFile file;
+  z_stream_s stream;
+  int err;
+  int fileRead;
+  const char *failureReason;
+
+  f = fopen(g_preload.ospath, "rb");
+  if ( f == NULL )
+  {
+    return "can not open the file";
+  }
+  if ( fstat(fileno(f), &st) != 0 )
+  {
+    fclose(f);
+    return "can not stat the file";
+  }
+  g_preload.mtime = st.st_mtime;
+  if ( fread(magic, 1, sizeof(magic), f) != sizeof(magic) || fread(&version, 1, sizeof(version), f) != sizeof(version) )
+  {
+    fclose(f);
+    return "file is too short";
+  }
+  if ( memcmp(magic, "IWffu100", 8u) || version != FASTFILE_VERSION )
+  {
+    fclose(f);
+    return "not an unsigned fastfile of the supported version";
+  }
+  fseek(f, 0, SEEK_END);
+  g_preload.fileSize = ftell(f);
+  fseek(f, sizeof(magic) + sizeof(version), SEEK_SET);
+
+  fileBuffer = (byte*)malloc(DBFILE_CHUNK_SIZE);
+  if ( fileBuffer == NULL )
+  {
+    fclose(f);
+    return "out of memory";
+  }
+  memset(&stream, 0, sizeof(stream));
+  if ( inflateInit(&stream) != Z_OK )
+  {
+    free(fileBuffer);
+    fclose(f);
+    return "inflate init failed";
+  }
+
+  /* The XFile header tells how large the inflated zone is */
+  stream.next_out = (byte*)&file;
+  stream.avail_out = sizeof(file);
+  failureReason = NULL;
+
+  while ( stream.avail_out > 0 )
+  {
+    if ( g_preload.cancel )
+    {
+      failureReason = "cancelled";
+      break;
+    }
+    if ( stream.avail_in == 0 )
+    {
+      fileRead = fread(fileBuffer, 1, DBFILE_CHUNK_SIZE, f);
+      if ( fileRead <= 0 )
+      {
+        failureReason = "file is truncated";
+        break;
+      }
+      stream.next_in = fileBuffer;
+      stream.avail_in = fileRead;
+    }
+    err = inflate(&stream, Z_SYNC_FLUSH);
+    if ( err != Z_OK && err != Z_STREAM_END )
+    {
+      failureReason = "file is corrupt";
+      break;
+    }
+    if ( err == Z_STREAM_END && stream.avail_out > 0 )
+    {
+      failureReason = "file is truncated";
+      break;
+    }
+    if ( g_preload.data == NULL && stream.avail_out == 0 )
+    {
+      if ( file.size > (unsigned int)(g_preload.maxBytes - sizeof(file)) )
+      {
+        failureReason = "zone exceeds the memory limit";
+        break;
+      }
+      g_preload.size = sizeof(file) + file.size;
+      g_preload.data = (byte*)malloc(g_preload.size);
+      if ( g_preload.data == NULL )
+      {
+        failureReason = "out of memory";
+        break;
+      }
+      memcpy(g_preload.data, &file, sizeof(file));
+      stream.next_out = g_preload.data + sizeof(file);
+      stream.avail_out = file.size;
+    }
+  }
+  inflateEnd(&stream);
+  free(fileBuffer);
+  fclose(f);
+
+  if ( failureReason && g_preload.data )
+  {
+    free(g_preload.data);
+    g_preload.data = NULL;
+  }
+  return failureReason;
+}
+
+static void* DB_PreloadThread(void* arg)
+{
+  int startTime;
+
+  while ( true )
+  {
+    Sys_WaitForObject(g_preload.wake);
+    if ( Sys_InterlockedExchangeAdd(&g_preload.state, 0) != DB_PRELOAD_RUNNING )
+    {
+      continue;
+    }
+    startTime = Sys_Milliseconds();
+    g_preload.failureReason = DB_PreloadZoneInternal();
+    g_preload.loadTime = Sys_Milliseconds() - startTime;
+    Sys_InterlockedExchangeAdd(&g_preload.state, (g_preload.failureReason ? DB_PRELOAD_FAILED : DB_PRELOAD_READY) - DB_PRELOAD_RUNNING);
+    Sys_SetEvent(g_preload.done);
+  }
+  return NULL;
+}
+
+static void DB_WaitPreload()
+{
+  while ( Sys_InterlockedExchangeAdd(&g_preload.state, 0) == DB_PRELOAD_RUNNING )
+  {
+    Sys_WaitForObject(g_preload.done);
+  }
+}
+
+static void DB_FreePreload()
+{
+  free(g_preload.data);
+  g_preload.data = NULL;
+  g_preload.size = 0;
+  g_preload.zoneName[0] = '\0';
+  g_preload.state = DB_PRELOAD_IDLE;
+}
+
+/*
+Drops the preloaded zone unless it is keepZoneName. NULL drops it in any case
+*/
+void DB_DiscardPreloadedZone(const char *keepZoneName)
+{
+  if ( !g_preload.threadStarted || Sys_InterlockedExchangeAdd(&g_preload.state, 0) == DB_PRELOAD_IDLE )
+  {
+    return;
+  }
+  if ( keepZoneName && !Q_stricmp(keepZoneName, g_preload.zoneName) )
+  {
+    return;
+  }
+  Sys_InterlockedIncrement(&g_preload.cancel);
+  DB_WaitPreload();
+  Sys_InterlockedDecrement(&g_preload.cancel);
+  DB_FreePreload();
+}
+
+/*
+Starts preloading zoneName unless it is already preloaded. Called every few seconds,
+reports the result of the preload once it is done
+*/
+void DB_PreloadZone(const char *zoneName, int maxBytes)
+{
+  threadid_t tid;
+  int ff_dir;
+  char ospath[MAX_OSPATH];
+
+  if ( g_preload.threadStarted && !Q_stricmp(zoneName, g_preload.zoneName) )
+  {
+    if ( !g_preload.reported )
+    {
+      switch ( Sys_InterlockedExchangeAdd(&g_preload.state, 0) )
+      {
+        case DB_PRELOAD_READY:
+          Com_Printf(CON_CHANNEL_FILES, "Preloaded zone '%s' for the next map: %i KB in %ims\n", g_preload.zoneName, g_preload.size / 1024, g_preload.loadTime);
+          g_preload.reported = true;
+          break;
+        case DB_PRELOAD_FAILED:
+          Com_PrintWarning(CON_CHANNEL_FILES, "Preloading zone '%s' for the next map failed: %s\n", g_preload.zoneName, g_preload.failureReason);
+          g_preload.reported = true;
+          break;
+      }
+    }
+    return;
+  }
+
+  DB_DiscardPreloadedZone(NULL);
+
+  ff_dir = DB_BuildZoneFilePath(zoneName, ospath, sizeof(ospath));
+  if ( ff_dir < 0 )
+  {
+    return;
+  }
+
+  if ( !g_preload.threadStarted )
+  {
+    g_preload.wake = Sys_CreateEvent(qfalse, qfalse, "DBPreloadWake");
+    g_preload.done = Sys_CreateEvent(qfalse, qfalse, "DBPreloadDone");
+    if ( !g_preload.wake || !g_preload.done || Sys_CreateNewThread(DB_PreloadThread, &tid, NULL) == qfalse )
+    {
+      Com_PrintWarning(CON_CHANNEL_FILES, "Failed to start the zone preload thread\n");
+      return;
+    }
+    Sys_SetThreadName(tid, "DBPreload");
+    g_preload.threadStarted = true;
+  }
+
+  Q_strncpyz(g_preload.zoneName, zoneName, sizeof(g_preload.zoneName));
+  Q_strncpyz(g_preload.ospath, ospath, sizeof(g_preload.ospath));
+  g_preload.maxBytes = maxBytes;
+  g_preload.reported = false;
+  g_preload.failureReason = NULL;
+  g_preload.state = DB_PRELOAD_RUNNING;
+  Sys_SetEvent(g_preload.wake);
+}
+
+/*
+Hands the preloaded data over to the loader if it was made from this file.
+A file which got replaced since the preload differs in size or modification time
+*/
+static bool DB_TakePreloadedZone(const char *ospath, int fileSize)
+{
+  struct stat st;
+
+  if ( !g_preload.threadStarted || Q_stricmp(ospath, g_preload.ospath) )
+  {
+    return false;
+  }
+  DB_WaitPreload();
+  if ( Sys_InterlockedExchangeAdd(&g_preload.state, 0) != DB_PRELOAD_READY || fileSize != g_preload.fileSize )
+  {
+    return false;
+  }
+  if ( stat(ospath, &st) != 0 || st.st_mtime != g_preload.mtime )
+  {
+    Com_DPrintf(CON_CHANNEL_FILES, "Preloaded zone '%s' is outdated, loading it from the file\n", g_preload.zoneName);
+    return false;
+  }
+  g_preload.state = DB_PRELOAD_INUSE;
+  g_load.preloadData = g_preload.data;
+  g_load.preloadSize = g_preload.size;
+  g_load.preloadPos = 0;
+  return true;
+}
+
 qboolean __cdecl DB_ReadData()
 {
-  char *fileBuffer;
+  DWORD chunk;
+  DWORD limit;
+  unsigned long long waitStart;
 
   assert(g_load.compressBufferStart);
   assert(g_load.f);
@@ -761,21 +1214,47 @@ qboolean __cdecl DB_ReadData()
   {
     g_load.interrupt();
   }
-  fileBuffer = &g_load.compressBufferStart[g_load.overlapped.Offset % DBFILE_BUFFER_SIZE];
+
+  chunk = g_load.overlapped.Offset / DBFILE_CHUNK_SIZE;
 
   Sys_WaitDatabaseThread();
 
-  if ( _ReadFileEx(g_load.f, fileBuffer, 0x40000u, &g_load.overlapped, DB_FileReadCompletionDummyCallback) )
+  /* zlib still reads from chunk - 1, every other slot can be refilled */
+  limit = chunk + DBFILE_CHUNK_COUNT -1;
+  if ( limit != g_readAhead.limit )
+  {
+    g_readAhead.limit = limit;
+    if ( g_readAhead.threadStarted )
+    {
+      Sys_SetEvent(g_readAhead.wakeReader);
+    }
+  }
+
+  waitStart = Sys_Microseconds();
+  if ( g_readAhead.threadStarted )
   {
-    ++g_load.outstandingReads;
-    g_load.overlapped.Offset += 0x40000;
-    return qtrue;
+    while ( Sys_InterlockedExchangeAdd(&g_readAhead.readChunks, 0) <= chunk && !Sys_InterlockedExchangeAdd(&g_readAhead.error, 0) )
+    {
+      Sys_WaitForObject(g_readAhead.chunkDone);
+    }
   }
-  return qfalse;
+  else
+  {
+    while ( g_readAhead.readChunks <= chunk && !g_readAhead.error && DB_ReadAheadChunk() );
+  }
+  g_load.ioWaitTime += Sys_Microseconds() - waitStart;
+
+  if ( Sys_InterlockedExchangeAdd(&g_readAhead.readChunks, 0) <= chunk )
+  {
+    return qfalse;
+  }
+  ++g_load.outstandingReads;
+  g_load.overlapped.Offset += DBFILE_CHUNK_SIZE;
+  return qtrue;
 }
 
-//g_load.outstandingReads get increased by 1 when we have read data of amount 0x40000 or less on end of file
-//g_load.outstandingReads gets lowered by 1 when 
+//g_load.outstandingReads get increased by 1 when the next chunk is in the compress buffer
+//g_load.outstandingReads gets lowered by 1 when the chunk got handed over to zlib
 
 void DB_ReadXFileStage()
 {
@@ -787,7 +1266,7 @@ void DB_ReadXFileStage()
     assert ( !g_load.outstandingReads );
     if ( !DB_ReadData() )
     {
-      if(_GetLastError() == 38)
+      if(g_readAhead.error == 38)
       {
         g_load.ateof = true;
       }else{
@@ -808,16 +1287,12 @@ void __cdecl DB_ResetZoneSize(bool trackLoadProgress)
 
 void DB_WaitXFileStage()
 {
-    int waitStart;
     assert(g_load.f);
     assert(g_load.outstandingReads > 0);
 
     --g_load.outstandingReads;
-    waitStart = Sys_Milliseconds();
-    _SleepEx(-1, TRUE);
-    g_totalWait += Sys_Milliseconds() - waitStart;
     InterlockedIncrement((DWORD*)&g_loadedSize);
-    g_load.stream.avail_in += 0x40000;
+    g_load.stream.avail_in += DBFILE_CHUNK_SIZE;
 }
 
 
@@ -837,7 +1312,13 @@ void __cdecl DB_CancelLoadXFile()
     assert ( g_load.f );
     assert ( (signed int)g_load.f != INVALID_DBFILE );
 
+    DB_StopReadAhead();
     _CloseHandle(g_load.f);
+    if ( g_load.preloadData )
+    {
+      DB_FreePreload();
+      g_load.preloadData = NULL;
+    }
   }
 }
 
@@ -849,6 +1330,7 @@ void __cdecl DB_LoadXFileData(byte *pos, int size)
   int lastDeflateRemainingFileSize;
   int bytesToCopy;
   int err;
+  unsigned long long inflateStart;
 
   assert(size);
   assert(g_load.f);
@@ -857,6 +1339,19 @@ void __cdecl DB_LoadXFileData(byte *pos, int size)
   {
     return;
   }
+  if ( g_load.preloadData )
+  {
+    if ( size > g_load.preloadSize - g_load.preloadPos )
+    {
+      DB_CancelLoadXFile();
+      Com_Error(ERR_DROP, "Fastfile for zone '%s' appears corrupt or unreadable. Unexpected end of stream. Missing %d bytes.",
+        g_load.filename, size - (g_load.preloadSize - g_load.preloadPos));
+    }
+    memcpy(pos, g_load.preloadData + g_load.preloadPos, size);
+    g_load.preloadPos += size;
+    g_load.deflateRemainingFileSize -= size;
+    return;
+  }
   while( size + g_load.deflateBufferPos > DEFLATE_BUFFER_SIZE && size > 0)
   {
       assert(g_load.deflateBufferPos <= DEFLATE_BUFFER_SIZE);
@@ -905,7 +1400,9 @@ void __cdecl DB_LoadXFileData(byte *pos, int size)
           DB_ReadXFileStage();
           continue;
         }
+        inflateStart = Sys_Microseconds();
         err = DB_AuthLoad_Inflate(&g_load.stream, 2);
+        g_load.inflateTime += Sys_Microseconds() - inflateStart;
         if ( err && err != 1)
         {
           //R_ShowDirtyDiscError();
@@ -1096,19 +1593,15 @@ void __cdecl Load_XAssetArrayCustom(int count)
   }
 }
 
-void __cdecl DB_LoadXFileInternal()
+/* Reads the uncompressed header and sets up the inflate stream */
+static void DB_LoadXFileHeader()
 {
   bool fileIsSecure;
   int err;
   unsigned int version;
-  XFile file;
-  int fileSize;
   const char *failureReason;
   char magic[8];
 
-  g_totalWait = 0;
-  assert(g_load.f);
-
   DB_ReadXFileStage();
 
   if ( !g_load.outstandingReads )
@@ -1170,6 +1663,22 @@ void __cdecl DB_LoadXFileInternal()
 
   assert(g_load.deflateBufferPos == DEFLATE_BUFFER_SIZE);
 
+}
+
+void __cdecl DB_LoadXFileInternal()
+{
+  XFile file;
+  int fileSize;
+  int loadTime;
+
+  assert(g_load.f);
+
+  /* A preloaded zone is already inflated */
+  if ( !g_load.preloadData )
+  {
+    DB_LoadXFileHeader();
+  }
+
   DB_LoadXFileSetSize(sizeof(file));
   DB_LoadXFileData((byte*)&file, sizeof(file));
 
@@ -1215,7 +1724,14 @@ void __cdecl DB_LoadXFileInternal()
 
   assert(g_load.compressBufferStart);
 
-  Com_Printf(CON_CHANNEL_FILES, "Loaded fastfile '%s' in %ims (%dms waiting)\n", g_load.filename, Sys_Milliseconds() - g_load.startTime, g_totalWait);
+  loadTime = Sys_Milliseconds() - g_load.startTime;
+  Com_Printf(CON_CHANNEL_FILES, "Loaded fastfile '%s' in %ims (%ims waiting for I/O, %ims inflating, %ims loading assets and fixing up pointers)\n",
+             g_load.filename, loadTime, (int)(g_load.ioWaitTime / 1000), (int)(g_load.inflateTime / 1000),
+             loadTime - (int)((g_load.ioWaitTime + g_load.inflateTime) / 1000));
+  if ( !g_load.preloadData )
+  {
+    Com_DPrintf(CON_CHANNEL_FILES, "Read-ahead of '%s': %u chunks in %ims\n", g_load.filename, g_readAhead.readChunks, (int)(g_readAhead.readTime / 1000));
+  }
   if ( g_load.flags & 1 )
   {
     g_minimumFastFileLoaded = 1;
@@ -1245,6 +1761,14 @@ bool __cdecl DB_LoadXFile(const char *path, HANDLE f, const char *filename, XBlo
   g_load.stream.next_in = (byte*)buf;
   g_load.stream.avail_in = 0;
   g_load.deflateBufferPos = DEFLATE_BUFFER_SIZE;
+  if ( DB_TakePreloadedZone(path, _GetFileSize(f, 0)) )
+  {
+    Com_Printf(CON_CHANNEL_FILES, "Using preloaded zone '%s'\n", filename);
+  }
+  else
+  {
+    DB_StartReadAhead(f, buf);
+  }
   DB_LoadXFileInternal();
   return 1;
 }
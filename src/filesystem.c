@@ -215,6 +215,11 @@ or configs will never get loaded from disk!
 #include <errno.h>
 #include <unistd.h>
 #include <ctype.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
 
 
 
@@ -4167,8 +4172,24 @@ int FS_PureServerSetLoadedIwds(const char *paksums, const char *paknames)
 }
 
 
+/*
+==============================================================================
+
+Download checksums
+
+Clients get the crc32 of every SERVERFILECHKSUMBLOCKSIZE block of a file they
+download. Sums are cached per qpath and stay valid as long as size and
+modification time of the file are unchanged. The table is indexed by
+FS_HashFileName with chaining, since the hash ignores the file extension.
+SV_CalculateChecksums hands all downloadable files of the new map to
+FS_PrecomputeChecksums which checksums the outdated ones on worker threads.
+
+==============================================================================
+*/
+
 #define SERVERFILECHKSUMPERFILE 256
 
+/* Gets sent to the clients as it is */
 typedef struct
 {
     char qpath[MAX_QPATH];
@@ -4179,94 +4200,379 @@ typedef struct
 
 #define SERVERFILECHKSUMBLOCKSIZE 2*1024*1024
 #define SERVERFILEMAXCHKSUM 512
+#define SERVERFILECHKSUMHASHSIZE (SERVERFILEMAXCHKSUM << 2)
+#define MAX_CHECKSUM_WORKERS 8
 
-
+typedef struct fs_crcsumentry_s
+{
+    fs_crcsum_t crc;
+    qboolean inuse;
+    time_t mtime;
+    unsigned int lastUsed;
+    struct fs_crcsumentry_s *next;
+}fs_crcsumentry_t;
 
 typedef struct
 {
-    fs_crcsum_t sums[SERVERFILEMAXCHKSUM];
-    fs_crcsum_t *hash[SERVERFILEMAXCHKSUM << 2];
+    fs_crcsumentry_t sums[SERVERFILEMAXCHKSUM];
+    fs_crcsumentry_t *hash[SERVERFILECHKSUMHASHSIZE];
+    unsigned int useCount;
 }fs_crcsums_t;
 
-fs_crcsums_t fscrcsums;
+static fs_crcsums_t fscrcsums;
+
+typedef struct
+{
+    char ospath[MAX_OSPATH];
+    fs_crcsumentry_t *entry;
+    int length;
+    time_t mtime;
+    fs_crcsum_t crc;
+    qboolean success;
+}fs_checksumJob_t;
+
+typedef struct
+{
+    fs_checksumJob_t *jobs;
+    int numJobs;
+    volatile DWORD nextJob;
+    volatile DWORD numAlive;
+    HANDLE done;
+}fs_checksumPool_t;
+
+static fs_checksumPool_t fs_checksumPool;
 
-fs_crcsum_t* FS_FindChecksumForFile(const char* filename, int len)
+
+/*
+Finds the file in homepath or basepath like FS_SV_FOpenFileRead does
+*/
+static qboolean FS_SV_FileStat(const char* filename, char* ospath, struct stat *st)
 {
+    FS_BuildOSPathForThread( fs_homepath->string, filename, "", ospath, 0 );
+    ospath[strlen(ospath)-1] = '\0';
 
+    if(stat(ospath, st) == 0)
+    {
+        return qtrue;
+    }
+    if(Q_stricmp(fs_homepath->string, fs_basepath->string) == 0)
+    {
+        return qfalse;
+    }
+    FS_BuildOSPathForThread( fs_basepath->string, filename, "", ospath, 0 );
+    ospath[strlen(ospath)-1] = '\0';
+
+    return stat(ospath, st) == 0;
+}
+
+static fs_crcsumentry_t* FS_FindChecksumForFile(const char* filename)
+{
+    fs_crcsumentry_t *entry;
+
+    for(entry = fscrcsums.hash[FS_HashFileName(filename, SERVERFILECHKSUMHASHSIZE)]; entry; entry = entry->next)
+    {
+        if(strcmp(filename, entry->crc.qpath) == 0)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void FS_UnlinkChecksumEntry(fs_crcsumentry_t *entry)
+{
+    fs_crcsumentry_t **link;
+
+    for(link = &fscrcsums.hash[FS_HashFileName(entry->crc.qpath, SERVERFILECHKSUMHASHSIZE)]; *link; link = &(*link)->next)
+    {
+        if(*link == entry)
+        {
+            *link = entry->next;
+            break;
+        }
+    }
+    Com_Memset(entry, 0, sizeof(fs_crcsumentry_t));
+}
+
+/*
+Returns the cached entry of the file or a new one. If the table is full the least recently used entry gets replaced
+*/
+static fs_crcsumentry_t* FS_GetChecksumEntry(const char* filename)
+{
     int i;
+    long hash;
+    fs_crcsumentry_t *entry, *oldest;
+
+    entry = FS_FindChecksumForFile(filename);
+    if(entry)
+    {
+        entry->lastUsed = ++fscrcsums.useCount;
+        return entry;
+    }
 
+    oldest = &fscrcsums.sums[0];
     for(i = 0; i < SERVERFILEMAXCHKSUM; ++i)
     {
+        if(fscrcsums.sums[i].inuse == qfalse)
+        {
+            break;
+        }
+        if(fscrcsums.sums[i].lastUsed < oldest->lastUsed)
+        {
+            oldest = &fscrcsums.sums[i];
+        }
+    }
+    if(i < SERVERFILEMAXCHKSUM)
+    {
+        entry = &fscrcsums.sums[i];
+    }else{
+        Com_DPrintf(CON_CHANNEL_FILES, "Exceeded number of maximum files for checksumming. Dropping %s\n", oldest->crc.qpath);
+        FS_UnlinkChecksumEntry(oldest);
+        entry = oldest;
+    }
+
+    Q_strncpyz(entry->crc.qpath, filename, sizeof(entry->crc.qpath));
+    entry->inuse = qtrue;
+    entry->lastUsed = ++fscrcsums.useCount;
+    hash = FS_HashFileName(entry->crc.qpath, SERVERFILECHKSUMHASHSIZE);
+    entry->next = fscrcsums.hash[hash];
+    fscrcsums.hash[hash] = entry;
+    return entry;
+}
+
+/*
+Thread safe, touches nothing but its arguments
+*/
+static qboolean FS_ChecksumOSFile(const char* ospath, fs_crcsum_t *crc, byte* block)
+{
+    FILE* f;
+    int blockSize, i;
+
+    f = fopen(ospath, "rb");
+    if(f == NULL)
+    {
+        return qfalse;
+    }
+    crc->sum = 0;
+    i = 0;
+    do
+    {
+        blockSize = fread( block, 1, SERVERFILECHKSUMBLOCKSIZE, f );
+        crc->sum = crc32_16bytes( block, blockSize, crc->sum );
+        crc->sums[i] = crc32_16bytes( block, blockSize, 0 );
+        ++i;
+    }while(blockSize > 0 && i < SERVERFILECHKSUMPERFILE);
+
+    fclose(f);
+    return qtrue;
+}
+
+static void FS_RunChecksumJobs( byte* block )
+{
+    int job;
+    fs_checksumJob_t *j;
+
+    while((job = Sys_InterlockedIncrement(&fs_checksumPool.nextJob) -1) < fs_checksumPool.numJobs)
+    {
+        j = &fs_checksumPool.jobs[job];
+        j->success = FS_ChecksumOSFile(j->ospath, &j->crc, block);
+    }
+}
+
+static void* FS_ChecksumWorkerThread(void* arg)
+{
+    byte* block = malloc(SERVERFILECHKSUMBLOCKSIZE);
 
-        if(strcmp(filename, fscrcsums.sums[i].qpath) == 0)
+    if(block)
+    {
+        FS_RunChecksumJobs( block );
+        free(block);
+    }
+    if(Sys_InterlockedDecrement(&fs_checksumPool.numAlive) == 0)
+    {
+        Sys_SetEvent(fs_checksumPool.done);
+    }
+    return NULL;
+}
+
+static void FS_CommitChecksumJob(fs_checksumJob_t *j)
+{
+    fs_crcsumentry_t *entry = j->entry;
+
+    if(j->success == qfalse)
+    {
+        FS_UnlinkChecksumEntry(entry);
+        return;
+    }
+    Q_strncpyz(j->crc.qpath, entry->crc.qpath, sizeof(j->crc.qpath));
+    j->crc.length = j->length;
+    entry->crc = j->crc;
+    entry->mtime = j->mtime;
+}
+
+/*
+Brings the checksums of all given files up to date. Outdated files get
+checksummed by up to numThreads worker threads and the calling thread.
+Returns when all checksums are done
+*/
+void FS_PrecomputeChecksums(const char** filenames, int count, int numThreads)
+{
+    int i, numjobs, numworkers;
+    struct stat st;
+    fs_crcsumentry_t *entry;
+    fs_checksumJob_t *j;
+    byte* block;
+    threadid_t tid;
+    unsigned long long starttime;
+
+    if(count < 1)
+    {
+        return;
+    }
+    if(count > SERVERFILEMAXCHKSUM)
+    {
+        Com_PrintWarning(CON_CHANNEL_FILES, "FS_PrecomputeChecksums: Only the first %d of %d files get checksummed\n", SERVERFILEMAXCHKSUM, count);
+        count = SERVERFILEMAXCHKSUM;
+    }
+    starttime = Sys_Microseconds();
+
+    fs_checksumPool.jobs = Z_Malloc(count * sizeof(fs_checksumJob_t));
+    block = malloc(SERVERFILECHKSUMBLOCKSIZE);
+
+    if(fs_checksumPool.jobs == NULL || block == NULL)
+    {
+        if(fs_checksumPool.jobs)
+        {
+            Z_Free(fs_checksumPool.jobs);
+        }
+        free(block);
+        fs_checksumPool.jobs = NULL;
+        Com_PrintError(CON_CHANNEL_FILES, "FS_PrecomputeChecksums: Out of memory\n");
+        return;
+    }
+
+    numjobs = 0;
+    for(i = 0; i < count; ++i)
+    {
+        j = &fs_checksumPool.jobs[numjobs];
+
+        if(FS_SV_FileStat(filenames[i], j->ospath, &st) == qfalse || st.st_size <= 0)
+        {
+            continue;
+        }
+        entry = FS_GetChecksumEntry(filenames[i]);
+        if(entry->crc.length == st.st_size && entry->mtime == st.st_mtime)
+        {
+            continue;
+        }
+        /* Listed twice */
+        if(entry->crc.length == -1)
+        {
+            continue;
+        }
+        entry->crc.length = -1;
+        j->entry = entry;
+        j->length = st.st_size;
+        j->mtime = st.st_mtime;
+        j->success = qfalse;
+        ++numjobs;
+    }
+
+    if(numjobs > 0)
+    {
+        fs_checksumPool.numJobs = numjobs;
+        fs_checksumPool.nextJob = 0;
+        fs_checksumPool.numAlive = 1;
+        fs_checksumPool.done = Sys_CreateEvent(qfalse, qfalse, "checksumsdone");
+
+        if(numThreads > numjobs -1)
+        {
+            numThreads = numjobs -1;
+        }
+        if(numThreads > MAX_CHECKSUM_WORKERS)
         {
-            if(fscrcsums.sums[i].length != len)
+            numThreads = MAX_CHECKSUM_WORKERS;
+        }
+        for(numworkers = 0; numworkers < numThreads && fs_checksumPool.done; ++numworkers)
+        {
+            Sys_InterlockedIncrement(&fs_checksumPool.numAlive);
+            if(Sys_CreateNewThread(FS_ChecksumWorkerThread, &tid, NULL) == qfalse)
             {
-                Com_Memset(&fscrcsums.sums[i], 0, sizeof(fs_crcsums_t));
+                Sys_InterlockedDecrement(&fs_checksumPool.numAlive);
+                break;
             }
-            return &fscrcsums.sums[i];
+            Sys_SetThreadName(tid, "ChecksumWorker");
         }
 
-        if(fscrcsums.sums[i].length == 0)
+        FS_RunChecksumJobs( block );
+
+        if(Sys_InterlockedDecrement(&fs_checksumPool.numAlive) > 0)
         {
-            return &fscrcsums.sums[i];
+            Sys_WaitForObject(fs_checksumPool.done);
+        }
+        if(fs_checksumPool.done)
+        {
+            _CloseHandle(fs_checksumPool.done);
+            fs_checksumPool.done = 0;
         }
 
+        for(i = 0; i < numjobs; ++i)
+        {
+            FS_CommitChecksumJob(&fs_checksumPool.jobs[i]);
+        }
+        Com_Printf(CON_CHANNEL_FILES, "Checksummed %d of %d files with %d threads in %d msec\n", numjobs, count, numworkers +1,
+                   (int)((Sys_Microseconds() - starttime) / 1000));
     }
-    Com_PrintError(CON_CHANNEL_FILES,"Exceeded number of maximum files for checksumming\n");
-    Com_Memset(&fscrcsums.sums[SERVERFILEMAXCHKSUM / 2 -1], 0, sizeof(fscrcsums.sums) / 2);
 
-    return &fscrcsums.sums[SERVERFILEMAXCHKSUM / 2 -1];
+    free(block);
+    Z_Free(fs_checksumPool.jobs);
+    fs_checksumPool.jobs = NULL;
+    fs_checksumPool.numJobs = 0;
 }
 
 
 int FS_CalculateChecksumForFile(const char* filename, int *crc32)
 {
-    int blockSize, len, i;
-    fileHandle_t fh;
-    byte block[SERVERFILECHKSUMBLOCKSIZE];
-    fs_crcsum_t* chksums;
+    fs_checksumJob_t job;
+    struct stat st;
+    byte* block;
 
     *crc32 = 0;
 
-    len = FS_SV_FOpenFileRead( filename, &fh );
-
-    if(len <= 0)
+    if(FS_SV_FileStat(filename, job.ospath, &st) == qfalse || st.st_size <= 0)
     {
-        return len;
+        return 0;
     }
 
-    chksums = FS_FindChecksumForFile(filename, len);
+    job.entry = FS_GetChecksumEntry(filename);
 
-    if(chksums->length != len)
+    if(job.entry->crc.length != st.st_size || job.entry->mtime != st.st_mtime)
     {
-        i = 0;
-        do
+        block = malloc(SERVERFILECHKSUMBLOCKSIZE);
+        if(block == NULL)
         {
-            blockSize = FS_Read( block, sizeof(block), fh );
-            *crc32 = crc32_16bytes(  block, blockSize, *crc32 );
-            chksums->sums[i] = crc32_16bytes( block, blockSize, 0 );
-            ++i;
-        }while(blockSize > 0 && i < SERVERFILECHKSUMPERFILE);
-        chksums->length = len;
-        chksums->sum = *crc32;
-        Q_strncpyz(chksums->qpath, filename, sizeof(chksums->qpath));
-        fscrcsums.hash[FS_HashFileName(chksums->qpath, sizeof(fscrcsums.hash) / sizeof(fs_crcsum_t*))] = chksums;
-    }else{
-        *crc32 = chksums->sum;
-    }
-    FS_FCloseFile(fh);
+            return 0;
+        }
+        job.length = st.st_size;
+        job.mtime = st.st_mtime;
+        job.success = FS_ChecksumOSFile(job.ospath, &job.crc, block);
+        free(block);
 
-    return len;
+        FS_CommitChecksumJob(&job);
+        if(job.success == qfalse)
+        {
+            return 0;
+        }
+    }
+    *crc32 = job.entry->crc.sum;
+    return job.entry->crc.length;
 }
 
 int FS_WriteChecksumInfo(const char* filename, byte* data, int maxsize)
 {
-    int i;
-
-    fs_crcsum_t* chksums = fscrcsums.hash[FS_HashFileName(filename, sizeof(fscrcsums.hash) / sizeof(fs_crcsum_t*))];
+    fs_crcsumentry_t* entry = FS_FindChecksumForFile(filename);
 
-    if(chksums == NULL || chksums->length == 0)
+    if(entry == NULL || entry->crc.length <= 0)
     {
         return 0;
     }
@@ -4275,26 +4581,250 @@ int FS_WriteChecksumInfo(const char* filename, byte* data, int maxsize)
         Com_PrintError(CON_CHANNEL_FILES,"FS_WriteChecksumInfo(): Insufficient buffer size. Expected %d but got %d\n", sizeof(fs_crcsum_t), maxsize);
         return 0;
     }
-    if(strcmp(chksums->qpath, filename) == 0)
+    Com_Printf(CON_CHANNEL_FILES,"Writing %s len %d\n", entry->crc.qpath, entry->crc.length);
+    Com_Memcpy(data, &entry->crc, sizeof(fs_crcsum_t));
+    return sizeof(fs_crcsum_t);
+}
+
+
+/*
+==============================================================================
+
+Download file cache
+
+Every client downloading a file used to open its own handle and seek on each
+block request. Now all downloaders of a file share one read only mapping of it.
+Entries are refcounted and get unmapped when the last downloader closes them.
+The file stays open to notice when it gets truncated under the mapping, which
+would fault on access otherwise.
+If the file can't be mapped, e.g. a large .iwd in a 32 bit address space, the
+entry keeps only the open file and blocks are read from it on each request.
+Server thread only.
+
+==============================================================================
+*/
+
+struct fsDownloadFile_s
+{
+    char qpath[MAX_QPATH];
+    byte *data;
+    int size;
+    int refcount;
+#ifdef _WIN32
+    FILE *f;
+#else
+    int fd;
+#endif
+    struct fsDownloadFile_s *next;
+};
+
+static fsDownloadFile_t *fs_downloadFiles;
+
+
+static fsDownloadFile_t* FS_MapDownloadFile(const char* qpath)
+{
+    char ospath[MAX_OSPATH];
+    struct stat st;
+    fsDownloadFile_t *file;
+
+    if(FS_SV_FileStat(qpath, ospath, &st) == qfalse || st.st_size <= 0)
+    {
+        return NULL;
+    }
+    file = Z_Malloc(sizeof(fsDownloadFile_t));
+    if(file == NULL)
     {
-        Com_Printf(CON_CHANNEL_FILES,"Writing %s len %d\n", chksums->qpath, chksums->length);
-        Com_Memcpy(data, chksums, sizeof(fs_crcsum_t));
-        return sizeof(fs_crcsum_t);
+        return NULL;
     }
+    Com_Memset(file, 0, sizeof(fsDownloadFile_t));
+    Q_strncpyz(file->qpath, qpath, sizeof(file->qpath));
+    file->size = st.st_size;
 
-    //Search via hash has failed. Doing slow search
-    for(i = 0; i < SERVERFILEMAXCHKSUM; ++i)
+#ifdef _WIN32
+    file->f = fopen(ospath, "rb");
+    if(file->f == NULL)
+    {
+        Z_Free(file);
+        return NULL;
+    }
+    file->data = malloc(file->size);
+    if(file->data != NULL)
     {
-        if(strcmp(filename, fscrcsums.sums[i].qpath) == 0)
+        if(fread(file->data, 1, file->size, file->f) == (size_t)file->size)
         {
+            fclose(file->f);
+            file->f = NULL;
+            return file;
+        }
+        free(file->data);
+        file->data = NULL;
+    }
+#else
+    file->fd = open(ospath, O_RDONLY);
+    if(file->fd < 0)
+    {
+        Z_Free(file);
+        return NULL;
+    }
+    file->data = mmap(NULL, file->size, PROT_READ, MAP_SHARED, file->fd, 0);
+    if(file->data != MAP_FAILED)
+    {
+        return file;
+    }
+    file->data = NULL;
+#endif
+    Com_DPrintf(CON_CHANNEL_FILES, "Download file %s can not be mapped, reading it per block\n", qpath);
+    return file;
+}
 
-            Com_Memcpy(data, &fscrcsums.sums[i], sizeof(fs_crcsum_t));
-            return sizeof(fs_crcsum_t);
+static void FS_UnmapDownloadFile(fsDownloadFile_t *file)
+{
+#ifdef _WIN32
+    if(file->data)
+    {
+        free(file->data);
+    }else{
+        fclose(file->f);
+    }
+#else
+    if(file->data)
+    {
+        munmap(file->data, file->size);
+    }
+    close(file->fd);
+#endif
+    Z_Free(file);
+}
+
+/*
+Returns the shared download of qpath and its size, NULL if it doesn't exist or is empty
+*/
+fsDownloadFile_t* FS_OpenDownloadFile(const char* qpath, int *size)
+{
+    fsDownloadFile_t *file;
+
+    for(file = fs_downloadFiles; file; file = file->next)
+    {
+        if(strcmp(file->qpath, qpath) == 0)
+        {
+            break;
         }
     }
-    //Slow search did not generate results :/
-    return 0;
+    if(file == NULL)
+    {
+        file = FS_MapDownloadFile(qpath);
+        if(file == NULL)
+        {
+            *size = 0;
+            return NULL;
+        }
+        file->next = fs_downloadFiles;
+        fs_downloadFiles = file;
+    }
+    ++file->refcount;
+    *size = file->size;
+    return file;
+}
+
+void FS_CloseDownloadFile(fsDownloadFile_t *file)
+{
+    fsDownloadFile_t **link;
+
+    if(--file->refcount > 0)
+    {
+        return;
+    }
+    for(link = &fs_downloadFiles; *link; link = &(*link)->next)
+    {
+        if(*link == file)
+        {
+            *link = file->next;
+            break;
+        }
+    }
+    FS_UnmapDownloadFile(file);
+}
+
+/*
+Points data to len bytes at offset of the file. Mapped files are not copied, otherwise
+the block is read into buffer which has to hold len bytes.
+Returns the number of bytes available there, 0 at the end of file or if the file got truncated
+*/
+int FS_GetDownloadFileBlock(fsDownloadFile_t *file, int offset, int len, byte *buffer, const byte **data)
+{
+#ifndef _WIN32
+    struct stat st;
+    ssize_t numread;
+#endif
+
+    *data = NULL;
+    if(offset < 0 || offset >= file->size || len <= 0)
+    {
+        return 0;
+    }
+    if(len > file->size - offset)
+    {
+        len = file->size - offset;
+    }
+#ifdef _WIN32
+    if(file->data == NULL)
+    {
+        if(fseek(file->f, offset, SEEK_SET) != 0)
+        {
+            return 0;
+        }
+        len = fread(buffer, 1, len, file->f);
+        if(len <= 0)
+        {
+            return 0;
+        }
+        *data = buffer;
+        return len;
+    }
+#else
+    if(file->data == NULL)
+    {
+        do
+        {
+            numread = pread(file->fd, buffer, len, offset);
+        }while(numread < 0 && errno == EINTR);
+        if(numread <= 0)
+        {
+            return 0;
+        }
+        *data = buffer;
+        return numread;
+    }
+    if(fstat(file->fd, &st) != 0 || st.st_size < offset + len)
+    {
+        Com_PrintWarning(CON_CHANNEL_FILES, "Download file %s changed on disk while it is being downloaded\n", file->qpath);
+        return 0;
+    }
+#endif
+    *data = file->data + offset;
+    return len;
+}
+
+/*
+Prints the files clients are downloading right now
+*/
+void FS_DownloadFileStats_f()
+{
+    fsDownloadFile_t *file;
+    int numfiles, mapped;
 
+    numfiles = 0;
+    mapped = 0;
+    for(file = fs_downloadFiles; file; file = file->next)
+    {
+        Com_Printf(CON_CHANNEL_DONT_FILTER, "%3d downloaders %8d KB %s%s\n", file->refcount, file->size / 1024, file->qpath, file->data ? "" : " (read per block)");
+        ++numfiles;
+        if(file->data)
+        {
+            mapped += file->size / 1024;
+        }
+    }
+    Com_Printf(CON_CHANNEL_DONT_FILTER, "%d files, %d KB mapped\n", numfiles, mapped);
 }
 
 
@@ -4942,8 +5472,56 @@ char *__cdecl FS_GetMapBaseName(const char *mapname)
   return basename;
 }
 
-//8kbyte buffer
-#define DEFAULT_LOGFILEBUFFER (1024*8)
+/*
+==============================================================================
+
+Logfile ring
+
+Every logfile owns a multi producer / single consumer ring. A producer
+reserves space by advancing reserveHead with a compare exchange, copies the
+message behind a record header and commits the record by setting the header
+to its length ored with LOGRING_COMMITTED. Producers never wait for each other.
+The LogfileWriter thread collects all committed records up to the first not
+yet committed one and writes them with a single writev(). The written
+space is cleared before tail is advanced, so a reserved header always
+reads as zero until it gets committed.
+fileHandleData_t::writebuffer of a logfile handle points to its ring.
+
+==============================================================================
+*/
+
+#define LOGRING_SIZE		(256 * 1024) //Has to be a power of two
+#define LOGRING_MASK		(LOGRING_SIZE - 1)
+#define LOGRING_HEADER		((int)sizeof(DWORD))
+#define LOGRING_COMMITTED	0x80000000
+#define LOGRING_MAXRECORD	(LOGRING_SIZE / 8) //Longer messages are split
+#define LOGRING_MAXIOV		64
+
+#define LOGRING_RECORDSIZE(len) (LOGRING_HEADER + (((len) + LOGRING_HEADER -1) & ~(LOGRING_HEADER -1)))
+
+typedef struct
+{
+	byte data[LOGRING_SIZE];
+	volatile DWORD reserveHead;
+	volatile DWORD tail;
+	volatile DWORD bytesQueued;
+	volatile DWORD bytesDropped;
+	volatile DWORD messagesDropped;
+	/* Only modified by the writer */
+	volatile DWORD bytesWritten;
+	volatile DWORD flushes;
+	volatile DWORD writeErrors;
+	volatile DWORD flushUSecTotal;
+	volatile DWORD flushUSecMax;
+}logRing_t;
+
+/* Gather list entry, turned into a struct iovec only where writev() exists */
+typedef struct
+{
+	const byte* base;
+	size_t len;
+}logRingSpan_t;
+
 
 void FS_CloseLogFile(fileHandle_t f)
 {
@@ -4959,7 +5537,10 @@ void FS_CloseLogFile(fileHandle_t f)
     FS_WriteLogFlush( f );
 
     Z_Free(fhd->writebuffer);
+
+    Sys_EnterCriticalSection(CRITSECT_FILESYSTEM);
     FS_FCloseFile( f );
+    Sys_LeaveCriticalSection(CRITSECT_FILESYSTEM);
 }
 
 
@@ -4985,66 +5566,167 @@ fileHandle_t FS_OpenLogfile(const char* name, char mode)
 	}
 	fhd = &fsh[logfile];
 
-	fhd->writebuffer = Z_Malloc(DEFAULT_LOGFILEBUFFER);
+	fhd->writebuffer = Z_Malloc(sizeof(logRing_t));
 	if(fhd->writebuffer == NULL)
 	{
 		FS_FCloseFile( logfile );
 		return 0;
 	}
-	fhd->bufferSize = DEFAULT_LOGFILEBUFFER;
+	Com_Memset(fhd->writebuffer, 0, sizeof(logRing_t));
+	fhd->bufferSize = LOGRING_SIZE;
 	fhd->bufferPos = 0;
 	fhd->rbufferPos = 0;
 	return logfile;
 }
 
+static qboolean FS_LogRingPut( logRing_t* ring, const byte* data, int len )
+{
+	DWORD head, tail, size, pos, first;
+
+	size = LOGRING_RECORDSIZE(len);
+
+	do
+	{
+		head = Sys_InterlockedExchangeAdd(&ring->reserveHead, 0);
+		tail = Sys_InterlockedExchangeAdd(&ring->tail, 0);
+		if(head - tail + size > LOGRING_SIZE)
+		{
+			return qfalse;
+		}
+	}while(Sys_InterlockedCompareExchange(&ring->reserveHead, head + size, head) != head);
+
+	pos = (head + LOGRING_HEADER) & LOGRING_MASK;
+	first = LOGRING_SIZE - pos;
+	if(first > len)
+	{
+		first = len;
+	}
+	Com_Memcpy(ring->data + pos, data, first);
+	Com_Memcpy(ring->data, data + first, len - first);
+
+	/* The interlocked add is a full barrier, the record is visible once the header is set */
+	Sys_InterlockedExchangeAdd((volatile DWORD*)(ring->data + (head & LOGRING_MASK)), LOGRING_COMMITTED | len);
+	return qtrue;
+}
+
+/*
+Returns the number of bytes which have been queued. Never blocks, the caller
+decides what happens with the rest once the ring is full
+*/
 int FS_WriteLog( const void *buffer, int ilen, fileHandle_t h )
 {
 	fileHandleData_t *fhd;
-	int remaining;
-	int writelen;
-	int i, len;
-	len = ilen;
+	logRing_t* ring;
+	const byte* data;
+	int chunk, len;
 
 	fhd = &fsh[h];
 	if(fhd->writebuffer == NULL)
 	{
 		Com_Error(ERR_FATAL, "attempted to use FS_WriteLog on a non logfile handle");
 	}
+	ring = (logRing_t*)fhd->writebuffer;
 
-	Sys_EnterCriticalSection(CRITSECT_LOGFILETHREAD);
-
-	if(fhd->bufferPos >= fhd->rbufferPos)
+	data = buffer;
+	len = ilen;
+	while(len > 0)
 	{
-	    remaining = DEFAULT_LOGFILEBUFFER - (fhd->bufferPos - fhd->rbufferPos) -1;
-	}else{
-	    remaining = (fhd->rbufferPos - fhd->bufferPos) -1;
+		chunk = len;
+		if(chunk > LOGRING_MAXRECORD)
+		{
+			chunk = LOGRING_MAXRECORD;
+		}
+		if(!FS_LogRingPut(ring, data, chunk))
+		{
+			break;
+		}
+		data += chunk;
+		len -= chunk;
 	}
+	Sys_InterlockedExchangeAdd(&ring->bytesQueued, ilen - len);
+	return ilen - len;
+}
 
-	writelen = len;
-	if(remaining < writelen)
+void FS_WriteLogDropped( int len, fileHandle_t h )
+{
+	logRing_t* ring = (logRing_t*)fsh[h].writebuffer;
+
+	if(ring == NULL)
 	{
-		writelen = remaining;
+		return;
 	}
-	int index;
-	for(i = 0; i < writelen; ++i)
+	Sys_InterlockedExchangeAdd(&ring->bytesDropped, len);
+	Sys_InterlockedIncrement(&ring->messagesDropped);
+}
+
+static qboolean FS_LogRingWrite( fileHandleData_t *fhd, const logRingSpan_t* span, int count )
+{
+#ifdef _WIN32
+	int i;
+
+	for(i = 0; i < count; ++i)
 	{
-		index = (fhd->bufferPos + i) % DEFAULT_LOGFILEBUFFER;
-		((char*)fhd->writebuffer)[index] = ((char*)buffer)[i];
+		if(fwrite(span[i].base, 1, span[i].len, fhd->handleFiles.file.o) != span[i].len)
+		{
+			return qfalse;
+		}
 	}
-	fhd->bufferPos = (fhd->bufferPos + i) % DEFAULT_LOGFILEBUFFER;
+	if ( fhd->handleSync ) {
+		fflush( fhd->handleFiles.file.o );
+	}
+	return qtrue;
+#else
+	struct iovec iovbuf[LOGRING_MAXIOV];
+	struct iovec* iov;
+	int fd, i;
+	ssize_t written;
 
-	Sys_LeaveCriticalSection(CRITSECT_LOGFILETHREAD);
+	for(i = 0; i < count; ++i)
+	{
+		iovbuf[i].iov_base = (void*)span[i].base;
+		iovbuf[i].iov_len = span[i].len;
+	}
+	iov = iovbuf;
 
-	return writelen;
+	/* Logfiles are only written here, so the stdio buffer of the FILE is always empty */
+	fd = fileno(fhd->handleFiles.file.o);
+	while(count > 0)
+	{
+		written = writev(fd, iov, count);
+		if(written < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return qfalse;
+		}
+		/* Partial write, skip what is done */
+		while(count > 0 && written >= (ssize_t)iov->iov_len)
+		{
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0)
+		{
+			iov->iov_base = (byte*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return qtrue;
+#endif
 }
 
-
 void FS_WriteLogFlush( fileHandle_t h ) //This function gets called from the logwrite thread and fileclose function
 {
 	fileHandleData_t *fhd;
-	int remaining;
-	int i;
-	char cpybuffer[DEFAULT_LOGFILEBUFFER];
+	logRing_t* ring;
+	logRingSpan_t span[LOGRING_MAXIOV];
+	DWORD tail, end, header, len, pos, first, bytes;
+	unsigned long long start;
+	DWORD usec;
+	int count;
 
 	if(h < 1)
 	{
@@ -5054,50 +5736,106 @@ void FS_WriteLogFlush( fileHandle_t h ) //This function gets called from the log
 	fhd = &fsh[h];
 	if(fhd->writebuffer == NULL)
 	{
-		Com_Error(ERR_FATAL, "attempted to use FS_WriteLogFlush on a non logfile handle");
-	}
-
-	Sys_EnterCriticalSection(CRITSECT_LOGFILETHREAD);
-
-	if(fhd->bufferPos == fhd->rbufferPos)
-	{
-		Sys_LeaveCriticalSection(CRITSECT_LOGFILETHREAD);
+		Sys_Print("FS_WriteLogFlush: attempted to flush a non logfile handle\n");
 		return;
 	}
+	ring = (logRing_t*)fhd->writebuffer;
 
-	if(fhd->bufferPos >= fhd->rbufferPos)
+	while(qtrue)
 	{
-	    remaining = (fhd->bufferPos - fhd->rbufferPos);
-	}else{
-	    remaining = DEFAULT_LOGFILEBUFFER - (fhd->rbufferPos - fhd->bufferPos);
-	}
+		tail = ring->tail;
+		end = tail;
+		count = 0;
+		bytes = 0;
+
+		/* Gather committed records in order */
+		while(count < LOGRING_MAXIOV -1)
+		{
+			header = Sys_InterlockedExchangeAdd((volatile DWORD*)(ring->data + (end & LOGRING_MASK)), 0);
+			if(!(header & LOGRING_COMMITTED))
+			{
+				break;
+			}
+			len = header & ~LOGRING_COMMITTED;
+			pos = (end + LOGRING_HEADER) & LOGRING_MASK;
+			first = LOGRING_SIZE - pos;
+			if(first > len)
+			{
+				first = len;
+			}
+			span[count].base = ring->data + pos;
+			span[count].len = first;
+			count++;
+			if(len > first)
+			{
+				span[count].base = ring->data;
+				span[count].len = len - first;
+				count++;
+			}
+			bytes += len;
+			end += LOGRING_RECORDSIZE(len);
+		}
 
-	assert(remaining <= DEFAULT_LOGFILEBUFFER);
+		if(end == tail)
+		{
+			return;
+		}
 
-	for(i = 0; i < remaining; ++i)
-	{
-	    ((char*)cpybuffer)[i] = ((char*)fhd->writebuffer)[(fhd->rbufferPos + i) % DEFAULT_LOGFILEBUFFER];
-	}
-	fhd->rbufferPos = fhd->bufferPos;
+		start = Sys_Microseconds();
+		if(!FS_LogRingWrite(fhd, span, count))
+		{
+			ring->writeErrors++;
+		}
+		usec = Sys_Microseconds() - start;
 
-	Sys_LeaveCriticalSection(CRITSECT_LOGFILETHREAD);
+		ring->bytesWritten += bytes;
+		ring->flushes++;
+		ring->flushUSecTotal += usec;
+		if(usec > ring->flushUSecMax)
+		{
+			ring->flushUSecMax = usec;
+		}
 
-	int written = fwrite (cpybuffer, 1, remaining, fhd->handleFiles.file.o);
-	if (written == 0) {
-		Sys_Print("FS_WriteLogFlush: 0 bytes written\n" );
-		return;
+		/* Any position can become a record header later. The space has to read as
+		   zero before it is handed back to the producers */
+		pos = tail & LOGRING_MASK;
+		len = end - tail;
+		first = LOGRING_SIZE - pos;
+		if(first > len)
+		{
+			first = len;
+		}
+		Com_Memset(ring->data + pos, 0, first);
+		Com_Memset(ring->data, 0, len - first);
+		Sys_InterlockedExchangeAdd(&ring->tail, end - tail);
 	}
+}
 
-	if (written == -1) {
-		Sys_Print("FS_WriteLogFlush: -1 bytes written\n" );
-		return;
-	}
-	if ( fhd->handleSync ) {
-		fflush( fhd->handleFiles.file.o );
+qboolean FS_GetLogfileStats( fileHandle_t h, logfileStats_t* stats )
+{
+	logRing_t* ring;
+
+	if(h < 1 || fsh[h].writebuffer == NULL)
+	{
+		return qfalse;
 	}
+	ring = (logRing_t*)fsh[h].writebuffer;
 
+	Q_strncpyz(stats->name, fsh[h].name, sizeof(stats->name));
+	stats->bufferSize = LOGRING_SIZE;
+	stats->bytesPending = ring->reserveHead - ring->tail;
+	stats->bytesQueued = ring->bytesQueued;
+	stats->bytesWritten = ring->bytesWritten;
+	stats->bytesDropped = ring->bytesDropped;
+	stats->messagesDropped = ring->messagesDropped;
+	stats->flushes = ring->flushes;
+	stats->writeErrors = ring->writeErrors;
+	stats->flushUSecMax = ring->flushUSecMax;
+	stats->flushUSecAvg = ring->flushes ? ring->flushUSecTotal / ring->flushes : 0;
+	return qtrue;
 }
 
+
 //Parse all zip files for files inside a directory, path must be with forward slash only
 //must Z_Free return value, result will go invalid on FS_Restart
 //On fail return value is NULL
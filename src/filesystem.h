@@ -150,6 +150,7 @@ extern "C"{
 void FS_CopyFile(char* FromOSPath,char* ToOSPath);
 int FS_Read(void* data, int length, fileHandle_t);
 long FS_FOpenFileRead(const char* filename, fileHandle_t* returnhandle);
+long FS_HashFileName( const char *fname, int hashSize );
 long FS_FOpenFileReadThread1(const char* filename, fileHandle_t* returnhandle);
 long FS_FOpenFileReadThread2(const char* filename, fileHandle_t* returnhandle);
 fileHandle_t FS_FOpenFileWrite(const char* filename);
@@ -238,7 +239,13 @@ void FS_StripSeperators(char* path);
 void FS_StripTrailingSeperator( char *path );
 void FS_ReplaceSeparators( char *path );
 int FS_CalculateChecksumForFile(const char* filename, int *crc32);
+void FS_PrecomputeChecksums(const char** filenames, int count, int numThreads);
 int FS_WriteChecksumInfo(const char* filename, byte* data, int maxsize);
+typedef struct fsDownloadFile_s fsDownloadFile_t;
+fsDownloadFile_t* FS_OpenDownloadFile(const char* qpath, int *size);
+void FS_CloseDownloadFile(fsDownloadFile_t *file);
+int FS_GetDownloadFileBlock(fsDownloadFile_t *file, int offset, int len, byte *buffer, const byte **data);
+void FS_DownloadFileStats_f();
 int FS_WriteFileOSPath( char *ospath, const void *buffer, int size );
 void FS_ClearPakReferences( int flags );
 int FS_filelengthForOSPath( const char* ospath );
@@ -253,10 +260,29 @@ void __cdecl FS_FileClose(FILE *stream);
 qboolean SEH_GetLanguageIndexForName(const char* language, int *langindex);
 const char* SEH_GetLanguageName(unsigned int langindex);
 int SEH_GetCurrentLanguage( );
+
+typedef struct
+{
+	char name[MAX_ZPATH];
+	unsigned int bufferSize;
+	unsigned int bytesPending;
+	unsigned int bytesQueued;
+	unsigned int bytesWritten;
+	unsigned int bytesDropped;
+	unsigned int messagesDropped;
+	unsigned int flushes;
+	unsigned int writeErrors;
+	unsigned int flushUSecAvg;
+	unsigned int flushUSecMax;
+}logfileStats_t;
+
 void FS_CloseLogFile(fileHandle_t f);
 fileHandle_t FS_OpenLogfile(const char* name, char mode);
 void FS_WriteLogFlush(fileHandle_t f);
+/* Queues as much as fits into the ring of the logfile and returns the number of bytes queued */
 int FS_WriteLog( const void *buffer, int ilen, fileHandle_t h );
+void FS_WriteLogDropped( int len, fileHandle_t h );
+qboolean FS_GetLogfileStats( fileHandle_t h, logfileStats_t* stats );
 
 const char** FS_ListFilesInPackDirectory(const char* path);
 
@@ -29,32 +29,30 @@
  * Compression book.  The ranks are not actually stored, but implicitly defined
  * by the location of a node within a doubly-linked list */
 
-static int bloc = 0;
-
 /* Add a bit to the output file (buffered) */
-static void add_bit( char bit, byte *fout ) {
-	if ( ( bloc & 7 ) == 0 ) {
-		fout[( bloc >> 3 )] = 0;
+static void add_bit( char bit, byte *fout, int *bloc ) {
+	if ( ( *bloc & 7 ) == 0 ) {
+		fout[( *bloc >> 3 )] = 0;
 	}
-	fout[( bloc >> 3 )] |= bit << ( bloc & 7 );
-	bloc++;
+	fout[( *bloc >> 3 )] |= bit << ( *bloc & 7 );
+	(*bloc)++;
 }
 
 /* Receive one bit from the input file (buffered) */
-static int get_bit( byte *fin ) {
+static int get_bit( const byte *fin, int *bloc ) {
 	int t;
-	t = ( fin[( bloc >> 3 )] >> ( bloc & 7 ) ) & 0x1;
-	bloc++;
+	t = ( fin[( *bloc >> 3 )] >> ( *bloc & 7 ) ) & 0x1;
+	(*bloc)++;
 	return t;
 }
 
 /* Get a symbol */
 
-static void Huff_offsetReceive( node_t *node, int *ch, byte *fin, int *offset ) {
-	bloc = *offset;
+static void Huff_offsetReceive( node_t *node, int *ch, const byte *fin, int *offset ) {
+	int bloc = *offset;
 	while ( node && node->symbol == INTERNAL_NODE ) {
 
-		if ( get_bit( fin ) ) {
+		if ( get_bit( fin, &bloc ) ) {
 			node = node->right;
 
 		} else {
@@ -75,23 +73,21 @@ static void Huff_offsetReceive( node_t *node, int *ch, byte *fin, int *offset )
 
 
 /* Send the prefix code for this node */
-static void Huff_send( node_t *node, node_t *child, byte *fout ) {
+static void Huff_send( node_t *node, node_t *child, byte *fout, int *bloc ) {
 	if ( node->parent ) {
-		Huff_send( node->parent, node, fout );
+		Huff_send( node->parent, node, fout, bloc );
 	}
 	if ( child ) {
 		if ( node->right == child ) {
-			add_bit( 1, fout );
+			add_bit( 1, fout, bloc );
 		} else {
-			add_bit( 0, fout );
+			add_bit( 0, fout, bloc );
 		}
 	}
 }
 
 static void Huff_offsetTransmit( huff_t *huff, int ch, byte *fout, int *offset ) {
-	bloc = *offset;
-	Huff_send( huff->loc[ch], NULL, fout );
-	*offset = bloc;
+	Huff_send( huff->loc[ch], NULL, fout, offset );
 }
 
 
@@ -374,8 +370,13 @@ int msg_hData[256] = {
 };
 
 static huff_t		msgHuff;
+static huffTable_t	msgHuffTable;
 
-int MSG_ReadBitsCompress(const byte* input, int readsize, byte* outputBuf, int outputBufSize){
+/*
+Reference implementation which walks the tree one bit at a time.
+Kept for verification and benchmarking of the table driven codec.
+*/
+int MSG_ReadBitsCompressTree(const byte* input, int readsize, byte* outputBuf, int outputBufSize){
 
     readsize = readsize * 8;
     byte *outptr = outputBuf;
@@ -389,14 +390,14 @@ int MSG_ReadBitsCompress(const byte* input, int readsize, byte* outputBuf, int o
     }
 
     for(offset = 0, i = 0; offset < readsize && i < outputBufSize; i++){
-        Huff_offsetReceive( msgHuff.tree, &get, (byte*)input, &offset);
+        Huff_offsetReceive( msgHuff.tree, &get, input, &offset);
         *outptr = (byte)get;
         outptr++;
     }
     return i;
 }
 
-int MSG_WriteBitsCompress( const byte *datasrc, byte *buffdest, int bytecount){
+int MSG_WriteBitsCompressTree( const byte *datasrc, byte *buffdest, int bytecount){
 
     int offset;
     int i;
@@ -411,6 +412,138 @@ int MSG_WriteBitsCompress( const byte *datasrc, byte *buffdest, int bytecount){
     return (offset + 7) / 8;
 }
 
+/*
+Decodes up to HUFF_DECODE_BITS bits per table lookup. As long as 3 whole input bytes
+are left we can peek without touching memory outside of the input buffer. The tail and
+codes which do not fit into the table are decoded by walking the tree so the result
+stays identical to MSG_ReadBitsCompressTree()
+*/
+int MSG_ReadBitsCompress(const byte* input, int readsize, byte* outputBuf, int outputBufSize){
+
+    const huffTable_t *table = &msgHuffTable;
+    unsigned int peek;
+    unsigned int index;
+    int get;
+    int offset;
+    int fastsize;
+    int i;
+
+    readsize = readsize * 8;
+
+    if(readsize <= 0){
+        return 0;
+    }
+
+    fastsize = readsize - 24;
+
+    for(offset = 0, i = 0; offset < readsize && i < outputBufSize; i++){
+
+        if(offset <= fastsize)
+        {
+            const byte *p = input + (offset >> 3);
+            peek = (p[0] | (p[1] << 8) | (p[2] << 16)) >> (offset & 7);
+            index = peek & ((1 << HUFF_DECODE_BITS) -1);
+            if(table->decodeLen[index])
+            {
+                outputBuf[i] = (byte)table->decodeSym[index];
+                offset += table->decodeLen[index];
+                continue;
+            }
+        }
+        Huff_offsetReceive( msgHuff.tree, &get, input, &offset);
+        outputBuf[i] = (byte)get;
+    }
+    return i;
+}
+
+/*
+Emits whole codes into a 64 bit accumulator and flushes complete bytes.
+The last partial byte gets its unused high bits cleared like add_bit() does.
+*/
+int MSG_WriteBitsCompress( const byte *datasrc, byte *buffdest, int bytecount){
+
+    const huffTable_t *table = &msgHuffTable;
+    unsigned long long acc;
+    int numbits;
+    int i;
+    byte *outptr = buffdest;
+
+    if(bytecount <= 0){
+        return 0;
+    }
+
+    for(acc = 0, numbits = 0, i = 0; i < bytecount; i++){
+        acc |= (unsigned long long)table->code[datasrc[i]] << numbits;
+        numbits += table->codeLen[datasrc[i]];
+        while(numbits >= 8)
+        {
+            *outptr = (byte)acc;
+            outptr++;
+            acc >>= 8;
+            numbits -= 8;
+        }
+    }
+    if(numbits > 0)
+    {
+        *outptr = (byte)acc;
+        outptr++;
+    }
+    return outptr - buffdest;
+}
+
+/*
+Flattens the static tree into the encode and decode tables.
+*/
+static void Huff_BuildTables(const huff_t* huff, huffTable_t* table)
+{
+    const node_t *node;
+    unsigned int code;
+    int len, depth, i, sym;
+
+    Com_Memset(table, 0, sizeof(huffTable_t));
+
+    for(sym = 0; sym < HMAX; ++sym)
+    {
+        node = huff->loc[sym];
+        if(node == NULL)
+        {
+            continue;
+        }
+        for(len = 0, code = 0; node->parent; node = node->parent, ++len)
+        {
+            code <<= 1;
+            if(node->parent->right == node)
+            {
+                code |= 1;
+            }
+        }
+        /* Shifting while walking up leaves the root edge in bit 0 which gets sent first */
+        table->code[sym] = code;
+        table->codeLen[sym] = len;
+    }
+
+    for(i = 0; i < (1 << HUFF_DECODE_BITS); ++i)
+    {
+        node = huff->tree;
+        for(depth = 0; node && node->symbol == INTERNAL_NODE && depth < HUFF_DECODE_BITS; ++depth)
+        {
+            if(i & (1 << depth))
+            {
+                node = node->right;
+            }else{
+                node = node->left;
+            }
+        }
+        if(node == NULL || node->symbol == INTERNAL_NODE || depth == 0)
+        {
+            /* Handled by the tree walk */
+            continue;
+        }
+        table->decodeSym[i] = node->symbol;
+        table->decodeLen[i] = depth;
+    }
+}
+
 
 static void Huff_BuildFromData(huff_t* huff, const int* msg_hData)
 {
@@ -2739,4 +2872,5 @@ void Huffman_InitMain() {
 	huffInit = qtrue;
 	Huff_Init(&msgHuff);
 	Huff_BuildFromData(&msgHuff, msg_hData);
+	Huff_BuildTables(&msgHuff, &msgHuffTable);
 }
@@ -56,8 +56,20 @@ typedef struct {
 } huff_t;
 /* size 19476*/
 
+/* Longest code of the static msg tree is 11 bits so a single lookup decodes every symbol */
+#define HUFF_DECODE_BITS 11
+
+typedef struct {
+	unsigned int code[HMAX];        /* bit order as on the wire, first bit is bit 0 */
+	byte codeLen[HMAX];
+	short decodeSym[1 << HUFF_DECODE_BITS];
+	byte decodeLen[1 << HUFF_DECODE_BITS];   /* 0 = fall back to walking the tree */
+} huffTable_t;
+
 int MSG_ReadBitsCompress(const byte* input, int readsize, byte* outputBuf, int outputBufsize);
 int MSG_WriteBitsCompress( const byte *datasrc, byte *buffdest, int bytecount);
+int MSG_ReadBitsCompressTree(const byte* input, int readsize, byte* outputBuf, int outputBufsize);
+int MSG_WriteBitsCompressTree( const byte *datasrc, byte *buffdest, int bytecount);
 void Huffman_InitMain();
 
 #endif
@@ -0,0 +1,613 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm
+
+    This file is part of CoD4X18-Server source code.
+
+    CoD4X18-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X18-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+#include "q_shared.h"
+#include "qcommon_io.h"
+#include "filesystem.h"
+#include "sys_main.h"
+#include "sys_thread.h"
+#include "varstorage.h"
+#include "kvstore.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+==============================================================================
+
+Persistent key value store
+
+Script and plugin facing store on top of varstorage. Lookups and updates only
+touch the in-memory hashtable of the game thread, never the disk.
+Every update appends one line in the varstorage file format to the journal
+(kvstore.journal), removed keys are journaled as \del\1\name\<key>\.
+The "KVStoreWriter" thread writes the journal in the background.
+Once the journal has grown larger than the snapshot (kvstore.dat) the store is
+compacted: the game thread serializes the hashtable, the writer thread
+replaces the snapshot with it and truncates the journal. Records are written
+strictly in order, so a snapshot contains every journal line queued before it.
+Loading reads the snapshot and replays the journal on top of it.
+
+==============================================================================
+*/
+
+#define KVS_SNAPSHOT_FILE	"kvstore.dat"
+#define KVS_JOURNAL_FILE	"kvstore.journal"
+#define KVS_COMPACT_MINSIZE	(1024 * 1024) //Smaller journals are never compacted
+#define KVS_MAX_QUEUEDBYTES	(32 * 1024 * 1024) //Journal lines are dropped beyond this until the writer catches up
+
+typedef enum
+{
+	KVS_RECORD_JOURNAL,
+	KVS_RECORD_SNAPSHOT
+}kvsRecordType_t;
+
+typedef struct kvsRecord_s
+{
+	struct kvsRecord_s* next;
+	kvsRecordType_t type;
+	int len;
+	char* data;
+}kvsRecord_t;
+
+static struct
+{
+	varStorage_t store;
+	qboolean loaded;
+
+	/* Queue of records for the writer thread, protected by CRITSECT_KVSTORE */
+	kvsRecord_t* queueHead;
+	kvsRecord_t* queueTail;
+	volatile DWORD queuedBytes;
+	volatile DWORD pendingRecords;
+	volatile DWORD writeErrors;
+
+	HANDLE wakeEvent;
+	threadid_t threadid;
+	qboolean started;
+	char snapshotPath[MAX_OSPATH];
+	char journalPath[MAX_OSPATH];
+	FILE* journal; //Writer thread only
+
+	/* Game thread only */
+	int journalBytes;
+	int snapshotBytes;
+	qboolean journalLost;
+	unsigned int gets;
+	unsigned int misses;
+	unsigned int sets;
+	unsigned int removes;
+	unsigned int compactions;
+	unsigned int droppedRecords;
+}kvs;
+
+
+static qboolean KVS_WriteJournal( kvsRecord_t* record )
+{
+	if(kvs.journal == NULL)
+	{
+		kvs.journal = fopen(kvs.journalPath, "ab");
+		if(kvs.journal == NULL)
+		{
+			return qfalse;
+		}
+	}
+	return fwrite(record->data, 1, record->len, kvs.journal) == (size_t)record->len;
+}
+
+/* Writes data to a temporary file which then replaces path */
+static qboolean KVS_ReplaceFile( const char* path, const void* data, int len )
+{
+	char tmppath[MAX_OSPATH];
+	FILE* f;
+	size_t written;
+
+	Q_strncpyz(tmppath, path, sizeof(tmppath));
+	Q_strncat(tmppath, sizeof(tmppath), ".tmp");
+
+	f = fopen(tmppath, "wb");
+	if(f == NULL)
+	{
+		return qfalse;
+	}
+	written = fwrite(data, 1, len, f);
+	if(fclose(f) != 0 || written != (size_t)len)
+	{
+		remove(tmppath);
+		return qfalse;
+	}
+	if(rename(tmppath, path) != 0)
+	{
+		/* Windows does not replace existing files */
+		remove(path);
+		if(rename(tmppath, path) != 0)
+		{
+			return qfalse;
+		}
+	}
+	return qtrue;
+}
+
+static qboolean KVS_WriteSnapshot( kvsRecord_t* record )
+{
+	FILE* f;
+
+	if(!KVS_ReplaceFile(kvs.snapshotPath, record->data, record->len))
+	{
+		return qfalse;
+	}
+
+	/* Everything in the journal is part of the snapshot now */
+	if(kvs.journal)
+	{
+		fclose(kvs.journal);
+		kvs.journal = NULL;
+	}
+	f = fopen(kvs.journalPath, "wb");
+	if(f == NULL)
+	{
+		return qfalse;
+	}
+	fclose(f);
+	return qtrue;
+}
+
+static qboolean KVS_WriteRecord( kvsRecord_t* record )
+{
+	if(record->type == KVS_RECORD_SNAPSHOT)
+	{
+		return KVS_WriteSnapshot(record);
+	}
+	return KVS_WriteJournal(record);
+}
+
+static void KVS_FreeRecord( kvsRecord_t* record )
+{
+	free(record->data);
+	free(record);
+}
+
+void* KVS_WriterThread(void* null)
+{
+	kvsRecord_t *record, *next;
+	DWORD bytes, count;
+
+	while(qtrue)
+	{
+		Sys_WaitForObject(kvs.wakeEvent);
+		Sys_ResetEvent(kvs.wakeEvent);
+
+		Sys_EnterCriticalSection(CRITSECT_KVSTORE);
+		record = kvs.queueHead;
+		kvs.queueHead = kvs.queueTail = NULL;
+		Sys_LeaveCriticalSection(CRITSECT_KVSTORE);
+
+		for(bytes = 0, count = 0; record; record = next)
+		{
+			next = record->next;
+			if(!KVS_WriteRecord(record))
+			{
+				Sys_InterlockedIncrement(&kvs.writeErrors);
+			}
+			bytes += record->len;
+			count++;
+			KVS_FreeRecord(record);
+		}
+		if(kvs.journal && fflush(kvs.journal) != 0)
+		{
+			Sys_InterlockedIncrement(&kvs.writeErrors);
+		}
+		Sys_InterlockedExchangeAdd(&kvs.queuedBytes, -bytes);
+		Sys_InterlockedExchangeAdd(&kvs.pendingRecords, -count);
+	}
+	return NULL;
+}
+
+static void KVS_StartWriter( )
+{
+	if(kvs.started)
+	{
+		return;
+	}
+	kvs.wakeEvent = Sys_CreateEvent(qtrue, qfalse, "wakekvstorewriter");
+	if(Sys_CreateNewThread(KVS_WriterThread, &kvs.threadid, NULL) == qfalse)
+	{
+		Com_PrintWarning(CON_CHANNEL_SCRIPT, "Couldn't create the key value store writer thread. Writing synchronously\n");
+		return;
+	}
+	Sys_SetThreadName(kvs.threadid, "KVStoreWriter");
+	kvs.started = qtrue;
+}
+
+/* Takes ownership of data which has to be allocated with malloc */
+static void KVS_QueueRecord( kvsRecordType_t type, char* data, int len )
+{
+	kvsRecord_t* record;
+
+	record = malloc(sizeof(kvsRecord_t));
+	if(record == NULL)
+	{
+		free(data);
+		kvs.droppedRecords++;
+		kvs.journalLost = qtrue;
+		return;
+	}
+	record->next = NULL;
+	record->type = type;
+	record->data = data;
+	record->len = len;
+
+	if(!kvs.started)
+	{
+		if(!KVS_WriteRecord(record))
+		{
+			kvs.writeErrors++;
+		}
+		KVS_FreeRecord(record);
+		return;
+	}
+
+	Sys_InterlockedExchangeAdd(&kvs.queuedBytes, len);
+	Sys_InterlockedIncrement(&kvs.pendingRecords);
+
+	Sys_EnterCriticalSection(CRITSECT_KVSTORE);
+	if(kvs.queueTail)
+	{
+		kvs.queueTail->next = record;
+	}else{
+		kvs.queueHead = record;
+	}
+	kvs.queueTail = record;
+	Sys_LeaveCriticalSection(CRITSECT_KVSTORE);
+
+	Sys_SetEvent(kvs.wakeEvent);
+}
+
+static void KVS_WaitForWriter( )
+{
+	int msec;
+
+	if(!kvs.started)
+	{
+		return;
+	}
+	for(msec = 0; msec < 10000; msec++)
+	{
+		if(Sys_InterlockedExchangeAdd(&kvs.pendingRecords, 0) == 0)
+		{
+			return;
+		}
+		Sys_SetEvent(kvs.wakeEvent);
+		Sys_SleepUSec(1000);
+	}
+	Com_PrintWarning(CON_CHANNEL_SCRIPT, "Timed out waiting for the key value store writer thread\n");
+}
+
+/*
+=================
+KVS_RepairJournal
+
+A crash can leave the last line of the journal cut off. It gets dropped before
+the journal is replayed, otherwise it would be loaded half and the next line
+appended to it
+=================
+*/
+static void KVS_RepairJournal( )
+{
+	FILE* f;
+	char* data;
+	long len, keep;
+
+	f = fopen(kvs.journalPath, "rb");
+	if(f == NULL)
+	{
+		return;
+	}
+	if(fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) <= 0 || fseek(f, 0, SEEK_SET) != 0)
+	{
+		fclose(f);
+		return;
+	}
+	data = malloc(len);
+	if(data == NULL || fread(data, 1, len, f) != (size_t)len)
+	{
+		Com_PrintError(CON_CHANNEL_SCRIPT, "KVS_Load: Couldn't read %s\n", kvs.journalPath);
+		free(data);
+		fclose(f);
+		return;
+	}
+	fclose(f);
+
+	for(keep = len; keep > 0 && data[keep -1] != '\n'; keep--);
+
+	if(keep < len)
+	{
+		Com_PrintWarning(CON_CHANNEL_SCRIPT, "KVS_Load: Dropping incomplete last line of %s (%ld bytes)\n", KVS_JOURNAL_FILE, len - keep);
+		if(!KVS_ReplaceFile(kvs.journalPath, data, keep))
+		{
+			Com_PrintError(CON_CHANNEL_SCRIPT, "KVS_Load: Couldn't truncate %s\n", kvs.journalPath);
+		}
+	}
+	free(data);
+}
+
+static qboolean KVS_Load( )
+{
+	fileHandle_t f;
+	int len;
+
+	if(kvs.loaded)
+	{
+		return qtrue;
+	}
+
+	if(HStorage_InitObject(&kvs.store, 0) == qfalse)
+	{
+		Com_PrintError(CON_CHANNEL_SCRIPT, "KVS_Load: Out of memory\n");
+		return qfalse;
+	}
+
+	FS_BuildOSPathForThread(fs_homepath->string, KVS_SNAPSHOT_FILE, "", kvs.snapshotPath, 0);
+	FS_StripTrailingSeperator(kvs.snapshotPath);
+	FS_BuildOSPathForThread(fs_homepath->string, KVS_JOURNAL_FILE, "", kvs.journalPath, 0);
+	FS_StripTrailingSeperator(kvs.journalPath);
+
+	KVS_RepairJournal();
+
+	HStorage_LoadDataFromFile(&kvs.store, KVS_SNAPSHOT_FILE);
+	HStorage_LoadDataFromFile(&kvs.store, KVS_JOURNAL_FILE);
+
+	kvs.snapshotBytes = 0;
+	len = FS_SV_FOpenFileRead(KVS_SNAPSHOT_FILE, &f);
+	if(f)
+	{
+		kvs.snapshotBytes = len;
+		FS_FCloseFile(f);
+	}
+	kvs.journalBytes = 0;
+	len = FS_SV_FOpenFileRead(KVS_JOURNAL_FILE, &f);
+	if(f)
+	{
+		kvs.journalBytes = len;
+		FS_FCloseFile(f);
+	}
+
+	kvs.loaded = qtrue;
+	kvs.journalLost = qfalse;
+
+	KVS_StartWriter();
+
+	/* Fold the replayed journal into a fresh snapshot */
+	if(kvs.journalBytes > 0)
+	{
+		KVS_Compact();
+	}
+	return qtrue;
+}
+
+void KVS_Init( )
+{
+	KVS_Load();
+}
+
+void KVS_Shutdown( )
+{
+	if(!kvs.loaded)
+	{
+		return;
+	}
+	if(kvs.journalBytes > 0 || kvs.journalLost)
+	{
+		KVS_Compact();
+	}
+	KVS_WaitForWriter();
+	HStorage_FreeObject(&kvs.store);
+	kvs.loaded = qfalse;
+}
+
+/*
+=================
+KVS_Compact
+
+Reclaims the memory of overwritten and removed keys and replaces the snapshot
+on disk with the current content of the store
+=================
+*/
+void KVS_Compact( )
+{
+	char* buffer;
+	int len;
+
+	if(!KVS_Load())
+	{
+		return;
+	}
+
+	HStorage_Compact(&kvs.store);
+
+	buffer = HStorage_WriteDataToMemory(&kvs.store, &len);
+	if(buffer == NULL)
+	{
+		Com_PrintError(CON_CHANNEL_SCRIPT, "KVS_Compact: %s\n", HStorage_GetLastError(&kvs.store));
+		return;
+	}
+	KVS_QueueRecord(KVS_RECORD_SNAPSHOT, buffer, len);
+
+	kvs.snapshotBytes = len;
+	kvs.journalBytes = 0;
+	kvs.journalLost = qfalse;
+	kvs.compactions++;
+}
+
+static void KVS_Journal( const char* line, int len )
+{
+	char* data;
+
+	if(Sys_InterlockedExchangeAdd(&kvs.queuedBytes, 0) > KVS_MAX_QUEUEDBYTES)
+	{
+		/* The writer can not keep up. The next compaction restores the lost lines */
+		kvs.journalLost = qtrue;
+		kvs.droppedRecords++;
+		return;
+	}
+	if(kvs.journalLost)
+	{
+		/* The snapshot already contains this update */
+		KVS_Compact();
+		return;
+	}
+
+	data = malloc(len);
+	if(data == NULL)
+	{
+		kvs.journalLost = qtrue;
+		kvs.droppedRecords++;
+		return;
+	}
+	memcpy(data, line, len);
+	KVS_QueueRecord(KVS_RECORD_JOURNAL, data, len);
+
+	kvs.journalBytes += len;
+	if(kvs.journalBytes > KVS_COMPACT_MINSIZE && kvs.journalBytes > kvs.snapshotBytes)
+	{
+		KVS_Compact();
+	}
+}
+
+/*
+Keys end up in infostrings and are limited to MAX_VARNAME -1 characters
+*/
+qboolean KVS_ValidKey( const char* key )
+{
+	int i;
+
+	for(i = 0; key[i]; i++)
+	{
+		if(i >= MAX_VARNAME -1)
+		{
+			return qfalse;
+		}
+		if((unsigned char)key[i] < ' ' || key[i] == '\\' || key[i] == ';' || key[i] == '\"')
+		{
+			return qfalse;
+		}
+	}
+	return i > 0;
+}
+
+qboolean KVS_Set( const char* key, varType_t type, vsValue_t* value )
+{
+	char line[BIG_INFO_STRING];
+	int len;
+
+	if(!KVS_ValidKey(key))
+	{
+		return qfalse;
+	}
+	if(type == VSVAR_STRING && strlen(value->string) >= KVS_MAX_STRINGLEN)
+	{
+		return qfalse;
+	}
+	if(!KVS_Load())
+	{
+		return qfalse;
+	}
+
+	if(!HStorage_BeginData(&kvs.store, type, key) || !HStorage_AddData(&kvs.store, value) || !HStorage_EndData(&kvs.store))
+	{
+		Com_PrintError(CON_CHANNEL_SCRIPT, "KVS_Set: %s\n", HStorage_GetLastError(&kvs.store));
+		return qfalse;
+	}
+	kvs.sets++;
+
+	len = HStorage_EntryToInfoString(&kvs.store, key, line, sizeof(line));
+	if(len > 0)
+	{
+		KVS_Journal(line, len);
+	}
+	return qtrue;
+}
+
+varType_t KVS_Get( const char* key, vsValue_t* value )
+{
+	char name[MAX_VARNAME];
+	varType_t type;
+
+	if(!KVS_ValidKey(key) || !KVS_Load())
+	{
+		return VSVAR_BAD;
+	}
+	kvs.gets++;
+
+	Q_strncpyz(name, key, sizeof(name));
+	if(HStorage_GetBeginData(&kvs.store, name, &type) < 1 || HStorage_GetData(&kvs.store, value) == 0)
+	{
+		kvs.misses++;
+		return VSVAR_BAD;
+	}
+	return type;
+}
+
+qboolean KVS_Remove( const char* key )
+{
+	char line[2 * MAX_VARNAME];
+	int len;
+
+	if(!KVS_ValidKey(key) || !KVS_Load())
+	{
+		return qfalse;
+	}
+	if(HStorage_RemoveData(&kvs.store, key) == qfalse)
+	{
+		return qfalse;
+	}
+	kvs.removes++;
+
+	len = Com_sprintf(line, sizeof(line), "\\name\\%s\\del\\1\\\n", key);
+	KVS_Journal(line, len);
+	return qtrue;
+}
+
+void KVS_Stats_f( )
+{
+	vsStats_t stats;
+
+	if(!KVS_Load())
+	{
+		return;
+	}
+	HStorage_GetStats(&kvs.store, &stats);
+
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "Key value store: %d keys, %d hashtable fields, %d/%d units used, %d garbage units, %d relocations\n",
+		stats.numEntries, stats.numTableFields, stats.usedUnits, stats.totalUnits, stats.garbageUnits, kvs.store.relocationCount);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "%u gets (%u misses), %u sets, %u removes\n", kvs.gets, kvs.misses, kvs.sets, kvs.removes);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "Journal: %d bytes, snapshot: %d bytes, %u compactions, %u records queued (%u bytes), %u dropped, %u write errors\n",
+		kvs.journalBytes, kvs.snapshotBytes, kvs.compactions, (unsigned int)kvs.pendingRecords, (unsigned int)kvs.queuedBytes,
+		kvs.droppedRecords, (unsigned int)kvs.writeErrors);
+}
+
+void KVS_Compact_f( )
+{
+	KVS_Compact();
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "Key value store compacted, %d bytes queued for the snapshot\n", kvs.snapshotBytes);
+}
@@ -0,0 +1,43 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm
+
+    This file is part of CoD4X18-Server source code.
+
+    CoD4X18-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X18-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+#ifndef __KVSTORE_H__
+#define __KVSTORE_H__
+
+#include "q_shared.h"
+#include "varstorage.h"
+
+#define KVS_MAX_STRINGLEN 256
+
+void KVS_Init( void );
+void KVS_Shutdown( void );
+
+qboolean KVS_ValidKey( const char* key );
+qboolean KVS_Set( const char* key, varType_t type, vsValue_t* value );
+/* Returns VSVAR_BAD if the key does not exist. A string stays valid until the next KVS_Set / KVS_Remove */
+varType_t KVS_Get( const char* key, vsValue_t* value );
+qboolean KVS_Remove( const char* key );
+void KVS_Compact( void );
+
+void KVS_Stats_f( void );
+void KVS_Compact_f( void );
+
+#endif
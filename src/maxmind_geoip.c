@@ -23,7 +23,10 @@
 
 
 #include "qcommon_io.h"
+#include "qcommon_mem.h"
 #include "filesystem.h"
+#include "maxmind_geoip.h"
+#include <string.h>
 
 
 #define SEGMENT_RECORD_LENGTH 3
@@ -50,91 +53,198 @@
 
 #define RECORD_LENGTH STANDARD_RECORD_LENGTH
 
-unsigned int _GeoIP_seek_record ( unsigned long ipnum ) {
+#define GEOIP_CACHE_SIZE 256
 
-	fileHandle_t file;
+typedef struct
+{
+	byte *data;
+	int size;
+	qboolean loaded; //Load was attempted
+}geoipDatabase_t;
 
-	int depth;
-	unsigned int x;
-	unsigned char stack_buffer[2 * MAX_RECORD_LENGTH];
-	const unsigned char *buf = stack_buffer;
-	unsigned int offset = 0;
+typedef struct
+{
+	netadrtype_t type;
+	byte ip[16];
+	unsigned int index;
+}geoipCacheEntry_t;
+
+static geoipDatabase_t geoip4;
+static geoipDatabase_t geoip6;
+static geoipCacheEntry_t geoipCache[GEOIP_CACHE_SIZE];
+
+
+static void _GeoIP_FreeDatabase( geoipDatabase_t *db ) {
+
+	if(db->data)
+		L_Free(db->data);
+
+	db->data = NULL;
+	db->size = 0;
+	db->loaded = qfalse;
+}
+
+/*
+Reads the whole database into memory so a lookup doesn't need any file access
+*/
+static void _GeoIP_LoadDatabase( geoipDatabase_t *db, const char* filename ) {
+
+	fileHandle_t file;
+	long len;
 
-	const unsigned char * p;
-	int j;
+	_GeoIP_FreeDatabase(db);
+	db->loaded = qtrue;
 
-	FS_SV_FOpenFileRead("GeoIP.dat", &file);
+	len = FS_SV_FOpenFileRead(filename, &file);
 
 	if(!file){
-		Com_Printf(CON_CHANNEL_SCRIPT,"GetGeoLocation(): Missing file GeoIP.dat\n");
-		return 0;
+		Com_Printf(CON_CHANNEL_SERVER,"GeoIP: Missing file %s\n", filename);
+		return;
 	}
 
-/*
-	unsigned char *data; = malloc(1024*1024*2);
-	if(!FS_Seek(file, 0, SEEK_SET)){
-		FS_Read(data , 1024*1024*2, file);
+	if(len < RECORD_LENGTH * 2){
+		Com_PrintError(CON_CHANNEL_SERVER,"GeoIP: File %s is too small\n", filename);
+		FS_FCloseFile(file);
+		return;
+	}
+
+	db->data = L_Malloc(len);
+	if(!db->data){
+		Com_PrintError(CON_CHANNEL_SERVER,"GeoIP: Out of memory loading %s\n", filename);
+		FS_FCloseFile(file);
+		return;
 	}
+
+	if(FS_Read(db->data, len, file) != len){
+		Com_PrintError(CON_CHANNEL_SERVER,"GeoIP: Failed to read %s\n", filename);
+		FS_FCloseFile(file);
+		_GeoIP_FreeDatabase(db);
+		db->loaded = qtrue;
+		return;
+	}
+	FS_FCloseFile(file);
+	db->size = len;
+	Com_Printf(CON_CHANNEL_SERVER,"GeoIP: Loaded %s (%ld bytes)\n", filename, len);
+}
+
+void GeoIP_Init( ) {
+
+	_GeoIP_LoadDatabase(&geoip4, "GeoIP.dat");
+	_GeoIP_LoadDatabase(&geoip6, "GeoIPv6.dat");
+	Com_Memset(geoipCache, 0, sizeof(geoipCache));
+}
+
+void GeoIP_Reload_f( ) {
+
+	GeoIP_Init( );
+}
+
+/*
+Walks the binary tree of the database. addr is in network byte order.
 */
-	unsigned int foffset;
+static unsigned int _GeoIP_seek_record_mem ( geoipDatabase_t *db, const byte *addr, int numbits ) {
+
+	int depth;
+	unsigned int x;
+	unsigned int offset = 0;
+	const unsigned char *buf;
 
+	if(!db->loaded){
+		_GeoIP_LoadDatabase(db, db == &geoip6 ? "GeoIPv6.dat" : "GeoIP.dat");
+	}
 
-	for (depth = 31; depth >= 0; depth--) {
-		/* read from disk */
-		foffset = (long)RECORD_LENGTH * 2 *offset;
+	if(!db->data){
+		return 0;
+	}
 
-		if(!FS_Seek(file, foffset, FS_SEEK_SET)){
-			FS_Read(stack_buffer , RECORD_LENGTH * 2, file);
+	for (depth = 0; depth < numbits; depth++) {
+
+		if((unsigned int)db->size / (RECORD_LENGTH * 2) <= offset){
+			break;
 		}
 		/* simply point to record in memory */
-//		buf = data + (long)RECORD_LENGTH * 2 *offset;
-		if (ipnum & (1 << depth)) {
-			/* Take the right-hand branch */
-			if ( RECORD_LENGTH == 3 ) {
-				/* Most common case is completely unrolled and uses constants. */
-				x =   (buf[3*1 + 0] << (0*8))  + (buf[3*1 + 1] << (1*8))  + (buf[3*1 + 2] << (2*8));
-
-			} else {
-				/* General case */
-				j = RECORD_LENGTH;
-				p = &buf[2*j];
-				x = 0;
-				do {
-					x <<= 8;
-					x += *(--p);
-				} while ( --j );
-			}
+		buf = db->data + RECORD_LENGTH * 2 * offset;
 
+		if (addr[depth >> 3] & (0x80 >> (depth & 7))) {
+			/* Take the right-hand branch */
+			x =   (buf[3*1 + 0] << (0*8))  + (buf[3*1 + 1] << (1*8))  + (buf[3*1 + 2] << (2*8));
 		} else {
 			/* Take the left-hand branch */
-			if ( RECORD_LENGTH == 3 ) {
-				/* Most common case is completely unrolled and uses constants. */
-				x =   (buf[3*0 + 0] << (0*8))  + (buf[3*0 + 1] << (1*8))  + (buf[3*0 + 2] << (2*8));
-			} else {
-				/* General case */
-				j = RECORD_LENGTH;
-				p = &buf[1*j];
-				x = 0;
-				do {
-					x <<= 8;
-					x += *(--p);
-				} while ( --j );
-			}
+			x =   (buf[3*0 + 0] << (0*8))  + (buf[3*0 + 1] << (1*8))  + (buf[3*0 + 2] << (2*8));
 		}
 
 		if (x >= BEGIN_OFFSET) {
 			//gi->netmask = gl->netmask = 32 - depth;
-			FS_FCloseFile(file);
 			return x - BEGIN_OFFSET;
 		}
 		offset = x;
 	}
-	/* shouldn't reach here */
-	Com_PrintError(CON_CHANNEL_SCRIPT,"Traversing Database for ipnum = %lu - Perhaps database is corrupt?\n",ipnum);
-	FS_FCloseFile(file);
+	Com_PrintError(CON_CHANNEL_SCRIPT,"Traversing Database failed - Perhaps database is corrupt?\n");
 	return 0;
 }
 
+unsigned int _GeoIP_seek_record ( unsigned long ipnum ) {
+
+	byte addr[4];
+
+	addr[0] = ipnum >> 24;
+	addr[1] = ipnum >> 16;
+	addr[2] = ipnum >> 8;
+	addr[3] = ipnum;
+
+	return _GeoIP_seek_record_mem(&geoip4, addr, 32);
+}
+
+/*
+Country index for an address. Results are cached per address.
+*/
+unsigned int GeoIP_LookupAddress ( netadr_t *adr ) {
+
+	static const byte v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+	geoipCacheEntry_t *entry;
+	netadrtype_t type;
+	unsigned int hash;
+	int size, i;
+
+	switch(adr->type)
+	{
+		case NA_IP:
+		case NA_TCP:
+			type = NA_IP;
+			size = 4;
+			break;
+		case NA_IP6:
+		case NA_TCP6:
+			type = NA_IP6;
+			size = 16;
+			break;
+		default:
+			return 0;
+	}
+
+	hash = 0;
+	for(i = 0; i < size; i++){
+		hash = hash * 31 + adr->ip6[i];
+	}
+	entry = &geoipCache[hash & (GEOIP_CACHE_SIZE -1)];
+
+	if(entry->type == type && memcmp(entry->ip, adr->ip6, size) == 0){
+		return entry->index;
+	}
+
+	entry->type = type;
+	Com_Memcpy(entry->ip, adr->ip6, size);
+
+	if(type == NA_IP){
+		entry->index = _GeoIP_seek_record_mem(&geoip4, adr->ip, 32);
+	}else if(memcmp(adr->ip6, v4mapped, sizeof(v4mapped)) == 0){
+		entry->index = _GeoIP_seek_record_mem(&geoip4, &adr->ip6[12], 32);
+	}else{
+		entry->index = _GeoIP_seek_record_mem(&geoip6, adr->ip6, 128);
+	}
+	return entry->index;
+}
+
 const char GeoIP_country_code[255][3] = { "--","AP","EU","AD","AE","AF","AG","AI","AL","AM","CW",
 	"AO","AQ","AR","AS","AT","AU","AW","AZ","BA","BB",
 	"BD","BE","BF","BG","BH","BI","BJ","BM","BN","BO",
@@ -22,8 +22,18 @@
 
 
 
+#ifndef __MAXMIND_GEOIP_H__
+#define __MAXMIND_GEOIP_H__
+
+#include "sys_net.h"
+
+void GeoIP_Init( );
+void GeoIP_Reload_f( );
+unsigned int GeoIP_LookupAddress ( netadr_t *adr );
 unsigned int _GeoIP_seek_record ( unsigned long ipnum );
 const char* _GeoIP_country_code ( unsigned int index );
 const char* _GeoIP_country_code3 ( unsigned int index );
 const char* _GeoIP_country_name ( unsigned int index );
-const char* _GeoIP_continent_name ( unsigned int index );
\ No newline at end of file
+const char* _GeoIP_continent_name ( unsigned int index );
+
+#endif
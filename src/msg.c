@@ -302,9 +302,15 @@ void MSG_WriteBit1(msg_t *msg)
 }
 
 
+/*
+Writes up to 32 bits with one bounds check. A partially filled bit byte stays where it is
+even if whole bytes got written behind it in the meantime, so it gets topped up first
+and the remaining bits go out byte by byte from the accumulator.
+*/
 void MSG_WriteBits(msg_t *msg, int bits, int bitcount)
 {
-    int i;
+    uint64_t acc;
+    int bitpos, n;
 
     if ( msg->maxsize - msg->cursize < 4 )
     {
@@ -312,25 +318,44 @@ void MSG_WriteBits(msg_t *msg, int bits, int bitcount)
         return;
     }
 
-    if ( bitcount )
+    if ( bitcount <= 0 )
     {
+        return;
+    }
 
-      for (i = 0 ; bitcount != i; i++)
-      {
+    acc = (uint32_t)bits;
+    if ( bitcount < 32 )
+    {
+        acc &= (1u << bitcount) - 1;
+    }
 
-        if ( !(msg->bit & 7) )
+    bitpos = msg->bit & 7;
+    if ( bitpos )
+    {
+        n = 8 - bitpos;
+        msg->data[msg->bit >> 3] |= (byte)(acc << bitpos);
+        if ( n >= bitcount )
         {
-          msg->bit = 8 * msg->cursize;
-          msg->data[msg->cursize] = 0;
-          msg->cursize++;
+            msg->bit += bitcount;
+            return;
         }
+        acc >>= n;
+        bitcount -= n;
+    }
 
-        if ( bits & 1 )
-          msg->data[msg->bit >> 3] |= 1 << (msg->bit & 7);
-
-        msg->bit++;
-        bits >>= 1;
-      }
+    msg->bit = 8 * msg->cursize;
+    while ( bitcount > 0 )
+    {
+        msg->data[msg->cursize] = (byte)acc;
+        msg->cursize++;
+        acc >>= 8;
+        if ( bitcount > 8 )
+        {
+            msg->bit += 8;
+        }else{
+            msg->bit += bitcount;
+        }
+        bitcount -= 8;
     }
 }
 
@@ -754,50 +779,55 @@ int MSG_ReadBit(msg_t *msg)
 
 
 
+/*
+Reads up to 32 bits. Works on whole bytes: the rest of the current bit byte first,
+then one new byte per step from data or splitData.
+*/
 int MSG_ReadBits(msg_t *msg, int numBits)
 {
-  int i;
-  signed int var;
-  int retval;
+  int got, bitpos, numBytes, n;
+  unsigned int var;
+  uint32_t retval;
 
   retval = 0;
 
-  if ( numBits > 0 )
+  for(got = 0; got < numBits; got += n)
   {
-
-    for(i = 0 ;numBits != i; i++)
+    bitpos = msg->bit & 7;
+    if ( !bitpos )
     {
-      if ( !(msg->bit & 7) )
+      if ( msg->readcount >= msg->splitSize + msg->cursize )
       {
-        if ( msg->readcount >= msg->splitSize + msg->cursize )
-        {
-          msg->overflowed = 1;
-          return -1;
-        }
-        msg->bit = 8 * msg->readcount;
-        msg->readcount++;
+        msg->overflowed = 1;
+        return -1;
       }
-      if ( ((msg->bit / 8)) >= msg->cursize )
-      {
-
-        if(msg->splitData == NULL)
-            return 0;
+      msg->bit = 8 * msg->readcount;
+      msg->readcount++;
+    }
 
-        var = msg->splitData[(msg->bit / 8) - msg->cursize];
+    numBytes = msg->bit / 8;
+    if ( numBytes >= msg->cursize )
+    {
+      if(msg->splitData == NULL)
+        return 0;
 
-      }else
-        var = msg->data[msg->bit / 8];
+      var = msg->splitData[numBytes - msg->cursize];
+    }else{
+      var = msg->data[numBytes];
+    }
 
-      retval |= ((var >> (msg->bit & 7)) & 1) << i;
-      msg->bit++;
+    n = 8 - bitpos;
+    if ( n > numBits - got )
+    {
+      n = numBits - got;
     }
+    retval |= (uint32_t)((var >> bitpos) & ((1u << n) - 1)) << got;
+    msg->bit += n;
   }
   return retval;
 }
 
 
-
-
 void MSG_ReadBase64(msg_t* msg, byte* outbuf, int len)
 {
     int databyte;
@@ -27,6 +27,7 @@
 #include "httpftp.h"
 #include "sapi.h"
 #include "g_shared.h"
+#include "kvstore.h"
 /*=========================================*
  *                                         *
  *        Plugin Handler's exports         *
@@ -1108,3 +1109,63 @@ P_P_F level_locals_t* Plugin_GetLevelBase( )
 {
     return &level;
 }
+
+/* Persistent key value store, the same store scripts access with KVSet / KVGet */
+P_P_F qboolean Plugin_KVS_SetInt(const char* key, int value)
+{
+    vsValue_t v;
+    v.integer = value;
+    return KVS_Set(key, VSVAR_INTEGER, &v);
+}
+
+P_P_F qboolean Plugin_KVS_SetFloat(const char* key, float value)
+{
+    vsValue_t v;
+    v.floatVar = value;
+    return KVS_Set(key, VSVAR_FLOAT, &v);
+}
+
+P_P_F qboolean Plugin_KVS_SetString(const char* key, const char* value)
+{
+    vsValue_t v;
+    v.string = (char*)value;
+    return KVS_Set(key, VSVAR_STRING, &v);
+}
+
+P_P_F qboolean Plugin_KVS_GetInt(const char* key, int* value)
+{
+    vsValue_t v;
+    if(KVS_Get(key, &v) != VSVAR_INTEGER)
+    {
+        return qfalse;
+    }
+    *value = v.integer;
+    return qtrue;
+}
+
+P_P_F qboolean Plugin_KVS_GetFloat(const char* key, float* value)
+{
+    vsValue_t v;
+    if(KVS_Get(key, &v) != VSVAR_FLOAT)
+    {
+        return qfalse;
+    }
+    *value = v.floatVar;
+    return qtrue;
+}
+
+P_P_F qboolean Plugin_KVS_GetString(const char* key, char* buf, int size)
+{
+    vsValue_t v;
+    if(KVS_Get(key, &v) != VSVAR_STRING)
+    {
+        return qfalse;
+    }
+    Q_strncpyz(buf, v.string, size);
+    return qtrue;
+}
+
+P_P_F qboolean Plugin_KVS_Remove(const char* key)
+{
+    return KVS_Remove(key);
+}
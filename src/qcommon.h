@@ -54,6 +54,9 @@ void Com_Init(char* cmdline);
 void Com_UpdateRealtime();
 time_t Com_GetRealtime();
 int QDECL Com_AddTimedEvent( int delay, void *function, unsigned int argcount, ...);
+qboolean Com_CancelTimedEvent( int handle );
+int Com_NumTimedEvents( );
+void Com_TimedEventLoop( void );
 int Com_FilterPath( char *filter, char *name, int casesensitive );
 
 void Com_RandomBytes( byte *string, int len );
@@ -74,6 +77,7 @@ extern cvar_t* com_dedicated;
 extern cvar_t* com_timescale;
 extern cvar_t* com_sv_running;
 extern cvar_t* com_logfile;
+extern cvar_t* com_logfileOverflow;
 extern cvar_t* com_developer;
 extern cvar_t* useFastFile;
 extern cvar_t* com_animCheck;
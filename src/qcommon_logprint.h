@@ -38,6 +38,7 @@ void Com_CloseLogFiles(void);
 fileHandle_t Com_OpenGameLogfile(const char* name, char mode, qboolean sync);
 void Com_CloseGameLogfile();
 int Com_WriteGameLogfile(const char* data, int len);
+void Com_LogfileStats_f( );
 
 #ifdef __cplusplus
 };
@@ -913,7 +913,7 @@ void Info_Print( const char *s ) {
 
 static void Info_EncodeChar(unsigned char chr, unsigned char* encodedchr)
 {
-	Com_sprintf((char*)encodedchr, 0x7fffffff, "%%%X", (char)chr);
+	Com_sprintf((char*)encodedchr, 0x7fffffff, "%%%02X", chr);
 }
 
 static void Info_Encode(const char* inurl, int encodelen, char* outencodedurl, int len)
@@ -929,6 +929,7 @@ static void Info_Encode(const char* inurl, int encodelen, char* outencodedurl, i
 			case '\\':
 			case '\"':
 			case ';':
+			case '%':
 				Info_EncodeChar(url[i], &encodedurl[y]);
 				y += 3;
 				break;
@@ -956,7 +957,7 @@ char Info_DecodeChar(unsigned char* encodedchr)
         encoded[0] = encodedchr[0];
         encoded[1] = encodedchr[1];
         encoded[2] = encodedchr[2];
-        encoded[3] = encodedchr[3];
+        encoded[3] = '\0'; //Always two hex digits
 
         if(encoded[0] != '%'){
             return ' ';
@@ -715,6 +715,8 @@ unsigned int __cdecl Scr_GetObject( unsigned int );
 void __cdecl Scr_GetObjectField(unsigned int classnum, int entnum, int offset);
 const char *__cdecl Scr_GetIString(unsigned int index);
 void VM_Resume(unsigned int id);
+void Scr_Profile_f( );
+void Scr_ProfileScriptsFreed( );
 
 int Scr_GetFunc(unsigned int paramnum);
 extern char* (__cdecl *Scr_GetLocalizedString)(unsigned int arg);
@@ -753,6 +755,7 @@ void __cdecl Scr_MakeArray( void );
 void __cdecl Scr_AddArrayKeys( unsigned int strIdx );
 void __cdecl Scr_Notify( gentity_t*, unsigned short, unsigned int);
 void __cdecl Scr_NotifyNum( int, unsigned int, unsigned int, unsigned int);
+void __cdecl Scr_NotifyLevel( int, unsigned int);
 
 int __cdecl Scr_GetFunctionHandle( const char* scriptName, const char* labelName);
 short __cdecl Scr_ExecEntThread( gentity_t* ent, int callbackHook, unsigned int numArgs);
@@ -809,6 +812,12 @@ int Scr_FS_Read( void *buffer, int len, fileHandle_t f );
 int Scr_FS_Write( const void *buffer, int len, fileHandle_t h );
 int Scr_FS_Seek( fileHandle_t f, long offset, int origin );
 qboolean Scr_FileExists( const char* filename );
+char* Scr_FS_ReadAll( const char* qpath, int* len );
+void Scr_AddLineArray( char* text );
+int Scr_FS_ReadFileAsync( const char* qpath, const char* notify, int entnum, unsigned int classnum );
+int Scr_FS_WriteFileAsync( const char* qpath, const char* data, int len, qboolean append, const char* notify, int entnum, unsigned int classnum );
+void Scr_FS_RunAsyncCallbacks( void );
+void Scr_FS_CancelAsyncCallbacks( void );
 
 void GScr_MakeCvarServerInfo(void);
 void GScr_SetCvar();
@@ -26,6 +26,11 @@
 #include "filesystem.h"
 #include "scr_vm.h"
 #include "cvar.h"
+#include "qcommon_mem.h"
+#include "sys_main.h"
+#include "sys_thread.h"
+#include "cscr_stringlist.h"
+#include "cscr_variable.h"
 
 #include <string.h>
 
@@ -452,5 +457,417 @@ int Scr_FS_Seek( fileHandle_t f, long offset, int origin ) {
 
 
 
+/*
+========================================================================================
+
+Whole file reads and asynchronous file I/O for scripts
+
+Requests are executed in order by the "ScriptFileIO" thread. The result is
+delivered on the next server frame with a notify on the requesting entity or
+on level: notify(<notify>, <request id>, <result>).
+Requests of a previous level are discarded.
+
+========================================================================================
+*/
+
+#define MAX_SCRIPT_ASYNCREQUESTS 32
+#define MAX_SCRIPT_FILESIZE (16 * 1024 * 1024)
+
+typedef enum
+{
+	SCR_ASYNC_FREE,
+	SCR_ASYNC_QUEUED,
+	SCR_ASYNC_DONE
+}scr_asyncState_t;
+
+typedef enum
+{
+	SCR_ASYNC_READ,
+	SCR_ASYNC_WRITE,
+	SCR_ASYNC_APPEND
+}scr_asyncOp_t;
+
+typedef struct
+{
+	volatile DWORD state;
+	scr_asyncOp_t op;
+	int id;
+	int generation;
+	int entnum; //-1 for level
+	unsigned int classnum;
+	unsigned int entId; //Script object of the entity. Referenced while the request is pending so it can't be reused by another entity
+	char ospath[2][MAX_OSPATH]; //fs_homepath and fs_basepath, the second one may be empty
+	char notify[MAX_QPATH];
+	char* data; //Data to write or the file which has been read
+	int len;
+	qboolean success;
+}scr_asyncRequest_t;
+
+static struct
+{
+	scr_asyncRequest_t requests[MAX_SCRIPT_ASYNCREQUESTS];
+	int nextId;
+	int generation;
+	HANDLE wakeEvent;
+	threadid_t threadid;
+	qboolean started;
+}scr_async;
+
+
+/*
+=================
+Scr_FS_ReadOSFile
+
+Reads a whole file into a new null terminated buffer, free it with L_Free
+=================
+*/
+static char* Scr_FS_ReadOSFile( FILE* f, int* len )
+{
+	long size;
+	char* buf;
+
+	if(fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || size > MAX_SCRIPT_FILESIZE)
+	{
+		return NULL;
+	}
+	fseek(f, 0, SEEK_SET);
+
+	buf = L_Malloc(size +1);
+	if(buf == NULL)
+	{
+		return NULL;
+	}
+	*len = fread(buf, 1, size, f);
+	buf[*len] = '\0';
+	return buf;
+}
+
+/*
+=================
+Scr_FS_ReadAll
+
+Reads a whole file from fs_homepath or fs_basepath. Returns NULL if the file
+can not be read, otherwise a buffer which has to be freed with L_Free
+=================
+*/
+char* Scr_FS_ReadAll( const char* qpath, int* len )
+{
+	scr_fileHandle_t fh;
+	char* buf;
+
+	Com_Memset( &fh, 0, sizeof( fh ));
+
+	if(!Scr_FS_FOpenFile(qpath, FS_READ, &fh))
+	{
+		return NULL;
+	}
+	buf = Scr_FS_ReadOSFile(fh.fh, len);
+	Scr_FS_CloseFile(&fh);
+	return buf;
+}
+
+/*
+=================
+Scr_AddLineArray
+
+Returns the text as array of lines to the script. Line endings get removed
+=================
+*/
+void Scr_AddLineArray( char* text )
+{
+	char* line;
+	char* end;
+	char* next;
+
+	Scr_MakeArray();
+
+	for(line = text; line && *line; line = next)
+	{
+		end = strchr(line, '\n');
+		if(end)
+		{
+			next = end +1;
+		}else{
+			next = NULL;
+			end = line + strlen(line);
+		}
+		*end = '\0';
+		if(end > line && end[-1] == '\r')
+		{
+			end[-1] = '\0';
+		}
+		Scr_AddString(line);
+		Scr_AddArray();
+	}
+}
+
+
+static void Scr_FS_ExecuteAsyncRequest( scr_asyncRequest_t* req )
+{
+	FILE* f;
+	int i;
+
+	req->success = qfalse;
+
+	for(i = 0; i < 2 && !req->success; i++)
+	{
+		if(req->ospath[i][0] == '\0')
+		{
+			continue;
+		}
+		if(req->op == SCR_ASYNC_READ)
+		{
+			f = fopen(req->ospath[i], "rb");
+			if(f == NULL)
+			{
+				continue;
+			}
+			req->data = Scr_FS_ReadOSFile(f, &req->len);
+			req->success = req->data != NULL;
+		}else{
+			if(FS_CreatePath(req->ospath[i]))
+			{
+				continue;
+			}
+			f = fopen(req->ospath[i], req->op == SCR_ASYNC_APPEND ? "ab" : "wb");
+			if(f == NULL)
+			{
+				continue;
+			}
+			req->success = fwrite(req->data, 1, req->len, f) == (size_t)req->len;
+		}
+		fclose(f);
+	}
+}
+
+void* Scr_FS_AsyncThread( void* null )
+{
+	int i;
+	scr_asyncRequest_t* req;
+	scr_asyncRequest_t* next;
+
+	while(qtrue)
+	{
+		Sys_WaitForObject(scr_async.wakeEvent);
+		Sys_ResetEvent(scr_async.wakeEvent);
+
+		//Oldest request first so reads and writes of the same file stay in order
+		do
+		{
+			next = NULL;
+			for(i = 0, req = scr_async.requests; i < MAX_SCRIPT_ASYNCREQUESTS; i++, req++)
+			{
+				if(Sys_InterlockedExchangeAdd(&req->state, 0) != SCR_ASYNC_QUEUED)
+				{
+					continue;
+				}
+				if(next == NULL || req->id < next->id)
+				{
+					next = req;
+				}
+			}
+			if(next)
+			{
+				Scr_FS_ExecuteAsyncRequest(next);
+				Sys_InterlockedCompareExchange(&next->state, SCR_ASYNC_DONE, SCR_ASYNC_QUEUED);
+			}
+		}while(next);
+	}
+	return NULL;
+}
 
+/*
+=================
+Scr_FS_QueueAsyncRequest
+
+Returns the request id or 0 if the request can not be queued
+=================
+*/
+static int Scr_FS_QueueAsyncRequest( scr_asyncOp_t op, const char* qpath, char* data, int len, const char* notify, int entnum, unsigned int classnum )
+{
+	int i;
+	scr_asyncRequest_t* req;
+
+	if ( !FS_Initialized() ) {
+		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
+	}
+
+	if(strstr(qpath, "..") || strstr(qpath, "::"))
+	{
+		Com_PrintScriptRuntimeWarning("Scr_FS_QueueAsyncRequest: Invalid filename %s\n", qpath);
+		return 0;
+	}
+
+	if(!scr_async.started)
+	{
+		scr_async.wakeEvent = Sys_CreateEvent(qtrue, qfalse, "wakescriptfileio");
+		if(Sys_CreateNewThread(Scr_FS_AsyncThread, &scr_async.threadid, NULL) == qfalse)
+		{
+			Com_PrintError(CON_CHANNEL_SCRIPT, "Couldn't create the script file I/O thread\n");
+			return 0;
+		}
+		Sys_SetThreadName(scr_async.threadid, "ScriptFileIO");
+		scr_async.started = qtrue;
+	}
+
+	for(i = 0, req = scr_async.requests; i < MAX_SCRIPT_ASYNCREQUESTS; i++, req++)
+	{
+		if(req->state == SCR_ASYNC_FREE)
+		{
+			break;
+		}
+	}
+	if(i == MAX_SCRIPT_ASYNCREQUESTS)
+	{
+		Com_PrintScriptRuntimeWarning("Scr_FS_QueueAsyncRequest: Exceeded limit of %i pending requests\n", MAX_SCRIPT_ASYNCREQUESTS);
+		return 0;
+	}
+
+	req->entId = 0;
+	if(entnum >= 0)
+	{
+		req->entId = FindEntityId(entnum, classnum);
+		if(req->entId == 0)
+		{
+			Com_PrintScriptRuntimeWarning("Scr_FS_QueueAsyncRequest: Entity %i does not exist\n", entnum);
+			return 0;
+		}
+		AddRefToObject(req->entId);
+	}
+
+	req->op = op;
+	req->id = ++scr_async.nextId;
+	req->generation = scr_async.generation;
+	req->entnum = entnum;
+	req->classnum = classnum;
+	req->data = data;
+	req->len = len;
+	req->success = qfalse;
+	Q_strncpyz(req->notify, notify, sizeof(req->notify));
+
+	FS_BuildOSPathForThread( fs_homepath->string, "", qpath, req->ospath[0], 0);
+	req->ospath[1][0] = '\0';
+	if (Q_stricmp(fs_homepath->string, fs_basepath->string)){
+		FS_BuildOSPathForThread( fs_basepath->string, "", qpath, req->ospath[1], 0);
+	}
+
+	Sys_InterlockedCompareExchange(&req->state, SCR_ASYNC_QUEUED, SCR_ASYNC_FREE);
+	Sys_SetEvent(scr_async.wakeEvent);
+	return req->id;
+}
+
+int Scr_FS_ReadFileAsync( const char* qpath, const char* notify, int entnum, unsigned int classnum )
+{
+	return Scr_FS_QueueAsyncRequest(SCR_ASYNC_READ, qpath, NULL, 0, notify, entnum, classnum);
+}
+
+int Scr_FS_WriteFileAsync( const char* qpath, const char* data, int len, qboolean append, const char* notify, int entnum, unsigned int classnum )
+{
+	char* copy;
+	int id;
+
+	copy = L_Malloc(len +1);
+	if(copy == NULL)
+	{
+		return 0;
+	}
+	Com_Memcpy(copy, data, len);
+
+	id = Scr_FS_QueueAsyncRequest(append ? SCR_ASYNC_APPEND : SCR_ASYNC_WRITE, qpath, copy, len, notify, entnum, classnum);
+	if(id == 0)
+	{
+		L_Free(copy);
+	}
+	return id;
+}
+
+/*
+=================
+Scr_FS_RunAsyncCallbacks
+
+Delivers finished requests to the scripts. Called every server frame
+=================
+*/
+void Scr_FS_RunAsyncCallbacks( )
+{
+	int i;
+	unsigned int notify;
+	scr_asyncRequest_t* req;
+
+	if(!scr_async.started)
+	{
+		return;
+	}
+
+	for(i = 0, req = scr_async.requests; i < MAX_SCRIPT_ASYNCREQUESTS; i++, req++)
+	{
+		if(Sys_InterlockedExchangeAdd(&req->state, 0) != SCR_ASYNC_DONE)
+		{
+			continue;
+		}
+
+		//A freed entity keeps its object while we reference it, so a new entity in the same slot has another id
+		if(req->generation == scr_async.generation && (req->entnum < 0 || FindEntityId(req->entnum, req->classnum) == req->entId))
+		{
+			if(req->op == SCR_ASYNC_READ)
+			{
+				if(req->success)
+				{
+					Scr_AddLineArray(req->data);
+				}else{
+					Scr_AddUndefined();
+				}
+			}else{
+				Scr_AddBool(req->success);
+			}
+			Scr_AddInt(req->id);
+
+			notify = SL_GetString(req->notify, 0);
+			if(req->entnum < 0)
+			{
+				Scr_NotifyLevel(notify, 2);
+			}else{
+				Scr_NotifyNum(req->entnum, req->classnum, notify, 2);
+			}
+			SL_RemoveRefToString(notify);
+		}
 
+		if(req->entId && req->generation == scr_async.generation)
+		{
+			RemoveRefToObject(req->entId);
+		}
+		req->entId = 0;
+
+		if(req->data)
+		{
+			L_Free(req->data);
+			req->data = NULL;
+		}
+		req->state = SCR_ASYNC_FREE;
+	}
+}
+
+/*
+=================
+Scr_FS_CancelAsyncCallbacks
+
+Pending requests still get executed but their results are not delivered anymore.
+Called when the game scripts are shut down, before the script variables get freed
+=================
+*/
+void Scr_FS_CancelAsyncCallbacks( )
+{
+	int i;
+	scr_asyncRequest_t* req;
+
+	for(i = 0, req = scr_async.requests; i < MAX_SCRIPT_ASYNCREQUESTS; i++, req++)
+	{
+		//entId is only touched by the main thread
+		if(req->entId && req->generation == scr_async.generation)
+		{
+			RemoveRefToObject(req->entId);
+			req->entId = 0;
+		}
+	}
+	scr_async.generation++;
+}
@@ -22,6 +22,7 @@
 #include "q_shared.h"
 #include "qcommon_io.h"
 #include "qcommon.h"
+#include "qcommon_mem.h"
 #include "g_hud.h"
 #include "scr_vm.h"
 #include "cmd.h"
@@ -43,6 +44,7 @@
 #include <time.h>
 #include "plugin_handler.h"
 #include "scr_vm_functions.h"
+#include "kvstore.h"
 #include "tomcrypt/tomcrypt_misc.h"
 
 static qboolean g_isLocStringPrecached[MAX_LOCALIZEDSTRINGS] = {qfalse};
@@ -847,7 +849,7 @@ void PlayerCmd_GetGeoLocation(scr_entref_t arg)
 
     rettype = Scr_GetInt(0);
 
-    locIndex = _GeoIP_seek_record(BigLong(*(unsigned long *)&svs.clients[entityNum].netchan.remoteAddress.ip));
+    locIndex = GeoIP_LookupAddress(&svs.clients[entityNum].netchan.remoteAddress);
 
     switch (rettype)
     {
@@ -1852,6 +1854,227 @@ void GScr_FS_Remove()
     }
 }
 
+/*
+============
+GScr_FS_ReadAllLines
+
+Reads a whole file at once. Returns an array with all lines without the line endings
+or undefined if the file can not be read.
+Usage: lines = FS_ReadAllLines(string <filename>)
+============
+*/
+
+void GScr_FS_ReadAllLines()
+{
+    char *buf;
+    int len;
+
+    if (Scr_GetNumParam() != 1)
+        Scr_Error("Usage: FS_ReadAllLines(<filename>)\n");
+
+    char *filename = Scr_GetString(0);
+
+    buf = Scr_FS_ReadAll(filename, &len);
+    if (buf == NULL)
+    {
+        Scr_AddUndefined();
+        return;
+    }
+    Scr_AddLineArray(buf);
+    L_Free(buf);
+}
+
+/*
+============
+GScr_FS_ReadFileAsync
+
+Reads a whole file in the background. When done the calling entity or level gets
+notified with the request id and an array of all lines, or undefined on failure.
+Returns the request id or 0 if the request failed.
+Usage: id = [entity] FS_ReadFileAsync(string <filename>, [string <notify> = "fs_readdone"])
+level waittill("fs_readdone", id, lines);
+============
+*/
+
+static void GScr_FS_ReadFileAsyncInternal(int entnum, unsigned int classnum)
+{
+    const char *notify = "fs_readdone";
+
+    if (Scr_GetNumParam() < 1 || Scr_GetNumParam() > 2)
+        Scr_Error("Usage: FS_ReadFileAsync(<filename>, [notify])\n");
+
+    char *filename = Scr_GetString(0);
+    if (Scr_GetNumParam() > 1)
+        notify = Scr_GetString(1);
+
+    Scr_AddInt(Scr_FS_ReadFileAsync(filename, notify, entnum, classnum));
+}
+
+void GScr_FS_ReadFileAsync()
+{
+    GScr_FS_ReadFileAsyncInternal(-1, 0);
+}
+
+void GScr_FS_ReadFileAsyncMethod(scr_entref_t arg)
+{
+    GScr_FS_ReadFileAsyncInternal(arg.entnum, arg.classnum);
+}
+
+/*
+============
+GScr_FS_WriteFileAsync
+
+Writes or appends a string to a file in the background. When done the calling entity
+or level gets notified with the request id and true on success.
+Returns the request id or 0 if the request failed.
+Usage: id = [entity] FS_WriteFileAsync(string <filename>, string <data>, [bool <append> = false], [string <notify> = "fs_writedone"])
+============
+*/
+
+static void GScr_FS_WriteFileAsyncInternal(int entnum, unsigned int classnum)
+{
+    const char *notify = "fs_writedone";
+    qboolean append = qfalse;
+
+    if (Scr_GetNumParam() < 2 || Scr_GetNumParam() > 4)
+        Scr_Error("Usage: FS_WriteFileAsync(<filename>, <data>, [append], [notify])\n");
+
+    char *filename = Scr_GetString(0);
+    char *data = Scr_GetString(1);
+    if (Scr_GetNumParam() > 2)
+        append = Scr_GetInt(2);
+    if (Scr_GetNumParam() > 3)
+        notify = Scr_GetString(3);
+
+    Scr_AddInt(Scr_FS_WriteFileAsync(filename, data, strlen(data), append, notify, entnum, classnum));
+}
+
+void GScr_FS_WriteFileAsync()
+{
+    GScr_FS_WriteFileAsyncInternal(-1, 0);
+}
+
+void GScr_FS_WriteFileAsyncMethod(scr_entref_t arg)
+{
+    GScr_FS_WriteFileAsyncInternal(arg.entnum, arg.classnum);
+}
+
+/*
+============
+GScr_KVSet
+
+Stores an int, float, string or vector in the persistent key value store.
+Undefined removes the key. Keys are limited to 63 characters, strings to 255.
+Usage: KVSet(string <key>, <value>)
+============
+*/
+
+void GScr_KVSet()
+{
+    vsValue_t value;
+    varType_t type;
+    char *key;
+
+    if (Scr_GetNumParam() != 2)
+        Scr_Error("Usage: KVSet(<key>, <value>)\n");
+
+    key = Scr_GetString(0);
+    if (!KVS_ValidKey(key))
+    {
+        Scr_ParamError(0, "KVSet: invalid key");
+        return;
+    }
+
+    switch (Scr_GetType(1))
+    {
+        case 0:
+            KVS_Remove(key);
+            return;
+        case 2:
+            type = VSVAR_STRING;
+            value.string = Scr_GetString(1);
+            if (strlen(value.string) >= KVS_MAX_STRINGLEN)
+            {
+                Scr_ParamError(1, "KVSet: string exceeds 255 characters");
+                return;
+            }
+            break;
+        case 4:
+            type = VSVAR_VECTOR;
+            Scr_GetVector(1, value.vector);
+            break;
+        case 5:
+            type = VSVAR_FLOAT;
+            value.floatVar = Scr_GetFloat(1);
+            break;
+        case 6:
+            type = VSVAR_INTEGER;
+            value.integer = Scr_GetInt(1);
+            break;
+        default:
+            Scr_ParamError(1, "KVSet: value has to be an int, float, string, vector or undefined");
+            return;
+    }
+
+    KVS_Set(key, type, &value);
+}
+
+/*
+============
+GScr_KVGet
+
+Returns the value of the key from the persistent key value store or undefined.
+Usage: value = KVGet(string <key>)
+============
+*/
+
+void GScr_KVGet()
+{
+    vsValue_t value;
+
+    if (Scr_GetNumParam() != 1)
+        Scr_Error("Usage: KVGet(<key>)\n");
+
+    switch (KVS_Get(Scr_GetString(0), &value))
+    {
+        case VSVAR_STRING:
+            Scr_AddString(value.string);
+            break;
+        case VSVAR_VECTOR:
+            Scr_AddVector(value.vector);
+            break;
+        case VSVAR_FLOAT:
+            Scr_AddFloat(value.floatVar);
+            break;
+        case VSVAR_INTEGER:
+            Scr_AddInt(value.integer);
+            break;
+        case VSVAR_BOOLEAN:
+            Scr_AddBool(value.boolean);
+            break;
+        default:
+            Scr_AddUndefined();
+            break;
+    }
+}
+
+/*
+============
+GScr_KVDelete
+
+Removes the key from the persistent key value store. Returns true if it existed.
+Usage: bool = KVDelete(string <key>)
+============
+*/
+
+void GScr_KVDelete()
+{
+    if (Scr_GetNumParam() != 1)
+        Scr_Error("Usage: KVDelete(<key>)\n");
+
+    Scr_AddBool(KVS_Remove(Scr_GetString(0)));
+}
+
 /*
 ============
 GScr_FS_InitParamList
@@ -87,6 +87,14 @@ void GScr_FS_TestFile();
 void GScr_FS_ReadLine();
 void GScr_FS_WriteLine();
 void GScr_FS_Remove();
+void GScr_FS_ReadAllLines();
+void GScr_FS_ReadFileAsync();
+void GScr_FS_ReadFileAsyncMethod(scr_entref_t arg);
+void GScr_FS_WriteFileAsync();
+void GScr_FS_WriteFileAsyncMethod(scr_entref_t arg);
+void GScr_KVSet();
+void GScr_KVGet();
+void GScr_KVDelete();
 void GScr_SpawnBot();
 void GScr_RemoveAllBots();
 void GScr_RemoveBot();
@@ -273,6 +273,12 @@ void Scr_AddStockFunctions()
     Scr_AddFunction("fs_readline", GScr_FS_ReadLine, 0);
     Scr_AddFunction("fs_writeline", GScr_FS_WriteLine, 0);
     Scr_AddFunction("fs_remove", GScr_FS_Remove, 0);
+    Scr_AddFunction("fs_readalllines", GScr_FS_ReadAllLines, 0);
+    Scr_AddFunction("fs_readfileasync", GScr_FS_ReadFileAsync, 0);
+    Scr_AddFunction("fs_writefileasync", GScr_FS_WriteFileAsync, 0);
+    Scr_AddFunction("kvset", GScr_KVSet, 0);
+    Scr_AddFunction("kvget", GScr_KVGet, 0);
+    Scr_AddFunction("kvdelete", GScr_KVDelete, 0);
     Scr_AddFunction("getrealtime", GScr_GetRealTime, 0);
     Scr_AddFunction("timetostring", GScr_TimeToString, 0);
     Scr_AddFunction("strtokbypixlen", GScr_StrTokByPixLen, 0);
@@ -606,6 +612,9 @@ void Scr_AddStockMethods()
     // Force player stance.
     Scr_AddMethod("setstance", PlayerCmd_SetStance, qfalse);
     Scr_AddMethod("getentityhandlertype", EntityCmd_GetHandlerType, qtrue);
+    // Asynchronous file I/O which notifies the calling entity
+    Scr_AddMethod("fs_readfileasync", GScr_FS_ReadFileAsyncMethod, qfalse);
+    Scr_AddMethod("fs_writefileasync", GScr_FS_WriteFileAsyncMethod, qfalse);
 }
 
 void Scr_InitFunctions()
@@ -900,7 +909,7 @@ void Scr_ScriptPreCompile( void *scr_buffer_handle, char *filepath )
 	char * p = strstr( scr_buffer_handle, "#if" );
 	while( p != NULL )
 	{
-		if( *( p - 1 ) == '/' )
+		if( p > (char*)scr_buffer_handle && *( p - 1 ) == '/' )
 		{
 			p = strstr( p + 1, "#if" );
 			continue;
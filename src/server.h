@@ -131,6 +131,7 @@ typedef enum {
     UN_NEEDUID,
     UN_OK
 }username_t;
+
 #pragma pack(1)
 
 
@@ -204,7 +205,7 @@ struct client_s
 	int			wwwDl_var01;
 	// downloading
 	char			downloadName[MAX_QPATH]; // if not empty string, we are downloading
-	fileHandle_t		download;		// file being downloaded
+	fsDownloadFile_t	*download;		// file being downloaded, shared by all its downloaders
  	int			downloadSize;		// total bytes (can't use EOF because of paks)
  	int			downloadCount;		// bytes sent
 	int			downloadClientBlock;	// Current block we send to client
@@ -240,7 +241,7 @@ struct client_s
 	short			scriptId;
 	int			canNotReliable;
 	int			serverId;
-	struct VoicePacket_t	voicePackets[MAX_VOICEPACKETS];
+	unsigned short		voicePackets[MAX_VOICEPACKETS]; //Indices into the shared voice packet arena
 	int			voicePacketCount;
 	byte			muteList[MAX_CLIENTS];
 	byte			sendVoice;
@@ -601,6 +602,7 @@ extern cvar_t* sv_rconPassword;
 extern cvar_t* sv_protocol;
 extern cvar_t* sv_padPackets;
 extern cvar_t* sv_demoCompletedCmd;
+extern cvar_t* sv_demoCompress;
 extern cvar_t* sv_screenshotArrivedCmd;
 extern cvar_t* sv_mapDownloadCompletedCmd;
 extern cvar_t* sv_wwwBaseURL;
@@ -631,6 +633,11 @@ extern cvar_t* sv_maxRate;
 extern cvar_t* sv_mapname;
 extern cvar_t* sv_floodProtect;
 extern cvar_t* sv_showAverageBPS;
+extern cvar_t* sv_snapshotThreads;
+extern cvar_t* sv_checksumThreads;
+extern cvar_t* sv_preloadNextMap;
+extern cvar_t* sv_preloadNextMapMaxMB;
+extern cvar_t* sv_snapshotStats;
 extern cvar_t* sv_hostname;
 extern cvar_t* sv_shownet;
 extern cvar_t* sv_legacymode;
@@ -675,6 +682,8 @@ void QDECL SV_SendServerCommand(client_t *cl, const char *fmt, ...);
 __optimize3 __regparm2 void SV_PacketEvent( netadr_t *from, msg_t *msg );
 
 void SV_AddServerCommand( client_t *cl, int type, const char *cmd );
+const char* SV_GetReliableCommand( client_t *cl, int sequence );
+void SV_ResetReliableCommands( client_t *cl );
 
 void Scr_SpawnBot(void);
 
@@ -693,9 +702,11 @@ void SV_WriteDemoMessageForClient( byte *msg, int dataLen, client_t *client );
 void SV_StopRecord( client_t *cl );
 void SV_RecordClient( client_t* cl, char* basename );
 void SV_DemoSystemShutdown( void );
+void SV_DemoWriterStats_f( void );
 void SV_WriteDemoArchive(client_t *client);
 
 void SV_SendClientVoiceData(client_t *client);
+void SV_ClearClientVoicePackets(client_t *client);
 
 void SV_InitCvarsOnce( void );
 
@@ -736,6 +747,7 @@ qboolean SV_FriendlyPlayerCanBlock(void);
 qboolean SV_FFAPlayerCanBlock(void);
 const char* SV_GetMessageOfTheDay(void);
 const char* SV_GetNextMap(void);
+qboolean SV_PredictNextMap(char* map, int maxlen);
 void QDECL SV_EnterLeaveLog( const char *fmt, ... );
 
 
@@ -830,6 +842,8 @@ char* SV_PlayerIsBanned(uint64_t playerid, uint64_t steamid, netadr_t *addr, con
 char* SV_PlayerBannedByip(netadr_t *netadr, char* message, int len);	//Gets called in SV_DirectConnect
 void SV_PlayerAddBanByip(netadr_t *remote, char *message, int expire);
 void SV_RemoveBanByip(netadr_t *remote);
+void SV_PlayerAddBanByipRange(netadr_t *remote, int netmask, const char *message, int expire);
+void SV_RemoveBanByipRange(netadr_t *remote, int netmask);
 void SV_RemoveBan(baninfo_t* baninfo);
 void SV_DumpBanlist( void );
 void SV_AddBanForPlayer(uint64_t steamid, uint64_t playerid, const char* name, int bantime, const char* banreason);
@@ -855,6 +869,12 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 void G_TraceCapsule(trace_t *results, const float *start, const float *mins, const float *maxs, const float *end, int passEntityNum, int contentmask);
 int SV_PointContents( const vec3_t p, int passEntityNum, int contentmask );
 qboolean SV_inPVSIgnorePortals( const vec3_t p1, const vec3_t p2 );
+typedef struct queryLimit_s queryLimit_t;
+queryLimit_t* SV_QueryLimitCreate( int bytes );
+void SV_QueryLimitDestroy( queryLimit_t *ql );
+qboolean SV_QueryLimitAddress( queryLimit_t *ql, netadr_t *from, int burst, int period, unsigned long long now );
+void SV_QueryLimitStats( queryLimit_t *ql, int *numUsed, int *maxBuckets );
+void SV_QueryCacheStats_f( void );
 
 qboolean SV_SetupReliableMessageProtocol(client_t* client);
 void SV_DisconnectReliableMessageProtocol(client_t* client);
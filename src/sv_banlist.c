@@ -36,10 +36,13 @@
 #include <string.h>
 #include <time.h>
 
-#define MAX_IPBANS 32
+#define MAX_IPBANS 65536
+#define IPBAN_HASH_SIZE 4096
 //Don't ban IPs for more than MAX_IPBAN_MINUTES minutes as they can be shared (Carrier-grade NAT)
 #define MAX_DEFAULT_IPBAN_MINUTES 240
 #define DEFAULT_APPEAL_MINHOURS 4
+//Timeout of permanent bans, sorts behind every real timeout in the expiry heap
+#define IPBAN_TIMEOUT_NEVER 0xffffffff
 
 cvar_t *ipbantime;
 cvar_t *sv_banappealurl;
@@ -52,9 +55,37 @@ typedef struct {	//It is only for timelimited tempbans to prevent happy reconnec
     unsigned int	timeout;
     int		expire;
     int		systime;
+    int		netmask;	//Prefix length in bits. Full length for a single address
+    int		next;		//Next ban in hash chain or free list
+    int		heapIndex;	//Position in expiry heap
+    int		node;		//Prefix tree node of a range ban, 0 for a single address
 }ipBanList_t;
 
-ipBanList_t ipBans[MAX_IPBANS];
+typedef struct {
+    int		child[2];
+    int		ban;
+}ipBanNode_t;
+
+/*
+Single addresses are kept in a hash table, address ranges in a binary prefix tree per address type.
+All bans are in a min-heap ordered by timeout so expired bans get removed without scanning.
+Indices into bans and nodes start at 1, 0 means none.
+*/
+typedef struct {
+    ipBanList_t	*bans;
+    int		maxBans;
+    int		numBans;
+    int		freeBans;
+    int		*heap;
+    int		hash[IPBAN_HASH_SIZE];
+    ipBanNode_t	*nodes;
+    int		numNodes;
+    int		maxNodes;
+    int		freeNodes;	//Free list of pruned nodes, linked through child[0]
+    int		roots[NA_DOWN +1];
+}ipBanStore_t;
+
+static ipBanStore_t ipBans;
 
 
 const char* SV_WriteBanTimelimit(int timeleftsecs, char *outbuffer, int outbufferlen)
@@ -79,28 +110,417 @@ const char* SV_WriteBanTimelimit(int timeleftsecs, char *outbuffer, int outbuffe
 }
 
 
+static int SV_IPBanAddressBits(netadrtype_t type)
+{
+    switch(type)
+    {
+        case NA_IP:
+        case NA_TCP:
+            return 32;
+        case NA_IP6:
+        case NA_TCP6:
+            return 128;
+        case NA_LOOPBACK:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+static unsigned int SV_IPBanHash(netadr_t *adr)
+{
+    unsigned int hash = adr->type;
+    int i, size;
+
+    size = SV_IPBanAddressBits(adr->type) / 8;
+
+    for(i = 0; i < size; i++)
+    {
+        hash = hash * 31 + adr->ip6[i];
+    }
+    return (hash ^ (hash >> 12)) & (IPBAN_HASH_SIZE -1);
+}
+
+static qboolean SV_IPBanSameAddress(netadr_t *a, netadr_t *b)
+{
+    if(a->type != b->type)
+        return qfalse;
+
+    return memcmp(a->ip6, b->ip6, SV_IPBanAddressBits(a->type) / 8) == 0;
+}
+
+/*
+Expiry heap
+*/
+static void SV_IPBanHeapSet(int pos, int ban)
+{
+    ipBans.heap[pos] = ban;
+    ipBans.bans[ban].heapIndex = pos;
+}
+
+static void SV_IPBanHeapUp(int pos)
+{
+    int ban = ipBans.heap[pos];
+    int parent;
+
+    while(pos > 0)
+    {
+        parent = (pos -1) / 2;
+        if(ipBans.bans[ipBans.heap[parent]].timeout <= ipBans.bans[ban].timeout)
+            break;
+
+        SV_IPBanHeapSet(pos, ipBans.heap[parent]);
+        pos = parent;
+    }
+    SV_IPBanHeapSet(pos, ban);
+}
+
+static void SV_IPBanHeapDown(int pos)
+{
+    int ban = ipBans.heap[pos];
+    int child;
+
+    while((child = 2 * pos +1) < ipBans.numBans)
+    {
+        if(child +1 < ipBans.numBans && ipBans.bans[ipBans.heap[child +1]].timeout < ipBans.bans[ipBans.heap[child]].timeout)
+            child++;
+
+        if(ipBans.bans[ban].timeout <= ipBans.bans[ipBans.heap[child]].timeout)
+            break;
+
+        SV_IPBanHeapSet(pos, ipBans.heap[child]);
+        pos = child;
+    }
+    SV_IPBanHeapSet(pos, ban);
+}
+
+static void SV_IPBanHeapUpdate(int pos)
+{
+    if(pos > 0 && ipBans.bans[ipBans.heap[(pos -1) / 2]].timeout > ipBans.bans[ipBans.heap[pos]].timeout)
+        SV_IPBanHeapUp(pos);
+    else
+        SV_IPBanHeapDown(pos);
+}
+
+/*
+Prefix tree
+*/
+static int SV_IPBanNewNode()
+{
+    ipBanNode_t *newnodes;
+    int newmax, node;
+
+    if(ipBans.freeNodes)
+    {
+        node = ipBans.freeNodes;
+        ipBans.freeNodes = ipBans.nodes[node].child[0];
+        Com_Memset(&ipBans.nodes[node], 0, sizeof(ipBanNode_t));
+        return node;
+    }
+
+    if(ipBans.numNodes +1 >= ipBans.maxNodes)
+    {
+        newmax = ipBans.maxNodes ? 2 * ipBans.maxNodes : 256;
+        newnodes = realloc(ipBans.nodes, newmax * sizeof(ipBanNode_t));
+        if(newnodes == NULL)
+        {
+            return 0;
+        }
+        ipBans.nodes = newnodes;
+        ipBans.maxNodes = newmax;
+        if(ipBans.numNodes == 0)
+        {
+            ipBans.numNodes = 1; //Node 0 is none
+        }
+    }
+    Com_Memset(&ipBans.nodes[ipBans.numNodes], 0, sizeof(ipBanNode_t));
+    return ipBans.numNodes++;
+}
+
+//Returns the node for the prefix. Creates missing nodes if create is set
+static int SV_IPBanFindNode(netadr_t *adr, int netmask, qboolean create)
+{
+    int node, next, depth, bit;
+
+    node = ipBans.roots[adr->type];
+    if(node == 0)
+    {
+        if(!create || (node = SV_IPBanNewNode()) == 0)
+            return 0;
+
+        ipBans.roots[adr->type] = node;
+    }
+
+    for(depth = 0; depth < netmask; depth++)
+    {
+        bit = (adr->ip6[depth >> 3] >> (7 - (depth & 7))) & 1;
+        next = ipBans.nodes[node].child[bit];
+        if(next == 0)
+        {
+            if(!create || (next = SV_IPBanNewNode()) == 0)
+                return 0;
+
+            ipBans.nodes[node].child[bit] = next;
+        }
+        node = next;
+    }
+    return node;
+}
+
+static int SV_IPBanFindExact(netadr_t *adr)
+{
+    int i;
+
+    for(i = ipBans.hash[SV_IPBanHash(adr)]; i; i = ipBans.bans[i].next)
+    {
+        if(SV_IPBanSameAddress(adr, &ipBans.bans[i].remote))
+            return i;
+    }
+    return 0;
+}
+
+static int SV_IPBanFind(netadr_t *adr, int netmask)
+{
+    int node;
+
+    if(netmask == SV_IPBanAddressBits(adr->type))
+        return SV_IPBanFindExact(adr);
+
+    node = SV_IPBanFindNode(adr, netmask, qfalse);
+    if(node == 0)
+        return 0;
+
+    return ipBans.nodes[node].ban;
+}
+
+//Releases the nodes on the path to a removed range ban which don't lead to any other ban anymore
+static void SV_IPBanPruneNodes(netadr_t *adr, int netmask)
+{
+    int path[129];
+    int depth, node, bit;
+
+    node = ipBans.roots[adr->type];
+    for(depth = 0; node; depth++)
+    {
+        path[depth] = node;
+        if(depth == netmask)
+            break;
+
+        node = ipBans.nodes[node].child[(adr->ip6[depth >> 3] >> (7 - (depth & 7))) & 1];
+    }
+    if(node == 0)
+        return;
+
+    for(; depth >= 0; depth--)
+    {
+        node = path[depth];
+        if(ipBans.nodes[node].ban || ipBans.nodes[node].child[0] || ipBans.nodes[node].child[1])
+            break;
+
+        if(depth > 0)
+        {
+            bit = (adr->ip6[(depth -1) >> 3] >> (7 - ((depth -1) & 7))) & 1;
+            ipBans.nodes[path[depth -1]].child[bit] = 0;
+        }else{
+            ipBans.roots[adr->type] = 0;
+        }
+        ipBans.nodes[node].child[0] = ipBans.freeNodes;
+        ipBans.freeNodes = node;
+    }
+}
+
+static void SV_IPBanRemoveIndex(int ban)
+{
+    ipBanList_t *entry = &ipBans.bans[ban];
+    int *link;
+    int pos, last;
+
+    if(entry->node)
+    {
+        ipBans.nodes[entry->node].ban = 0;
+        SV_IPBanPruneNodes(&entry->remote, entry->netmask);
+    }else{
+        for(link = &ipBans.hash[SV_IPBanHash(&entry->remote)]; *link; link = &ipBans.bans[*link].next)
+        {
+            if(*link == ban)
+            {
+                *link = entry->next;
+                break;
+            }
+        }
+    }
+
+    pos = entry->heapIndex;
+    ipBans.numBans--;
+    last = ipBans.heap[ipBans.numBans];
+    if(pos < ipBans.numBans)
+    {
+        SV_IPBanHeapSet(pos, last);
+        SV_IPBanHeapUpdate(pos);
+    }
+
+    Com_Memset(entry, 0, sizeof(ipBanList_t));
+    entry->next = ipBans.freeBans;
+    ipBans.freeBans = ban;
+}
+
+static int SV_IPBanAllocIndex()
+{
+    ipBanList_t *newbans;
+    int *newheap;
+    int newmax, ban;
+
+    if(ipBans.freeBans == 0)
+    {
+        if(ipBans.maxBans > MAX_IPBANS)
+        {
+            //Full, replace the ban which expires first
+            SV_IPBanRemoveIndex(ipBans.heap[0]);
+        }else{
+            newmax = ipBans.maxBans ? 2 * ipBans.maxBans : 64;
+            if(newmax > MAX_IPBANS +1)
+                newmax = MAX_IPBANS +1;
+
+            newbans = realloc(ipBans.bans, newmax * sizeof(ipBanList_t));
+            if(newbans == NULL)
+                return 0;
+
+            ipBans.bans = newbans;
+            newheap = realloc(ipBans.heap, newmax * sizeof(int));
+            if(newheap == NULL)
+                return 0;
+
+            ipBans.heap = newheap;
+
+            Com_Memset(&ipBans.bans[ipBans.maxBans], 0, (newmax - ipBans.maxBans) * sizeof(ipBanList_t));
+            for(ban = newmax -1; ban >= ipBans.maxBans && ban > 0; ban--)
+            {
+                ipBans.bans[ban].next = ipBans.freeBans;
+                ipBans.freeBans = ban;
+            }
+            ipBans.maxBans = newmax;
+        }
+    }
+
+    ban = ipBans.freeBans;
+    ipBans.freeBans = ipBans.bans[ban].next;
+    ipBans.bans[ban].next = 0;
+    return ban;
+}
+
+//Drops all bans which have 1 second or less remaining
+static void SV_ExpireIPBans()
+{
+    int now = Com_GetRealtime();
+
+    while(ipBans.numBans > 0 && ipBans.bans[ipBans.heap[0]].timeout != IPBAN_TIMEOUT_NEVER && (int)(ipBans.bans[ipBans.heap[0]].timeout - now) <= 1)
+    {
+        SV_IPBanRemoveIndex(ipBans.heap[0]);
+    }
+}
+
+static void SV_AddIPBan(netadr_t *remote, int netmask, const char *message, int expire, unsigned int timeout)
+{
+    ipBanList_t *entry;
+    unsigned int hash;
+    int ban, node, bits;
+
+    bits = SV_IPBanAddressBits(remote->type);
+    if(bits < 0)
+        return;
+
+    if(netmask < 0 || netmask > bits)
+        netmask = bits;
+
+    node = 0;
+    ban = SV_IPBanFind(remote, netmask);	//At first check whether we have already an entry for this address
+
+    if(ban == 0)
+    {
+        if(netmask < bits)
+        {
+            node = SV_IPBanFindNode(remote, netmask, qtrue);
+            if(node == 0)
+            {
+                Com_PrintError(CON_CHANNEL_SERVER,"SV_AddIPBan: Out of memory\n");
+                return;
+            }
+        }
+        ban = SV_IPBanAllocIndex();
+        if(ban == 0)
+        {
+            Com_PrintError(CON_CHANNEL_SERVER,"SV_AddIPBan: Out of memory\n");
+            return;
+        }
+        entry = &ipBans.bans[ban];
+        entry->remote = *remote;
+        entry->netmask = netmask;
+        entry->node = node;
+
+        if(node)
+        {
+            ipBans.nodes[node].ban = ban;
+        }else{
+            hash = SV_IPBanHash(remote);
+            entry->next = ipBans.hash[hash];
+            ipBans.hash[hash] = ban;
+        }
+        entry->heapIndex = ipBans.numBans;
+        ipBans.heap[ipBans.numBans] = ban;
+        ipBans.numBans++;
+    }
+
+    entry = &ipBans.bans[ban];
+    Q_strncpyz(entry->banmsg, message, sizeof(entry->banmsg));
+    entry->expire = expire;
+    entry->systime = Sys_Milliseconds();
+    entry->timeout = timeout;
+
+    SV_IPBanHeapUpdate(entry->heapIndex);
+}
+
 char* SV_PlayerBannedByip(netadr_t *netadr, char* message, int len){	//Gets called in SV_DirectConnect
     ipBanList_t *this;
-    int i;
     char outbuffer[512];
     int timeleftsecs;
+    int ban, node, depth, bits;
 
     message[0] = 0;
 
-    for(this = &ipBans[0], i = 0; i < MAX_IPBANS; this++, i++)
+    bits = SV_IPBanAddressBits(netadr->type);
+    if(bits < 0)
+        return NULL;
+
+    SV_ExpireIPBans();
+
+    ban = SV_IPBanFindExact(netadr);
+
+    if(ban == 0)
     {
+        //Most specific range containing this address
+        node = ipBans.roots[netadr->type];
+        for(depth = 0; node; depth++)
+        {
+            if(ipBans.nodes[node].ban)
+                ban = ipBans.nodes[node].ban;
 
-        if(NET_CompareBaseAdr(netadr, &this->remote)){
+            if(depth >= bits)
+                break;
 
-            timeleftsecs = this->timeout - Com_GetRealtime();
-            if(timeleftsecs > 1)
-            {
-              Com_sprintf(message, len, "%s\n%s\n", this->banmsg, SV_WriteBanTimelimit(timeleftsecs, outbuffer, sizeof(outbuffer)));
-              return message;
-            }
+            node = ipBans.nodes[node].child[(netadr->ip6[depth >> 3] >> (7 - (depth & 7))) & 1];
         }
     }
-    return NULL;
+
+    if(ban == 0)
+        return NULL;
+
+    this = &ipBans.bans[ban];
+    if(this->timeout == IPBAN_TIMEOUT_NEVER)
+        timeleftsecs = -1;
+    else
+        timeleftsecs = this->timeout - Com_GetRealtime();
+    Com_sprintf(message, len, "%s\n%s\n", this->banmsg, SV_WriteBanTimelimit(timeleftsecs, outbuffer, sizeof(outbuffer)));
+    return message;
 }
 
 
@@ -109,10 +529,6 @@ char* SV_PlayerBannedByip(netadr_t *netadr, char* message, int len){	//Gets call
 //duration is in minutes
 void SV_PlayerAddBanByip(netadr_t *remote, char *message, int expire){		//Gets called by future implemented ban-commands and if a prior ban got enforced again
 
-    ipBanList_t *list;
-    int i;
-    int oldest =	0;
-    unsigned int oldestTime = 0xFFFFFFFF;
     int duration;
 
     if(!remote)
@@ -125,53 +541,125 @@ void SV_PlayerAddBanByip(netadr_t *remote, char *message, int expire){		//Gets c
     if(!ipbantime || ipbantime->integer == 0)
         return;
 
-    for(list = &ipBans[0], i = 0; i < MAX_IPBANS; list++, i++){	//At first check whether we have already an entry for this player
-        if(NET_CompareBaseAdr(remote, &list->remote)){
-              break;
-        }
-    		if (list->systime < oldestTime) {
-    			oldestTime = list->systime;
-    			oldest = i;
-    		}
-    }
+    duration = expire - Com_GetRealtime();
+    if(duration > ipbantime->integer*60 || expire == -1)
+        duration = ipbantime->integer*60;	//Don't ban IPs for more than MAX_IPBAN_MINUTES minutes as they can be shared (Carrier-grade NAT)
+
+    SV_AddIPBan(remote, -1, message, expire, Com_GetRealtime() + duration);
+}
 
-    if(i == MAX_IPBANS){
-	 list = &ipBans[oldest];
+//Bans all addresses which match remote in the first netmask bits. Same matching as NET_CompareBaseAdrMask
+//expire -1 is a permanent ban
+void SV_PlayerAddBanByipRange(netadr_t *remote, int netmask, const char *message, int expire)
+{
+    if(!remote)
+    {
+        Com_PrintError(CON_CHANNEL_SERVER,"SV_PlayerAddBanByipRange: IP address is NULL\n");
+        return;
     }
-    list->remote = *remote;
+    SV_AddIPBan(remote, netmask, message, expire, expire == -1 ? IPBAN_TIMEOUT_NEVER : (unsigned int)expire);
+}
 
-    Q_strncpyz(list->banmsg, message, sizeof(list->banmsg));
+void SV_RemoveBanByipRange(netadr_t *remote, int netmask)
+{
+    int ban, bits;
 
-    list->expire = expire;
+    if(remote == NULL)
+        return;
 
-    duration = expire - Com_GetRealtime();
-    if(duration > ipbantime->integer*60 || expire == -1)
-        duration = ipbantime->integer*60;	//Don't ban IPs for more than MAX_IPBAN_MINUTES minutes as they can be shared (Carrier-grade NAT)
+    bits = SV_IPBanAddressBits(remote->type);
+    if(bits < 0)
+        return;
 
-    list->systime = Sys_Milliseconds();
+    if(netmask < 0 || netmask > bits)
+        netmask = bits;
 
-    list->timeout = Com_GetRealtime() + duration;
+    ban = SV_IPBanFind(remote, netmask);
+    if(ban)
+    {
+        SV_IPBanRemoveIndex(ban);
+    }
+}
 
+void SV_RemoveBanByip(netadr_t *remote)
+{
+    SV_RemoveBanByipRange(remote, -1);
 }
 
+/*
+Parses address[/bits]
+*/
+static qboolean SV_ParseIPBanAddress(const char *string, netadr_t *adr, int *netmask)
+{
+    char address[NET_ADDRSTRMAXLEN];
+    char *slash;
 
-void SV_RemoveBanByip(netadr_t *remote)
+    Q_strncpyz(address, string, sizeof(address));
+    *netmask = -1;
+
+    slash = strchr(address, '/');
+    if(slash)
+    {
+        *slash = '\0';
+        *netmask = atoi(slash +1);
+    }
+
+    if(NET_StringToAdr(address, adr, NA_UNSPEC) == 0)
+    {
+        Com_Printf(CON_CHANNEL_DONT_FILTER, "Bad address: %s\n", address);
+        return qfalse;
+    }
+    return qtrue;
+}
+
+/*
+banip <address[/bits]> <minutes> [reason]
+*/
+static void SV_BanIP_f()
 {
-    ipBanList_t *thisipban;
-    int i;
+    netadr_t adr;
+    int netmask, minutes;
+    const char *reason;
 
-    if(remote != NULL && remote->type != NA_BAD)
+    if(Cmd_Argc() < 3)
     {
-        for(thisipban = ipBans, i = 0; i < MAX_IPBANS; thisipban++, i++)
-        {
-            if(NET_CompareBaseAdr(remote, &thisipban->remote))
-            {
-                Com_Memset(thisipban,0,sizeof(ipBanList_t));
-                return;
-            }
-        }
+        Com_Printf(CON_CHANNEL_DONT_FILTER, "Usage: banip <address[/bits]> <minutes> [reason]\n");
+        return;
+    }
+
+    if(!SV_ParseIPBanAddress(Cmd_Argv(1), &adr, &netmask))
+        return;
+
+    minutes = atoi(Cmd_Argv(2));
+    if(minutes <= 0)
+    {
+        Com_Printf(CON_CHANNEL_DONT_FILTER, "Minutes have to be greater than 0\n");
+        return;
+    }
+    reason = Cmd_Argc() > 3 ? Cmd_Argv(3) : "You are banned from this server";
+
+    SV_PlayerAddBanByipRange(&adr, netmask, reason, Com_GetRealtime() + 60 * minutes);
+    Com_Printf(CON_CHANNEL_DONT_FILTER, "Banned %s for %d minutes\n", Cmd_Argv(1), minutes);
+}
+
+/*
+unbanip <address[/bits]>
+*/
+static void SV_UnbanIP_f()
+{
+    netadr_t adr;
+    int netmask;
 
+    if(Cmd_Argc() != 2)
+    {
+        Com_Printf(CON_CHANNEL_DONT_FILTER, "Usage: unbanip <address[/bits]>\n");
+        return;
     }
+
+    if(!SV_ParseIPBanAddress(Cmd_Argv(1), &adr, &netmask))
+        return;
+
+    SV_RemoveBanByipRange(&adr, netmask);
 }
 
 
@@ -215,6 +703,9 @@ void SV_InitBanlist()
     sv_banappealurl = Cvar_RegisterString("banlist_appealurl", "", 0, "Showing the url for ban appeal");
     sv_banappealminhours = Cvar_RegisterInt("banlist_appealminhours", DEFAULT_APPEAL_MINHOURS, 0, 336, 0, "How much hours have to be left for showing an appeal url");
 
+    Cmd_AddPCommand("banip", SV_BanIP_f, 80);
+    Cmd_AddPCommand("unbanip", SV_UnbanIP_f, 80);
+
 }
 
 void SV_AddBan(baninfo_t* baninfo)
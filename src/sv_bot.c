@@ -105,6 +105,7 @@ int SV_BotAllocateClient( void ) {
 
 	//gotnewcl:
 	Com_Memset(cl, 0x00, sizeof(client_t));
+	SV_ResetReliableCommands(cl);
 
 	cl->power = 0; //Sets the default power for the client
 	// (build a new connection
@@ -64,6 +64,11 @@
 
 
 static void SV_CloseDownload( client_t *cl );
+static void SV_SetDownloadXmitBlock( client_t *cl, int block );
+
+//Clients with a download in progress, used to split sv_maxDownloadRate
+static int sv_numDownloaders;
+static qboolean sv_downloaderCounted[MAX_CLIENTS];
 
 /*
 =================
@@ -393,11 +398,13 @@ __optimize3 __regparm1 void SV_DirectConnect( netadr_t *from ) {
 	if(version <= 7 && newcl->challenge == challenge && newcl->state && newcl->updateconnOK)
 	{
 		Com_Memset(newcl, 0x00, sizeof(client_t));
+		SV_ResetReliableCommands(newcl);
 		newcl->updateconnOK = qtrue;
 
 	}else{
 #endif
 		Com_Memset(newcl, 0x00, sizeof(client_t));
+		SV_ResetReliableCommands(newcl);
 
 #ifdef COD4X18UPDATE
 	}
@@ -522,6 +529,7 @@ __optimize3 __regparm1 void SV_DirectConnect( netadr_t *from ) {
 			Com_Printf(CON_CHANNEL_SERVER,"Rejected client %s because updatebackend is unavailable\n", nick);
 			SV_FreeClientScriptId(newcl);
 			Com_Memset(newcl, 0, sizeof(client_t));
+			SV_ResetReliableCommands(newcl);
 			return;
 		}
 		SV_ConnectWithUpdateProxy(newcl);
@@ -833,6 +841,7 @@ void SV_CloseAllClientHandles(client_t *drop)
 		SV_StopRecord(drop);
 	}
 
+	SV_ClearClientVoicePackets(drop);
 	SV_NotifySApiDisconnect(drop);
 	SV_DisconnectXAC(drop);
 	SV_CloseDownload(drop);
@@ -1034,7 +1043,7 @@ __optimize3 __regparm3 void SV_UserMove( client_t *cl, msg_t *msg, qboolean delt
 	// also use the message acknowledge
 	key ^= cl->messageAcknowledge;
 	// also use the last acknowledged server command in the key
-	key ^= Com_HashKey( cl->reliableCommands[ cl->reliableAcknowledge & ( MAX_RELIABLE_COMMANDS - 1 ) ].command, 32 );
+	key ^= Com_HashKey( (char*)SV_GetReliableCommand( cl, cl->reliableAcknowledge ), 32 );
 
 	ps = SV_GameClientNum( clientNum );
 
@@ -1278,6 +1287,7 @@ gentity_t* SV_AddBotClient( char* requested_name ){
 
 	//gotnewcl:
 	Com_Memset(cl, 0x00, sizeof(client_t));
+	SV_ResetReliableCommands(cl);
 
 	cl->power = 0; //Sets the default power for the client
 	// (build a new connection
@@ -1419,7 +1429,7 @@ void SV_WWWRedirect(client_t *cl, msg_t *msg){
     cl->wwwDl_var01 = qfalse;
 
     if(cl->download){
-        FS_FCloseFile(cl->download);
+        FS_CloseDownloadFile(cl->download);
     }
 
     cl->download = 0;
@@ -1428,6 +1438,11 @@ void SV_WWWRedirect(client_t *cl, msg_t *msg){
 
 
 
+#define MAX_DOWNLOAD_BLOCKSIZE 0xffff
+
+//Blocks of download files which could not be mapped are read into this
+static byte sv_downloadReadBuffer[MAX_DOWNLOAD_BLOCKSIZE];
+
 /*
 ==================
 SV_WriteDownloadToClient
@@ -1439,10 +1454,10 @@ Fill up msg with data
 
 __cdecl void SV_WriteDownloadToClient( client_t *cl ) {
 	char errorMessage[1024];
-	byte downloadBlock[0xffff];
+	const byte *downloadBlock;
 	int blockSize, filepos, remaining;
 	msg_t msg;
-	byte data[0xffff + 64];
+	byte data[MAX_DOWNLOAD_BLOCKSIZE + 64];
 
 	if ( !*cl->downloadName ) {
 		return; // Nothing being downloaded
@@ -1468,7 +1483,7 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl ) {
 		MSG_WriteLong( &msg, svc_download );
 
 
-		if ( !sv_allowDownload->integer || ( cl->downloadSize = FS_SV_FOpenFileRead( cl->downloadName, &cl->download ) ) <= 0 ) {
+		if ( !sv_allowDownload->integer || ( cl->download = FS_OpenDownloadFile( cl->downloadName, &cl->downloadSize ) ) == NULL ) {
 			// cannot auto-download file
 			if ( !sv_allowDownload->integer ) {
 				Com_Printf(CON_CHANNEL_SERVER, "clientDownload: %d : \"%s\" download disabled", cl - svs.clients, cl->downloadName );
@@ -1489,7 +1504,7 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl ) {
 
 			cl->wwwDl_var01 = 0;
 			if(cl->download){
-				FS_FCloseFile(cl->download);
+				FS_CloseDownloadFile(cl->download);
 			}
 			cl->download = 0;
 			*cl->downloadName = 0;
@@ -1515,7 +1530,8 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl ) {
 		}
 
 		// Init
-		cl->downloadCurrentBlock = cl->downloadClientBlock = cl->downloadXmitBlock = 0;
+		cl->downloadCurrentBlock = cl->downloadClientBlock = 0;
+		SV_SetDownloadXmitBlock(cl, 0);
 		cl->downloadCount = 0;
 		//No block has been requested yet - waiting for client to tell which block it wants
 		cl->downloadEOF = qtrue;
@@ -1536,14 +1552,7 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl ) {
 		return;
 	}
 
-	int i, numdl;
-
-	for(i = 0, numdl = 0; i < sv_maxclients->integer; ++i){
-		if(svs.clients[i].state >= CS_CONNECTED && svs.clients[i].downloadXmitBlock > 0)
-		{
-			++numdl;
-		}
-	}
+	int numdl = sv_numDownloaders;
 
 	if(numdl < 1)
 	{
@@ -1587,9 +1596,9 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl ) {
 	}
 
 
-	if(cl->downloadBlockSize > sizeof(downloadBlock))
+	if(cl->downloadBlockSize > MAX_DOWNLOAD_BLOCKSIZE)
 	{
-		cl->downloadBlockSize = sizeof(downloadBlock);
+		cl->downloadBlockSize = MAX_DOWNLOAD_BLOCKSIZE;
 	}
 
 	remaining = cl->downloadBeginOffset + cl->downloadNumBytes - cl->downloadCount;
@@ -1607,7 +1616,7 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl ) {
 			cl->downloadBlockSize = remaining;
 		}
 
-		blockSize = FS_Read( downloadBlock, cl->downloadBlockSize, cl->download );
+		blockSize = FS_GetDownloadFileBlock( cl->download, cl->downloadCount, cl->downloadBlockSize, sv_downloadReadBuffer, &downloadBlock );
 		if ( blockSize <= 0 ) {
 			// EOF right now
 			cl->downloadEOF = qtrue;  // We have added the EOF block
@@ -1813,6 +1822,27 @@ void SV_SendClientGameState( client_t *client ) {
 
 
 
+/*
+==================
+SV_SetDownloadXmitBlock
+
+Keeps the number of clients downloading from this server up to date. The slot
+remembers if it got counted because client_t gets wiped on connect
+==================
+*/
+static void SV_SetDownloadXmitBlock( client_t *cl, int block ) {
+	int clnum = cl - svs.clients;
+
+	if ( sv_downloaderCounted[clnum] && block <= 0 ) {
+		sv_downloaderCounted[clnum] = qfalse;
+		--sv_numDownloaders;
+	} else if ( !sv_downloaderCounted[clnum] && block > 0 ) {
+		sv_downloaderCounted[clnum] = qtrue;
+		++sv_numDownloaders;
+	}
+	cl->downloadXmitBlock = block;
+}
+
 /*
 ==================
 SV_CloseDownload
@@ -1823,11 +1853,11 @@ clear/free any download vars
 static void SV_CloseDownload( client_t *cl ) {
 	// EOF
 	if ( cl->download ) {
-		FS_FCloseFile( cl->download );
+		FS_CloseDownloadFile( cl->download );
 	}
 	cl->download = 0;
 	*cl->downloadName = 0;
-	cl->downloadXmitBlock = 0; //reset so we can still count clients downloading from server
+	SV_SetDownloadXmitBlock(cl, 0); //reset so we can still count clients downloading from server
 }
 
 
@@ -2278,7 +2308,7 @@ void SV_RetransmitDownload_f( client_t *cl ) {
 	int block = atoi( SV_Cmd_Argv( 1 ) );
 
 	if ( block == cl->downloadClientBlock ) {
-		cl->downloadXmitBlock = block;
+		SV_SetDownloadXmitBlock(cl, block);
 	}
 }
 
@@ -2312,7 +2342,7 @@ void SV_WWWDownload_Done_f(client_t *cl)
 
 	cl->wwwDl_var01 = 0;
 	if ( cl->download ) {
-		FS_FCloseFile( cl->download );
+		FS_CloseDownloadFile( cl->download );
 	}
 	cl->download = 0;
 	*cl->downloadName = 0;
@@ -2333,7 +2363,7 @@ void SV_WWWDownload_Fail_f(client_t *cl)
 	Com_PrintWarning(CON_CHANNEL_SERVER,"Client '%s' reported that the http download of '%s' failed, falling back to a server download\n", cl->name, cl->downloadName);
 	cl->wwwDl_var01 = 0;
 	if ( cl->download ) {
-		FS_FCloseFile( cl->download );
+		FS_CloseDownloadFile( cl->download );
 	}
 	cl->download = 0;
 	*cl->downloadName = 0;
@@ -2358,7 +2388,7 @@ void SV_WWWDownload_ChkFail_f(client_t *cl)
 
 	cl->wwwDl_var01 = 0;
 	if ( cl->download ) {
-		FS_FCloseFile( cl->download );
+		FS_CloseDownloadFile( cl->download );
 	}
 	cl->download = 0;
 	*cl->downloadName = 0;
@@ -2416,6 +2446,15 @@ void SV_SelectDownloadBlocksX_f( client_t *cl, msg_t* msg )
     cl->downloadNumBytes = MSG_ReadLong(msg);
     cl->downloadEOF = qfalse;
 
+    if( cl->downloadBeginOffset < 0 )
+    {
+        cl->downloadBeginOffset = 0;
+    }
+    if( cl->downloadNumBytes < 0 )
+    {
+        cl->downloadNumBytes = 0;
+    }
+
     //Expected file is longer than in reality
     if( cl->downloadBeginOffset > cl->downloadSize )
     {
@@ -2426,7 +2465,6 @@ void SV_SelectDownloadBlocksX_f( client_t *cl, msg_t* msg )
     {
         cl->downloadNumBytes = cl->downloadSize - cl->downloadBeginOffset;
     }
-    FS_Seek(cl->download, cl->downloadBeginOffset, FS_SEEK_SET);
     cl->downloadCount = cl->downloadBeginOffset;
     Com_Printf(CON_CHANNEL_SERVER,"DL Get blocks: %d len %d\n", cl->downloadBeginOffset, cl->downloadNumBytes);
     return;
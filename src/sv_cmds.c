@@ -49,6 +49,8 @@ These commands can only be entered from stdin or by a remote operator datagram
 #include "scr_vm.h"
 #include "cscr_memorytree.h"
 #include "cscr_variable.h"
+#include "maxmind_geoip.h"
+#include "kvstore.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -1855,6 +1857,69 @@ static void SV_MapRotate_f( void ) {
 	}
 }
 
+/*
+================
+SV_FirstMapInRotation
+
+Returns the map of the first "map <mapname>" pair in a rotation string
+================
+*/
+static qboolean SV_FirstMapInRotation(const char* rotation, char* map, int maxlen)
+{
+	char map_rotationbuf[CVAR_STRING_SIZE];
+	char* maplist;
+	int len;
+
+	Q_strncpyz(map_rotationbuf, rotation, sizeof(map_rotationbuf));
+	Com_ParseReset();
+	maplist = Com_ParseGetToken(map_rotationbuf);
+
+	while(maplist)
+	{
+		if(!Q_stricmpn(maplist, "map ", 4)){
+
+			maplist = Com_ParseGetToken(maplist);
+			if(maplist == NULL)
+				break;
+
+			len = Com_ParseTokenLength(maplist);
+			if(len >= maxlen)
+				len = maxlen -1;
+
+			Q_strncpyz(map, maplist, len+1);
+			return qtrue;
+		}
+		maplist = Com_ParseGetToken(maplist);
+	}
+	return qfalse;
+}
+
+/*
+================
+SV_PredictNextMap
+
+Figures out which map ExitLevel() is going to load without advancing the rotation.
+Returns qfalse if this isn't known yet, like for a random rotation which still has to be mixed
+================
+*/
+qboolean SV_PredictNextMap(char* map, int maxlen)
+{
+	if(*g_votedMapName->string){
+		Q_strncpyz(map, g_votedMapName->string, maxlen);
+		return qtrue;
+	}
+	if(*SV_GetNextMap()){
+		return SV_FirstMapInRotation(SV_GetNextMap(), map, maxlen);
+	}
+	if(sv_mapRotationCurrent->string[0] == '\0'){
+		if(sv_randomMapRotation->boolean)
+			return qfalse;
+
+		return SV_FirstMapInRotation(sv_mapRotation->string, map, maxlen);
+	}
+	return SV_FirstMapInRotation(sv_mapRotationCurrent->string, map, maxlen);
+}
+
 static void SV_MapRestart_f(void){
 
 	SV_MapRestart(qfalse);
@@ -2375,6 +2440,13 @@ void SV_AddOperatorCommands()
 
 	Cmd_AddPCommand("stoprecord", SV_StopRecord_f, 70);
 	Cmd_AddPCommand("record", SV_Record_f, 50);
+	Cmd_AddCommand ("geoipreload", GeoIP_Reload_f);
+	Cmd_AddCommand ("querycachestats", SV_QueryCacheStats_f);
+	Cmd_AddCommand ("demowriterstats", SV_DemoWriterStats_f);
+	Cmd_AddCommand ("kvstorestats", KVS_Stats_f);
+	Cmd_AddCommand ("scriptprofile", Scr_Profile_f);
+	Cmd_AddCommand ("downloadstats", FS_DownloadFileStats_f);
+	Cmd_AddCommand ("kvstorecompact", KVS_Compact_f);
 
 	if(Com_IsDeveloper()){
 		Cmd_AddCommand ("showconfigstring", SV_ShowConfigstring_f);
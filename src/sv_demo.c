@@ -30,20 +30,131 @@
 #include "server.h"
 #include "q_platform.h"
 #include "sys_main.h"
+#include "sys_thread.h"
 #include "net_game_conf.h"
+#include "zlib/zlib.h"
 
 #include <stdint.h>
 #include <string.h>
 
-#define FS_DEMOWRITEBUF_SIZE NETCHAN_UNSENTBUFFER_SIZE
-
 
 int FS_DemoWrite( const void *buffer, int len, fileHandleData_t* h );
-qboolean FS_FOpenDemoFileWrite( const char *filename, fileHandleData_t* h );
+int FS_DemoWriteSpace( fileHandleData_t *fh );
+qboolean FS_FOpenDemoFileWrite( const char *filename, fileHandleData_t* h, qboolean compress );
 qboolean FS_FCloseDemoFile( fileHandleData_t* f );
+qboolean FS_DemoCloseAndRun( fileHandleData_t *fh, const char* cmdline );
 qboolean FS_DemoFileExists( const char *file );
-void FS_DemoForceFlush(fileHandleData_t *fh);
-int FS_DemoFlush( fileHandleData_t *fh );
+void FS_DemoWaitForWriter( );
+
+/*
+==============================================================================
+
+Demo writer thread
+
+Every open demo file owns a single producer / single consumer byte ring. The
+game thread appends messages to the ring and never touches the FILE* again;
+the "DemoWriter" thread drains all rings to disk. head is only advanced by
+the game thread and tail only by the writer thread, both are published with
+an interlocked add so no lock is needed.
+If a ring is full the game thread does not wait: the message is dropped and
+the caller resynchronizes the demo with the next non delta snapshot.
+Closing hands the ring to the writer thread which drains it, closes the file
+and runs the completion command.
+fileHandleData_t::writebuffer of a demo handle points to its ring.
+
+Compressed demos (sv_demoCompress) are deflated on the writer thread into the
+.dmz container. The raw demo stream is split into independent zlib blocks,
+a new block starts at an archive frame once DEMO_SYNC_BLOCKSIZE bytes have
+been collected, so every block begins at a seekable sync point:
+
+	header:	"CDMZ", int version, int protocol, int sync blocksize
+	block:	"DMZB", int compressed length, int uncompressed length,
+		int archive index, int commandTime, zlib data
+
+All integers are little endian. The first block has the archive index -1.
+Concatenating all inflated blocks gives the classic .dm_1 file again,
+tools/demo_uncompress does exactly that.
+
+==============================================================================
+*/
+
+#define DEMO_RING_SIZE		(1 << 20) //Per recording, has to be a power of two
+#define DEMO_RING_MASK		(DEMO_RING_SIZE - 1)
+#define DEMO_RING_RESERVE	64 //Always kept free so the end of demo marker fits
+#define DEMO_RING_WAKESIZE	(16 * 1024) //Wake the writer after this many new bytes
+#define DEMO_MAX_RINGS		(2 * MAX_CLIENTS) //Recordings plus files still being drained
+
+#define DEMO_COMPRESSED_EXT	".dmz"
+#define DEMO_COMPRESSED_VERSION	1
+#define DEMO_SYNC_BLOCKSIZE	(256 * 1024)
+#define DEMO_BLOCKHEADER_SIZE	20
+#define DEMO_ARCHIVE_SIZE	53 //Size of a SV_WriteDemoArchive frame
+
+typedef enum
+{
+	DEMORING_FREE,
+	DEMORING_ACTIVE,
+	DEMORING_CLOSING
+}demoRingState_t;
+
+typedef struct
+{
+	z_stream	stream;
+	byte*		out; //Compressed data of the current block
+	int		outSize;
+	int		blockLen; //Uncompressed bytes in the current block
+	int		msgRemaining; //Bytes of the current demo message not yet compressed
+	int		syncIndex; //Sync information of the current block
+	int		syncTime;
+	qboolean	headerWritten;
+	qboolean	raw; //Stream is not parseable anymore, don't look for sync points
+}demoCompressor_t;
+
+typedef struct
+{
+	volatile DWORD	state;
+	volatile DWORD	head; //Bytes produced, written by the game thread
+	volatile DWORD	tail; //Bytes consumed, written by the writer thread
+	volatile DWORD	error;
+	DWORD		wakeHead; //head when the writer was woken the last time
+	FILE*		file;
+	byte*		data;
+	demoCompressor_t* compressor; //NULL for uncompressed demos
+	char		completedCmd[1024];
+}demoRing_t;
+
+static struct
+{
+	demoRing_t	rings[DEMO_MAX_RINGS];
+	volatile HANDLE	wakeEvent;
+	threadid_t	threadid;
+	qboolean	started;
+	//Game thread statistics
+	unsigned long long bytesQueued;
+	unsigned int	messagesDropped;
+	unsigned int	peakFill;
+	unsigned int	wakeups;
+	//Writer thread statistics
+	volatile unsigned long long bytesWritten;
+	volatile DWORD	flushes;
+	volatile DWORD	writeErrors;
+}demoWriter;
+
+
+/*
+====================
+SV_DemoDropMessage
+
+The demo writer can not keep up. Drop the message and continue the demo
+with the next non delta snapshot, same as at the beginning of a recording
+====================
+*/
+static void SV_DemoDropMessage( client_t *client ){
+
+	demoWriter.messagesDropped++;
+	client->demowaiting = qtrue;
+	client->demoDeltaFrameCount = 0;
+}
 
 /*
 ====================
@@ -79,6 +190,10 @@ void SV_WriteDemoArchive(client_t *client){
 	MSG_WriteVector(&msg, ps->viewangles);
 	client->demoArchiveIndex++;
 
+	if(FS_DemoWriteSpace( &client->demofile ) < msg.cursize){
+		SV_DemoDropMessage( client );
+		return;
+	}
 	FS_DemoWrite( msg.data, msg.cursize, &client->demofile );
 }
 
@@ -105,6 +220,11 @@ void SV_WriteDemoMessageForClient( byte *data, int dataLen, client_t *client ){
 
 	// write the servermessagelength
 	MSG_WriteLong(&msg, LittleLong( dataLen ));
+
+	if(FS_DemoWriteSpace( &client->demofile ) < msg.cursize + dataLen){
+		SV_DemoDropMessage( client );
+		return;
+	}
 	FS_DemoWrite( msg.data, msg.cursize, &client->demofile );
 
 	FS_DemoWrite( data, dataLen, &client->demofile );
@@ -139,22 +259,26 @@ void SV_StopRecord( client_t *cl ) {
 	FS_DemoWrite( &len, 4, &cl->demofile );
 	FS_DemoWrite( &len, 4, &cl->demofile );
 
-	FS_FCloseDemoFile( &cl->demofile );
 	cl->demorecording = qfalse;
 	Com_Printf(CON_CHANNEL_SERVERDEMO, "Stopped demo for: %s\n", cl->name);
 
 	if(!*sv_demoCompletedCmd->string)
+	{
+		FS_FCloseDemoFile( &cl->demofile );
 		return;
+	}
 
 	if(strstr(sv_demoCompletedCmd->string, ".."))
 	{
+		FS_FCloseDemoFile( &cl->demofile );
 		Com_PrintWarning(CON_CHANNEL_SERVERDEMO,"Commandlines containing \"..\" are not allowed\n");
 		return;
 	}
 
 	Com_sprintf(cmdline, sizeof(cmdline), "\"%s/apps/%s\" \"%s/%s\"", fs_homepath->string, sv_demoCompletedCmd->string, fs_homepath->string, cl->demoName);
 
-	Sys_DoStartProcess(cmdline);
+	//Runs after the writer thread has closed the file
+	FS_DemoCloseAndRun( &cl->demofile, cmdline );
 
 }
 
@@ -215,27 +339,28 @@ void SV_RecordClient( client_t* cl, char* basename ) {
 		basename = "demo";
 	}
 
-	// scan for a free demo name
+	// scan for a free demo name, compressed and plain demos share the numbering
 	for ( number = 0 ; number <= 9999 ; number++ ) {
 		SV_DemoFilename( number, basename, demoName );
 		Com_sprintf( name, sizeof( name ), "demos/%s.dm_%d", demoName, 1 );
 
-		if ( !FS_DemoFileExists( name ) ) {
+		if ( !FS_DemoFileExists( name ) && !FS_DemoFileExists( va("%s" DEMO_COMPRESSED_EXT, name) ) ) {
 			break;  // file doesn't exist
 		}
 	}
 
+	if( sv_demoCompress->boolean ) {
+		Q_strncat( name, sizeof( name ), DEMO_COMPRESSED_EXT );
+	}
+
 	// open the demo file
 	Com_Printf(CON_CHANNEL_SERVERDEMO, "recording to %s.\n", name );
-	if(!FS_FOpenDemoFileWrite( name, &cl->demofile ))
+	if(!FS_FOpenDemoFileWrite( name, &cl->demofile, sv_demoCompress->boolean ))
 	{
 		Com_Printf(CON_CHANNEL_SERVERDEMO, "ERROR: couldn't open.\n" );
 		return;
 	}
 
-	//For fwrite debug purpose only
-	FS_DemoForceFlush(&cl->demofile);
-
 
 	cl->demorecording = qtrue;
 	Q_strncpyz( cl->demoName, name, sizeof( cl->demoName ));
@@ -316,6 +441,7 @@ void SV_DemoSystemShutdown( ) {
 		if(cl->demorecording)
 			SV_StopRecord(cl);
 	}
+	FS_DemoWaitForWriter();
 }
 
 
@@ -363,52 +489,534 @@ qboolean FS_DemoFileOpened( fileHandleData_t *fh ) {
 
 
 
+static DWORD FS_DemoRingUsed( demoRing_t* ring )
+{
+	return ring->head - Sys_InterlockedExchangeAdd(&ring->tail, 0);
+}
+
 /*
-==============
-FS_FCloseDemoFile
+=================
+FS_DemoRingFlush
 
-If the FILE pointer is an open pak file, leave it open.
+Writer thread only: writes everything published so far to the file
+Returns qfalse on a write error
+=================
+*/
+static qboolean FS_DemoRingFlush( demoRing_t* ring )
+{
+	DWORD head, tail, block;
+	size_t written;
 
-For some reason, other dll's can't just cal fclose()
-on files returned by FS_FOpenFile...
-==============
+	head = Sys_InterlockedExchangeAdd(&ring->head, 0);
+	tail = ring->tail;
+
+	while(head != tail)
+	{
+		block = head - tail;
+		if(block > DEMO_RING_SIZE - (tail & DEMO_RING_MASK))
+		{
+			block = DEMO_RING_SIZE - (tail & DEMO_RING_MASK);
+		}
+		written = fwrite(ring->data + (tail & DEMO_RING_MASK), 1, block, ring->file);
+		if(written == 0)
+		{
+			Sys_InterlockedIncrement(&demoWriter.writeErrors);
+			return qfalse;
+		}
+		demoWriter.bytesWritten += written;
+		tail += written;
+		Sys_InterlockedExchangeAdd(&ring->tail, written);
+	}
+	Sys_InterlockedIncrement(&demoWriter.flushes);
+	return qtrue;
+}
+
+/*
+==============================================================================
+
+Compressed demos, writer thread only
+
+==============================================================================
 */
-qboolean FS_FCloseDemoFile( fileHandleData_t *fh ) {
-	// we didn't find it as a pak, so close it as a unique file
 
-	if (fh->handleFiles.file.o) {
-	    FS_DemoFlush( fh );
-	    if(fh->writebuffer){
-		L_Free(fh->writebuffer);
-	    }
-	    fclose (fh->handleFiles.file.o);
-	    Com_Memset( fh, 0, sizeof( fileHandleData_t ) );
-	    return qtrue;
+static void* FS_DemoZAlloc( void* opaque, unsigned int items, unsigned int size )
+{
+	return L_Malloc(items * size);
+}
+
+static void FS_DemoZFree( void* opaque, void* ptr )
+{
+	L_Free(ptr);
+}
+
+static void FS_DemoFreeCompressor( demoRing_t* ring )
+{
+	if(ring->compressor == NULL)
+	{
+		return;
+	}
+	deflateEnd(&ring->compressor->stream);
+	L_Free(ring->compressor->out);
+	L_Free(ring->compressor);
+	ring->compressor = NULL;
+}
+
+static void FS_DemoRingPeek( demoRing_t* ring, DWORD pos, void* out, int len )
+{
+	int offset, block;
+
+	offset = pos & DEMO_RING_MASK;
+	block = DEMO_RING_SIZE - offset;
+	if(block > len)
+	{
+		block = len;
+	}
+	Com_Memcpy(out, ring->data + offset, block);
+	Com_Memcpy((byte*)out + block, ring->data, len - block);
+}
+
+static qboolean FS_DemoFileWrite( demoRing_t* ring, const void* data, int len )
+{
+	if(len > 0 && fwrite(data, 1, len, ring->file) != (size_t)len)
+	{
+		Sys_InterlockedIncrement(&demoWriter.writeErrors);
+		return qfalse;
+	}
+	demoWriter.bytesWritten += len;
+	return qtrue;
+}
+
+static qboolean FS_DemoGrowOutput( demoCompressor_t* comp )
+{
+	int used = comp->outSize - comp->stream.avail_out;
+	byte* out = L_Malloc(2 * comp->outSize);
+
+	if(out == NULL)
+	{
+		return qfalse;
+	}
+	Com_Memcpy(out, comp->out, used);
+	L_Free(comp->out);
+	comp->out = out;
+	comp->outSize *= 2;
+	comp->stream.next_out = out + used;
+	comp->stream.avail_out = comp->outSize - used;
+	return qtrue;
+}
+
+static qboolean FS_DemoCompressData( demoCompressor_t* comp, byte* data, int len )
+{
+	comp->stream.next_in = data;
+	comp->stream.avail_in = len;
+
+	while(comp->stream.avail_in > 0)
+	{
+		if(comp->stream.avail_out == 0 && !FS_DemoGrowOutput(comp))
+		{
+			return qfalse;
+		}
+		if(deflate(&comp->stream, Z_NO_FLUSH) == Z_STREAM_ERROR)
+		{
+			return qfalse;
+		}
+	}
+	comp->blockLen += len;
+	return qtrue;
+}
+
+/*
+=================
+FS_DemoWriteBlock
+
+Finishes the current zlib block, writes it out and starts a new one
+=================
+*/
+static qboolean FS_DemoWriteBlock( demoRing_t* ring )
+{
+	demoCompressor_t* comp = ring->compressor;
+	int header[DEMO_BLOCKHEADER_SIZE / 4];
+	int status, used;
+
+	if(comp->blockLen == 0)
+	{
+		return qtrue;
+	}
+
+	while((status = deflate(&comp->stream, Z_FINISH)) != Z_STREAM_END)
+	{
+		if(status != Z_OK && status != Z_BUF_ERROR)
+		{
+			return qfalse;
+		}
+		if(!FS_DemoGrowOutput(comp))
+		{
+			return qfalse;
+		}
 	}
+	used = comp->outSize - comp->stream.avail_out;
 
-	if(fh->writebuffer){
-		L_Free(fh->writebuffer);
+	Com_Memcpy(&header[0], "DMZB", 4);
+	header[1] = LittleLong(used);
+	header[2] = LittleLong(comp->blockLen);
+	header[3] = LittleLong(comp->syncIndex);
+	header[4] = LittleLong(comp->syncTime);
+
+	if(!FS_DemoFileWrite(ring, header, sizeof(header)) || !FS_DemoFileWrite(ring, comp->out, used))
+	{
+		return qfalse;
 	}
 
+	deflateReset(&comp->stream);
+	comp->stream.next_out = comp->out;
+	comp->stream.avail_out = comp->outSize;
+	comp->blockLen = 0;
+	return qtrue;
+}
+
+/*
+=================
+FS_DemoRingCompress
+
+Compresses everything published so far. The stream is parsed message by
+message so blocks can be split in front of archive frames. A message header
+which is not yet complete is left in the ring until the next call, unless this
+is the final call for the file.
+=================
+*/
+static qboolean FS_DemoRingCompress( demoRing_t* ring, qboolean final )
+{
+	demoCompressor_t* comp = ring->compressor;
+	DWORD head, tail, avail, block;
+	byte msghdr[DEMO_ARCHIVE_SIZE];
+	int header[4];
+	int msgLen;
+
+	if(!comp->headerWritten)
+	{
+		Com_Memcpy(&header[0], "CDMZ", 4);
+		header[1] = LittleLong(DEMO_COMPRESSED_VERSION);
+		header[2] = LittleLong(PROTOCOL_VERSION);
+		header[3] = LittleLong(DEMO_SYNC_BLOCKSIZE);
+		if(!FS_DemoFileWrite(ring, header, sizeof(header)))
+		{
+			return qfalse;
+		}
+		comp->headerWritten = qtrue;
+	}
+
+	head = Sys_InterlockedExchangeAdd(&ring->head, 0);
+	tail = ring->tail;
+
+	while(head != tail)
+	{
+		avail = head - tail;
+
+		if(comp->msgRemaining == 0 && !comp->raw)
+		{
+			FS_DemoRingPeek(ring, tail, msghdr, 1);
+			switch(msghdr[0])
+			{
+				case 0: //Network message: type, sequence, length, data
+					if(avail < 9)
+					{
+						break;
+					}
+					FS_DemoRingPeek(ring, tail, msghdr, 9);
+					msgLen = LittleLong(*(int*)(msghdr + 5));
+					comp->msgRemaining = 9 + (msgLen > 0 ? msgLen : 0);
+					break;
+				case 1: //Archive frame: type, index, origin, velocity, 2 longs, commandTime, viewangles
+					if(avail < DEMO_ARCHIVE_SIZE)
+					{
+						break;
+					}
+					if(comp->blockLen >= DEMO_SYNC_BLOCKSIZE)
+					{
+						if(!FS_DemoWriteBlock(ring))
+						{
+							return qfalse;
+						}
+						FS_DemoRingPeek(ring, tail, msghdr, DEMO_ARCHIVE_SIZE);
+						comp->syncIndex = LittleLong(*(int*)(msghdr + 1));
+						comp->syncTime = LittleLong(*(int*)(msghdr + 37));
+					}
+					comp->msgRemaining = DEMO_ARCHIVE_SIZE;
+					break;
+				case 2: //Demo header
+					comp->msgRemaining = 17;
+					break;
+				default:
+					comp->raw = qtrue;
+					break;
+			}
+			if(comp->msgRemaining == 0 && !comp->raw)
+			{
+				if(!final)
+				{
+					break; //Wait for the rest of the header
+				}
+				comp->raw = qtrue;
+			}
+		}
+		if(comp->raw)
+		{
+			comp->msgRemaining = avail;
+		}
+
+		block = avail;
+		if(block > (DWORD)comp->msgRemaining)
+		{
+			block = comp->msgRemaining;
+		}
+		if(block > DEMO_RING_SIZE - (tail & DEMO_RING_MASK))
+		{
+			block = DEMO_RING_SIZE - (tail & DEMO_RING_MASK);
+		}
+		if(!FS_DemoCompressData(comp, ring->data + (tail & DEMO_RING_MASK), block))
+		{
+			return qfalse;
+		}
+		comp->msgRemaining -= block;
+		tail += block;
+		Sys_InterlockedExchangeAdd(&ring->tail, block);
+	}
+
+	if(final)
+	{
+		return FS_DemoWriteBlock(ring);
+	}
+	return qtrue;
+}
+
+/*
+=================
+FS_DemoRingFinish
+
+Writer thread only: closes the file of a drained ring and releases the slot
+=================
+*/
+static void FS_DemoRingFinish( demoRing_t* ring )
+{
+	fclose(ring->file);
+	ring->file = NULL;
+
+	if(ring->completedCmd[0] && !ring->error)
+	{
+		Sys_DoStartProcess(ring->completedCmd);
+	}
+
+	FS_DemoFreeCompressor(ring);
+	L_Free(ring->data);
+	ring->data = NULL;
+	Sys_InterlockedCompareExchange(&ring->state, DEMORING_FREE, DEMORING_CLOSING);
+}
+
+void* FS_DemoWriterThread(void* null)
+{
+	int i;
+	DWORD state;
+	demoRing_t* ring;
+
+	while(qtrue)
+	{
+		Sys_WaitForObject(demoWriter.wakeEvent);
+		Sys_ResetEvent(demoWriter.wakeEvent);
+
+		for(i = 0, ring = demoWriter.rings; i < DEMO_MAX_RINGS; i++, ring++)
+		{
+			state = Sys_InterlockedExchangeAdd(&ring->state, 0);
+			if(state == DEMORING_FREE)
+			{
+				continue;
+			}
+			if(ring->compressor)
+			{
+				if(!ring->error && !FS_DemoRingCompress(ring, state == DEMORING_CLOSING))
+				{
+					Sys_InterlockedIncrement(&ring->error);
+				}
+			}
+			else if(!ring->error && !FS_DemoRingFlush(ring))
+			{
+				//The game thread reports the error and closes the file
+				Sys_InterlockedIncrement(&ring->error);
+			}
+			if(state == DEMORING_CLOSING)
+			{
+				FS_DemoRingFinish(ring);
+			}
+		}
+	}
+	return NULL;
+}
+
+static void FS_DemoWakeWriter( )
+{
+	demoWriter.wakeups++;
+	Sys_SetEvent(demoWriter.wakeEvent);
+}
+
+static qboolean FS_DemoStartWriter( )
+{
+	if(demoWriter.started)
+	{
+		return qtrue;
+	}
+	demoWriter.wakeEvent = Sys_CreateEvent(qtrue, qfalse, "wakedemowriter");
+	if(Sys_CreateNewThread(FS_DemoWriterThread, &demoWriter.threadid, NULL) == qfalse)
+	{
+		Com_PrintError(CON_CHANNEL_SERVERDEMO, "Couldn't create the demo writer thread\n");
+		return qfalse;
+	}
+	Sys_SetThreadName(demoWriter.threadid, "DemoWriter");
+	demoWriter.started = qtrue;
+	return qtrue;
+}
+
+/*
+=================
+FS_DemoWaitForWriter
+
+Blocks until every closed demo file has been written out. Only used on shutdown
+=================
+*/
+void FS_DemoWaitForWriter( )
+{
+	int i, msec;
+	qboolean pending;
+
+	if(!demoWriter.started)
+	{
+		return;
+	}
+
+	for(msec = 0; msec < 10000; msec++)
+	{
+		pending = qfalse;
+		for(i = 0; i < DEMO_MAX_RINGS; i++)
+		{
+			if(Sys_InterlockedExchangeAdd(&demoWriter.rings[i].state, 0) != DEMORING_FREE)
+			{
+				pending = qtrue;
+				break;
+			}
+		}
+		if(!pending)
+		{
+			return;
+		}
+		Sys_SetEvent(demoWriter.wakeEvent);
+		Sys_SleepUSec(1000);
+	}
+	Com_PrintWarning(CON_CHANNEL_SERVERDEMO, "Timed out waiting for the demo writer thread\n");
+}
+
+/*
+=================
+FS_DemoCloseAndRun
+
+Hands the demo file over to the writer thread. cmdline, if given, is executed
+once the file is completely written and closed.
+=================
+*/
+qboolean FS_DemoCloseAndRun( fileHandleData_t *fh, const char* cmdline ) {
+
+	demoRing_t* ring = (demoRing_t*)fh->writebuffer;
+
+	if(ring == NULL)
+	{
+		Com_Memset( fh, 0, sizeof( fileHandleData_t ) );
+		return qfalse;
+	}
+
+	if(cmdline)
+	{
+		Q_strncpyz(ring->completedCmd, cmdline, sizeof(ring->completedCmd));
+	}
+	Sys_InterlockedCompareExchange(&ring->state, DEMORING_CLOSING, DEMORING_ACTIVE);
+	FS_DemoWakeWriter();
+
 	Com_Memset( fh, 0, sizeof( fileHandleData_t ) );
-	return qfalse;
+	return qtrue;
 }
 
+/*
+==============
+FS_FCloseDemoFile
+
+The file gets closed by the writer thread after all pending data is written
+==============
+*/
+qboolean FS_FCloseDemoFile( fileHandleData_t *fh ) {
+	return FS_DemoCloseAndRun( fh, NULL );
+}
+
+
+static demoCompressor_t* FS_DemoCreateCompressor( )
+{
+	demoCompressor_t* comp = L_Malloc(sizeof(demoCompressor_t));
+
+	if(comp == NULL)
+	{
+		return NULL;
+	}
+	Com_Memset(comp, 0, sizeof(demoCompressor_t));
+
+	comp->outSize = 64 * 1024;
+	comp->out = L_Malloc(comp->outSize);
+	comp->stream.zalloc = FS_DemoZAlloc;
+	comp->stream.zfree = FS_DemoZFree;
+
+	if(comp->out == NULL || deflateInit(&comp->stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+	{
+		if(comp->out)
+		{
+			L_Free(comp->out);
+		}
+		L_Free(comp);
+		return NULL;
+	}
+	comp->stream.next_out = comp->out;
+	comp->stream.avail_out = comp->outSize;
+	comp->syncIndex = -1;
+	return comp;
+}
 
 /*
 ===========
 FS_FOpenDemoFileWrite
 
+With compress set the file is written as .dmz container by the writer thread
 ===========
 */
-qboolean FS_FOpenDemoFileWrite( const char *filename, fileHandleData_t *fh ) {
+qboolean FS_FOpenDemoFileWrite( const char *filename, fileHandleData_t *fh, qboolean compress ) {
 
 	char ospath[MAX_OSPATH];
+	demoRing_t* ring;
+	int i;
 
 	if ( !FS_Initialized() ) {
 		Com_Error( ERR_FATAL, "Filesystem call made without initialization" );
 	}
 
+	if(!FS_DemoStartWriter())
+	{
+		return qfalse;
+	}
+
+	for(i = 0, ring = demoWriter.rings; i < DEMO_MAX_RINGS; i++, ring++)
+	{
+		if(Sys_InterlockedExchangeAdd(&ring->state, 0) == DEMORING_FREE)
+		{
+			break;
+		}
+	}
+	if(i == DEMO_MAX_RINGS)
+	{
+		Com_PrintWarning(CON_CHANNEL_SERVERDEMO, "FS_FOpenDemoFileWrite: Too many demo files pending\n");
+		return qfalse;
+	}
+
 	FS_BuildOSPathForThread( fs_homepath->string, filename, "", ospath, 0 );
 	ospath[strlen(ospath)-1] = '\0';
 
@@ -430,118 +1038,139 @@ qboolean FS_FOpenDemoFileWrite( const char *filename, fileHandleData_t *fh ) {
 	if (!fh->handleFiles.file.o) {
 		return qfalse;
 	}
-	fh->writebuffer = L_Malloc(FS_DEMOWRITEBUF_SIZE);
-	fh->bufferSize = FS_DEMOWRITEBUF_SIZE;
+	//The writer thread writes whole blocks out of the ring, stdio buffering on top only delays them.
+	//Has to be set before the first write and before the ring gets published
+	setvbuf( fh->handleFiles.file.o, NULL, _IONBF, 0 );
+
+	ring->data = L_Malloc(DEMO_RING_SIZE);
+	ring->compressor = compress ? FS_DemoCreateCompressor() : NULL;
+	if(ring->data == NULL || (compress && ring->compressor == NULL))
+	{
+		FS_DemoFreeCompressor(ring);
+		if(ring->data)
+		{
+			L_Free(ring->data);
+			ring->data = NULL;
+		}
+		fclose(fh->handleFiles.file.o);
+		Com_Memset( fh, 0, sizeof( fileHandleData_t ) );
+		return qfalse;
+	}
+	ring->file = fh->handleFiles.file.o;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->error = 0;
+	ring->wakeHead = 0;
+	ring->completedCmd[0] = '\0';
+	//Publishes the ring to the writer thread
+	Sys_InterlockedCompareExchange(&ring->state, DEMORING_ACTIVE, DEMORING_FREE);
+
+	fh->writebuffer = ring;
+	fh->bufferSize = DEMO_RING_SIZE;
 	return qtrue;
 }
 
 /*
 =================
-FS_DemoWrite
+FS_DemoWriteSpace
 
-Properly handles partial writes
+Bytes that can be written at once without dropping data
 =================
 */
-int FS_DemoWrite( const void *buffer, int len, fileHandleData_t *fh ) {
+int FS_DemoWriteSpace( fileHandleData_t *fh ) {
 
-	byte* wb;
-	int oldBufferPos;
+	demoRing_t* ring;
 
-	if ( !fh || !fh->handleFiles.file.o) {
+	if ( !fh || !fh->handleFiles.file.o || !fh->writebuffer ) {
 		return 0;
 	}
+	ring = (demoRing_t*)fh->writebuffer;
 
-	wb = (byte*)fh->writebuffer;
+	return DEMO_RING_SIZE - DEMO_RING_RESERVE - FS_DemoRingUsed(ring);
+}
 
-	if(wb == NULL){
+/*
+=================
+FS_DemoWrite
 
-		fh->writebuffer = (void*)buffer;
-		fh->bufferPos = len;
-		oldBufferPos = fh->bufferPos;
+Queues data for the writer thread. Never blocks, returns 0 if the data did
+not fit or the file had a write error
+=================
+*/
+int FS_DemoWrite( const void *buffer, int len, fileHandleData_t *fh ) {
 
-		if(FS_DemoFlush( fh ) != oldBufferPos){ //Fatal file write error
-			Com_Printf(CON_CHANNEL_SERVERDEMO,"Demo file write error. Closing file %s\n", fh->name);
-			FS_FCloseDemoFile( fh );
-			return 0;
-		}
+	demoRing_t* ring;
+	DWORD used, offset, block;
 
-		fh->writebuffer = NULL;
-		return len;
+	if ( !fh || !fh->handleFiles.file.o || !fh->writebuffer ) {
+		return 0;
 	}
 
-	oldBufferPos = fh->bufferPos;
+	ring = (demoRing_t*)fh->writebuffer;
 
-	if(len + fh->bufferPos > fh->bufferSize){ //If the buffer is too small to take more data flush it
-		if(FS_DemoFlush( fh ) != oldBufferPos){ //Fatal file write error
-			Com_Printf(CON_CHANNEL_SERVERDEMO,"Demo file write error. Closing file %s\n", fh->name);
-			FS_FCloseDemoFile( fh );
-			return 0;
-		}
+	if(Sys_InterlockedExchangeAdd(&ring->error, 0)){ //Fatal file write error
+		Com_Printf(CON_CHANNEL_SERVERDEMO,"Demo file write error. Closing file %s\n", fh->name);
+		FS_FCloseDemoFile( fh );
+		return 0;
 	}
 
-	Com_Memcpy(wb + fh->bufferPos, buffer, len);
-	fh->bufferPos += len;
-
-	return len;
-}
-
-/*
-=================
-FS_DemoFlush
+	used = FS_DemoRingUsed(ring);
 
-Writting buffer to file
-=================
-*/
-int FS_DemoFlush( fileHandleData_t *fh ) {
-	int	block, remaining;
-	int	written, overallwritten;
-	byte	*buf;
-	int	tries;
-	FILE	*f;
-	const void *buffer = fh->writebuffer;
-	int len = fh->bufferPos;
-
-	if ( !fh ) {
+	if(len <= 0 || used + len > DEMO_RING_SIZE){
 		return 0;
 	}
 
-	f = fh->handleFiles.file.o;
-	buf = (byte *)buffer;
-
-	remaining = len;
-	tries = 0;
-	overallwritten = 0;
-	while (remaining) {
-		block = remaining;
-		written = fwrite (buf, 1, block, f);
-		overallwritten += written;
-		if (written == 0) {
-			if (!tries) {
-				tries = 1;
-			} else {
-				Com_Printf(CON_CHANNEL_SERVERDEMO, "FS_DemoFlush: 0 bytes written\n" );
-				return 0;
-			}
-		}
+	offset = ring->head & DEMO_RING_MASK;
+	block = DEMO_RING_SIZE - offset;
+	if(block > (DWORD)len)
+	{
+		block = len;
+	}
+	Com_Memcpy(ring->data + offset, buffer, block);
+	Com_Memcpy(ring->data, (const byte*)buffer + block, len - block);
 
-		if (written == -1) {
-			Com_Printf(CON_CHANNEL_SERVERDEMO, "FS_DemoFlush: -1 bytes written\n" );
-			return 0;
-		}
+	//Publish the data after it has been copied
+	Sys_InterlockedExchangeAdd(&ring->head, len);
 
-		remaining -= written;
-		buf += written;
+	used += len;
+	if(used > demoWriter.peakFill)
+	{
+		demoWriter.peakFill = used;
 	}
+	demoWriter.bytesQueued += len;
 
-	fh->bufferPos = 0; //Reset the buffer offset to the beginning
-
-	return overallwritten;
+	if(ring->head - ring->wakeHead >= DEMO_RING_WAKESIZE)
+	{
+		ring->wakeHead = ring->head;
+		FS_DemoWakeWriter();
+	}
+	return len;
 }
 
+/*
+=================
+SV_DemoWriterStats_f
+=================
+*/
+void SV_DemoWriterStats_f( void )
+{
+	int i, active, closing;
+	DWORD state;
 
+	active = closing = 0;
+	for(i = 0; i < DEMO_MAX_RINGS; i++)
+	{
+		state = demoWriter.rings[i].state;
+		if(state == DEMORING_ACTIVE)
+			active++;
+		else if(state == DEMORING_CLOSING)
+			closing++;
+	}
 
-void FS_DemoForceFlush(fileHandleData_t *fh){
-
-	setvbuf( fh->handleFiles.file.o, NULL, _IONBF, 0 );
-
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "Demo writer: %s, %d recording, %d closing, %d KiB buffer per recording\n",
+		demoWriter.started ? "running" : "not started", active, closing, DEMO_RING_SIZE / 1024);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "%llu bytes queued, %llu bytes written, %u flushes, %u wakeups\n",
+		demoWriter.bytesQueued, demoWriter.bytesWritten, (unsigned int)demoWriter.flushes, demoWriter.wakeups);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "Backpressure: %u messages dropped, peak fill %u bytes, %u write errors\n",
+		demoWriter.messagesDropped, demoWriter.peakFill, (unsigned int)demoWriter.writeErrors);
 }
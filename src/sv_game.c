@@ -810,6 +810,7 @@ void __cdecl SV_ShutdownGameVM(int clearScripts)
 
   assert(Sys_IsMainThread());
   PIXBeginNamedEvent(-1, "SV_ShutdownGameVM");
+  Scr_FS_CancelAsyncCallbacks();
   G_ShutdownGame(clearScripts);
 /*  if ( GetCurrentThreadId() == (_DWORD)g_DXDeviceThread && 0 == dword_A8402BC )
   {
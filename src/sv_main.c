@@ -50,10 +50,12 @@
 #include "cscr_stringlist.h"
 #include "cscr_variable.h"
 #include "g_sv_main.h"
+#include "maxmind_geoip.h"
 #include "sapi.h"
 #include "xac_helper.h"
 #include "db_load.h"
 #include "sec_crypto.h"
+#include "kvstore.h"
 
 #include <string.h>
 #include <stdarg.h>
@@ -101,6 +103,7 @@ cvar_t	*g_friendlyPlayerCanBlock;
 cvar_t	*g_FFAPlayerCanBlock;
 cvar_t	*sv_autodemorecord;
 cvar_t	*sv_demoCompletedCmd;
+cvar_t	*sv_demoCompress;
 cvar_t	*sv_screenshotArrivedCmd;
 cvar_t	*sv_mapDownloadCompletedCmd;
 cvar_t	*sv_master[MAX_MASTER_SERVERS];	// master server ip address
@@ -127,6 +130,11 @@ cvar_t* sv_serverid;
 cvar_t* sv_pure;
 cvar_t* sv_fps;
 cvar_t* sv_showAverageBPS;
+cvar_t* sv_snapshotThreads;
+cvar_t* sv_checksumThreads;
+cvar_t* sv_preloadNextMap;
+cvar_t* sv_preloadNextMapMaxMB;
+cvar_t* sv_snapshotStats;
 cvar_t* sv_botsPressAttackBtn;
 cvar_t* sv_debugRate;
 cvar_t* sv_debugReliableCmds;
@@ -233,249 +241,745 @@ void SV_DumpReliableCommands( client_t *client, const char* cmd) {
 */
 
 /*
-======================
-SV_AddServerCommand
+==============================================================================
 
-The given command will be transmitted to the client, and is guaranteed to
-not have future snapshot_t executed before it is executed
-======================
+BROADCAST COMMAND STORE
+
+A command which goes to all clients is cleaned up and stored only once.
+The reliable command slots of the clients reference it by index and keep
+it alive through a reference count.
+
+==============================================================================
 */
 
-void sub_5310E0(client_t *client)
-{
-    int v1;
-    int i;
+#define MAX_BROADCAST_COMMANDS ( MAX_CLIENTS * MAX_RELIABLE_COMMANDS )
 
-    v1 = client->reliableSent + 1;
+typedef struct
+{
+    char* command;
+    int key;
+    int refCount;
+    int nextFree;
+}broadcastCommand_t;
 
-    for(i = client->reliableSent + 1 ; i <= client->reliableSequence; ++i)
-    {
-        if ( client->reliableCommands[i & (MAX_RELIABLE_COMMANDS - 1)].cmdType )
-        {
-            if ( (v1 & (MAX_RELIABLE_COMMANDS - 1)) != (i & (MAX_RELIABLE_COMMANDS - 1)) )
-            {
-                memcpy(&client->reliableCommands[v1 & (MAX_RELIABLE_COMMANDS - 1)], &client->reliableCommands[i & (MAX_RELIABLE_COMMANDS - 1)], sizeof(reliableCommands_t));
-            }
-            ++v1;
-        }
-    }
-    client->reliableSequence = v1 - 1;
-}
+static struct
+{
+    broadcastCommand_t* commands;   //Index 0 is never used
+    int numCommands;
+    int numUsed;
+    int freeList;
+}broadcastStore;
 
+// Hashed index over the unsent reliable commands of a client. Used to find
+// commands which get replaced by a newer one without scanning them all
+#define RELIABLE_INDEX_SIZE ( MAX_RELIABLE_COMMANDS * 4 )
 
+typedef struct
+{
+    int key;
+    int sequence;	// 0 = empty
+}reliableCommandIndex_t;
 
+typedef struct
+{
+    int key;	// dedupe key, 0 if this command never gets replaced
+    int shared;	// index into the broadcast command store, 0 if the text is in command
+}reliableCommandInfo_t;
 
-int sub_530FC0(client_t *client, const char *command)
+/*
+Dedupe state of the reliable commands of each client. It is kept apart from
+client_t so its layout, which plugins depend on, stays the same.
+slots[i] belongs to client->reliableCommands[i].
+*/
+typedef struct
 {
+    reliableCommandInfo_t slots[MAX_RELIABLE_COMMANDS];
+    reliableCommandIndex_t index[RELIABLE_INDEX_SIZE];
+    int indexUsed;
+}reliableCommandState_t;
 
-    int i;
+static reliableCommandState_t sv_reliableState[MAX_CLIENTS];
 
-    for( i = client->reliableSent + 1; i <= client->reliableSequence; ++i)
-    {
+static reliableCommandState_t* SV_ReliableState( client_t *client )
+{
+    return &sv_reliableState[client - svs.clients];
+}
 
-        if ( client->reliableCommands[i & (MAX_RELIABLE_COMMANDS - 1)].cmdType == 0 )
-            continue;
+static void SV_FreeBroadcastCommand( int index )
+{
+    broadcastCommand_t* bc = &broadcastStore.commands[index];
+
+    L_Free( bc->command );
+    bc->command = NULL;
+    bc->refCount = 0;
+    bc->nextFree = broadcastStore.freeList;
+    broadcastStore.freeList = index;
+    broadcastStore.numUsed--;
+}
 
-        if(client->reliableCommands[i & (MAX_RELIABLE_COMMANDS - 1)].command[0] != command[0])
-            continue;
+static void SV_DerefBroadcastCommand( int index )
+{
+    broadcastCommand_t* bc;
 
-        if ( command[0] >= 120 && command[0] <= 122 )
-            continue;
+    if(index < 1 || index >= broadcastStore.numCommands)
+    {
+        return;
+    }
+    bc = &broadcastStore.commands[index];
+    if(bc->command == NULL)
+    {
+        return;
+    }
+    bc->refCount--;
+    if(bc->refCount <= 0)
+    {
+        SV_FreeBroadcastCommand( index );
+    }
+}
 
-        if ( !strcmp(&command[1], &client->reliableCommands[i & (MAX_RELIABLE_COMMANDS - 1)].command[1]) )
-            return i;
+/*
+======================
+SV_CollectBroadcastCommands
 
+Recounts all references from the client slots. Slots of clients which got
+wiped by a Com_Memset() can't release their references, so this gets run
+whenever the store is full.
+======================
+*/
+static void SV_CollectBroadcastCommands( )
+{
+    int i, j, index;
+    client_t* cl;
+    reliableCommands_t* slot;
+    reliableCommandInfo_t* info;
 
-        switch ( command[0] )
-        {
-            case 100:
-            case 118:
-                if ( !I_IsEqualUnitWSpace( (char*)&command[2], &client->reliableCommands[i & (MAX_RELIABLE_COMMANDS - 1)].command[2]))
-                {
-                    continue;
-                }
-            case 67:
-            case 68:
-            case 97:
-            case 98:
-            case 111:
-            case 112:
-            case 113:
-            case 114:
-            case 116:
-                return i;
+    for(i = 1; i < broadcastStore.numCommands; i++)
+    {
+        broadcastStore.commands[i].refCount = 0;
+    }
 
-            default:
+    for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+    {
+        info = sv_reliableState[i].slots;
+        for(j = 0, slot = cl->reliableCommands; j < MAX_RELIABLE_COMMANDS; j++, slot++, info++)
+        {
+            index = info->shared;
+            if(index == 0)
+            {
+                continue;
+            }
+            if(cl->state == CS_FREE || index >= broadcastStore.numCommands || broadcastStore.commands[index].command == NULL)
+            {
+                info->shared = 0;
+                slot->command[0] = '\0';
                 continue;
+            }
+            broadcastStore.commands[index].refCount++;
+        }
+    }
 
+    for(i = 1; i < broadcastStore.numCommands; i++)
+    {
+        if(broadcastStore.commands[i].command && broadcastStore.commands[i].refCount == 0)
+        {
+            SV_FreeBroadcastCommand( i );
         }
     }
-    return -1;
 }
 
-
-
-void __cdecl SV_AddServerCommand(client_t *client, int type, const char *cmd)
+static qboolean SV_GrowBroadcastStore( )
 {
-  int v4;
-  int i;
-  int j;
-  int index;
-  char string[64];
+    broadcastCommand_t* newCommands;
+    int i, newNum;
 
-    if(client->netchan.remoteAddress.type == NA_BOT)
+    if(broadcastStore.numCommands > MAX_BROADCAST_COMMANDS)
     {
-        return;
+        return qfalse;
     }
-    if ( client->canNotReliable )
-        return;
 
-    if ( client->reliableSequence - client->reliableAcknowledge >= MAX_RELIABLE_COMMANDS / 2 || client->state != CS_ACTIVE)
+    if(broadcastStore.numCommands == 0)
     {
-        sub_5310E0(client);
-
-        if(!type)
-            return;
-
+        newNum = 256;
+    }else{
+        newNum = 2 * broadcastStore.numCommands;
+    }
+    if(newNum > MAX_BROADCAST_COMMANDS +1)
+    {
+        newNum = MAX_BROADCAST_COMMANDS +1;
     }
 
-    v4 = sub_530FC0(client, cmd);
+    newCommands = realloc(broadcastStore.commands, newNum * sizeof(broadcastCommand_t));
+    if(newCommands == NULL)
+    {
+        return qfalse;
+    }
+    Com_Memset(&newCommands[broadcastStore.numCommands], 0, (newNum - broadcastStore.numCommands) * sizeof(broadcastCommand_t));
 
-    if ( v4 < 0 )
+    for(i = newNum -1; i >= broadcastStore.numCommands && i > 0; i--)
     {
-        ++client->reliableSequence;
+        newCommands[i].nextFree = broadcastStore.freeList;
+        broadcastStore.freeList = i;
     }
-    else
+    broadcastStore.commands = newCommands;
+    broadcastStore.numCommands = newNum;
+    return qtrue;
+}
+
+/*
+======================
+SV_AllocBroadcastCommand
+
+Returns 0 if the store is exhausted. The caller falls back to a copy per client then
+======================
+*/
+static int SV_AllocBroadcastCommand( const char* cleancmd, int key )
+{
+    int index, len;
+    broadcastCommand_t* bc;
+
+    if(broadcastStore.freeList == 0)
     {
-        for ( i = v4 + 1; i <= client->reliableSequence; ++v4 )
+        if(SV_GrowBroadcastStore() == qfalse)
         {
-          memcpy(&client->reliableCommands[v4 & 0x7F], &client->reliableCommands[i++ & 0x7F], sizeof(reliableCommands_t));
+            SV_CollectBroadcastCommands();
+            if(broadcastStore.freeList == 0)
+            {
+                return 0;
+            }
         }
     }
 
-    if ( client->reliableSequence - client->reliableAcknowledge == (MAX_RELIABLE_COMMANDS + 1) )
+    len = strlen(cleancmd);
+
+    index = broadcastStore.freeList;
+    bc = &broadcastStore.commands[index];
+    bc->command = L_Malloc(len +1);
+    if(bc->command == NULL)
     {
-        Com_PrintNoRedirect(CON_CHANNEL_SERVER,"Client: %i lost reliable commands\n", client - svs.clients);
-#if 0
-        Com_PrintNoRedirect(CON_CHANNEL_SERVER,"===== pending server commands =====\n");
-        for ( j = client->reliableAcknowledge + 1; j <= client->reliableSequence; ++j )
+        return 0;
+    }
+    Com_Memcpy(bc->command, cleancmd, len +1);
+    broadcastStore.freeList = bc->nextFree;
+    bc->nextFree = 0;
+    bc->key = key;
+    bc->refCount = 0;
+    broadcastStore.numUsed++;
+    return index;
+}
+
+static const char* SV_ReliableCommandText( const reliableCommands_t* slot, const reliableCommandInfo_t* info )
+{
+    if(info->shared == 0)
     {
-        Com_PrintNoRedirect(CON_CHANNEL_SERVER,"cmd %5d: %8d: %s\n", j, client->reliableCommands[j & (MAX_RELIABLE_COMMANDS - 1)].cmdTime, &client->reliableCommands[j & (MAX_RELIABLE_COMMANDS - 1)].command);
+        return slot->command;
     }
-    Com_PrintNoRedirect(CON_CHANNEL_SERVER,"cmd %5d: %8d: %s\n", j, svs.time, cmd);
-#endif
-
-    NET_OutOfBandPrint( NS_SERVER, &client->netchan.remoteAddress, "disconnect" );
-    SV_DelayDropClient(client, "EXE_SERVERCOMMANDOVERFLOW");
-
-        type = 1;
-        Com_sprintf(string,sizeof(string),"%c \"EXE_SERVERCOMMANDOVERFLOW\"", 119);
-        cmd = string;
+    if(info->shared >= broadcastStore.numCommands || broadcastStore.commands[info->shared].command == NULL)
+    {
+        return "";
     }
-
-    index = client->reliableSequence & ( MAX_RELIABLE_COMMANDS - 1 );
-    MSG_WriteReliableCommandToBuffer(cmd, client->reliableCommands[ index ].command, sizeof( client->reliableCommands[ index ].command ));
-    client->reliableCommands[ index ].cmdTime = svs.time;
-    client->reliableCommands[ index ].cmdType = type;
-//    Com_Printf(CON_CHANNEL_SERVER,"ReliableCommand: %s\n", cmd);
+    return broadcastStore.commands[info->shared].command;
 }
 
+const char* SV_GetReliableCommand( client_t *cl, int sequence )
+{
+    int index = sequence & ( MAX_RELIABLE_COMMANDS - 1 );
 
+    return SV_ReliableCommandText( &cl->reliableCommands[ index ], &SV_ReliableState( cl )->slots[ index ] );
+}
 
+static void SV_ReleaseReliableCommand( reliableCommandInfo_t* info )
+{
+    if(info->shared)
+    {
+        SV_DerefBroadcastCommand( info->shared );
+        info->shared = 0;
+    }
+}
 
 /*
-=================
-SV_SendServerCommand
+======================
+SV_ResetReliableCommands
 
-Sends a reliable command string to be interpreted by
-the client game module: "cp", "print", "chat", etc
-A NULL client will broadcast to all clients
-=================
-*/
-/*known stuff
-"t \" ==  open callvote screen
-"h \" ==  chat
-"c \" ==  print bold to players screen
-"e \" ==  print to players console
+Has to be called whenever a client_t gets wiped, the dedupe state isn't part of it
+======================
 */
-void QDECL SV_SendServerCommandString(client_t *cl, int type, char *message)
+void SV_ResetReliableCommands( client_t *client )
 {
-    client_t	*client;
-    int		j;
+    reliableCommandState_t* state = SV_ReliableState( client );
+    int i;
 
-    if ( cl != NULL ){
-        SV_AddServerCommand(cl, type, (char *)message );
-        return;
+    for(i = 0; i < MAX_RELIABLE_COMMANDS; i++)
+    {
+        SV_ReleaseReliableCommand( &state->slots[i] );
     }
+    Com_Memset(state, 0, sizeof(reliableCommandState_t));
+}
 
-    // hack to echo broadcast prints to console
-    if ( !strncmp( (char *)message, "say", 3) ) {
-        Com_Printf(CON_CHANNEL_SERVER,"broadcast: %s\n", SV_ExpandNewlines((char *)message) );
+//to and from are slot numbers
+static void SV_MoveReliableCommand( client_t *client, int to, int from )
+{
+    reliableCommandState_t* state = SV_ReliableState( client );
+    int shared = state->slots[from].shared;
+
+    /* Reference first, both slots can point to the same entry */
+    if(shared)
+    {
+        broadcastStore.commands[shared].refCount++;
     }
+    SV_ReleaseReliableCommand( &state->slots[to] );
 
-    // send the data to all relevent clients
-    for (j = 0, client = svs.clients; j < sv_maxclients->integer; j++, client++) {
-        if ( client->state < CS_PRIMED ) {
-            continue;
-        }
-        SV_AddServerCommand(client, type, (char *)message );
+    client->reliableCommands[to].cmdTime = client->reliableCommands[from].cmdTime;
+    client->reliableCommands[to].cmdType = client->reliableCommands[from].cmdType;
+    state->slots[to].key = state->slots[from].key;
+    state->slots[to].shared = shared;
+
+    if(shared)
+    {
+        client->reliableCommands[to].command[0] = '\0';
+    }else{
+        Q_strncpyz(client->reliableCommands[to].command, client->reliableCommands[from].command, sizeof(client->reliableCommands[to].command));
     }
 }
 
-void QDECL SV_SendServerCommand_IW(client_t *cl, int cmdtype, const char *fmt, ...) {
+/*
+======================
+SV_ReliableCommandKey
 
-    va_list		argptr;
-    byte		message[MAX_MSGLEN];
+Commands which can replace each other according to SV_ReliableCommandReplaces()
+always share the same key. 0 is used for commands which never get replaced.
+======================
+*/
+static int SV_ReliableCommandKey( const char* cmd )
+{
+    unsigned int hash;
+    const char* s;
 
+    hash = 2166136261u ^ (byte)cmd[0];
+    hash *= 16777619u;
 
-    va_start (argptr,fmt);
-    Q_vsnprintf ((char *)message, sizeof(message), fmt,argptr);
-    va_end (argptr);
-    SV_SendServerCommandString(cl, cmdtype, (char *)message);
+    switch(cmd[0])
+    {
+        case 120:
+        case 121:
+        case 122:
+            return 0;
 
-}
+        case 67:
+        case 68:
+        case 97:
+        case 98:
+        case 111:
+        case 112:
+        case 113:
+        case 114:
+        case 116:
+            break;
 
-void QDECL SV_SendServerCommand(client_t *cl, const char *fmt, ...) {
-    va_list		argptr;
-    byte		message[MAX_MSGLEN];
+        case 100:
+        case 118:
+            if(cmd[1] == '\0')
+            {
+                break;
+            }
+            for(s = &cmd[2]; *s && *s != ' '; s++)
+            {
+                hash = (hash ^ (byte)*s) * 16777619u;
+            }
+            break;
 
-    va_start (argptr,fmt);
-    Q_vsnprintf ((char *)message, sizeof(message), fmt,argptr);
-    va_end (argptr);
+        case '\0':
+            break;
 
-    SV_SendServerCommandString(cl, 0, (char *)message);
+        default:
+            for(s = &cmd[1]; *s; s++)
+            {
+                hash = (hash ^ (byte)*s) * 16777619u;
+            }
+            break;
+    }
 
+    if(hash == 0)
+    {
+        hash = 1;
+    }
+    return hash;
 }
 
-void QDECL SV_SendServerCommandNoLoss(client_t *cl, const char *fmt, ...) {
-    va_list		argptr;
-    byte		message[MAX_MSGLEN];
+/*
+======================
+SV_ReliableCommandReplaces
 
-    va_start (argptr,fmt);
-    Q_vsnprintf ((char *)message, sizeof(message), fmt,argptr);
-    va_end (argptr);
+True if the new command makes the pending one obsolete
+======================
+*/
+static qboolean SV_ReliableCommandReplaces( const char *command, const char *pending )
+{
+    if ( pending[0] != command[0] )
+        return qfalse;
 
-    SV_SendServerCommandString(cl, 1, (char *)message);
+    if ( command[0] >= 120 && command[0] <= 122 )
+        return qfalse;
 
-}
+    if ( command[0] == '\0' )
+        return qtrue;
 
+    if ( !strcmp(&command[1], &pending[1]) )
+        return qtrue;
 
-/*
-==============================================================================
+    switch ( command[0] )
+    {
+        case 100:
+        case 118:
+            if ( command[1] == '\0' || pending[1] == '\0' )
+            {
+                return qfalse;
+            }
+            return I_IsEqualUnitWSpace( (char*)&command[2], (char*)&pending[2]);
+
+        case 67:
+        case 68:
+        case 97:
+        case 98:
+        case 111:
+        case 112:
+        case 113:
+        case 114:
+        case 116:
+            return qtrue;
 
-CONNECTIONLESS COMMANDS
+        default:
+            return qfalse;
+    }
+}
 
-==============================================================================
-*/
+static void SV_AddReliableIndex( client_t *client, int sequence, int key )
+{
+    reliableCommandState_t* state = SV_ReliableState( client );
+    int h;
 
-typedef struct leakyBucket_s leakyBucket_t;
-struct leakyBucket_s {
+    for(h = key & (RELIABLE_INDEX_SIZE -1); state->index[h].sequence != 0; h = (h +1) & (RELIABLE_INDEX_SIZE -1));
 
-    byte	type;
+    state->index[h].key = key;
+    state->index[h].sequence = sequence;
+    state->indexUsed++;
+}
 
-    union {
-        byte	_4[4];
-        byte	_6[16];
+static void SV_RebuildReliableIndex( client_t *client )
+{
+    reliableCommandState_t* state = SV_ReliableState( client );
+    int i, index;
+
+    Com_Memset(state->index, 0, sizeof(state->index));
+    state->indexUsed = 0;
+
+    for(i = client->reliableSent + 1; i <= client->reliableSequence; ++i)
+    {
+        index = i & (MAX_RELIABLE_COMMANDS - 1);
+        if(client->reliableCommands[index].cmdType && state->slots[index].key)
+        {
+            SV_AddReliableIndex( client, i, state->slots[index].key );
+        }
+    }
+}
+
+/*
+======================
+SV_FindReplacedReliableCommand
+
+Returns the oldest unsent command which gets replaced by cmd or -1.
+Entries in the index can be outdated, every hit gets verified against the slot.
+======================
+*/
+static int SV_FindReplacedReliableCommand( client_t *client, const char *cmd, int key )
+{
+    int h, sequence, best, index;
+    reliableCommandState_t* state = SV_ReliableState( client );
+
+    if(key == 0)
+    {
+        return -1;
+    }
+
+    if(state->indexUsed >= RELIABLE_INDEX_SIZE / 2)
+    {
+        SV_RebuildReliableIndex( client );
+    }
+
+    best = -1;
+
+    for(h = key & (RELIABLE_INDEX_SIZE -1); state->index[h].sequence != 0; h = (h +1) & (RELIABLE_INDEX_SIZE -1))
+    {
+        if(state->index[h].key != key)
+        {
+            continue;
+        }
+        sequence = state->index[h].sequence;
+        if(sequence <= client->reliableSent || sequence > client->reliableSequence)
+        {
+            continue;
+        }
+        if(best >= 0 && sequence >= best)
+        {
+            continue;
+        }
+        index = sequence & (MAX_RELIABLE_COMMANDS - 1);
+        if(client->reliableCommands[index].cmdType == 0 || state->slots[index].key != key)
+        {
+            continue;
+        }
+        if(SV_ReliableCommandReplaces( cmd, SV_ReliableCommandText( &client->reliableCommands[index], &state->slots[index] ) ))
+        {
+            best = sequence;
+        }
+    }
+    return best;
+}
+
+/*
+======================
+SV_AddServerCommand
+
+The given command will be transmitted to the client, and is guaranteed to
+not have future snapshot_t executed before it is executed
+======================
+*/
+
+void sub_5310E0(client_t *client)
+{
+    int v1;
+    int i;
+
+    v1 = client->reliableSent + 1;
+
+    for(i = client->reliableSent + 1 ; i <= client->reliableSequence; ++i)
+    {
+        if ( client->reliableCommands[i & (MAX_RELIABLE_COMMANDS - 1)].cmdType )
+        {
+            if ( (v1 & (MAX_RELIABLE_COMMANDS - 1)) != (i & (MAX_RELIABLE_COMMANDS - 1)) )
+            {
+                SV_MoveReliableCommand(client, v1 & (MAX_RELIABLE_COMMANDS - 1), i & (MAX_RELIABLE_COMMANDS - 1));
+            }
+            ++v1;
+        }
+    }
+    if(client->reliableSequence != v1 - 1)
+    {
+        client->reliableSequence = v1 - 1;
+        SV_RebuildReliableIndex( client );
+    }
+}
+
+
+/*
+======================
+SV_AddServerCommandShared
+
+cmd is the raw command, key its SV_ReliableCommandKey(). If shared is set
+the slot references this broadcast store entry instead of copying the text
+======================
+*/
+static void SV_AddServerCommandShared(client_t *client, int type, const char *cmd, int key, int shared)
+{
+  int v4;
+  int i;
+  int j;
+  int index;
+  qboolean replaced;
+  reliableCommands_t* slot;
+  reliableCommandInfo_t* info;
+  char string[64];
+
+    if(client->netchan.remoteAddress.type == NA_BOT)
+    {
+        return;
+    }
+    if ( client->canNotReliable )
+        return;
+
+    if ( client->reliableSequence - client->reliableAcknowledge >= MAX_RELIABLE_COMMANDS / 2 || client->state != CS_ACTIVE)
+    {
+        sub_5310E0(client);
+
+        if(!type)
+            return;
+
+    }
+
+    v4 = SV_FindReplacedReliableCommand(client, cmd, key);
+
+    if ( v4 < 0 )
+    {
+        ++client->reliableSequence;
+        replaced = qfalse;
+    }
+    else
+    {
+        for ( i = v4 + 1; i <= client->reliableSequence; ++v4 )
+        {
+          SV_MoveReliableCommand(client, v4 & 0x7F, i++ & 0x7F);
+        }
+        replaced = qtrue;
+    }
+
+    if ( client->reliableSequence - client->reliableAcknowledge == (MAX_RELIABLE_COMMANDS + 1) )
+    {
+        Com_PrintNoRedirect(CON_CHANNEL_SERVER,"Client: %i lost reliable commands\n", client - svs.clients);
+#if 0
+        Com_PrintNoRedirect(CON_CHANNEL_SERVER,"===== pending server commands =====\n");
+        for ( j = client->reliableAcknowledge + 1; j <= client->reliableSequence; ++j )
+    {
+        Com_PrintNoRedirect(CON_CHANNEL_SERVER,"cmd %5d: %8d: %s\n", j, client->reliableCommands[j & (MAX_RELIABLE_COMMANDS - 1)].cmdTime, SV_GetReliableCommand(client, j));
+    }
+    Com_PrintNoRedirect(CON_CHANNEL_SERVER,"cmd %5d: %8d: %s\n", j, svs.time, cmd);
+#endif
+
+    NET_OutOfBandPrint( NS_SERVER, &client->netchan.remoteAddress, "disconnect" );
+    SV_DelayDropClient(client, "EXE_SERVERCOMMANDOVERFLOW");
+
+        type = 1;
+        Com_sprintf(string,sizeof(string),"%c \"EXE_SERVERCOMMANDOVERFLOW\"", 119);
+        cmd = string;
+        shared = 0;
+    }
+
+    index = client->reliableSequence & ( MAX_RELIABLE_COMMANDS - 1 );
+    slot = &client->reliableCommands[ index ];
+    info = &SV_ReliableState( client )->slots[ index ];
+    SV_ReleaseReliableCommand( info );
+
+    if(shared)
+    {
+        info->shared = shared;
+        slot->command[0] = '\0';
+        info->key = broadcastStore.commands[shared].key;
+        broadcastStore.commands[shared].refCount++;
+    }else{
+        MSG_WriteReliableCommandToBuffer(cmd, slot->command, sizeof( slot->command ));
+        info->key = SV_ReliableCommandKey( slot->command );
+    }
+    slot->cmdTime = svs.time;
+    slot->cmdType = type;
+
+    if(replaced || SV_ReliableState( client )->indexUsed >= RELIABLE_INDEX_SIZE / 2)
+    {
+        SV_RebuildReliableIndex( client );
+    }else if(type && info->key){
+        SV_AddReliableIndex( client, client->reliableSequence, info->key );
+    }
+//    Com_Printf(CON_CHANNEL_SERVER,"ReliableCommand: %s\n", cmd);
+}
+
+void __cdecl SV_AddServerCommand(client_t *client, int type, const char *cmd)
+{
+    SV_AddServerCommandShared(client, type, cmd, SV_ReliableCommandKey( cmd ), 0);
+}
+
+
+
+/*
+=================
+SV_SendServerCommand
+
+Sends a reliable command string to be interpreted by
+the client game module: "cp", "print", "chat", etc
+A NULL client will broadcast to all clients
+=================
+*/
+/*known stuff
+"t \" ==  open callvote screen
+"h \" ==  chat
+"c \" ==  print bold to players screen
+"e \" ==  print to players console
+*/
+void QDECL SV_SendServerCommandString(client_t *cl, int type, char *message)
+{
+    client_t	*client;
+    int		j, key, shared;
+    char	cleancmd[MAX_STRING_CHARS];
+
+    if ( cl != NULL ){
+        SV_AddServerCommand(cl, type, (char *)message );
+        return;
+    }
+
+    // hack to echo broadcast prints to console
+    if ( !strncmp( (char *)message, "say", 3) ) {
+        Com_Printf(CON_CHANNEL_SERVER,"broadcast: %s\n", SV_ExpandNewlines((char *)message) );
+    }
+
+    // clean the command once and let all clients reference it
+    key = SV_ReliableCommandKey( message );
+    MSG_WriteReliableCommandToBuffer( message, cleancmd, sizeof(cleancmd) );
+    shared = SV_AllocBroadcastCommand( cleancmd, SV_ReliableCommandKey( cleancmd ) );
+
+    // send the data to all relevent clients
+    for (j = 0, client = svs.clients; j < sv_maxclients->integer; j++, client++) {
+        if ( client->state < CS_PRIMED ) {
+            continue;
+        }
+        SV_AddServerCommandShared(client, type, message, key, shared );
+    }
+
+    if(shared && broadcastStore.commands[shared].refCount == 0)
+    {
+        SV_FreeBroadcastCommand( shared );
+    }
+}
+
+void QDECL SV_SendServerCommand_IW(client_t *cl, int cmdtype, const char *fmt, ...) {
+
+    va_list		argptr;
+    byte		message[MAX_MSGLEN];
+
+
+    va_start (argptr,fmt);
+    Q_vsnprintf ((char *)message, sizeof(message), fmt,argptr);
+    va_end (argptr);
+    SV_SendServerCommandString(cl, cmdtype, (char *)message);
+
+}
+
+void QDECL SV_SendServerCommand(client_t *cl, const char *fmt, ...) {
+    va_list		argptr;
+    byte		message[MAX_MSGLEN];
+
+    va_start (argptr,fmt);
+    Q_vsnprintf ((char *)message, sizeof(message), fmt,argptr);
+    va_end (argptr);
+
+    SV_SendServerCommandString(cl, 0, (char *)message);
+
+}
+
+void QDECL SV_SendServerCommandNoLoss(client_t *cl, const char *fmt, ...) {
+    va_list		argptr;
+    byte		message[MAX_MSGLEN];
+
+    va_start (argptr,fmt);
+    Q_vsnprintf ((char *)message, sizeof(message), fmt,argptr);
+    va_end (argptr);
+
+    SV_SendServerCommandString(cl, 1, (char *)message);
+
+}
+
+
+/*
+==============================================================================
+
+CONNECTIONLESS COMMANDS
+
+==============================================================================
+*/
+
+typedef struct leakyBucket_s leakyBucket_t;
+struct leakyBucket_s {
+
+    byte	type;
+
+    union {
+        byte	_4[4];
+        byte	_6[16];
     } ipv;
 
     unsigned long long	lastTime;
@@ -484,244 +988,837 @@ struct leakyBucket_s {
     long		hash;
 
     leakyBucket_t *prev, *next;
+    leakyBucket_t *lruPrev, *lruNext; //Free list or LRU list
 };
 
 
-typedef struct{
+struct queryLimit_s{
+
+    int max_buckets;
+    int max_hashes;
+    leakyBucket_t *buckets;
+    leakyBucket_t **bucketHashes;
+    leakyBucket_t *freeBuckets; //Unused buckets, linked by lruNext
+    leakyBucket_t *lruHead; //Least recently used bucket in use
+    leakyBucket_t *lruTail; //Most recently used bucket in use
+    int numUsed;
+    int queryLimitsEnabled;
+    leakyBucket_t infoBucket;
+    leakyBucket_t statusBucket;
+    leakyBucket_t rconBucket;
+};
+
+
+    static queryLimit_t querylimit;
+
+
+
+/*
+================
+SVC_AllocBuckets
+
+Allocates and links up the buckets of a rate limiter. Returns qfalse if out of memory
+================
+*/
+static qboolean SVC_AllocBuckets( queryLimit_t *ql, int bytes ){
+
+    int i, totalsize;
+
+    ql->max_buckets = bytes / sizeof(leakyBucket_t);
+    ql->max_hashes = 4096; //static
+
+    totalsize = ql->max_buckets * sizeof(leakyBucket_t) + ql->max_hashes * sizeof(leakyBucket_t*);
+
+    ql->buckets = L_Malloc(totalsize);
+
+    if(!ql->buckets)
+    {
+        return qfalse;
+    }
+    memset(ql->buckets, 0, totalsize);
+
+    ql->bucketHashes = (leakyBucket_t**)&ql->buckets[ql->max_buckets];
+
+    ql->freeBuckets = NULL;
+    for(i = ql->max_buckets -1; i >= 0; --i)
+    {
+        ql->buckets[i].lruNext = ql->freeBuckets;
+        ql->freeBuckets = &ql->buckets[i];
+    }
+    ql->lruHead = ql->lruTail = NULL;
+    ql->numUsed = 0;
+    return qtrue;
+}
+
+// This is deliberately quite large to make it more of an effort to DoS
+
+/*
+================
+SVC_RateLimitInit
+
+Init the rate limit system
+================
+*/
+static void SVC_RateLimitInit( ){
+
+    if(!sv_queryIgnoreMegs->integer)
+    {
+        Com_Printf(CON_CHANNEL_SERVER,"QUERY LIMIT: Querylimiting is disabled\n");
+        querylimit.queryLimitsEnabled = 0;
+        return;
+    }
+
+    if(!SVC_AllocBuckets( &querylimit, sv_queryIgnoreMegs->integer * 1024*1024 ))
+    {
+        Com_PrintError(CON_CHANNEL_SERVER,"QUERY LIMIT: System is out of memory. All queries are disabled\n");
+        querylimit.queryLimitsEnabled = -1;
+        return;
+    }
+
+    Com_Printf(CON_CHANNEL_SERVER,"QUERY LIMIT: Querylimiting is enabled\n");
+    querylimit.queryLimitsEnabled = 1;
+}
+
+
+
+/*
+================
+SVC_HashForAddress
+================
+*/
+__optimize3 __regparm2 static long SVC_HashForAddress( queryLimit_t *ql, netadr_t *address ) {
+    byte 		*ip = NULL;
+    size_t	size = 0;
+    int			i;
+    long		hash = 0;
+
+    switch ( address->type ) {
+        case NA_IP:  ip = address->ip;  size = 4; break;
+        case NA_IP6: ip = address->ip6; size = 16; break;
+        default: break;
+    }
+
+    for ( i = 0; i < size; i++ ) {
+        hash += (long)( ip[ i ] ) * ( i + 119 );
+    }
+
+    hash = ( hash ^ ( hash >> 10 ) ^ ( hash >> 20 ) ^ psvs.randint);
+    hash &= ( ql->max_hashes - 1 );
+
+    return hash;
+}
+
+/*
+================
+SVC_UnlinkBucketLRU
+================
+*/
+static void SVC_UnlinkBucketLRU( queryLimit_t *ql, leakyBucket_t *bucket ) {
+
+    if ( bucket->lruPrev != NULL ) {
+        bucket->lruPrev->lruNext = bucket->lruNext;
+    } else {
+        ql->lruHead = bucket->lruNext;
+    }
+
+    if ( bucket->lruNext != NULL ) {
+        bucket->lruNext->lruPrev = bucket->lruPrev;
+    } else {
+        ql->lruTail = bucket->lruPrev;
+    }
+    bucket->lruPrev = bucket->lruNext = NULL;
+}
+
+/*
+================
+SVC_LinkBucketLRU
+
+Append as most recently used bucket
+================
+*/
+static void SVC_LinkBucketLRU( queryLimit_t *ql, leakyBucket_t *bucket ) {
+
+    bucket->lruNext = NULL;
+    bucket->lruPrev = ql->lruTail;
+
+    if ( ql->lruTail != NULL ) {
+        ql->lruTail->lruNext = bucket;
+    } else {
+        ql->lruHead = bucket;
+    }
+    ql->lruTail = bucket;
+}
+
+/*
+================
+SVC_BucketForAddress
+
+Find or allocate a bucket for an address
+Buckets in use are kept in least recently used order so only the oldest
+one has to be checked for expiry when no free bucket is left.
+================
+*/
+__optimize3 __regparm3 static leakyBucket_t *SVC_BucketForAddress( queryLimit_t *ql, netadr_t *address, int burst, int period, unsigned long long now ) {
+    leakyBucket_t		*bucket = NULL;
+    int			interval;
+    long			hash = SVC_HashForAddress( ql, address );
+
+    for ( bucket = ql->bucketHashes[ hash ]; bucket; bucket = bucket->next ) {
+
+        switch ( bucket->type ) {
+            case NA_IP:
+                if ( memcmp( bucket->ipv._4, address->ip, 4 ) == 0 ) {
+                    SVC_UnlinkBucketLRU( ql, bucket );
+                    SVC_LinkBucketLRU( ql, bucket );
+                    return bucket;
+                }
+                break;
+
+            case NA_IP6:
+                if ( memcmp( bucket->ipv._6, address->ip6, 16 ) == 0 ) {
+                    SVC_UnlinkBucketLRU( ql, bucket );
+                    SVC_LinkBucketLRU( ql, bucket );
+                    return bucket;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+    }
+
+    if ( address->type != NA_IP && address->type != NA_IP6 ) {
+        return NULL;
+    }
+
+    bucket = ql->freeBuckets;
+
+    if ( bucket != NULL ) {
+        ql->freeBuckets = bucket->lruNext;
+        ql->numUsed++;
+    } else {
+        // Reclaim the least recently used bucket if it has expired
+        bucket = ql->lruHead;
+        if ( bucket == NULL ) {
+            return NULL;
+        }
+        interval = now - bucket->lastTime;
+
+        if ( interval <= ( burst * period ) && interval >= 0 ) {
+            // Couldn't allocate a bucket for this address
+            return NULL;
+        }
+
+        if ( bucket->prev != NULL ) {
+            bucket->prev->next = bucket->next;
+        } else {
+            ql->bucketHashes[ bucket->hash ] = bucket->next;
+        }
+
+        if ( bucket->next != NULL ) {
+            bucket->next->prev = bucket->prev;
+        }
+
+        SVC_UnlinkBucketLRU( ql, bucket );
+    }
+
+    Com_Memset( bucket, 0, sizeof( leakyBucket_t ) );
+
+    bucket->type = address->type;
+    switch ( address->type ) {
+        case NA_IP:	bucket->ipv._4[0] = address->ip[0];
+                bucket->ipv._4[1] = address->ip[1];
+                bucket->ipv._4[2] = address->ip[2];
+                bucket->ipv._4[3] = address->ip[3];
+                break;
+
+        default: Com_Memcpy( bucket->ipv._6, address->ip6, 16 ); break;
+    }
+
+    bucket->lastTime = now;
+    bucket->burst = 0;
+    bucket->hash = hash;
+
+    // Add to the head of the relevant hash chain
+    bucket->next = ql->bucketHashes[ hash ];
+    if ( ql->bucketHashes[ hash ] != NULL ) {
+        ql->bucketHashes[ hash ]->prev = bucket;
+    }
+
+    bucket->prev = NULL;
+    ql->bucketHashes[ hash ] = bucket;
+
+    SVC_LinkBucketLRU( ql, bucket );
+
+    return bucket;
+}
+
+
+/*
+================
+SVC_RateLimitTime
+================
+*/
+/*__optimize3 __attribute__((always_inline)) */
+static qboolean SVC_RateLimitTime( leakyBucket_t *bucket, int burst, int period, unsigned long long now ) {
+    if ( bucket != NULL ) {
+        int interval = now - bucket->lastTime;
+        int expired = interval / period;
+        int expiredRemainder = interval % period;
+
+        if ( expired > bucket->burst ) {
+            bucket->burst = 0;
+            bucket->lastTime = now;
+        } else {
+            bucket->burst -= expired;
+            bucket->lastTime = now - expiredRemainder;
+        }
+
+        if ( bucket->burst < burst ) {
+            bucket->burst++;
+
+            return qfalse;
+        }
+    }
+
+    return qtrue;
+}
+
+/*
+================
+SVC_RateLimit
+================
+*/
+static qboolean SVC_RateLimit( leakyBucket_t *bucket, int burst, int period ) {
+    return SVC_RateLimitTime( bucket, burst, period, com_uFrameTime );
+}
+
+/*
+================
+SVC_RateLimitAddress
+
+Rate limit for a particular address
+================
+*/
+__optimize3 __regparm3 static qboolean SVC_RateLimitAddress( netadr_t *from, int burst, int period ) {
+
+    if(Sys_IsLANAddress(from))
+        return qfalse;
+
+
+    if(querylimit.queryLimitsEnabled == 1)
+    {
+        leakyBucket_t *bucket = SVC_BucketForAddress( &querylimit, from, burst, period, com_uFrameTime );
+        return SVC_RateLimit( bucket, burst, period );
+
+    }else if(querylimit.queryLimitsEnabled == 0){
+        return qfalse;
+
+    }else{//Init error, to be save we deny everything
+        return qtrue;
+    }
 
-    int max_buckets;
-    int max_hashes;
-    leakyBucket_t *buckets;
-    leakyBucket_t **bucketHashes;
-    int queryLimitsEnabled;
-    leakyBucket_t infoBucket;
-    leakyBucket_t statusBucket;
-    leakyBucket_t rconBucket;
-}queryLimit_t;
+}
 
+/*
+================
+SV_QueryLimitCreate
 
-    static queryLimit_t querylimit;
+A rate limiter apart from the one which guards the server, so the querylimitbench
+test doesn't flush the buckets of real clients. Returns NULL if out of memory
+================
+*/
+queryLimit_t* SV_QueryLimitCreate( int bytes ) {
+    queryLimit_t *ql = L_Malloc( sizeof( queryLimit_t ) );
 
+    if ( ql == NULL ) {
+        return NULL;
+    }
+    Com_Memset( ql, 0, sizeof( queryLimit_t ) );
 
+    if ( !SVC_AllocBuckets( ql, bytes ) ) {
+        L_Free( ql );
+        return NULL;
+    }
+    ql->queryLimitsEnabled = 1;
+    return ql;
+}
 
-// This is deliberately quite large to make it more of an effort to DoS
+void SV_QueryLimitDestroy( queryLimit_t *ql ) {
+    L_Free( ql->buckets );
+    L_Free( ql );
+}
 
 /*
 ================
-SVC_RateLimitInit
+SV_QueryLimitAddress
 
-Init the rate limit system
+Same as SVC_RateLimitAddress but on the given limiter and at the given time in usec
 ================
 */
-static void SVC_RateLimitInit( ){
+qboolean SV_QueryLimitAddress( queryLimit_t *ql, netadr_t *from, int burst, int period, unsigned long long now ) {
+    leakyBucket_t *bucket = SVC_BucketForAddress( ql, from, burst, period, now );
+    return SVC_RateLimitTime( bucket, burst, period, now );
+}
 
-    int bytes;
+void SV_QueryLimitStats( queryLimit_t *ql, int *numUsed, int *maxBuckets ) {
+    *numUsed = ql->numUsed;
+    *maxBuckets = ql->max_buckets;
+}
 
-    if(!sv_queryIgnoreMegs->integer)
-    {
-        Com_Printf(CON_CHANNEL_SERVER,"QUERY LIMIT: Querylimiting is disabled\n");
-        querylimit.queryLimitsEnabled = 0;
-        return;
-    }
 
-    bytes = sv_queryIgnoreMegs->integer * 1024*1024;
+/*
+==============================================================================
+
+QUERY RESPONSE CACHE
 
-    querylimit.max_buckets = bytes / sizeof(leakyBucket_t);
-    querylimit.max_hashes = 4096; //static
+getstatus, getinfo and the Source engine A2S queries all answer with data
+that changes far less often than it gets requested. The serialized replies
+are kept here together with the versions they were built from and are only
+rebuilt when one of them moves:
+- cvar_modificationCount covers every serverinfo cvar, hostname, mapname etc.
+- a fingerprint of the client table covers connects, disconnects, bots,
+  names, scores and pings
+- A2S_PLAYER reports the connected time, so it is also bound to svs.time
 
-    int totalsize = querylimit.max_buckets * sizeof(leakyBucket_t) + querylimit.max_hashes * sizeof(leakyBucket_t*);
+The per request challenge is never part of the cached reply. Every entry is
+split into a head and a tail and the challenge bytes get inserted in between.
 
-    querylimit.buckets = L_Malloc(totalsize);
-    memset(querylimit.buckets, 0, totalsize);
+==============================================================================
+*/
 
-    if(!querylimit.buckets)
-    {
-        Com_PrintError(CON_CHANNEL_SERVER,"QUERY LIMIT: System is out of memory. All queries are disabled\n");
-        querylimit.queryLimitsEnabled = -1;
-    }
+typedef enum
+{
+    QUERYCACHE_STATUS,
+    QUERYCACHE_INFO,
+    QUERYCACHE_SE_INFO,
+    QUERYCACHE_SE_INFO_EXT,
+    QUERYCACHE_SE_PLAYERS,
+    QUERYCACHE_SE_RULES,
+    QUERYCACHE_NUMTYPES
+}queryCacheType_t;
 
-    querylimit.bucketHashes = (leakyBucket_t**)&querylimit.buckets[querylimit.max_buckets];
-    Com_Printf(CON_CHANNEL_SERVER,"QUERY LIMIT: Querylimiting is enabled\n");
-    querylimit.queryLimitsEnabled = 1;
-}
+typedef struct
+{
+    qboolean valid;
+    int cvarVersion;
+    unsigned long long clientVersion;
+    int frameTime;
+    int headLen;    //Bytes in front of the challenge
+    int infoLen;    //getstatus only: length of the infostring following the challenge
+    int len;        //Total length without the challenge
+    byte data[MAX_MSGLEN];
+}queryCacheEntry_t;
+
+static struct
+{
+    queryCacheEntry_t entries[QUERYCACHE_NUMTYPES];
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long bytesServed;
+}queryCache;
 
+/* OOB header + "statusResponse\n" */
+#define STATUSRESPONSE_HEADLEN 19
 
+static const char* queryCacheNames[QUERYCACHE_NUMTYPES] = { "getstatus", "getinfo", "A2S_INFO", "A2S_INFO (ext)", "A2S_PLAYER", "A2S_RULES" };
+
+static void SVC_SourceEngineQuery_WriteInfoHeader( msg_t* msg, qboolean clean );
+static void SVC_SourceEngineQuery_WriteInfoExtra( msg_t* msg );
+void SVC_SourceEngineQuery_WriteCvars(cvar_t const* cvar, void *var );
 
 /*
 ================
-SVC_HashForAddress
+SVC_QueryCacheClientVersion
+
+Fingerprint over everything from the client table that ends up in a query reply
 ================
 */
-__optimize3 __regparm1 static long SVC_HashForAddress( netadr_t *address ) {
-    byte 		*ip = NULL;
-    size_t	size = 0;
-    int			i;
-    long		hash = 0;
+static unsigned long long SVC_QueryCacheClientVersion( )
+{
+    unsigned long long hash;
+    int i;
+    client_t *cl;
+    gclient_t *gclient;
+    const char *c;
 
-    switch ( address->type ) {
-        case NA_IP:  ip = address->ip;  size = 4; break;
-        case NA_IP6: ip = address->ip6; size = 16; break;
-        default: break;
-    }
+    hash = 14695981039346656037ULL;
 
-    for ( i = 0; i < size; i++ ) {
-        hash += (long)( ip[ i ] ) * ( i + 119 );
+#define QUERYCACHE_HASH(x) hash = (hash ^ (unsigned int)(x)) * 1099511628211ULL
+
+    QUERYCACHE_HASH(sv_maxclients->integer);
+
+    for ( i = 0, cl = svs.clients, gclient = level.clients; i < sv_maxclients->integer ; i++, cl++, gclient++ )
+    {
+        if ( cl->state < CS_CONNECTED )
+        {
+            continue;
+        }
+        QUERYCACHE_HASH(i);
+        QUERYCACHE_HASH(cl->state);
+        QUERYCACHE_HASH(cl->netchan.remoteAddress.type);
+        QUERYCACHE_HASH(cl->undercover);
+        QUERYCACHE_HASH(cl->ping);
+        QUERYCACHE_HASH(cl->connectedTime);
+        QUERYCACHE_HASH(gclient->sess.score);
+        for(c = cl->name; *c; c++)
+        {
+            QUERYCACHE_HASH(*c);
+        }
     }
 
-    hash = ( hash ^ ( hash >> 10 ) ^ ( hash >> 20 ) ^ psvs.randint);
-    hash &= ( querylimit.max_hashes - 1 );
+#undef QUERYCACHE_HASH
 
     return hash;
 }
 
-/*
-================
-SVC_BucketForAddress
+static void SVC_QueryCacheBuildStatus( queryCacheEntry_t* entry, msg_t* msg )
+{
+    char infostring[MAX_INFO_STRING];
+    char player[1024];
+    int i, playerLength;
+    client_t *cl;
+    gclient_t *gclient;
 
-Find or allocate a bucket for an address
-================
-*/
-__optimize3 __regparm3 static leakyBucket_t *SVC_BucketForAddress( netadr_t *address, int burst, int period ) {
-    leakyBucket_t		*bucket = NULL;
-    int			i;
-    long			hash = SVC_HashForAddress( address );
-    unsigned long long	now = com_uFrameTime;
+    MSG_WriteLong( msg, -1 );
+    MSG_WriteData( msg, "statusResponse\n", STATUSRESPONSE_HEADLEN - 4 );
 
-    for ( bucket = querylimit.bucketHashes[ hash ]; bucket; bucket = bucket->next ) {
+    // Info_SetValueForKey() prepends, so pswrd ends up in front of the challenge
+    if(*sv_password->string)
+    {
+        MSG_WriteData( msg, "\\pswrd\\1", 8 );
+    }
+    entry->headLen = msg->cursize;
 
-        switch ( bucket->type ) {
-            case NA_IP:
-                if ( memcmp( bucket->ipv._4, address->ip, 4 ) == 0 ) {
-                    return bucket;
-                }
-                break;
+    Q_strncpyz( infostring, Cvar_InfoString( CVAR_SERVERINFO | CVAR_NORESTART), sizeof(infostring) );
+    Info_RemoveKey( infostring, "challenge" );
+    if(*sv_password->string)
+    {
+        Info_RemoveKey( infostring, "pswrd" );
+    }
+    entry->infoLen = strlen( infostring );
+    MSG_WriteData( msg, infostring, entry->infoLen );
+    MSG_WriteByte( msg, '\n' );
 
-            case NA_IP6:
-                if ( memcmp( bucket->ipv._6, address->ip6, 16 ) == 0 ) {
-                    return bucket;
-                }
-                break;
+    for ( i = 0, cl = svs.clients, gclient = level.clients ; i < sv_maxclients->integer ; i++, cl++, gclient++ ) {
+        if ( cl->state >= CS_CONNECTED && !cl->undercover) {
+            Com_sprintf( player, sizeof( player ), "%i %i \"%s\"\n",
+                         gclient->sess.score, cl->ping, cl->name );
+            playerLength = strlen( player );
+            if ( msg->cursize + playerLength >= msg->maxsize ) {
+                break;      // can't hold any more
+            }
+            MSG_WriteData( msg, player, playerLength );
+        }
+    }
+}
 
-            default:
-                break;
+static void SVC_QueryCacheBuildInfo( queryCacheEntry_t* entry, msg_t* msg )
+{
+    int		i, count, humans;
+    char		infostring[MAX_INFO_STRING];
+    mvabuf;
+
+    infostring[0] = 0;
+
+    // don't count privateclients
+    count = humans = 0;
+    for ( i = 0 ; i < sv_maxclients->integer ; i++ )
+    {
+        if ( svs.clients[i].state >= CS_CONNECTED ) {
+            count++;
+            if (svs.clients[i].netchan.remoteAddress.type != NA_BOT) {
+                humans++;
+            }
         }
+    }
+
+    //Info_SetValueForKey( infostring, "gamename", com_gamename->string );
+    Info_SetValueForKey(infostring, "protocol", "6");
+    Info_SetValueForKey( infostring, "hostname", sv_hostname->string );
+
+    Info_SetValueForKey( infostring, "mapname", sv_mapname->string );
+    Info_SetValueForKey( infostring, "clients", va("%i", count) );
+    Info_SetValueForKey( infostring, "g_humanplayers", va("%i", humans));
+    Info_SetValueForKey( infostring, "sv_maxclients", va("%i", sv_maxclients->integer - sv_privateClients->integer ) );
+    Info_SetValueForKey( infostring, "gametype", sv_g_gametype->string );
+    Info_SetValueForKey( infostring, "pure", va("%i", sv_pure->boolean ) );
+    Info_SetValueForKey( infostring, "build", va("%i", Sys_GetBuild()));
+    Info_SetValueForKey( infostring, "shortversion", va("x%d", PROTOCOL_VERSION) );
 
+    if(*sv_password->string)
+    {
+        Info_SetValueForKey( infostring, "pswrd", "1");
+    }else{
+        Info_SetValueForKey( infostring, "pswrd", "0");
     }
 
-    for ( i = 0; i < querylimit.max_buckets; i++ ) {
-        int interval;
+    Info_SetValueForKey( infostring, "ff", va("%d", Cvar_VariableIntegerValue("scr_team_fftype")));
 
-        bucket = &querylimit.buckets[ i ];
-        interval = now - bucket->lastTime;
+        if(Cvar_GetVariantString("scr_game_allowkillcam")){
+        Info_SetValueForKey( infostring, "ki", "1");
+    }
 
-        // Reclaim expired buckets
-        if ( bucket->lastTime > 0 && ( interval > ( burst * period ) || interval < 0 ) )
-        {
-            if ( bucket->prev != NULL ) {
-                bucket->prev->next = bucket->next;
-            } else {
-                querylimit.bucketHashes[ bucket->hash ] = bucket->next;
-            }
+        if(Cvar_GetVariantString("scr_hardcore")){
+        Info_SetValueForKey( infostring, "hc", "1");
+    }
 
-            if ( bucket->next != NULL ) {
-                bucket->next->prev = bucket->prev;
-            }
+        if(Cvar_GetVariantString("scr_oldschool")){
+        Info_SetValueForKey( infostring, "od", "1");
+    }
+    Info_SetValueForKey( infostring, "hw", "1");
 
-            Com_Memset( bucket, 0, sizeof( leakyBucket_t ) );
-        }
+        if(fs_gameDirVar->string[0] == '\0' || sv_showasranked->boolean){
+        Info_SetValueForKey( infostring, "mod", "0");
+    }else{
+        Info_SetValueForKey( infostring, "mod", "1");
+    }
+    Info_SetValueForKey( infostring, "voice", va("%i", sv_voice->boolean ) );
+#ifdef PUNKBUSTER
+    Info_SetValueForKey( infostring, "pb", va("%i", sv_punkbuster->boolean) );
+#endif
+    if( sv_maxPing->integer ) {
+        Info_SetValueForKey( infostring, "sv_maxPing", va("%i", sv_maxPing->integer) );
+    }
 
-        if ( bucket->type == NA_BAD ) {
-            bucket->type = address->type;
-            switch ( address->type ) {
-                case NA_IP:	bucket->ipv._4[0] = address->ip[0];
-                        bucket->ipv._4[1] = address->ip[1];
-                        bucket->ipv._4[2] = address->ip[2];
-                        bucket->ipv._4[3] = address->ip[3];
-                        break;
+    if( fs_gameDirVar->string[0] != '\0' ) {
+        Info_SetValueForKey( infostring, "game", fs_gameDirVar->string );
+    }
 
-                case NA_IP6: Com_Memcpy( bucket->ipv._6, address->ip6, 16 ); break;
+    MSG_WriteLong( msg, -1 );
+    MSG_WriteData( msg, "infoResponse\n", 13 );
+    MSG_WriteData( msg, infostring, strlen(infostring) );
+    // The challenge was the first key set, so it is the last one in the string
+    entry->headLen = msg->cursize;
+}
 
-                default: return NULL;
-            }
+static void SVC_QueryCacheBuildPlayers( queryCacheEntry_t* entry, msg_t* msg )
+{
+    int i, numClients, connectedTime;
+    client_t    *cl;
+    gclient_t *gclient;
+    char cleanplayername[128];
 
-            bucket->lastTime = now;
-            bucket->burst = 0;
-            bucket->hash = hash;
+    /* Write the OOB-Header */
+    MSG_WriteLong(msg, -1);
+    /* Write the Command-Header */
+    MSG_WriteByte(msg, 'D');
+    /* numClients is 0 for now */
+    MSG_WriteByte(msg, 0);
 
-            // Add to the head of the relevant hash chain
-            bucket->next = querylimit.bucketHashes[ hash ];
-            if ( querylimit.bucketHashes[ hash ] != NULL ) {
-                querylimit.bucketHashes[ hash ]->prev = bucket;
-            }
+    for ( i = 0, cl = svs.clients, gclient = level.clients, numClients = 0; i < sv_maxclients->integer ; i++, gclient++, cl++) {
+
+        if ( cl->state >= CS_CONNECTED ) {
 
-            bucket->prev = NULL;
-            querylimit.bucketHashes[ hash ] = bucket;
+            MSG_WriteByte(msg, i);
 
-            return bucket;
+            Q_strncpyz(cleanplayername, cl->name, sizeof(cleanplayername));
+            Q_CleanStr(cleanplayername);
+
+            MSG_WriteString(msg, cleanplayername);
+            MSG_WriteLong(msg, gclient->sess.score);
+            connectedTime = svs.time - cl->connectedTime;
+            if(cl->connectedTime == 0)
+            {
+                connectedTime = 0;
+            }
+            MSG_WriteFloat(msg, ((float)(connectedTime))/1000);
+            numClients++;
         }
     }
-
-    // Couldn't allocate a bucket for this address
-    return NULL;
+    /* update the playercount */
+    msg->data[5] = numClients;
+    entry->headLen = msg->cursize;
 }
 
+struct sourceEngineCvars_s
+{
+    msg_t* msg;
+    int num;
+};
+
+static void SVC_QueryCacheBuildRules( queryCacheEntry_t* entry, msg_t* msg )
+{
+    struct sourceEngineCvars_s data;
+
+    /* Write the OOB header */
+    MSG_WriteLong(msg, -1);
+    /* Write the Command-Header */
+    MSG_WriteByte(msg, 'E');
+    /* Number of rules = 0 for now */
+    MSG_WriteShort(msg, 0);
+    /* Write each cvar */
+    data.msg = msg;
+    data.num = 0;
+    Cvar_ForEach( SVC_SourceEngineQuery_WriteCvars, &data );
+
+    *(short*)&msg->data[5] = data.num;
+    entry->headLen = msg->cursize;
+}
 
 /*
 ================
-SVC_RateLimit
+SVC_QueryCacheGet
+
+Returns the cached reply of the given type. Rebuilds it first if it is outdated
 ================
 */
-/*__optimize3 __attribute__((always_inline)) */
-static qboolean SVC_RateLimit( leakyBucket_t *bucket, int burst, int period ) {
-    if ( bucket != NULL ) {
-        unsigned long long now = com_uFrameTime;
-        int interval = now - bucket->lastTime;
-        int expired = interval / period;
-        int expiredRemainder = interval % period;
+static queryCacheEntry_t* SVC_QueryCacheGet( queryCacheType_t type )
+{
+    queryCacheEntry_t* entry = &queryCache.entries[type];
+    unsigned long long clientVersion;
+    int frameTime;
+    msg_t msg;
 
-        if ( expired > bucket->burst ) {
-            bucket->burst = 0;
-            bucket->lastTime = now;
-        } else {
-            bucket->burst -= expired;
-            bucket->lastTime = now - expiredRemainder;
-        }
+    if(type == QUERYCACHE_SE_RULES)
+    {
+        clientVersion = 0;
+    }else{
+        clientVersion = SVC_QueryCacheClientVersion();
+    }
+
+    if(type == QUERYCACHE_SE_PLAYERS)
+    {
+        frameTime = svs.time;
+    }else{
+        frameTime = 0;
+    }
+
+    if(entry->valid && entry->cvarVersion == cvar_modificationCount && entry->clientVersion == clientVersion && entry->frameTime == frameTime)
+    {
+        queryCache.hits++;
+        return entry;
+    }
+    queryCache.misses++;
 
-        if ( bucket->burst < burst ) {
-            bucket->burst++;
+    /* The last byte is always kept free for the terminating zero */
+    MSG_Init(&msg, entry->data, sizeof(entry->data) -1);
+    entry->infoLen = 0;
 
-            return qfalse;
-        }
+    switch(type)
+    {
+        case QUERYCACHE_STATUS:
+            SVC_QueryCacheBuildStatus( entry, &msg );
+            break;
+        case QUERYCACHE_INFO:
+            SVC_QueryCacheBuildInfo( entry, &msg );
+            break;
+        case QUERYCACHE_SE_INFO:
+            /* A2S_INFO always used a buffer of MAX_INFO_STRING */
+            msg.maxsize = MAX_INFO_STRING;
+            SVC_SourceEngineQuery_WriteInfoHeader( &msg, qtrue );
+            entry->headLen = msg.cursize;
+            break;
+        case QUERYCACHE_SE_INFO_EXT:
+            msg.maxsize = MAX_INFO_STRING;
+            SVC_SourceEngineQuery_WriteInfoHeader( &msg, qfalse );
+            entry->headLen = msg.cursize;
+            SVC_SourceEngineQuery_WriteInfoExtra( &msg );
+            break;
+        case QUERYCACHE_SE_PLAYERS:
+            SVC_QueryCacheBuildPlayers( entry, &msg );
+            break;
+        case QUERYCACHE_SE_RULES:
+            SVC_QueryCacheBuildRules( entry, &msg );
+            break;
+        default:
+            break;
     }
 
-    return qtrue;
+    entry->len = msg.cursize;
+    entry->data[entry->len] = 0;
+    entry->cvarVersion = cvar_modificationCount;
+    entry->clientVersion = clientVersion;
+    entry->frameTime = frameTime;
+    entry->valid = qtrue;
+    return entry;
 }
 
 /*
 ================
-SVC_RateLimitAddress
+SVC_QueryCacheSend
 
-Rate limit for a particular address
+Sends a cached reply with the given challenge bytes inserted after its head.
+Without challenge the cached data goes out as is
 ================
 */
-__optimize3 __regparm3 static qboolean SVC_RateLimitAddress( netadr_t *from, int burst, int period ) {
+static void SVC_QueryCacheSend( netadr_t* from, queryCacheEntry_t* entry, const byte* challenge, int challengeLen, int maxsize )
+{
+    byte buf[MAX_MSGLEN];
+    int len, taillen;
 
-    if(Sys_IsLANAddress(from))
-        return qfalse;
+    if(challengeLen < 1 && entry->len <= maxsize)
+    {
+        NET_SendPacket(NS_SERVER, entry->len, entry->data, from);
+        queryCache.bytesServed += entry->len;
+        return;
+    }
 
+    if(maxsize > sizeof(buf))
+    {
+        maxsize = sizeof(buf);
+    }
 
-    if(querylimit.queryLimitsEnabled == 1)
+    len = entry->headLen;
+    if(len > maxsize)
     {
-        leakyBucket_t *bucket = SVC_BucketForAddress( from, burst, period );
-        return SVC_RateLimit( bucket, burst, period );
+        len = maxsize;
+    }
+    Com_Memcpy(buf, entry->data, len);
 
-    }else if(querylimit.queryLimitsEnabled == 0){
-        return qfalse;
+    if(challengeLen > maxsize - len)
+    {
+        challengeLen = maxsize - len;
+    }
+    Com_Memcpy(buf + len, challenge, challengeLen);
+    len += challengeLen;
 
-    }else{//Init error, to be save we deny everything
-        return qtrue;
+    taillen = entry->len - entry->headLen;
+    if(taillen > maxsize - len)
+    {
+        taillen = maxsize - len;
     }
+    Com_Memcpy(buf + len, entry->data + entry->headLen, taillen);
+    len += taillen;
+
+    NET_SendPacket(NS_SERVER, len, buf, from);
+    queryCache.bytesServed += len;
+}
+
+/*
+================
+SVC_QueryCacheChallenge
+
+Builds the "\challenge\<s>" pair which gets inserted into the infostring replies.
+Invalid challenges get rejected by Info_SetValueForKey() the same way as before.
+================
+*/
+static int SVC_QueryCacheChallenge( char* out, const char* challenge )
+{
+    out[0] = 0;
+    Info_SetValueForKey( out, "challenge", challenge );
+    return strlen(out);
+}
+
+void SV_QueryCacheStats_f( void )
+{
+    int i;
+    queryCacheEntry_t* entry;
 
+    Com_Printf(CON_CHANNEL_DONT_FILTER, "Query cache: %llu hits, %llu misses, %llu bytes served\n", queryCache.hits, queryCache.misses, queryCache.bytesServed);
+
+    for(i = 0; i < QUERYCACHE_NUMTYPES; i++)
+    {
+        entry = &queryCache.entries[i];
+        if(!entry->valid)
+        {
+            Com_Printf(CON_CHANNEL_DONT_FILTER, "%-16s not built\n", queryCacheNames[i]);
+            continue;
+        }
+        Com_Printf(CON_CHANNEL_DONT_FILTER, "%-16s %5d bytes, cvar version %d%s\n", queryCacheNames[i], entry->len, entry->cvarVersion,
+                   entry->cvarVersion == cvar_modificationCount ? "" : " (outdated)");
+    }
 }
 
 
@@ -736,15 +1833,10 @@ the simple info query.
 */
 
 __optimize3 __regparm1 void SVC_Status( netadr_t *from ) {
-    char player[1024];
-    char status[MAX_MSGLEN];
-    int i;
-    client_t    *cl;
-    gclient_t *gclient;
-    int statusLength;
-    int playerLength;
+    char challenge[MAX_INFO_STRING];
     char infostring[MAX_INFO_STRING];
-    mvabuf;
+    int challengeLen, len;
+    queryCacheEntry_t* entry;
 
     // Prevent using getstatus as an amplifier
     if ( SVC_RateLimitAddress( from, 2, sv_queryIgnoreTime->integer*1000 ) ) {
@@ -765,37 +1857,32 @@ __optimize3 __regparm1 void SVC_Status( netadr_t *from ) {
     if(strlen(SV_Cmd_Argv(1)) > 128)
         return;
 
-    strcpy( infostring, Cvar_InfoString( CVAR_SERVERINFO | CVAR_NORESTART) );
+    entry = SVC_QueryCacheGet( QUERYCACHE_STATUS );
+
     // echo back the parameter to status. so master servers can use it as a challenge
     // to prevent timed spoofed reply packets that add ghost servers
-    Info_SetValueForKey( infostring, "challenge", SV_Cmd_Argv( 1 ) );
-
-    if(*sv_password->string)
-        Info_SetValueForKey( infostring, "pswrd", "1");
+    challengeLen = SVC_QueryCacheChallenge( challenge, SV_Cmd_Argv( 1 ) );
 
     // add "demo" to the sv_keywords if restricted
     if(NET_CompareBaseAdr(&atvimaster, from))
     {
+        /* Rare case. Rebuild the infostring from the cached pieces */
+        len = entry->headLen - STATUSRESPONSE_HEADLEN;
+        Com_Memcpy( infostring, entry->data + STATUSRESPONSE_HEADLEN, len );
+        infostring[len] = 0;
+        Q_strncat( infostring, sizeof(infostring), challenge );
+        len = strlen( infostring );
+        if(entry->infoLen < sizeof(infostring) - len)
+        {
+            Com_Memcpy( infostring + len, entry->data + entry->headLen, entry->infoLen );
+            infostring[len + entry->infoLen] = 0;
+        }
         Info_SetValueForKey( infostring, "protocol", "6" );
+        NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s%s", infostring, (char*)entry->data + entry->headLen + entry->infoLen );
+        return;
     }
 
-    status[0] = 0;
-    statusLength = 0;
-
-    for ( i = 0, gclient = level.clients ; i < sv_maxclients->integer ; i++, gclient++ ) {
-        cl = &svs.clients[i];
-        if ( cl->state >= CS_CONNECTED && !cl->undercover) {
-            Com_sprintf( player, sizeof( player ), "%i %i \"%s\"\n",
-                         gclient->sess.score, cl->ping, cl->name );
-            playerLength = strlen( player );
-            if ( statusLength + playerLength >= sizeof( status ) ) {
-                break;      // can't hold any more
-            }
-            strcpy( status + statusLength, player );
-            statusLength += playerLength;
-        }
-    }
-    NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s\n%s", infostring, status );
+    SVC_QueryCacheSend( from, entry, (byte*)challenge, challengeLen, MAX_MSGLEN -1 );
 }
 
 
@@ -808,14 +1895,9 @@ if a user is interested in a server to do a full status
 ================
 */
 __optimize3 __regparm1 void SVC_Info( netadr_t *from ) {
-    int		i, count, humans;
-    char		infostring[MAX_INFO_STRING];
-    char*		s;
-    mvabuf;
-
-
-    s = SV_Cmd_Argv(1);
-
+    char challenge[MAX_INFO_STRING];
+    int challengeLen;
+    queryCacheEntry_t* entry;
 
     // Prevent using getstatus as an amplifier
     if ( SVC_RateLimitAddress( from, 4, sv_queryIgnoreTime->integer*1000 )) {
@@ -831,8 +1913,6 @@ __optimize3 __regparm1 void SVC_Info( netadr_t *from ) {
         return;
     }
 
-    infostring[0] = 0;
-
     /*
      * Check whether Cmd_Argv(1) has a sane length. This was not done in the original Quake3 version which led
      * to the Infostring bug discovered by Luigi Auriemma. See http://aluigi.altervista.org/ for the advisory.
@@ -842,77 +1922,13 @@ __optimize3 __regparm1 void SVC_Info( netadr_t *from ) {
     if(strlen(SV_Cmd_Argv(1)) > 128)
         return;
 
-    // don't count privateclients
-    count = humans = 0;
-    for ( i = 0 ; i < sv_maxclients->integer ; i++ )
-    {
-        if ( svs.clients[i].state >= CS_CONNECTED ) {
-            count++;
-            if (svs.clients[i].netchan.remoteAddress.type != NA_BOT) {
-                humans++;
-            }
-        }
-    }
+    entry = SVC_QueryCacheGet( QUERYCACHE_INFO );
 
     // echo back the parameter to status. so servers can use it as a challenge
     // to prevent timed spoofed reply packets that add ghost servers
+    challengeLen = SVC_QueryCacheChallenge( challenge, SV_Cmd_Argv(1) );
 
-    Info_SetValueForKey( infostring, "challenge", s);
-
-
-    //Info_SetValueForKey( infostring, "gamename", com_gamename->string );
-    Info_SetValueForKey(infostring, "protocol", "6");
-    Info_SetValueForKey( infostring, "hostname", sv_hostname->string );
-
-    Info_SetValueForKey( infostring, "mapname", sv_mapname->string );
-    Info_SetValueForKey( infostring, "clients", va("%i", count) );
-    Info_SetValueForKey( infostring, "g_humanplayers", va("%i", humans));
-    Info_SetValueForKey( infostring, "sv_maxclients", va("%i", sv_maxclients->integer - sv_privateClients->integer ) );
-    Info_SetValueForKey( infostring, "gametype", sv_g_gametype->string );
-    Info_SetValueForKey( infostring, "pure", va("%i", sv_pure->boolean ) );
-    Info_SetValueForKey( infostring, "build", va("%i", Sys_GetBuild()));
-    Info_SetValueForKey( infostring, "shortversion", va("x%d", PROTOCOL_VERSION) );
-
-    if(*sv_password->string)
-    {
-        Info_SetValueForKey( infostring, "pswrd", "1");
-    }else{
-        Info_SetValueForKey( infostring, "pswrd", "0");
-    }
-
-    Info_SetValueForKey( infostring, "ff", va("%d", Cvar_VariableIntegerValue("scr_team_fftype")));
-
-        if(Cvar_GetVariantString("scr_game_allowkillcam")){
-        Info_SetValueForKey( infostring, "ki", "1");
-    }
-
-        if(Cvar_GetVariantString("scr_hardcore")){
-        Info_SetValueForKey( infostring, "hc", "1");
-    }
-
-        if(Cvar_GetVariantString("scr_oldschool")){
-        Info_SetValueForKey( infostring, "od", "1");
-    }
-    Info_SetValueForKey( infostring, "hw", "1");
-
-        if(fs_gameDirVar->string[0] == '\0' || sv_showasranked->boolean){
-        Info_SetValueForKey( infostring, "mod", "0");
-    }else{
-        Info_SetValueForKey( infostring, "mod", "1");
-    }
-    Info_SetValueForKey( infostring, "voice", va("%i", sv_voice->boolean ) );
-#ifdef PUNKBUSTER
-    Info_SetValueForKey( infostring, "pb", va("%i", sv_punkbuster->boolean) );
-#endif
-    if( sv_maxPing->integer ) {
-        Info_SetValueForKey( infostring, "sv_maxPing", va("%i", sv_maxPing->integer) );
-    }
-
-    if( fs_gameDirVar->string[0] != '\0' ) {
-        Info_SetValueForKey( infostring, "game", fs_gameDirVar->string );
-    }
-
-    NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s", infostring );
+    SVC_QueryCacheSend( from, entry, (byte*)challenge, challengeLen, MAX_MSGLEN -1 );
 }
 
 #if 0
@@ -1131,7 +2147,7 @@ void CLC_SourceEngineQuery_ReadRules(msg_t* msg, queryrules_t* query)
 }
 #endif
 
-void SVC_SourceEngineQuery_WriteInfo( msg_t* msg, const char* challengeStr, qboolean masterserver)
+static void SVC_SourceEngineQuery_WriteInfoHeader( msg_t* msg, qboolean clean )
 {
     int i, humans, bots;
     char cleanhostname[1024];
@@ -1140,7 +2156,7 @@ void SVC_SourceEngineQuery_WriteInfo( msg_t* msg, const char* challengeStr, qboo
     MSG_WriteByte(msg, 'I');
     MSG_WriteByte(msg, sv_protocol->integer);
 
-    if(challengeStr[0] || masterserver)
+    if(!clean)
     {
         MSG_WriteString(msg, sv_hostname->string);
     }else{
@@ -1200,18 +2216,27 @@ void SVC_SourceEngineQuery_WriteInfo( msg_t* msg, const char* challengeStr, qboo
     MSG_WriteByte(msg, 0x80);
 
     MSG_WriteShort(msg, NET_GetHostPort());
+}
+
+static void SVC_SourceEngineQuery_WriteInfoExtra( msg_t* msg )
+{
+    MSG_WriteString(msg, sv_g_gametype->string );
+
+    MSG_WriteByte( msg, Cvar_VariableIntegerValue("scr_team_fftype"));
+    MSG_WriteByte( msg, Cvar_VariableBooleanValue("scr_game_allowkillcam"));
+    MSG_WriteByte( msg, Cvar_VariableBooleanValue("scr_hardcore"));
+    MSG_WriteByte( msg, Cvar_VariableBooleanValue("scr_oldschool"));
+    MSG_WriteByte( msg, sv_voice->boolean);
+}
+
+void SVC_SourceEngineQuery_WriteInfo( msg_t* msg, const char* challengeStr, qboolean masterserver)
+{
+    SVC_SourceEngineQuery_WriteInfoHeader( msg, !(challengeStr[0] || masterserver) );
 
     if(challengeStr[0] || masterserver)
     {
         MSG_WriteString(msg, challengeStr);
-        MSG_WriteString(msg, sv_g_gametype->string );
-
-        MSG_WriteByte( msg, Cvar_VariableIntegerValue("scr_team_fftype"));
-        MSG_WriteByte( msg, Cvar_VariableBooleanValue("scr_game_allowkillcam"));
-        MSG_WriteByte( msg, Cvar_VariableBooleanValue("scr_hardcore"));
-        MSG_WriteByte( msg, Cvar_VariableBooleanValue("scr_oldschool"));
-        MSG_WriteByte( msg, sv_voice->boolean);
-
+        SVC_SourceEngineQuery_WriteInfoExtra( msg );
 
         if(masterserver)
         {
@@ -1228,9 +2253,8 @@ void SVC_SourceEngineQuery_WriteInfo( msg_t* msg, const char* challengeStr, qboo
 
 void SVC_SourceEngineQuery_Info( netadr_t* from, const char* challengeStr)
 {
-
-    msg_t msg;
-    byte buf[MAX_INFO_STRING];
+    queryCacheEntry_t* entry;
+    int challengeLen;
 
     // Prevent using getstatus as an amplifier
     if ( SVC_RateLimitAddress( from, 4, sv_queryIgnoreTime->integer*1000 )) {
@@ -1245,12 +2269,23 @@ void SVC_SourceEngineQuery_Info( netadr_t* from, const char* challengeStr)
         return;
     }
 
-    MSG_Init(&msg, buf, sizeof(buf));
-
-    SVC_SourceEngineQuery_WriteInfo( &msg, challengeStr, qfalse);
+    if(challengeStr[0] == '\0')
+    {
+        entry = SVC_QueryCacheGet( QUERYCACHE_SE_INFO );
+        SVC_QueryCacheSend( from, entry, NULL, 0, MAX_INFO_STRING );
+        return;
+    }
 
-    NET_SendPacket(NS_SERVER, msg.cursize, msg.data, from);
+    entry = SVC_QueryCacheGet( QUERYCACHE_SE_INFO_EXT );
 
+    /* Same bytes as MSG_WriteString() would write */
+    challengeLen = strlen(challengeStr);
+    if(challengeLen >= MAX_STRING_CHARS)
+    {
+        challengeStr = "";
+        challengeLen = 0;
+    }
+    SVC_QueryCacheSend( from, entry, (const byte*)challengeStr, challengeLen +1, MAX_INFO_STRING );
 }
 
 
@@ -1324,15 +2359,9 @@ void SVC_SourceEngineQuery_SendSplitMessage( netadr_t* from, msg_t* longmsg )
 
 void SVC_SourceEngineQuery_Player( netadr_t* from, msg_t* recvmsg )
 {
-
     msg_t playermsg;
-    byte pbuf[MAX_MSGLEN];
-
-    int i, numClients, challenge;
-    client_t    *cl;
-    gclient_t *gclient;
-    char cleanplayername[128];
-
+    int challenge;
+    queryCacheEntry_t* entry;
 
     /* 1st check the challenge */
     MSG_BeginReading(recvmsg);
@@ -1349,47 +2378,17 @@ void SVC_SourceEngineQuery_Player( netadr_t* from, msg_t* recvmsg )
         return;
     }
 
-    MSG_Init(&playermsg, pbuf, sizeof(pbuf));
-    /* Write the OOB-Header */
-    MSG_WriteLong(&playermsg, -1);
-    /* Write the Command-Header */
-    MSG_WriteByte(&playermsg, 'D');
-    /* numClients is 0 for now */
-    MSG_WriteByte(&playermsg, 0);
-
-    for ( i = 0, cl = svs.clients, gclient = level.clients, numClients = 0; i < sv_maxclients->integer ; i++, gclient++, cl++) {
-
-        if ( cl->state >= CS_CONNECTED ) {
-
-            MSG_WriteByte(&playermsg, i);
+    entry = SVC_QueryCacheGet( QUERYCACHE_SE_PLAYERS );
 
-            Q_strncpyz(cleanplayername, cl->name, sizeof(cleanplayername));
-            Q_CleanStr(cleanplayername);
-
-            MSG_WriteString(&playermsg, cleanplayername);
-            MSG_WriteLong(&playermsg, gclient->sess.score);
-            int connectedTime = svs.time - cl->connectedTime;
-            if(cl->connectedTime == 0)
-            {
-                connectedTime = 0;
-            }
-            MSG_WriteFloat(&playermsg, ((float)(connectedTime))/1000);
-            numClients++;
-        }
-    }
-    /* update the playercount */
-    playermsg.data[5] = numClients;
+    /* Split messages only advance the readcount of this msg_t, the cached data stays untouched */
+    MSG_Init(&playermsg, entry->data, sizeof(entry->data));
+    playermsg.cursize = entry->len;
+    queryCache.bytesServed += entry->len;
 
     SVC_SourceEngineQuery_SendSplitMessage( from, &playermsg );
 
 }
 
-struct sourceEngineCvars_s
-{
-    msg_t* msg;
-    int num;
-};
-
 void	SVC_SourceEngineQuery_WriteCvars(cvar_t const* cvar, void *var ){
     struct sourceEngineCvars_s *data = var;
 
@@ -1405,9 +2404,8 @@ void	SVC_SourceEngineQuery_WriteCvars(cvar_t const* cvar, void *var ){
 void SVC_SourceEngineQuery_Rules( netadr_t* from, msg_t* recvmsg )
 {
     msg_t msg;
-    byte buf[MAX_MSGLEN];
-    struct sourceEngineCvars_s data;
-    int numvars, challenge;
+    int challenge;
+    queryCacheEntry_t* entry;
 
     /* 1st check the challenge */
     MSG_BeginReading(recvmsg);
@@ -1424,21 +2422,11 @@ void SVC_SourceEngineQuery_Rules( netadr_t* from, msg_t* recvmsg )
         return;
     }
 
-    numvars = 0;
+    entry = SVC_QueryCacheGet( QUERYCACHE_SE_RULES );
 
-    MSG_Init(&msg, buf, sizeof(buf));
-    /* Write the OOB header */
-    MSG_WriteLong(&msg, -1);
-    /* Write the Command-Header */
-    MSG_WriteByte(&msg, 'E');
-    /* Number of rules = 0 for now */
-    MSG_WriteShort(&msg, numvars);
-    /* Write each cvar */
-    data.msg = &msg;
-    data.num = 0;
-    Cvar_ForEach( SVC_SourceEngineQuery_WriteCvars, &data );
-
-    *(short*)&msg.data[5] = data.num;
+    MSG_Init(&msg, entry->data, sizeof(entry->data));
+    msg.cursize = entry->len;
+    queryCache.bytesServed += entry->len;
 
     SVC_SourceEngineQuery_SendSplitMessage( from, &msg );
 
@@ -2802,6 +3790,7 @@ __cdecl void SV_Shutdown( const char *finalmsg ) {
     SV_ShutdownGameProgs();
     SV_DisconnectAllClients();
     SV_DemoSystemShutdown();
+    KVS_Shutdown();
     SV_FreeClients();
 
     // free current level
@@ -3142,6 +4131,7 @@ void SV_InitCvarsOnce(void){
     sv_uptime = Cvar_RegisterString("uptime", "", CVAR_SERVERINFO | CVAR_ROM, "Time the server is running since last restart");
     sv_autodemorecord = Cvar_RegisterBool("sv_autodemorecord", qfalse, 0, "Automatically start from each connected client a demo.");
     sv_demoCompletedCmd = Cvar_RegisterString("sv_demoCompletedCmd", "", com_securemode ? CVAR_INIT : 0 , "This program will be executed when a demo has been completed. You have to specify an executable file located in fs_homepath/apps/. The arrived filename will be passed as argument.");
+    sv_demoCompress = Cvar_RegisterBool("sv_demoCompress", qfalse, CVAR_ARCHIVE, "Record server demos zlib compressed as .dm_1.dmz files. Use tools/demo_uncompress to turn them back into playable .dm_1 files.");
     sv_screenshotArrivedCmd = Cvar_RegisterString("sv_screenshotArrivedCmd", "", com_securemode ? CVAR_INIT : 0 , "This program will be executed when a new screenshot has arrived. You have to specify an executable file located in fs_homepath/apps/. The arrived filename will be passed as argument.");
     sv_mapDownloadCompletedCmd = Cvar_RegisterString("sv_mapDownloadCompletedCmd", "", com_securemode ? CVAR_INIT : 0 , "This program will be executed when a downloaded map was received. You have to specify an executable file located in fs_homepath/apps/. The arrived usermaps/mapname will be passed as argument.");
     sv_consayname = Cvar_RegisterString("sv_consayname", "^2Server: ^7", CVAR_ARCHIVE, "If the server broadcast text-messages this name will be used");
@@ -3171,6 +4161,11 @@ void SV_InitCvarsOnce(void){
     sv_pure = Cvar_RegisterBool("sv_pure", qtrue, 0xc, "Cannot use modified IWD files");
     sv_fps = Cvar_RegisterInt("sv_fps", 20, 1, 250, 0, "Server frames per second");
     sv_showAverageBPS = Cvar_RegisterBool("sv_showAverageBPS", qfalse, 0, "Show average bytes per second for net debugging");
+    sv_snapshotThreads = Cvar_RegisterInt("sv_snapshotThreads", 0, 0, 16, CVAR_ARCHIVE, "Number of worker threads building and encoding client snapshots. 0 = build them on the server thread");
+    sv_checksumThreads = Cvar_RegisterInt("sv_checksumThreads", 4, 0, 8, CVAR_ARCHIVE, "Number of worker threads checksumming the downloadable files of a new map. 0 = checksum them on the server thread");
+    sv_preloadNextMap = Cvar_RegisterBool("sv_preloadNextMap", qfalse, CVAR_ARCHIVE, "Read and inflate the fastfile of the next map in the background during the current map");
+    sv_preloadNextMapMaxMB = Cvar_RegisterInt("sv_preloadNextMapMaxMB", 256, 16, 1024, CVAR_ARCHIVE, "Maximum size in MB of an inflated fastfile preloaded by sv_preloadNextMap");
+    sv_snapshotStats = Cvar_RegisterBool("sv_snapshotStats", qfalse, 0, "Print snapshot build and encode times every 5 seconds");
     sv_botsPressAttackBtn = Cvar_RegisterBool("sv_botsPressAttackBtn", qtrue, 0, "Allow testclients to press attack button");
     sv_debugRate = Cvar_RegisterBool("sv_debugRate", qfalse, 0, "Enable snapshot rate debugging info");
     sv_debugReliableCmds = Cvar_RegisterBool("sv_debugReliableCmds", qfalse, 0, "Enable debugging information for reliable commands");
@@ -3189,6 +4184,7 @@ void SV_Init(){
     SV_InitCvarsOnce();
     SVC_RateLimitInit( );
     SV_InitBanlist();
+    GeoIP_Init();
     Init_CallVote();
     SV_InitServerId();
     SV_DownloadAndExecGlobalConfig();
@@ -3196,6 +4192,7 @@ void SV_Init(){
     Com_RandomBytes((byte*)&psvs.randint, sizeof(psvs.randint));
     SV_InitSApi();
     SV_TryLoadXAC();
+    KVS_Init();
 }
 
 
@@ -3536,6 +4533,7 @@ void SV_InitArchivedSnapshot()
 
 void SV_RunFrame(){
     SV_ResetSkeletonCache();
+    Scr_FS_RunAsyncCallbacks();
     G_RunFrame(svs.time);
 }
 
@@ -4240,6 +5238,32 @@ Player movement occurs as a result of packet events, which
 happen before SV_Frame is called
 ==================
 */
+/*
+==================
+SV_PreloadNextMap
+
+Keeps the zone of the map coming up next preloaded. A changed rotation or vote
+discards the preload and starts over with the new map
+==================
+*/
+static void SV_PreloadNextMap()
+{
+    char mapname[MAX_QPATH];
+
+    if(!sv_preloadNextMap->boolean || !useFastFile->boolean || sv.state != SS_GAME)
+    {
+        DB_DiscardPreloadedZone(NULL);
+        return;
+    }
+    if(!SV_PredictNextMap(mapname, sizeof(mapname)))
+    {
+        DB_DiscardPreloadedZone(NULL);
+        return;
+    }
+    DB_PreloadZone(mapname, sv_preloadNextMapMaxMB->integer * 1024 * 1024);
+}
+
+
 __optimize3 __regparm1 qboolean SV_Frame( unsigned int usec ) {
     unsigned int frameUsec;
     char mapname[MAX_QPATH];
@@ -4478,6 +5502,8 @@ __optimize3 __regparm1 qboolean SV_Frame( unsigned int usec ) {
 
             serverStatus_Write();
 
+            SV_PreloadNextMap();
+
             PHandler_Event(PLUGINS_ONTENSECONDS, NULL);	// Plugin event
     /*		if(svs.time > svs.nextsecret){
                 svs.nextsecret = svs.time+80000;
@@ -4543,47 +5569,66 @@ void SV_ShowClientUnAckCommands( client_t *client )
     for ( i = client->reliableAcknowledge + 1; i <= client->reliableSequence; ++i )
     {
         Com_Printf(CON_CHANNEL_SERVER,"cmd %5d: %8d: %s\n", i, client->reliableCommands[i & (MAX_RELIABLE_COMMANDS -1)].cmdTime,
-                   client->reliableCommands[i & (MAX_RELIABLE_COMMANDS -1)].command );
+                   SV_GetReliableCommand( client, i ) );
     }
 
     Com_Printf(CON_CHANNEL_SERVER,"-----------------------------------------------------\n");
 }
 
 
+#define MAX_CHECKSUMMED_FILES 512
+
 void SV_CalculateChecksums()
 {
-    int i;
-    char filename[MAX_OSPATH];
-    //char* str;
+    int i, numfiles;
+    char (*filenames)[MAX_QPATH];
+    const char* filelist[MAX_CHECKSUMMED_FILES];
     int len, crc32;
 
     Com_Printf(CON_CHANNEL_SERVER,"^4Calculate referenced files checksums...\n");
+
+    filenames = Z_Malloc(MAX_CHECKSUMMED_FILES * MAX_QPATH);
+    if(filenames == NULL)
+    {
+        return;
+    }
+    numfiles = 0;
+
     Cmd_TokenizeString(sv_referencedIwdNames->string);
 
-    for(i = 0; i < Cmd_Argc(); ++i)
+    for(i = 0; i < Cmd_Argc() && numfiles < MAX_CHECKSUMMED_FILES; ++i)
     {
-        Com_sprintf(filename, sizeof(filename), "%s.iwd", Cmd_Argv(i));
-        len = FS_CalculateChecksumForFile(filename, &crc32);
-        Com_Printf(CON_CHANNEL_SERVER,"^4CRC32 for %s is %x Len %d\n", filename, crc32, len);
+        Com_sprintf(filenames[numfiles], MAX_QPATH, "%s.iwd", Cmd_Argv(i));
+        ++numfiles;
     }
     Cmd_EndTokenizedString();
 
     Cmd_TokenizeString(sv_referencedFFNames->string);
 
-    for(i = 0; i < Cmd_Argc(); ++i)
+    for(i = 0; i < Cmd_Argc() && numfiles < MAX_CHECKSUMMED_FILES; ++i)
     {
+        DB_GetQPathForZone(Cmd_Argv(i), MAX_QPATH, filenames[numfiles]);
+        ++numfiles;
+    }
 
-        DB_GetQPathForZone(Cmd_Argv(i), sizeof(filename), filename);
+    Cmd_EndTokenizedString();
+
+    for(i = 0; i < numfiles; ++i)
+    {
+        filelist[i] = filenames[i];
+    }
+    FS_PrecomputeChecksums(filelist, numfiles, sv_checksumThreads->integer);
 
-        if((len = FS_CalculateChecksumForFile(filename, &crc32)) <= 0)
+    for(i = 0; i < numfiles; ++i)
+    {
+        if((len = FS_CalculateChecksumForFile(filenames[i], &crc32)) <= 0)
         {
-            Com_PrintError(CON_CHANNEL_SERVER,"file for loaded zone '%s' not found\n", Cmd_Argv(i));
+            Com_PrintError(CON_CHANNEL_SERVER,"file '%s' not found\n", filenames[i]);
         }else{
-            Com_Printf(CON_CHANNEL_SERVER,"^4CRC32 for %s is %x Len %d\n", filename, crc32, len);
+            Com_Printf(CON_CHANNEL_SERVER,"^4CRC32 for %s is %x Len %d\n", filenames[i], crc32, len);
         }
     }
-
-    Cmd_EndTokenizedString();
+    Z_Free(filenames);
 }
 
 
@@ -4835,6 +5880,8 @@ void SV_SpawnServer(const char *mapname)
   Com_SyncThreads();
   Sys_BeginLoadThreadPriorities();
 
+  DB_DiscardPreloadedZone(mapname);
+
 #ifndef DEDICATEDONLY
   char loadffname[128];
 
@@ -46,7 +46,7 @@ void SV_Netchan_Decode( client_t *client, byte *data, int remaining ) {
 //	extclient_t *extcl = &svs.extclients[ client - svs.clients ];
 	
 //	string = (byte *)extcl->reliableCommands[ client->reliableAcknowledge & ( MAX_RELIABLE_COMMANDS - 1 ) ].command;
-	string = (byte *)client->reliableCommands[ client->reliableAcknowledge & ( MAX_RELIABLE_COMMANDS - 1 ) ].command;
+	string = (byte *)SV_GetReliableCommand( client, client->reliableAcknowledge );
 
 	if(!remaining) return;
 	key = client->challenge ^ (byte)client->serverId ^ client->messageAcknowledge;
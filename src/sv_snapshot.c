@@ -32,6 +32,8 @@
 #include "g_sv_shared.h"
 #include "cm_public.h"
 #include "g_shared.h"
+#include "sys_thread.h"
+#include "qcommon_mem.h"
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -76,7 +78,7 @@ __cdecl void SV_UpdateServerCommandsToClient( client_t *client, msg_t *msg ) {
 		MSG_WriteByte( msg, svc_serverCommand );
 		MSG_WriteLong( msg, i );
 		//MSG_WriteString( msg, extcl->reliableCommands[ i & ( MAX_RELIABLE_COMMANDS - 1 ) ].command );
-		MSG_WriteString( msg, client->reliableCommands[ i & ( MAX_RELIABLE_COMMANDS - 1 ) ].command );
+		MSG_WriteString( msg, SV_GetReliableCommand( client, i ) );
 	}
 
 	client->reliableSent = client->reliableSequence;
@@ -87,18 +89,19 @@ void SV_UpdateServerCommandsToClientRecover( client_t *client, msg_t *msg )
 {
 	int i;
 	int cmdlen;
+	const char* cmd;
 
 	for(i = client->reliableAcknowledge + 1; i <= client->reliableSequence; i++)
 	{
-
-		cmdlen = strlen(client->reliableCommands[i & ( MAX_RELIABLE_COMMANDS - 1 )].command);
+		cmd = SV_GetReliableCommand( client, i );
+		cmdlen = strlen(cmd);
 
 		if ( cmdlen + msg->cursize + 6 >= msg->maxsize )
 			break;
 
 		MSG_WriteByte(msg, svc_serverCommand);
 		MSG_WriteLong(msg, i);
-		MSG_WriteString(msg, client->reliableCommands[i & ( MAX_RELIABLE_COMMANDS - 1 )].command);
+		MSG_WriteString(msg, cmd);
 
 	}
 	if ( i - 1 > client->reliableSent )
@@ -443,51 +446,32 @@ void SV_TrackHuffmanCompression(int compsize, int uncompsize)
 
 /*
 =======================
-SV_SendMessageToClient
+SV_SendMessageDataToClient
 
-Called by SV_SendClientSnapshot and SV_SendClientGameState
+Transmits an already compressed message. uncompsize is the size of the
+message before compression and drives the rate calculation.
 =======================
 */
-__cdecl void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
+static void SV_SendMessageDataToClient( client_t *client, byte *data, int len, int uncompsize ) {
 	int rateMsec;
 
-	byte svCompressBuf[4*65536];
-
-#ifdef SV_SEND_HUFFMAN
-	int len;
-	*(int32_t*)svCompressBuf = *(int32_t*)msg->data;
-	len = MSG_WriteBitsCompress( msg->data + 4 ,(byte*)svCompressBuf + 4, msg->cursize - 4);
-//	SV_TrackHuffmanCompression(len, msg->cursize - 4);
-	len += 4;
-#endif
 	if(client->delayDropMsg){
 		SV_DropClient(client, client->delayDropMsg);
 	}
 
 	if(client->demorecording && !client->demowaiting && client->demofile.handleFiles.file.o)
 	{
-#ifdef SV_SEND_HUFFMAN
-		SV_WriteDemoMessageForClient(svCompressBuf, len, client);
-#else
-		SV_WriteDemoMessageForClient(msg->data, msg->cursize, client);
-#endif
+		SV_WriteDemoMessageForClient(data, len, client);
 	}
 
 	// record information about the message
-#ifdef SV_SEND_HUFFMAN
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSize = len;
-#else
-	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSize = msg->cursize;
-#endif
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = Sys_Milliseconds();
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageAcked = 0xFFFFFFFF;
 
 	// send the datagram
-#ifdef SV_SEND_HUFFMAN
-	SV_Netchan_Transmit( client, svCompressBuf, len );
-#else
-	SV_Netchan_Transmit( client, msg->data, msg->cursize );
-#endif
+	SV_Netchan_Transmit( client, data, len );
+
 	// set nextSnapshotTime based on rate and requested number of updates
 
 	// local clients get snapshots every frame
@@ -504,7 +488,7 @@ __cdecl void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 	}
 
 	// normal rate / snapshotMsec calculation
-	rateMsec = SV_RateMsec( client, msg->cursize );
+	rateMsec = SV_RateMsec( client, uncompsize );
 
 	// TTimo - during a download, ignore the snapshotMsec
 	// the update server on steroids, with this disabled and sv_fps 60, the download can reach 30 kb/s
@@ -528,13 +512,47 @@ __cdecl void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 			client->nextSnapshotTime = svs.time + 1000;
 		}
 	}
-#ifdef SV_SEND_HUFFMAN
 	sv.bpsTotalBytes += len;
+}
+
+/*
+=======================
+SV_CompressMessage
+
+Returns the length of the data to transmit. The first 4 bytes stay uncompressed.
+dest has to hold at least 4 + msg->cursize * 2 bytes.
+=======================
+*/
+static int SV_CompressMessage( msg_t *msg, byte *dest ) {
+#ifdef SV_SEND_HUFFMAN
+	int len;
+	*(int32_t*)dest = *(int32_t*)msg->data;
+	len = MSG_WriteBitsCompress( msg->data + 4 ,dest + 4, msg->cursize - 4);
+//	SV_TrackHuffmanCompression(len, msg->cursize - 4);
+	return len + 4;
 #else
-	sv.bpsTotalBytes += msg->cursize;
+	Com_Memcpy(dest, msg->data, msg->cursize);
+	return msg->cursize;
 #endif
 }
 
+/*
+=======================
+SV_SendMessageToClient
+
+Called by SV_SendClientSnapshot and SV_SendClientGameState
+=======================
+*/
+__cdecl void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
+
+	byte svCompressBuf[4*65536];
+	int len;
+
+	len = SV_CompressMessage( msg, svCompressBuf );
+
+	SV_SendMessageDataToClient( client, svCompressBuf, len, msg->cursize );
+}
+
 void SV_SendClientSnapshot(client_t *cl){
 
 	msg_t msg;
@@ -551,12 +569,9 @@ void SV_SendClientSnapshot(client_t *cl){
 	SV_GetServerStaticHeader();
 }
 
-void SV_BeginClientSnapshot(client_t *client, msg_t *msg)
+static void SV_BeginClientSnapshotInBuffer(client_t *client, msg_t *msg, byte *buf, int bufsize)
 {
-	static byte tempSnapshotMsgBuf[NETCHAN_UNSENTBUFFER_SIZE];
-
-
-	MSG_Init( msg, tempSnapshotMsgBuf, sizeof(tempSnapshotMsgBuf) );
+	MSG_Init( msg, buf, bufsize );
 	MSG_ClearLastReferencedEntity( msg );
 
 	MSG_WriteLong( msg, client->lastClientCommand );
@@ -572,14 +587,15 @@ void SV_BeginClientSnapshot(client_t *client, msg_t *msg)
 
 }
 
-void SV_EndClientSnapshot(client_t *client, msg_t *msg)
+void SV_BeginClientSnapshot(client_t *client, msg_t *msg)
 {
+	static byte tempSnapshotMsgBuf[NETCHAN_UNSENTBUFFER_SIZE];
 
-	if ( client->state != CS_ZOMBIE )
-		SV_WriteDownloadToClient( client );
-
-	MSG_WriteByte(msg, svc_EOF);
+	SV_BeginClientSnapshotInBuffer(client, msg, tempSnapshotMsgBuf, sizeof(tempSnapshotMsgBuf));
+}
 
+static void SV_RecoverOverflowedSnapshot(client_t *client, msg_t *msg)
+{
 	if ( msg->overflowed == qtrue)
 	{
 		Com_PrintWarning(CON_CHANNEL_SERVER, "WARNING: msg overflowed for %s, trying to recover\n", client->name);
@@ -603,6 +619,17 @@ void SV_EndClientSnapshot(client_t *client, msg_t *msg)
 			SV_DropClient(client, "EXE_SERVERMESSAGEOVERFLOW");
 		}
 	}
+}
+
+void SV_EndClientSnapshot(client_t *client, msg_t *msg)
+{
+
+	if ( client->state != CS_ZOMBIE )
+		SV_WriteDownloadToClient( client );
+
+	MSG_WriteByte(msg, svc_EOF);
+
+	SV_RecoverOverflowedSnapshot(client, msg);
 
 	SV_SendMessageToClient(msg, client);
 }
@@ -714,10 +741,12 @@ static void SV_AddCachedEntitiesVisibleFromPoint(int from_num_entities, int from
 
 /*
 ===============
-SV_AddEntitiesVisibleFromPoint
+SV_AddEntitiesVisibleFromPointUncached
+
+Walks all entities. Only used if the visibility cache has no room for the cluster.
 ===============
 */
-static void SV_AddEntitiesVisibleFromPoint( float *origin, int clientNum, snapshotEntityNumbers_t *eNums )
+static void SV_AddEntitiesVisibleFromPointUncached( float *origin, int clientNum, snapshotEntityNumbers_t *eNums )
 {
 	int e, i;
 	gentity_t *ent;
@@ -836,6 +865,291 @@ static void SV_AddEntitiesVisibleFromPoint( float *origin, int clientNum, snapsh
 	}
 }
 
+/*
+==============================================================================
+
+Per frame entity visibility cache
+
+Entities get classified once per frame and the PVS test is done once for each
+cluster a client is standing in. A client then only walks the entities which can
+be visible from its cluster and does the cheap per client tests (client mask,
+own entity and fog distance) on those.
+
+==============================================================================
+*/
+
+#define VISCACHE_WORDS (MAX_GENTITIES / 32)
+#define MAX_VISCACHE_CLUSTERS MAX_CLIENTS
+
+typedef struct
+{
+	int cluster;
+	uint32_t pvs[VISCACHE_WORDS];          // clustered entities visible from this cluster
+}visCacheCluster_t;
+
+typedef struct
+{
+	qboolean valid;
+	int num_entities;
+	int numClusters;
+	uint32_t broadcast[VISCACHE_WORDS];    // active broadcasts, sent without any further test
+	uint32_t always[VISCACHE_WORDS];       // svFlags 0x18 or without clusters, client mask test only
+	uint32_t clustered[VISCACHE_WORDS];    // need the PVS test
+	visCacheCluster_t clusters[MAX_VISCACHE_CLUSTERS];
+}visCache_t;
+
+static visCache_t visCache;
+
+
+static void SV_InvalidateVisibilityCache()
+{
+	visCache.valid = qfalse;
+	visCache.numClusters = 0;
+}
+
+/*
+Expired broadcasts get reset once per frame before any client looks at the entities.
+*/
+static void SV_ClearExpiredBroadcasts()
+{
+	int e;
+	gentity_t *ent;
+
+	for ( e = 0 ; e < sv.num_entities ; e++ ) {
+		ent = SV_GentityNum( e );
+		if ( ent->r.linked && ent->r.broadcastTime > 0 && ent->r.broadcastTime < svs.time )
+		{
+			ent->r.broadcastTime = 0;
+		}
+	}
+}
+
+static void SV_UpdateVisibilityCache()
+{
+	int e;
+	gentity_t *ent;
+	svEntity_t *svEnt;
+	uint32_t bit;
+
+	if ( visCache.valid )
+	{
+		return;
+	}
+
+	SV_ClearExpiredBroadcasts();
+
+	Com_Memset(visCache.broadcast, 0, sizeof(visCache.broadcast));
+	Com_Memset(visCache.always, 0, sizeof(visCache.always));
+	Com_Memset(visCache.clustered, 0, sizeof(visCache.clustered));
+
+	visCache.num_entities = sv.num_entities;
+	visCache.numClusters = 0;
+
+	for ( e = 0 ; e < sv.num_entities ; e++ ) {
+		ent = SV_GentityNum( e );
+
+		if ( !ent->r.linked )
+		{
+			continue;
+		}
+
+		bit = 1 << (e & 31);
+
+		if ( ent->r.broadcastTime )
+		{
+			visCache.broadcast[e >> 5] |= bit;
+			continue;
+		}
+
+		svEnt = SV_SvEntityForGentity( ent );
+
+		if ( ent->r.svFlags & 0x18 || !svEnt->numClusters )
+		{
+			visCache.always[e >> 5] |= bit;
+			continue;
+		}
+		visCache.clustered[e >> 5] |= bit;
+	}
+	visCache.valid = qtrue;
+}
+
+/*
+Same test SV_AddEntitiesVisibleFromPointUncached does, including its handling of lastCluster
+*/
+static qboolean SV_EntityClustersVisible( svEntity_t *svEnt, byte *bitvector )
+{
+	int i, l;
+
+	l = 0;
+	for ( i = 0 ; i < svEnt->numClusters ; i++ )
+	{
+		l = svEnt->clusternums[i];
+		if ( bitvector[l >> 3] & ( 1 << ( l & 7 ) ) )
+		{
+			return qtrue;
+		}
+	}
+
+	// check overflow clusters that coudln't be stored
+	if ( !svEnt->lastCluster )
+	{
+		return qfalse;
+	}
+	for ( ; l <= svEnt->lastCluster ; l++ )
+	{
+		if ( bitvector[l >> 3] & ( 1 << ( l & 7 ) ) )
+		{
+			break;
+		}
+	}
+	if ( l == svEnt->lastCluster ) {
+		return qfalse;
+	}
+	return qtrue;
+}
+
+/*
+Returns the cached PVS result for cluster and builds it if needed.
+Worker threads only ever find clusters which got prepared by SV_PrepareVisibilityCache.
+*/
+static visCacheCluster_t* SV_GetVisibilityCacheCluster( int cluster )
+{
+	int i, w, e;
+	uint32_t bits;
+	byte *bitvector;
+	visCacheCluster_t *vc;
+
+	SV_UpdateVisibilityCache();
+
+	for ( i = 0; i < visCache.numClusters; ++i )
+	{
+		if ( visCache.clusters[i].cluster == cluster )
+		{
+			return &visCache.clusters[i];
+		}
+	}
+
+	if ( visCache.numClusters >= MAX_VISCACHE_CLUSTERS )
+	{
+		return NULL;
+	}
+
+	vc = &visCache.clusters[visCache.numClusters];
+	vc->cluster = cluster;
+	Com_Memset(vc->pvs, 0, sizeof(vc->pvs));
+
+	bitvector = CM_ClusterPVS( cluster );
+
+	for ( w = 0; w < (visCache.num_entities + 31) >> 5; ++w )
+	{
+		for ( bits = visCache.clustered[w]; bits; bits &= bits -1 )
+		{
+			e = (w << 5) + __builtin_ctz(bits);
+			if ( SV_EntityClustersVisible( SV_SvEntityForGentity( SV_GentityNum( e ) ), bitvector ) )
+			{
+				vc->pvs[w] |= 1 << (e & 31);
+			}
+		}
+	}
+	visCache.numClusters++;
+	return vc;
+}
+
+/*
+Builds the cache entry for the cluster at origin on the server thread
+*/
+static void SV_PrepareVisibilityCache( float *origin )
+{
+	int clientcluster;
+
+	clientcluster = CM_LeafCluster( CM_PointLeafnum( origin ) );
+
+	if ( clientcluster >= 0 )
+	{
+		SV_GetVisibilityCacheCluster( clientcluster );
+	}
+}
+
+
+/*
+===============
+SV_AddEntitiesVisibleFromPoint
+===============
+*/
+static void SV_AddEntitiesVisibleFromPoint( float *origin, int clientNum, snapshotEntityNumbers_t *eNums )
+{
+	int e, w, numWords, maskWord;
+	uint32_t bits, bit, maskBit;
+	gentity_t *ent;
+	int clientcluster;
+	int leafnum;
+	float fogOpaqueDistSqrd;
+	visCacheCluster_t *vc;
+
+
+	leafnum = CM_PointLeafnum( origin );
+	clientcluster = CM_LeafCluster( leafnum );
+
+	if(clientcluster < 0)
+	{
+		return;
+	}
+
+	vc = SV_GetVisibilityCacheCluster( clientcluster );
+
+	if ( vc == NULL )
+	{
+		SV_AddEntitiesVisibleFromPointUncached( origin, clientNum, eNums );
+		return;
+	}
+
+	fogOpaqueDistSqrd = G_GetFogOpaqueDistSqrd();
+
+	if ( fogOpaqueDistSqrd == 3.4028235e38 )
+	{
+      fogOpaqueDistSqrd = 0.0;
+	}
+
+	maskWord = clientNum >> 5;
+	maskBit = 1 << (clientNum & 31);
+	numWords = (visCache.num_entities + 31) >> 5;
+
+	// walking the words in order keeps the entity numbers sorted
+	for ( w = 0; w < numWords; ++w )
+	{
+		for ( bits = visCache.broadcast[w] | visCache.always[w] | vc->pvs[w]; bits; bits &= bits -1 )
+		{
+			e = (w << 5) + __builtin_ctz(bits);
+
+			// never send client's own entity, because it can
+			// be regenerated from the playerstate
+			if ( e == clientNum )
+			{
+				continue;
+			}
+
+			bit = 1 << (e & 31);
+
+			if ( !(visCache.broadcast[w] & bit) )
+			{
+				ent = SV_GentityNum( e );
+
+				if ( ent->r.svFlags & 1 || ent->r.clientMask[maskWord] & maskBit )
+				{
+					continue;
+				}
+
+				if ( vc->pvs[w] & bit && fogOpaqueDistSqrd != 0.0 && BoxDistSqrdExceeds(ent->r.absmin, ent->r.absmax, origin, fogOpaqueDistSqrd) )
+				{
+					continue;
+				}
+			}
+			// add it
+			SV_AddEntToSnapshot( e, eNums );
+		}
+	}
+}
+
 static cachedSnapshot_t *SV_GetCachedSnapshot(int *pArchiveTime)
 {
   int frame;
@@ -877,35 +1191,28 @@ static cachedSnapshot_t *SV_GetCachedSnapshot(int *pArchiveTime)
 
 /*
 =============
-SV_BuildClientSnapshot
+SV_BeginBuildClientSnapshot
 
-Decides which entities are going to be visible to the client, and
-copies off the playerstate and areabits.
-
-This properly handles multiple recursive portals, but the render
-currently doesn't.
-
-For viewing through other player's eyes, clent can be something other than client->gentity
+First part of SV_BuildClientSnapshot. Sets up the frame and copies off the playerstate.
+Killcam frames taken from the archive get completed right here.
+Returns qtrue if the visible entities still have to be determined from origin
+and the frame has to be completed with SV_FinishBuildClientSnapshot.
 =============
 */
-static void SV_BuildClientSnapshot( client_t *client ) {
+static qboolean SV_BeginBuildClientSnapshot( client_t *client, vec3_t org, int *pClientNum ) {
 
-	vec3_t org;
 	clientSnapshot_t            *frame;
 	snapshotEntityNumbers_t entityNumbers;
 	int i;
 	archivedEntity_t			*aent;
-	gentity_t              		*ent;
 	entityState_t               *entState;
 	cachedClient_t				*cachedClient;
-	clientState_t               *clientStateSource;
 	clientState_t               *clientState;
 	gentity_t					*clent;
 	int clientNum;
 	playerState_t               *ps;
 	int							archiveTime;
 	cachedSnapshot_t			*cachedSnap;
-	client_t					*snapClient;
 
 	// this is the frame we are creating
 	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
@@ -919,12 +1226,9 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 
 	clent = client->gentity;
 	if ( !clent || client->state == CS_ZOMBIE || sv.state < SS_GAME ) {
-		return;
+		return qfalse;
 	}
 
-	frame->first_entity = svs.nextSnapshotEntities;
-    frame->first_client = svs.nextSnapshotClients;
-
 	clientNum = client - svs.clients;
 
 
@@ -957,75 +1261,100 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	AddLeanToPosition(org, ps->viewangles[1], ps->leanf, 16.0, 20.0);
 //----(SA)	end
 
-	if(cachedSnap)
-	{
-		int snapTime = svs.time - cachedSnap->time;
+	*pClientNum = clientNum;
 
-		int maxCachedSnapshotEntities = sizeof(svs.cachedSnapshotEntities) / sizeof(svs.cachedSnapshotEntities[0]);
+	if(!cachedSnap)
+	{
+		return qtrue;
+	}
 
-		SV_AddCachedEntitiesVisibleFromPoint(cachedSnap->num_entities, cachedSnap->first_entity, org, clientNum, &entityNumbers);
+	frame->first_entity = svs.nextSnapshotEntities;
+	frame->first_client = svs.nextSnapshotClients;
 
-        for ( i = 0 ;i < entityNumbers.numSnapshotEntities; ++i )
-        {
-            entState = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
-            aent = &svs.cachedSnapshotEntities[(cachedSnap->first_entity + entityNumbers.snapshotEntities[i]) % maxCachedSnapshotEntities];
+	int snapTime = svs.time - cachedSnap->time;
 
-			*entState = aent->s;
+	int maxCachedSnapshotEntities = sizeof(svs.cachedSnapshotEntities) / sizeof(svs.cachedSnapshotEntities[0]);
 
-            if ( entState->lerp.pos.trTime )
-			{
-              entState->lerp.pos.trTime += snapTime;
-			}
-			if ( entState->lerp.apos.trTime )
-			{
-              entState->lerp.apos.trTime += snapTime;
-			}
-            if ( entState->time2 )
-			{
-              entState->time2 += snapTime;
-			}
+	SV_AddCachedEntitiesVisibleFromPoint(cachedSnap->num_entities, cachedSnap->first_entity, org, clientNum, &entityNumbers);
 
-            if ( entState->eType == 4 || entState->eType == 0 || entState->eType == 66 )
-			{
-              entState->lerp.u.anonymous.data[0] += snapTime;
-			}
-			svs.nextSnapshotEntities++;
-			// this should never hit, map should always be restarted first in SV_Frame
-			if ( svs.nextSnapshotEntities >= 0x7FFFFFFE ) {
-				Com_Error( ERR_FATAL, "svs.nextSnapshotEntities wrapped" );
-			}
+	for ( i = 0 ;i < entityNumbers.numSnapshotEntities; ++i )
+	{
+		entState = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
+		aent = &svs.cachedSnapshotEntities[(cachedSnap->first_entity + entityNumbers.snapshotEntities[i]) % maxCachedSnapshotEntities];
 
-			frame->num_entities++;
-        }
+		*entState = aent->s;
 
+		if ( entState->lerp.pos.trTime )
+		{
+			entState->lerp.pos.trTime += snapTime;
+		}
+		if ( entState->lerp.apos.trTime )
+		{
+			entState->lerp.apos.trTime += snapTime;
+		}
+		if ( entState->time2 )
+		{
+			entState->time2 += snapTime;
+		}
 
-		int maxCachedClients = sizeof(svs.cachedSnapshotClients) / sizeof(svs.cachedSnapshotClients[0]);
+		if ( entState->eType == 4 || entState->eType == 0 || entState->eType == 66 )
+		{
+			entState->lerp.u.anonymous.data[0] += snapTime;
+		}
+		svs.nextSnapshotEntities++;
+		// this should never hit, map should always be restarted first in SV_Frame
+		if ( svs.nextSnapshotEntities >= 0x7FFFFFFE ) {
+			Com_Error( ERR_FATAL, "svs.nextSnapshotEntities wrapped" );
+		}
 
-		for ( i = 0; i < cachedSnap->num_clients; ++i )
-        {
-			cachedClient = &svs.cachedSnapshotClients[(i + cachedSnap->first_client) % maxCachedClients];
-			clientState = &svs.snapshotClients[svs.nextSnapshotClients % svs.numSnapshotClients];
-			*clientState = cachedClient->cs;
-			svs.nextSnapshotClients++;
-
-			// this should never hit, map should always be restarted first in SV_Frame
-			if ( svs.nextSnapshotClients >= 0x7FFFFFFE ) {
-				Com_Error( ERR_FATAL, "svs.nextSnapshotClients wrapped" );
-			}
-			frame->num_clients++;
-        }
-		return;
+		frame->num_entities++;
 	}
 
 
+	int maxCachedClients = sizeof(svs.cachedSnapshotClients) / sizeof(svs.cachedSnapshotClients[0]);
 
-	// add all the entities directly visible to the eye, which
-	// may include portal entities that merge other viewpoints
-	SV_AddEntitiesVisibleFromPoint( org, clientNum, &entityNumbers );
+	for ( i = 0; i < cachedSnap->num_clients; ++i )
+	{
+		cachedClient = &svs.cachedSnapshotClients[(i + cachedSnap->first_client) % maxCachedClients];
+		clientState = &svs.snapshotClients[svs.nextSnapshotClients % svs.numSnapshotClients];
+		*clientState = cachedClient->cs;
+		svs.nextSnapshotClients++;
+
+		// this should never hit, map should always be restarted first in SV_Frame
+		if ( svs.nextSnapshotClients >= 0x7FFFFFFE ) {
+			Com_Error( ERR_FATAL, "svs.nextSnapshotClients wrapped" );
+		}
+		frame->num_clients++;
+	}
+	return qfalse;
+}
+
+
+/*
+=============
+SV_FinishBuildClientSnapshot
+
+Copies the visible entities and all client states into the snapshot rings
+=============
+*/
+static void SV_FinishBuildClientSnapshot( client_t *client, int clientNum, snapshotEntityNumbers_t *entityNumbers ) {
+
+	clientSnapshot_t            *frame;
+	int i;
+	gentity_t              		*ent;
+	entityState_t               *entState;
+	clientState_t               *clientStateSource;
+	clientState_t               *clientState;
+	client_t					*snapClient;
+
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
+	frame->first_entity = svs.nextSnapshotEntities;
+	frame->first_client = svs.nextSnapshotClients;
 
 	// copy the entity states out
-	for ( i = 0 ; i < entityNumbers.numSnapshotEntities ; i++ ) {
-		ent = SV_GentityNum( entityNumbers.snapshotEntities[i] );
+	for ( i = 0 ; i < entityNumbers->numSnapshotEntities ; i++ ) {
+		ent = SV_GentityNum( entityNumbers->snapshotEntities[i] );
 		entState = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
 		*entState = ent->s;
 		svs.nextSnapshotEntities++;
@@ -1062,13 +1391,406 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 		}
 		frame->num_clients++;
 	}
+}
+
+
+/*
+=============
+SV_BuildClientSnapshot
+
+Decides which entities are going to be visible to the client, and
+copies off the playerstate and areabits.
+
+This properly handles multiple recursive portals, but the render
+currently doesn't.
+
+For viewing through other player's eyes, clent can be something other than client->gentity
+=============
+*/
+static void SV_BuildClientSnapshot( client_t *client ) {
+
+	vec3_t org;
+	snapshotEntityNumbers_t entityNumbers;
+	int clientNum;
+
+	if ( !SV_BeginBuildClientSnapshot( client, org, &clientNum ) ) {
+		return;
+	}
 
+	entityNumbers.numSnapshotEntities = 0;
 
+	// add all the entities directly visible to the eye, which
+	// may include portal entities that merge other viewpoints
+	SV_AddEntitiesVisibleFromPoint( org, clientNum, &entityNumbers );
+
+	SV_FinishBuildClientSnapshot( client, clientNum, &entityNumbers );
 }
 //#endif
 
 
 
+/*
+==============================================================================
+
+Snapshot worker pool
+
+With sv_snapshotThreads > 0 the per client visibility tests and the delta
+encoding + compression of the snapshot messages are spread over worker threads.
+Everything that touches shared server state (snapshot rings, downloads, dropping
+clients, demo files and the actual transmit) still happens on the server thread
+in client order, so bps counters and the packet order stay deterministic.
+
+==============================================================================
+*/
+
+#define MAX_SNAPSHOT_WORKERS 16
+
+typedef struct
+{
+	byte *data;                 // compressed message ready to transmit
+	int allocsize;
+	int len;
+	int uncompsize;
+	qboolean overflowed;
+}snapshotEncodeSlot_t;
+
+typedef enum
+{
+	SNAPSHOTJOB_VISIBILITY,
+	SNAPSHOTJOB_ENCODE
+}snapshotJobType_t;
+
+typedef struct
+{
+	int numWorkers;
+	volatile DWORD numAlive;
+	volatile DWORD numBusy;
+	volatile DWORD nextJob;
+	volatile qboolean quit;
+	volatile qboolean failed;  // a job ran into Com_Error on a worker
+	HANDLE wake[MAX_SNAPSHOT_WORKERS];
+	HANDLE done;
+	byte *msgBuf[MAX_SNAPSHOT_WORKERS +1];    // index 0 belongs to the server thread
+
+	snapshotJobType_t jobType;
+	int numJobs;
+	int jobClients[MAX_CLIENTS];
+
+	vec3_t visOrigin[MAX_CLIENTS];
+	int visClientNum[MAX_CLIENTS];
+	snapshotEntityNumbers_t visEntities[MAX_CLIENTS];
+	snapshotEncodeSlot_t encodeSlots[MAX_CLIENTS];
+}snapshotWorkerPool_t;
+
+static snapshotWorkerPool_t snapshotPool;
+
+typedef struct
+{
+	int frames;
+	int snapshots;
+	unsigned long long buildTime;
+	unsigned long long encodeTime;
+	unsigned long long sendTime;
+	int nextPrintTime;
+}snapshotStats_t;
+
+static snapshotStats_t snapshotStats;
+
+
+/*
+Encodes the whole snapshot message for one client and compresses it into its slot.
+Runs on worker threads, so it must not transmit or touch other clients.
+*/
+static void SV_EncodeClientSnapshot(client_t *client, snapshotEncodeSlot_t *slot, byte *msgbuf)
+{
+	msg_t msg;
+	int needed;
+
+	SV_BeginClientSnapshotInBuffer(client, &msg, msgbuf, NETCHAN_UNSENTBUFFER_SIZE);
+
+	if(client->state == CS_ACTIVE || client->state == CS_ZOMBIE)
+		SV_WriteSnapshotToClient(client, &msg);
+
+	MSG_WriteByte(&msg, svc_EOF);
+
+	slot->overflowed = msg.overflowed;
+	slot->uncompsize = msg.cursize;
+	slot->len = 0;
+
+	if(msg.overflowed)
+	{
+		return;
+	}
+
+	needed = 4 + 2 * msg.cursize;
+	if(needed > slot->allocsize)
+	{
+		L_Free(slot->data);
+		slot->data = L_Malloc(needed);
+		if(slot->data == NULL)
+		{
+			slot->allocsize = 0;
+			// Let the server thread handle it like any other overflow
+			slot->overflowed = qtrue;
+			return;
+		}
+		slot->allocsize = needed;
+	}
+	slot->len = SV_CompressMessage(&msg, slot->data);
+}
+
+static void SV_RunSnapshotJobs(int threadnum)
+{
+	int job, clnum;
+
+	while((job = Sys_InterlockedIncrement(&snapshotPool.nextJob) -1) < snapshotPool.numJobs)
+	{
+		clnum = snapshotPool.jobClients[job];
+
+		if(snapshotPool.jobType == SNAPSHOTJOB_VISIBILITY)
+		{
+			snapshotPool.visEntities[clnum].numSnapshotEntities = 0;
+			SV_AddEntitiesVisibleFromPoint( snapshotPool.visOrigin[clnum], snapshotPool.visClientNum[clnum], &snapshotPool.visEntities[clnum] );
+		}else{
+			SV_EncodeClientSnapshot(&svs.clients[clnum], &snapshotPool.encodeSlots[clnum], snapshotPool.msgBuf[threadnum]);
+		}
+	}
+}
+
+static void* SV_SnapshotWorkerThread(void* arg)
+{
+	int threadnum = (intptr_t)arg;
+	workerThreadData_t threadData;
+
+	Com_InitWorkerThreadData(&threadData);
+
+	while(1)
+	{
+		Sys_WaitForObject(snapshotPool.wake[threadnum -1]);
+
+		if(snapshotPool.quit)
+		{
+			break;
+		}
+
+		if(setjmp(threadData.abortframe))
+		{
+			/* Com_Error has saved the error, SV_DispatchSnapshotJobs raises it on the server thread */
+			snapshotPool.failed = qtrue;
+		}else{
+			SV_RunSnapshotJobs(threadnum);
+		}
+
+		if(Sys_InterlockedDecrement(&snapshotPool.numBusy) == 0)
+		{
+			Sys_SetEvent(snapshotPool.done);
+		}
+	}
+	Sys_InterlockedDecrement(&snapshotPool.numAlive);
+	return NULL;
+}
+
+/*
+Runs all queued jobs on the workers and the server thread and returns when all are done
+*/
+static void SV_DispatchSnapshotJobs(snapshotJobType_t type)
+{
+	int i;
+
+	if(snapshotPool.numJobs == 0)
+	{
+		return;
+	}
+	snapshotPool.jobType = type;
+	snapshotPool.nextJob = 0;
+	snapshotPool.failed = qfalse;
+	snapshotPool.numBusy = snapshotPool.numWorkers;
+
+	for(i = 0; i < snapshotPool.numWorkers; ++i)
+	{
+		Sys_SetEvent(snapshotPool.wake[i]);
+	}
+
+	SV_RunSnapshotJobs(0);
+
+	Sys_WaitForObject(snapshotPool.done);
+
+	if(snapshotPool.failed)
+	{
+		Com_Error(ERR_DROP, "Error Cleanup");
+	}
+}
+
+static void SV_ShutdownSnapshotWorkers()
+{
+	int i;
+
+	if(snapshotPool.numWorkers == 0)
+	{
+		return;
+	}
+
+	snapshotPool.quit = qtrue;
+	for(i = 0; i < snapshotPool.numWorkers; ++i)
+	{
+		Sys_SetEvent(snapshotPool.wake[i]);
+	}
+	while(snapshotPool.numAlive > 0)
+	{
+		Sys_SleepUSec(100);
+	}
+	for(i = 0; i < snapshotPool.numWorkers; ++i)
+	{
+		_CloseHandle(snapshotPool.wake[i]);
+		snapshotPool.wake[i] = 0;
+	}
+	for(i = 0; i <= snapshotPool.numWorkers; ++i)
+	{
+		L_Free(snapshotPool.msgBuf[i]);
+		snapshotPool.msgBuf[i] = NULL;
+	}
+	_CloseHandle(snapshotPool.done);
+	snapshotPool.done = 0;
+	snapshotPool.numWorkers = 0;
+	snapshotPool.quit = qfalse;
+}
+
+/*
+Starts or stops worker threads whenever sv_snapshotThreads got changed
+*/
+static void SV_UpdateSnapshotWorkers()
+{
+	int i, count;
+	threadid_t tid;
+
+	count = sv_snapshotThreads->integer;
+
+	if(count == snapshotPool.numWorkers)
+	{
+		return;
+	}
+
+	SV_ShutdownSnapshotWorkers();
+
+	if(count < 1)
+	{
+		return;
+	}
+
+	snapshotPool.done = Sys_CreateEvent(qfalse, qfalse, "snapshotdone");
+	if(snapshotPool.done == 0)
+	{
+		Com_PrintError(CON_CHANNEL_SERVER, "Failed to create snapshot worker event\n");
+		Cvar_SetInt(sv_snapshotThreads, 0);
+		return;
+	}
+
+	snapshotPool.msgBuf[0] = L_Malloc(NETCHAN_UNSENTBUFFER_SIZE);
+	if(snapshotPool.msgBuf[0] == NULL)
+	{
+		_CloseHandle(snapshotPool.done);
+		snapshotPool.done = 0;
+		Cvar_SetInt(sv_snapshotThreads, 0);
+		return;
+	}
+
+	for(i = 0; i < count; ++i)
+	{
+		snapshotPool.msgBuf[i +1] = L_Malloc(NETCHAN_UNSENTBUFFER_SIZE);
+		snapshotPool.wake[i] = Sys_CreateEvent(qfalse, qfalse, "snapshotwake");
+
+		Sys_InterlockedIncrement(&snapshotPool.numAlive);
+
+		if(snapshotPool.msgBuf[i +1] == NULL || snapshotPool.wake[i] == 0 || Sys_CreateNewThread(SV_SnapshotWorkerThread, &tid, (void*)(intptr_t)(i +1)) == qfalse)
+		{
+			Sys_InterlockedDecrement(&snapshotPool.numAlive);
+			if(snapshotPool.wake[i])
+			{
+				_CloseHandle(snapshotPool.wake[i]);
+				snapshotPool.wake[i] = 0;
+			}
+			L_Free(snapshotPool.msgBuf[i +1]);
+			snapshotPool.msgBuf[i +1] = NULL;
+			break;
+		}
+		Sys_SetThreadName(tid, "SnapshotWorker");
+		snapshotPool.numWorkers++;
+	}
+
+	if(snapshotPool.numWorkers == 0)
+	{
+		L_Free(snapshotPool.msgBuf[0]);
+		snapshotPool.msgBuf[0] = NULL;
+		_CloseHandle(snapshotPool.done);
+		snapshotPool.done = 0;
+		Com_PrintError(CON_CHANNEL_SERVER, "Failed to start snapshot worker threads\n");
+		Cvar_SetInt(sv_snapshotThreads, 0);
+		return;
+	}
+	Com_Printf(CON_CHANNEL_SERVER, "Started %d snapshot worker threads\n", snapshotPool.numWorkers);
+}
+
+/*
+Transmits a snapshot encoded by SV_EncodeClientSnapshot
+*/
+static void SV_SendEncodedClientSnapshot(client_t *client, snapshotEncodeSlot_t *slot)
+{
+	static byte recoverMsgBuf[NETCHAN_UNSENTBUFFER_SIZE];
+	msg_t msg;
+
+	if ( client->state != CS_ZOMBIE )
+		SV_WriteDownloadToClient( client );
+
+	if(slot->overflowed)
+	{
+		MSG_Init(&msg, recoverMsgBuf, sizeof(recoverMsgBuf));
+		MSG_WriteLong(&msg, client->lastClientCommand);
+		msg.overflowed = qtrue;
+
+		SV_RecoverOverflowedSnapshot(client, &msg);
+		SV_SendMessageToClient(&msg, client);
+		return;
+	}
+	SV_SendMessageDataToClient(client, slot->data, slot->len, slot->uncompsize);
+}
+
+static void SV_UpdateSnapshotStats(int numSnapshots, unsigned long long tStart, unsigned long long tBuild, unsigned long long tEncode, unsigned long long tEnd)
+{
+	if(!sv_snapshotStats->boolean)
+	{
+		snapshotStats.frames = 0;
+		return;
+	}
+	if(snapshotStats.frames == 0)
+	{
+		Com_Memset(&snapshotStats, 0, sizeof(snapshotStats));
+		snapshotStats.nextPrintTime = svs.time + 5000;
+	}
+	snapshotStats.frames++;
+	snapshotStats.snapshots += numSnapshots;
+	snapshotStats.buildTime += tBuild - tStart;
+	snapshotStats.encodeTime += tEncode - tBuild;
+	snapshotStats.sendTime += tEnd - tEncode;
+
+	if(svs.time < snapshotStats.nextPrintTime)
+	{
+		return;
+	}
+
+	if(snapshotPool.numWorkers > 0)
+	{
+		Com_Printf(CON_CHANNEL_SERVER, "Snapshots: %d frames, %.1f snapshots/frame, build %.1f usec, encode %.1f usec, send %.1f usec per frame (%d worker threads)\n",
+			snapshotStats.frames, (float)snapshotStats.snapshots / snapshotStats.frames, (float)snapshotStats.buildTime / snapshotStats.frames,
+			(float)snapshotStats.encodeTime / snapshotStats.frames, (float)snapshotStats.sendTime / snapshotStats.frames, snapshotPool.numWorkers);
+	}else{
+		Com_Printf(CON_CHANNEL_SERVER, "Snapshots: %d frames, %.1f snapshots/frame, build %.1f usec, encode+send %.1f usec per frame (no worker threads)\n",
+			snapshotStats.frames, (float)snapshotStats.snapshots / snapshotStats.frames, (float)snapshotStats.buildTime / snapshotStats.frames,
+			(float)(snapshotStats.encodeTime + snapshotStats.sendTime) / snapshotStats.frames);
+	}
+	snapshotStats.frames = 0;
+}
+
+
 /*
  =======================
  SV_SendClientMessages
@@ -1082,13 +1804,24 @@ void SV_SendClientMessages( void ) {
 	client_t *c;
 	byte snapClients[MAX_CLIENTS];
 	int numclients = 0; // NERVE - SMF - net debugging
+	unsigned long long tStart, tBuild, tEncode;
 	/*
 	SV_SendClientMessagesA( );
 	return;
 	 */
+	SV_UpdateSnapshotWorkers();
+
+	tStart = Sys_Microseconds();
+	snapshotPool.numJobs = 0;
+
+	SV_InvalidateVisibilityCache();
+
 	sv.bpsTotalBytes = 0; // NERVE - SMF - net debugging
 	sv.ubpsTotalBytes = 0; // NERVE - SMF - net debugging
 
+	// All packets of this frame go out in one batch
+	NET_BeginPacketBatch();
+
 	// send a message to each connected client
 	for ( i = 0, c = svs.clients ; i < sv_maxclients->integer ; i++, c++ ) {
 		if ( !c->state || c->netchan.remoteAddress.type == NA_BOT)
@@ -1119,18 +1852,70 @@ void SV_SendClientMessages( void ) {
 		// generate a new message
 		snapClients[i] = 1;
 
-		if ( c->state == CS_ACTIVE || c->state == CS_ZOMBIE )
-            SV_BuildClientSnapshot( c );
+		if ( c->state != CS_ACTIVE && c->state != CS_ZOMBIE )
+			continue;
 
+		if ( snapshotPool.numWorkers == 0 )
+		{
+			SV_BuildClientSnapshot( c );
+			continue;
+		}
+
+		if ( SV_BeginBuildClientSnapshot( c, snapshotPool.visOrigin[i], &snapshotPool.visClientNum[i] ) )
+		{
+			snapshotPool.jobClients[snapshotPool.numJobs] = i;
+			snapshotPool.numJobs++;
+		}
 	}
 
+	if ( snapshotPool.numJobs > 0 )
+	{
+		// Workers only read the visibility cache
+		for ( index = 0; index < snapshotPool.numJobs; ++index )
+		{
+			SV_PrepareVisibilityCache( snapshotPool.visOrigin[snapshotPool.jobClients[index]] );
+		}
+		SV_DispatchSnapshotJobs(SNAPSHOTJOB_VISIBILITY);
+
+		// The rings get filled in client order as before
+		for ( index = 0; index < snapshotPool.numJobs; ++index )
+		{
+			i = snapshotPool.jobClients[index];
+			SV_FinishBuildClientSnapshot( &svs.clients[i], snapshotPool.visClientNum[i], &snapshotPool.visEntities[i] );
+		}
+	}
+
+	tBuild = Sys_Microseconds();
+
 	SV_SetServerStaticHeader();
 
+	if ( snapshotPool.numWorkers > 0 )
+	{
+		snapshotPool.numJobs = 0;
+		for (i = 0; i < sv_maxclients->integer; i++) {
+			if(snapClients[i])
+			{
+				snapshotPool.jobClients[snapshotPool.numJobs] = i;
+				snapshotPool.numJobs++;
+			}
+		}
+		SV_DispatchSnapshotJobs(SNAPSHOTJOB_ENCODE);
+	}
+
+	tEncode = Sys_Microseconds();
+
 	for (i = 0, c = svs.clients; i < sv_maxclients->integer; i++, c++) {
 
 		if(snapClients[i] == 0)
 			continue;
 
+		if ( snapshotPool.numWorkers > 0 )
+		{
+			SV_SendEncodedClientSnapshot( c, &snapshotPool.encodeSlots[i] );
+			SV_SendClientVoiceData( c );
+			continue;
+		}
+
 		SV_BeginClientSnapshot( c, &msg );
 
 		if(c->state == CS_ACTIVE || c->state == CS_ZOMBIE)
@@ -1140,6 +1925,10 @@ void SV_SendClientMessages( void ) {
 		SV_SendClientVoiceData( c );
 	}
 
+	NET_EndPacketBatch();
+
+	SV_UpdateSnapshotStats(numclients, tStart, tBuild, tEncode, Sys_Microseconds());
+
 	// NERVE - SMF - net debugging
 	if ( sv_showAverageBPS->integer && numclients > 0 ) {
 		float ave = 0, uave = 0;
@@ -2,9 +2,96 @@
 #include "server.h"
 #include "g_public.h"
 
+/*
+Every received voice packet is stored once in the voice arena. Listeners only
+queue the arena index, a packet is released when the last listener has sent it.
+*/
+#define MAX_VOICEARENA_PACKETS (MAX_CLIENTS * MAX_VOICEPACKETS + 1)
+//"v", packet count, then talker, size and data of each packet
+#define MAX_VOICEMSG_SIZE (2 + 1 + MAX_VOICEPACKETS * (2 + MAX_VOICE_PACKET_DATA))
+
+static struct
+{
+	VoicePacket_t	packets[MAX_VOICEARENA_PACKETS];
+	unsigned short	refCount[MAX_VOICEARENA_PACKETS];
+	unsigned short	freeList[MAX_VOICEARENA_PACKETS];
+	int		numFree;
+	int		pending; //1 + index of the packet currently being broadcast, 0 if none
+	qboolean	initialized;
+}voiceArena;
+
+
+/*
+Rebuilds the reference counts from the listener queues. Recovers packets
+which got lost when a client slot was cleared without releasing its queue.
+*/
+static void SV_CollectVoicePackets()
+{
+	int i, j;
+	client_t *cl;
+
+	Com_Memset(voiceArena.refCount, 0, sizeof(voiceArena.refCount));
+
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+	{
+		if(cl->state == CS_FREE)
+		{
+			cl->voicePacketCount = 0;
+			continue;
+		}
+		for(j = 0; j < cl->voicePacketCount; j++)
+		{
+			voiceArena.refCount[cl->voicePackets[j]]++;
+		}
+	}
+	if(voiceArena.pending > 0)
+	{
+		voiceArena.refCount[voiceArena.pending -1]++;
+	}
+
+	voiceArena.numFree = 0;
+	for(i = MAX_VOICEARENA_PACKETS -1; i >= 0; i--)
+	{
+		if(voiceArena.refCount[i] == 0)
+		{
+			voiceArena.freeList[voiceArena.numFree++] = i;
+		}
+	}
+	voiceArena.initialized = qtrue;
+}
+
+//Returns a packet with one reference or -1
+static int SV_AllocVoicePacket()
+{
+	int index;
+
+	if(!voiceArena.initialized || voiceArena.numFree == 0)
+	{
+		SV_CollectVoicePackets();
+		if(voiceArena.numFree == 0)
+		{
+			return -1;
+		}
+	}
+	index = voiceArena.freeList[--voiceArena.numFree];
+	voiceArena.refCount[index] = 1;
+	return index;
+}
+
+static void SV_ReleaseVoicePacket(int index)
+{
+	assert(voiceArena.refCount[index] > 0);
+
+	if(--voiceArena.refCount[index] == 0)
+	{
+		voiceArena.freeList[voiceArena.numFree++] = index;
+	}
+}
+
 void SV_WriteClientVoiceData(msg_t *msg, client_s *client)
 {
 	int i;
+	VoicePacket_t *packet;
 
   assert(client->voicePacketCount >= 0 && client->voicePacketCount <= MAX_VOICEPACKETS);
 
@@ -12,9 +99,10 @@ void SV_WriteClientVoiceData(msg_t *msg, client_s *client)
 
 	for(i = 0; i < client->voicePacketCount; i++)
 	{
-		MSG_WriteByte( msg, client->voicePackets[i].talker );
-		MSG_WriteByte( msg, client->voicePackets[i].dataSize );
-		MSG_WriteData( msg, client->voicePackets[i].data, client->voicePackets[i].dataSize );
+		packet = &voiceArena.packets[client->voicePackets[i]];
+		MSG_WriteByte( msg, packet->talker );
+		MSG_WriteByte( msg, packet->dataSize );
+		MSG_WriteData( msg, packet->data, packet->dataSize );
 	}
 }
 
@@ -37,30 +125,22 @@ bool __cdecl SV_ClientHasClientMuted(int listener, int talker)
 }
 
 
-void __cdecl SV_QueueVoicePacket(int talkerNum, int clientNum, VoicePacket_t *voicePacket)
+void SV_ClearClientVoicePackets(client_s *client)
 {
-  client_s *client;
-
-  assert(talkerNum >= 0 && talkerNum < sv_maxclients->integer);
-  assert(clientNum >= 0 && clientNum < sv_maxclients->integer);
+  int i;
 
-  client = &svs.clients[clientNum];
-  if ( svs.clients[clientNum].voicePacketCount < 40 )
+  for(i = 0; i < client->voicePacketCount; i++)
   {
-    client->voicePackets[client->voicePacketCount].dataSize = voicePacket->dataSize;
-    memcpy(client->voicePackets[client->voicePacketCount].data, voicePacket->data, voicePacket->dataSize);
-
-    client->voicePackets[client->voicePacketCount].talker = talkerNum;
-    client->voicePacketCount++;
+    SV_ReleaseVoicePacket(client->voicePackets[i]);
   }
+  client->voicePacketCount = 0;
 }
 
 
-
 void SV_SendClientVoiceData(client_s *client)
 {
     msg_t msg;
-    byte buff[0x20000];
+    byte buff[MAX_VOICEMSG_SIZE];
 
     if ( client->state < CS_ACTIVE || client->voicePacketCount == 0)
     {
@@ -75,7 +155,49 @@ void SV_SendClientVoiceData(client_s *client)
 		return;
     }
     NET_OutOfBandData(NS_SERVER, &client->netchan.remoteAddress, msg.data, msg.cursize);
-    client->voicePacketCount = 0;
+    SV_ClearClientVoicePackets(client);
+}
+
+
+void __cdecl SV_QueueVoicePacket(int talkerNum, int clientNum, VoicePacket_t *voicePacket)
+{
+  client_s *client;
+  int index;
+
+  assert(talkerNum >= 0 && talkerNum < sv_maxclients->integer);
+  assert(clientNum >= 0 && clientNum < sv_maxclients->integer);
+
+  client = &svs.clients[clientNum];
+
+  if ( client->voicePacketCount == MAX_VOICEPACKETS )
+  {
+    //Send the full queue right away instead of dropping the packet
+    SV_SendClientVoiceData(client);
+    if ( client->voicePacketCount == MAX_VOICEPACKETS )
+    {
+      return;
+    }
+  }
+
+  if ( voicePacket >= voiceArena.packets && voicePacket < voiceArena.packets + MAX_VOICEARENA_PACKETS )
+  {
+    index = voicePacket - voiceArena.packets;
+    voiceArena.refCount[index]++;
+  }
+  else
+  {
+    //Not coming from SV_UserVoice, store a copy
+    index = SV_AllocVoicePacket();
+    if ( index < 0 )
+    {
+      return;
+    }
+    voiceArena.packets[index].dataSize = voicePacket->dataSize;
+    memcpy(voiceArena.packets[index].data, voicePacket->data, voicePacket->dataSize);
+  }
+  voiceArena.packets[index].talker = talkerNum;
+  client->voicePackets[client->voicePacketCount] = index;
+  client->voicePacketCount++;
 }
 
 
@@ -90,8 +212,9 @@ bool __cdecl SV_ClientWantsVoiceData(int clientNum)
 void __cdecl SV_UserVoice(client_t *cl, msg_t *msg)
 {
   int packet;
-  VoicePacket_t voicePacket;
+  VoicePacket_t *voicePacket;
   int packetCount;
+  int index;
 
   if ( SV_VoiceEnabled() )
   {
@@ -100,18 +223,30 @@ void __cdecl SV_UserVoice(client_t *cl, msg_t *msg)
 
     for ( packet = 0; packet < packetCount; ++packet )
     {
-      voicePacket.dataSize = MSG_ReadByte(msg);
-      if ( voicePacket.dataSize <= 0 || voicePacket.dataSize > 256 )
+      index = SV_AllocVoicePacket();
+      if ( index < 0 )
       {
-        Com_Printf(CON_CHANNEL_SERVER, "Received invalid voice packet of size %i from %s\n", voicePacket.dataSize, cl->name);
         return;
       }
+      voicePacket = &voiceArena.packets[index];
 
-      assert(voicePacket.dataSize <= MAX_VOICE_PACKET_DATA);
+      voicePacket->dataSize = MSG_ReadByte(msg);
+      if ( voicePacket->dataSize <= 0 || voicePacket->dataSize > 256 )
+      {
+        Com_Printf(CON_CHANNEL_SERVER, "Received invalid voice packet of size %i from %s\n", voicePacket->dataSize, cl->name);
+        SV_ReleaseVoicePacket(index);
+        return;
+      }
+
+      assert(voicePacket->dataSize <= MAX_VOICE_PACKET_DATA);
       assert(msg->data != NULL);
 
-      MSG_ReadData(msg, voicePacket.data, voicePacket.dataSize);
-      G_BroadcastVoice(cl->gentity, &voicePacket);
+      MSG_ReadData(msg, voicePacket->data, voicePacket->dataSize);
+      //Listeners reference the arena packet, nothing gets copied
+      voiceArena.pending = index +1;
+      G_BroadcastVoice(cl->gentity, voicePacket);
+      voiceArena.pending = 0;
+      SV_ReleaseVoicePacket(index);
     }
   }
 }
@@ -120,10 +255,11 @@ void __cdecl SV_UserVoice(client_t *cl, msg_t *msg)
 void __cdecl SV_PreGameUserVoice(client_t *cl, msg_t *msg)
 {
   int packet;
-  VoicePacket_t voicePacket;
+  VoicePacket_t *voicePacket;
   int otherPlayer;
   int talker;
   int packetCount;
+  int index;
 
   if ( SV_VoiceEnabled() )
   {
@@ -131,24 +267,35 @@ void __cdecl SV_PreGameUserVoice(client_t *cl, msg_t *msg)
     packetCount = MSG_ReadByte(msg);
     for ( packet = 0; packet < packetCount; ++packet )
     {
-      voicePacket.dataSize = MSG_ReadShort(msg);
-      if ( voicePacket.dataSize <= 0 || voicePacket.dataSize > MAX_VOICE_PACKET_DATA )
+      index = SV_AllocVoicePacket();
+      if ( index < 0 )
+      {
+        return;
+      }
+      voicePacket = &voiceArena.packets[index];
+
+      voicePacket->dataSize = MSG_ReadShort(msg);
+      if ( voicePacket->dataSize <= 0 || voicePacket->dataSize > MAX_VOICE_PACKET_DATA )
       {
-        Com_Printf(CON_CHANNEL_SERVER, "Received invalid voice packet of size %i from %s\n", voicePacket.dataSize, cl->name);
+        Com_Printf(CON_CHANNEL_SERVER, "Received invalid voice packet of size %i from %s\n", voicePacket->dataSize, cl->name);
+        SV_ReleaseVoicePacket(index);
         return;
       }
 
       assert(msg->data != NULL);
 
-      MSG_ReadData(msg, voicePacket.data, voicePacket.dataSize);
+      MSG_ReadData(msg, voicePacket->data, voicePacket->dataSize);
+      voiceArena.pending = index +1;
       for ( otherPlayer = 0; otherPlayer < sv_maxclients->integer; ++otherPlayer )
       {
         if ( otherPlayer != talker && svs.clients[otherPlayer].state >= CS_CONNECTED && !SV_ClientHasClientMuted(otherPlayer, talker)
           && SV_ClientWantsVoiceData(otherPlayer) )
         {
-          SV_QueueVoicePacket(talker, otherPlayer, &voicePacket);
+          SV_QueueVoicePacket(talker, otherPlayer, voicePacket);
         }
       }
+      voiceArena.pending = 0;
+      SV_ReleaseVoicePacket(index);
     }
   }
 }
@@ -165,6 +165,12 @@
 	#		include <sys/filio.h>
 	#	endif
 
+	#	ifdef __linux__
+	#		include <sys/epoll.h>
+	#		define NET_USE_EPOLL
+	#		define NET_USE_MMSG
+	#	endif
+
 
 	#	define INVALID_SOCKET		-1
 	#	define SOCKET_ERROR		-1
@@ -247,6 +253,7 @@ static cvar_t	*net_mcast6addr;
 static cvar_t	*net_mcast6iface;
 
 static cvar_t	*net_dropsim;
+static cvar_t	*net_batchPackets;
 
 
 
@@ -314,6 +321,9 @@ typedef struct{
 	tcpclientstate_t	state;
 	qboolean		wantwrite;
 	//SOCKET			sock;
+	qboolean		readable; //epoll only: data may be left to read
+	qboolean		writable; //epoll only: socket accepted the last write
+	qboolean		ready; //epoll only: in readyList
 }tcpConnections_t;
 
 
@@ -323,6 +333,9 @@ typedef struct{
 	int			activeConnectionCount; //Connections that have been successfully authentificated
 	unsigned long long	lastAttackWarnTime;
 	tcpConnections_t	connections[MAX_TCPCONNECTIONS];
+	int			epollfd; //-1 if select() is used
+	int			numReady;
+	int			readyList[MAX_TCPCONNECTIONS]; //Connections which have to be serviced in the next frame
 }tcpServer_t;
 
 tcpServer_t tcpServer;
@@ -1303,6 +1316,16 @@ Receive one packet
 int	recvfromCount;
 #endif
 
+typedef struct{
+	unsigned long long	sendCalls;
+	unsigned long long	sendPackets;
+	unsigned long long	recvCalls;
+	unsigned long long	recvPackets;
+	unsigned long long	frames; //Batches sent by the server frame
+}netSyscallStats_t;
+
+static netSyscallStats_t netSyscallStats;
+
 __optimize3 __regparm3 int NET_GetPacket(netadr_t *net_from, void *net_message, int maxsize, int socket)
 {
 	int 	ret;
@@ -1313,6 +1336,7 @@ __optimize3 __regparm3 int NET_GetPacket(netadr_t *net_from, void *net_message,
 #ifdef _DEBUG
 	recvfromCount++;		// performance check
 #endif
+	netSyscallStats.recvCalls++;
 
 	if(socket != INVALID_SOCKET)
 	{
@@ -1347,6 +1371,7 @@ __optimize3 __regparm3 int NET_GetPacket(netadr_t *net_from, void *net_message,
 			else {*/
 				SockadrToNetadr( (struct sockaddr *) &from, net_from, qfalse, socket);
 //			}
+			netSyscallStats.recvPackets++;
 
 			if( ret >= maxsize ) {
 				Com_PrintWarningNoRedirect(CON_CHANNEL_NETWORK, "Oversize packet from %s\n", NET_AdrToString (net_from) );
@@ -1363,6 +1388,201 @@ __optimize3 __regparm3 int NET_GetPacket(netadr_t *net_from, void *net_message,
 
 
 
+#ifdef NET_USE_MMSG
+
+#define NET_SENDQUEUE_PACKETS 64
+#define NET_SENDQUEUE_BYTES 0x40000
+#define NET_SENDQUEUES 2
+
+/*
+Outgoing datagrams of the main thread which get queued between NET_BeginPacketBatch and
+NET_EndPacketBatch. One queue per socket, sent with a single sendmmsg() call.
+*/
+typedef struct{
+	int			sock;
+	int			numPackets;
+	int			numBytes;
+	struct mmsghdr		msgs[NET_SENDQUEUE_PACKETS];
+	struct iovec		iov[NET_SENDQUEUE_PACKETS];
+	struct sockaddr_storage	addr[NET_SENDQUEUE_PACKETS];
+	byte			data[NET_SENDQUEUE_BYTES];
+}netSendQueue_t;
+
+static netSendQueue_t netSendQueues[NET_SENDQUEUES];
+static qboolean netBatchActive;
+
+static void NET_FlushSendQueue(netSendQueue_t *queue)
+{
+	int sent, ret, err;
+	char errstr[256];
+
+	sent = 0;
+	while(sent < queue->numPackets)
+	{
+		netSyscallStats.sendCalls++;
+		ret = sendmmsg(queue->sock, &queue->msgs[sent], queue->numPackets - sent, 0);
+
+		if(ret == SOCKET_ERROR)
+		{
+			err = socketError;
+
+			if(err == EINTR)
+			{
+				continue;
+			}
+			// wouldblock is silent
+			if(err == EAGAIN)
+			{
+				break;
+			}
+			if(err != EADDRNOTAVAIL)
+			{
+				Com_PrintWarningNoRedirect(CON_CHANNEL_NETWORK, "NET_SendPacket: %s\n", NET_ErrorStringMT(errstr, sizeof(errstr)) );
+			}
+			//Drop the packet which failed and go on with the rest
+			sent++;
+			continue;
+		}
+		netSyscallStats.sendPackets += ret;
+		sent += ret;
+	}
+	queue->numPackets = 0;
+	queue->numBytes = 0;
+}
+
+static qboolean NET_QueuePacket( int length, const void *data, netadr_t *to, struct sockaddr_storage *addr )
+{
+	netSendQueue_t *queue;
+	struct mmsghdr *msg;
+	int i;
+
+	if(length > NET_SENDQUEUE_BYTES)
+	{
+		return qfalse;
+	}
+
+	for(i = 0, queue = NULL; i < NET_SENDQUEUES; i++)
+	{
+		if(netSendQueues[i].numPackets > 0 && netSendQueues[i].sock == to->sock)
+		{
+			queue = &netSendQueues[i];
+			break;
+		}
+		if(queue == NULL && netSendQueues[i].numPackets == 0)
+		{
+			queue = &netSendQueues[i];
+		}
+	}
+	if(queue == NULL)
+	{
+		//More sockets than queues
+		queue = &netSendQueues[0];
+		NET_FlushSendQueue(queue);
+	}
+
+	if(queue->numPackets == NET_SENDQUEUE_PACKETS || queue->numBytes + length > NET_SENDQUEUE_BYTES)
+	{
+		NET_FlushSendQueue(queue);
+	}
+
+	queue->sock = to->sock;
+	i = queue->numPackets;
+
+	Com_Memcpy(queue->data + queue->numBytes, data, length);
+	queue->addr[i] = *addr;
+	queue->iov[i].iov_base = queue->data + queue->numBytes;
+	queue->iov[i].iov_len = length;
+
+	msg = &queue->msgs[i];
+	Com_Memset(msg, 0, sizeof(struct mmsghdr));
+	msg->msg_hdr.msg_name = &queue->addr[i];
+	if( to->type == NA_IP || to->type == NA_BROADCAST )
+		msg->msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+	else
+		msg->msg_hdr.msg_namelen = sizeof(struct sockaddr_in6);
+	msg->msg_hdr.msg_iov = &queue->iov[i];
+	msg->msg_hdr.msg_iovlen = 1;
+
+	queue->numBytes += length;
+	queue->numPackets++;
+	return qtrue;
+}
+#endif
+
+/*
+==================
+NET_BeginPacketBatch / NET_EndPacketBatch
+
+Packets the main thread sends in between get queued and sent with one syscall per socket.
+Batches don't nest.
+==================
+*/
+void NET_BeginPacketBatch( )
+{
+#ifdef NET_USE_MMSG
+	if(Sys_IsMainThread())
+	{
+		netBatchActive = qtrue;
+	}
+#endif
+}
+
+void NET_EndPacketBatch( )
+{
+#ifdef NET_USE_MMSG
+	netBatchActive = qfalse;
+	NET_FlushPacketQueue();
+#endif
+	netSyscallStats.frames++;
+}
+
+/*
+==================
+NET_ResetPacketBatch
+
+Called at the start of every frame. A Com_Error longjmp skips NET_EndPacketBatch,
+this sends what got queued until then and ends the batch
+==================
+*/
+void NET_ResetPacketBatch( )
+{
+#ifdef NET_USE_MMSG
+	netBatchActive = qfalse;
+	NET_FlushPacketQueue();
+#endif
+}
+
+void NET_FlushPacketQueue( )
+{
+#ifdef NET_USE_MMSG
+	int i;
+
+	for(i = 0; i < NET_SENDQUEUES; i++)
+	{
+		if(netSendQueues[i].numPackets > 0)
+		{
+			NET_FlushSendQueue(&netSendQueues[i]);
+		}
+	}
+#endif
+}
+
+/*
+==================
+NET_SyscallStats_f
+Prints the number of send and receive syscalls since the last call
+==================
+*/
+static void NET_SyscallStats_f( )
+{
+	double frames = netSyscallStats.frames > 0 ? (double)netSyscallStats.frames : 1.0;
+
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "Network syscalls over %llu server frames (net_batchPackets %d):\n", netSyscallStats.frames, net_batchPackets ? net_batchPackets->integer : 0);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  send: %llu calls for %llu packets, %.2f calls per frame\n", netSyscallStats.sendCalls, netSyscallStats.sendPackets, netSyscallStats.sendCalls / frames);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  recv: %llu calls for %llu packets, %.2f calls per frame\n", netSyscallStats.recvCalls, netSyscallStats.recvPackets, netSyscallStats.recvCalls / frames);
+	Com_Memset(&netSyscallStats, 0, sizeof(netSyscallStats));
+}
+
 /*
 ==================
 Sys_SendPacket
@@ -1388,6 +1608,16 @@ qboolean Sys_SendPacket( int length, const void *data, netadr_t *to ) {
 	memset(&addr, 0, sizeof(addr));
 
 	NetadrToSockadr( to, (struct sockaddr *) &addr );
+
+#ifdef NET_USE_MMSG
+	if(netBatchActive && to->sock != 0 && net_batchPackets->boolean && Sys_IsMainThread())
+	{
+		if(NET_QueuePacket(length, data, to, &addr))
+		{
+			return qtrue;
+		}
+	}
+#endif
 /*
 	if( usingSocks && to->type == NA_IP ) {
 		socksBuf[0] = 0;	// reserved
@@ -1407,6 +1637,7 @@ qboolean Sys_SendPacket( int length, const void *data, netadr_t *to ) {
 #endif
 	if(to->sock != 0)
 	{
+		netSyscallStats.sendCalls++;
 		if( to->type == NA_IP || to->type == NA_BROADCAST )
 			ret = sendto( to->sock, data, length, 0, (struct sockaddr *) &addr, sizeof(struct sockaddr_in) );
 		else if( to->type == NA_IP6 || to->type == NA_MULTICAST6 )
@@ -2756,6 +2987,7 @@ static qboolean NET_GetCvars( void ) {
 	net_socksPassword->modified = qfalse;
 */
 	net_dropsim = Cvar_RegisterInt("net_dropsim", 0,0,100, CVAR_TEMP, "Net enable packetloss simulation");
+	net_batchPackets = Cvar_RegisterBool("net_batchPackets", qtrue, CVAR_ARCHIVE, "Send and receive UDP packets in batches with sendmmsg/recvmmsg where supported");
 	return modified ? qtrue : qfalse;
 }
 
@@ -2809,6 +3041,8 @@ void NET_Config( qboolean enableNetworking ) {
 
 		tcpConnections_t *con;
 
+		NET_FlushPacketQueue();
+
 
 		for(i = 0, con = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, con++){
 
@@ -2911,31 +3145,71 @@ void NET_TcpCloseSocket(int socket)
 	if(socket == INVALID_SOCKET)
 		return;
 
-	//Close the socket
-	closesocket(socket);
-
 	//See if this was a serversocket and clear all references to it
 	for(i = 0, conn = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, conn++)
 	{
 		if(conn->remote.sock == socket)
 		{
 			conn->lastMsgTime = 0;
-			FD_CLR(conn->remote.sock, &tcpServer.fdr);
-			if(conn->wantwrite)
+#ifdef NET_USE_EPOLL
+			if(tcpServer.epollfd >= 0)
 			{
-				FD_CLR(conn->remote.sock, &tcpServer.fdw);
+				epoll_ctl(tcpServer.epollfd, EPOLL_CTL_DEL, socket, NULL);
+				conn->readable = qfalse;
+				conn->writable = qfalse;
+			}else
+#endif
+			{
+				FD_CLR(conn->remote.sock, &tcpServer.fdr);
+				if(conn->wantwrite)
+				{
+					FD_CLR(conn->remote.sock, &tcpServer.fdw);
+				}
 			}
+			closesocket(socket);
 			conn->state = 0;
 
 			tcpServer.activeConnectionCount--;
 			NET_TCPConnectionClosed(&conn->remote, conn->connectionId, conn->serviceId);
 			conn->remote.sock = INVALID_SOCKET;
-			NET_TcpServerRebuildFDList();
+			if(tcpServer.epollfd < 0)
+			{
+				NET_TcpServerRebuildFDList();
+			}
 			return;
 		}
 	}
+
+	//Close the socket
+	closesocket(socket);
 }
 
+#ifdef NET_USE_EPOLL
+/*
+==================
+NET_TcpServerSocketBlocked
+The send buffer of a server connection is full. Wait for EPOLLOUT before calling it again
+==================
+*/
+static void NET_TcpServerSocketBlocked(int sock)
+{
+	int i;
+	tcpConnections_t	*conn;
+
+	if(tcpServer.epollfd < 0)
+		return;
+
+	for(i = 0, conn = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, conn++)
+	{
+		if(conn->remote.sock == sock)
+		{
+			conn->writable = qfalse;
+			return;
+		}
+	}
+}
+#endif
+
 /*
 ==================
 NET_TcpSendData
@@ -2959,6 +3233,9 @@ int NET_TcpSendData( int sock, const void *data, int length, char* errormsg, int
 
 			if(err == EAGAIN || err == EINTR)
 			{
+#ifdef NET_USE_EPOLL
+				NET_TcpServerSocketBlocked(sock);
+#endif
 				return NET_WANT_WRITE;
 			}
       if(errormsg)
@@ -3074,8 +3351,192 @@ void NET_TcpServerInit()
 	{
 		conn->remote.sock = INVALID_SOCKET;
 	}
+
+	tcpServer.epollfd = -1;
+#ifdef NET_USE_EPOLL
+	tcpServer.epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if(tcpServer.epollfd < 0)
+	{
+		Com_PrintWarning(CON_CHANNEL_NETWORK, "NET_TcpServerInit: epoll_create1() failed: %s. Using select()\n", NET_ErrorString());
+	}
+#endif
 }
 
+#ifdef NET_USE_EPOLL
+/*
+==================
+NET_TcpServerEpollControl
+Registers a connection. Edge triggered, asks for write readiness only if the connection has pending output
+==================
+*/
+static void NET_TcpServerEpollControl(int op, int index)
+{
+	struct epoll_event ev;
+	tcpConnections_t *conn = &tcpServer.connections[index];
+
+	Com_Memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+	if(conn->wantwrite)
+	{
+		ev.events |= EPOLLOUT;
+	}
+	ev.data.u32 = index;
+
+	if(epoll_ctl(tcpServer.epollfd, op, conn->remote.sock, &ev) < 0)
+	{
+		Com_PrintWarningNoRedirect(CON_CHANNEL_NETWORK,"NET_TcpServerEpollControl: epoll_ctl() failed: %s\n", NET_ErrorString());
+	}
+}
+
+static void NET_TcpServerSetReady(int index)
+{
+	tcpConnections_t *conn = &tcpServer.connections[index];
+
+	if(!conn->ready)
+	{
+		conn->ready = qtrue;
+		tcpServer.readyList[tcpServer.numReady] = index;
+		tcpServer.numReady++;
+	}
+}
+#endif
+
+static void NET_TcpServerSetWantWrite(tcpConnections_t *conn, qboolean wantwrite)
+{
+	if(conn->wantwrite == wantwrite)
+	{
+		return;
+	}
+	conn->wantwrite = wantwrite;
+
+#ifdef NET_USE_EPOLL
+	if(tcpServer.epollfd >= 0)
+	{
+		//Modifying the registration reports EPOLLOUT again if the socket is writable
+		conn->writable = qfalse;
+		NET_TcpServerEpollControl(EPOLL_CTL_MOD, conn - tcpServer.connections);
+		return;
+	}
+#endif
+	if(wantwrite)
+	{
+		FD_SET(conn->remote.sock, &tcpServer.fdw);
+	}else{
+		FD_CLR(conn->remote.sock, &tcpServer.fdw);
+	}
+}
+
+
+#ifdef NET_USE_EPOLL
+/*
+==================
+NET_TcpServerEpollEventLoop
+Only connections with an event or with data left over from a previous frame are touched.
+A connection stays on the ready list until recv() runs dry and, if it has pending output,
+until send() would block.
+==================
+*/
+static void NET_TcpServerEpollEventLoop(byte *bufData, int maxsize)
+{
+	struct epoll_event events[MAX_TCPCONNECTIONS];
+	int readyList[MAX_TCPCONNECTIONS];
+	int numevents, numReady, i, ret, cursize;
+	tcpConnections_t	*conn;
+	qboolean wantwrite;
+	char errstr[256];
+
+	numevents = epoll_wait(tcpServer.epollfd, events, MAX_TCPCONNECTIONS, 0);
+
+	if(numevents < 0)
+	{
+		if(socketError != EINTR)
+		{
+			Com_PrintWarningNoRedirect(CON_CHANNEL_NETWORK,"NET_TcpServerEpollEventLoop: epoll_wait() syscall failed: %s\n", NET_ErrorStringMT(errstr, sizeof(errstr)));
+		}
+		numevents = 0;
+	}
+
+	for(i = 0; i < numevents; i++)
+	{
+		conn = &tcpServer.connections[events[i].data.u32];
+		if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+		{
+			conn->readable = qtrue;
+		}
+		if(events[i].events & EPOLLOUT)
+		{
+			conn->writable = qtrue;
+		}
+		NET_TcpServerSetReady(events[i].data.u32);
+	}
+
+	if(tcpServer.numReady == 0)
+	{
+		return;
+	}
+
+	numReady = tcpServer.numReady;
+	Com_Memcpy(readyList, tcpServer.readyList, numReady * sizeof(int));
+	tcpServer.numReady = 0;
+
+	for(i = 0; i < numReady; i++)
+	{
+		conn = &tcpServer.connections[readyList[i]];
+		conn->ready = qfalse;
+
+		if(conn->remote.sock == INVALID_SOCKET)
+		{
+			continue;
+		}
+		if(!conn->readable && !(conn->wantwrite && conn->writable))
+		{
+			continue;
+		}
+
+		cursize = 0;
+		if(conn->readable)
+		{
+			ret = NET_TcpServerGetPacket(conn, bufData, maxsize, qtrue);
+			if(ret < 0)
+			{
+				continue; //Closed
+			}
+			if(ret == 0)
+			{
+				conn->readable = qfalse;
+			}
+			cursize = ret;
+		}
+
+		wantwrite = NET_TCPPacketEvent(&conn->remote, bufData, cursize, &conn->connectionId, &conn->serviceId);
+
+		if(conn->remote.sock == INVALID_SOCKET)
+		{
+			continue;
+		}
+		NET_TcpServerSetWantWrite(conn, wantwrite);
+
+		if(conn->readable || (conn->wantwrite && conn->writable))
+		{
+			NET_TcpServerSetReady(readyList[i]);
+		}
+	}
+
+	if(numevents == 0)
+	{
+		return;
+	}
+
+	//Same timeout as the select() loop which only checks when something has happened
+	for(i = 0, conn = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, conn++)
+	{
+		if(conn->remote.sock != INVALID_SOCKET && !conn->ready && conn->lastMsgTime + MAX_TCPAUTHWAITTIME < NET_TimeGetTime() +1)
+		{
+			NET_TcpCloseSocket(conn->remote.sock);
+		}
+	}
+}
+#endif
 
 /*
 ==================
@@ -3101,6 +3562,14 @@ void NET_TcpServerPacketEventLoop()
 
 	byte bufData[MAX_MSGLEN];
 
+#ifdef NET_USE_EPOLL
+	if(tcpServer.epollfd >= 0)
+	{
+		NET_TcpServerEpollEventLoop(bufData, sizeof(bufData));
+		return;
+	}
+#endif
+
 	if(tcpServer.highestfd < 0)
 	{
 		// windows ain't happy when select is called without valid FDs
@@ -3145,19 +3614,9 @@ void NET_TcpServerPacketEventLoop()
 				cursize = sizeof(bufData);
 			}
 			qboolean wantwrite = NET_TCPPacketEvent(&conn->remote, bufData, cursize, &conn->connectionId, &conn->serviceId);
-			if(wantwrite)
+			if(conn->remote.sock != INVALID_SOCKET)
 			{
-				if(!conn->wantwrite)
-				{
-					conn->wantwrite = qtrue;
-					FD_SET(conn->remote.sock, &tcpServer.fdw);
-				}
-			}else{
-				if(conn->wantwrite)
-				{
-					conn->wantwrite = qfalse;
-					FD_CLR(conn->remote.sock, &tcpServer.fdw);
-				}
+				NET_TcpServerSetWantWrite(conn, wantwrite);
 			}
 			break;
 
@@ -3242,10 +3701,20 @@ void NET_TcpServerOpenConnection( netadr_t *from )
 	conn->connectionId = -1;
 	conn->wantwrite = qfalse;
 
-	FD_SET(conn->remote.sock, &tcpServer.fdr);
+#ifdef NET_USE_EPOLL
+	if(tcpServer.epollfd >= 0)
+	{
+		conn->readable = qfalse;
+		conn->writable = qfalse;
+		NET_TcpServerEpollControl(EPOLL_CTL_ADD, i);
+	}else
+#endif
+	{
+		FD_SET(conn->remote.sock, &tcpServer.fdr);
 
-	if(tcpServer.highestfd < conn->remote.sock)
-		tcpServer.highestfd = conn->remote.sock;
+		if(tcpServer.highestfd < conn->remote.sock)
+			tcpServer.highestfd = conn->remote.sock;
+	}
 
 	Com_DPrintf(CON_CHANNEL_NETWORK,"Opening a new TCP server connection. Sock: %d Index: %d From:%s\n", conn->remote.sock, i, NET_AdrToStringMT(&conn->remote, adrstr, sizeof(adrstr)));
 
@@ -3286,7 +3755,7 @@ __optimize3 __regparm3 qboolean NET_TcpServerConnectRequest(netadr_t* net_from,
 			return qfalse;
 		}
 #ifndef _WIN32
-		if( socket < 0 || socket >= MAX_SOCKETLIMIT ) {
+		if( socket < 0 || (socket >= MAX_SOCKETLIMIT && tcpServer.epollfd < 0) ) { //epoll has no FD_SETSIZE limit
 			Com_Printf(CON_CHANNEL_NETWORK, "WARNING: NET_TcpServerConnectRequest: socket is out of range 0 to 1023. Are there too many open connections or files?\n");
 			closesocket(socket);
 			return qfalse;
@@ -3319,7 +3788,7 @@ __optimize3 __regparm3 qboolean NET_TcpServerConnectRequest(netadr_t* net_from,
 			return qfalse;
 		}
 #ifndef _WIN32
-		if( socket < 0 || socket >= MAX_SOCKETLIMIT ) {
+		if( socket < 0 || (socket >= MAX_SOCKETLIMIT && tcpServer.epollfd < 0) ) { //epoll has no FD_SETSIZE limit
 			Com_Printf(CON_CHANNEL_NETWORK, "WARNING: NET_TcpServerConnectRequest: socket is out of range 0 to 1023. Are there too many open connections or files?\n");
 			closesocket(socket);
 			return qfalse;
@@ -3645,6 +4114,97 @@ int NET_TcpClientConnectNonBlockingToAdr( netadr_t* adr )
   return NET_TcpClientConnectInternal(NULL, adr, NULL, qfalse, 0);
 }
 
+#ifdef NET_USE_MMSG
+
+#define NET_RECVBATCH 16
+#define NET_RECVBATCH_BUFSIZE 0x10000 //Largest possible UDP datagram
+
+/*
+====================
+NET_EventBatched
+
+Same as NET_Event but drains up to NET_RECVBATCH packets per recvmmsg() call
+====================
+*/
+static qboolean NET_EventBatched(int socket, byte *bufData, int maxsize)
+{
+	static byte recvData[NET_RECVBATCH][NET_RECVBATCH_BUFSIZE];
+	struct mmsghdr msgs[NET_RECVBATCH];
+	struct iovec iov[NET_RECVBATCH];
+	struct sockaddr_storage addr[NET_RECVBATCH];
+	netadr_t from;
+	int i, j, n, err, len;
+
+	for(i = 0; i < NET_RECVBATCH; i++)
+	{
+		iov[i].iov_base = recvData[i];
+		iov[i].iov_len = NET_RECVBATCH_BUFSIZE;
+	}
+
+	//Give the system a possibility to abort processing network packets so it won't block execution of frames if the network getting flooded
+	for(i = 0; i < MAX_NETPACKETS; i += n)
+	{
+		Com_Memset(msgs, 0, sizeof(msgs));
+		for(j = 0; j < NET_RECVBATCH; j++)
+		{
+			msgs[j].msg_hdr.msg_name = &addr[j];
+			msgs[j].msg_hdr.msg_namelen = sizeof(addr[j]);
+			msgs[j].msg_hdr.msg_iov = &iov[j];
+			msgs[j].msg_hdr.msg_iovlen = 1;
+		}
+
+		netSyscallStats.recvCalls++;
+		n = recvmmsg(socket, msgs, NET_RECVBATCH, MSG_DONTWAIT, NULL);
+
+		if(n == SOCKET_ERROR)
+		{
+			err = socketError;
+			if( err != EAGAIN && err != ECONNRESET && err != EINTR ){
+				Com_PrintWarningNoRedirect(CON_CHANNEL_NETWORK, "NET_GetPacket on (%s - %d): %s\n", NET_AdrToString(NET_SockToAdr(socket)), socket , NET_ErrorString() );
+			}
+			return qfalse;
+		}
+		if(n == 0)
+		{
+			return qfalse;
+		}
+		netSyscallStats.recvPackets += n;
+
+		for(j = 0; j < n; j++)
+		{
+			SockadrToNetadr( (struct sockaddr *) &addr[j], &from, qfalse, socket);
+			len = msgs[j].msg_len;
+
+			if((msgs[j].msg_hdr.msg_flags & MSG_TRUNC) || len >= maxsize)
+			{
+				Com_PrintWarningNoRedirect(CON_CHANNEL_NETWORK, "Oversize packet from %s\n", NET_AdrToString (&from) );
+				continue;
+			}
+			if(len <= 0)
+			{
+				continue;
+			}
+			if(net_dropsim->integer > 0 && net_dropsim->integer <= 100)
+			{
+				// com_dropsim->value percent of incoming packets get dropped.
+				if(rand() % 101 <= net_dropsim->integer)
+					continue;          // drop this packet
+			}
+			//The handler is allowed to use the whole buffer
+			Com_Memcpy(bufData, recvData[j], len);
+			NET_UDPPacketEvent(&from, bufData, len, maxsize);
+		}
+
+		if(n < NET_RECVBATCH)
+		{
+			//Drained
+			return qfalse;
+		}
+	}
+	return qtrue;
+}
+#endif
+
 /*
 ====================
 NET_Event
@@ -3659,6 +4219,13 @@ __optimize3 __regparm1 qboolean NET_Event(int socket)
 	netadr_t from;
 	int i, len;
 
+#ifdef NET_USE_MMSG
+	if(net_batchPackets->boolean)
+	{
+		return NET_EventBatched(socket, bufData, sizeof(bufData));
+	}
+#endif
+
 	//Give the system a possibility to abort processing network packets so it won't block execution of frames if the network getting flooded
 	for(i = 0; i < MAX_NETPACKETS; i++)
 	{
@@ -3700,6 +4267,7 @@ void NET_Init( void ) {
 	NET_TcpServerInit();
 
 	Cmd_AddCommand ("net_restart", NET_Restart_f);
+	Cmd_AddCommand ("net_syscallstats", NET_SyscallStats_f);
 
 
 }
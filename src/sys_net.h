@@ -88,6 +88,9 @@ void		NET_Shutdown( void );
 void		NET_Restart_f( void );
 void		NET_Config( qboolean enableNetworking );
 void		NET_FlushPacketQueue(void);
+void		NET_BeginPacketBatch(void);
+void		NET_EndPacketBatch(void);
+void		NET_ResetPacketBatch(void);
 qboolean	NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t *to);
 void		NET_RegisterDefaultCommunicationSocket(netadr_t *adr);
 netadr_t*	NET_GetDefaultCommunicationSocket(netadrtype_t family);
@@ -55,7 +55,7 @@ TraceThreadInfo g_traceThreadInfo[NUMTHREADS];
 
 
 
-#define MAX_KEYS 3
+#define MAX_KEYS MAX_THREAD_VALUES
 
 void* sys_valuestoreage[NUMTHREADS][MAX_KEYS];
 
@@ -477,6 +477,15 @@ void __cdecl Com_InitThreadData(int threadContext)
 */
 }
 
+void Com_InitWorkerThreadData(workerThreadData_t* data)
+{
+  Com_Memset(data, 0, sizeof(workerThreadData_t));
+  Sys_SetThreadLocalStorage(data->values);
+
+  Sys_SetValue(1, &data->va);
+  Sys_SetValue(2, &data->abortframe);
+}
+
 void __cdecl Sys_InitThreadAffinity()
 {
   unsigned int cpuCount;
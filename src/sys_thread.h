@@ -28,6 +28,7 @@
 #include "cm_local.h"
 #include "sys_main.h"
 #include <stdarg.h>
+#include <setjmp.h>
 
 
 #ifndef _WIN32
@@ -63,7 +64,8 @@ enum CriticalSection
   CRITSECT_PHYSICAL_MEMORY = 24,
   CRITSECT_WATCHDOG = 25,
   CRITSECT_MISSING_ASSET = 26,
-  CRITSECT_COUNT = 27
+  CRITSECT_KVSTORE = 27,
+  CRITSECT_COUNT = 28
 };
 
 enum ThreadOwner
@@ -145,6 +147,19 @@ typedef struct TraceThreadInfo
 
 extern TraceThreadInfo g_traceThreadInfo[NUMTHREADS];
 
+#define MAX_THREAD_VALUES 3
+
+/* Thread local values of a thread started with Sys_CreateNewThread. Com_Error on
+   such a thread longjmps to abortframe instead of terminating the thread */
+typedef struct
+{
+  void* values[MAX_THREAD_VALUES];
+  struct va_info_t va;
+  jmp_buf abortframe;
+}workerThreadData_t;
+
+void Com_InitWorkerThreadData(workerThreadData_t* data);
+
 unsigned int Sys_GetProcessAffinityMask();
 void** Sys_GetThreadLocalStorage();
 void Sys_SetThreadLocalStorage(void**);
@@ -9,6 +9,11 @@
 #include "xassets/xmodel.h"
 //#include "g_scr_vehicle.h"
 #include "g_shared.h"
+#include "huffman.h"
+#include "qcommon_mem.h"
+#include "filesystem.h"
+#include "sys_main.h"
+#include "varstorage.h"
 
 extern byte* archivedEntityFields[];
 extern byte* playerStateFields[];
@@ -348,9 +353,758 @@ void DumpVariable_f(){
 }
 
 
+#define HUFFBENCH_MAXPACKETS 2048
+#define HUFFBENCH_POOLSIZE (4*1024*1024)
+
+/*
+Reads the net messages out of a server recorded demo. Layout is written by sv_demo.c:
+17 byte header, then records of type 0 (seq, len, data) and type 1 (52 byte archive).
+The first 4 bytes of each net message are not compressed.
+*/
+static int HuffBench_LoadDemo(const char* filename, byte* pool, int* offsets, int* lengths)
+{
+	byte* buf;
+	int len, pos, numpackets, poolpos, msglen;
+
+	len = FS_ReadFile(filename, (void**)&buf);
+	if(len <= 17)
+	{
+		if(len > 0)
+		{
+			FS_FreeFile(buf);
+		}
+		return 0;
+	}
+	for(pos = 17, numpackets = 0, poolpos = 0; pos < len && numpackets < HUFFBENCH_MAXPACKETS; )
+	{
+		if(buf[pos] == 1)
+		{
+			pos += 53;
+			continue;
+		}
+		if(buf[pos] != 0 || pos + 9 > len)
+		{
+			break;
+		}
+		msglen = LittleLong(*(int*)(buf + pos + 5));
+		pos += 9;
+		if(msglen <= 4 || pos + msglen > len)
+		{
+			break;
+		}
+		offsets[numpackets] = poolpos;
+		lengths[numpackets] = MSG_ReadBitsCompressTree(buf + pos + 4, msglen - 4, pool + poolpos, HUFFBENCH_POOLSIZE - poolpos);
+		poolpos += lengths[numpackets];
+		pos += msglen;
+		++numpackets;
+		if(poolpos >= HUFFBENCH_POOLSIZE - MAX_MSGLEN)
+		{
+			break;
+		}
+	}
+	FS_FreeFile(buf);
+	return numpackets;
+}
+
+/*
+Without a capture we fake snapshot like payloads: mostly small values with some noise.
+*/
+static int HuffBench_GeneratePackets(byte* pool, int* offsets, int* lengths)
+{
+	int i, k, poolpos;
+
+	for(i = 0, poolpos = 0; i < 512; ++i)
+	{
+		offsets[i] = poolpos;
+		lengths[i] = 200 + (rand() % 1200);
+		for(k = 0; k < lengths[i]; ++k)
+		{
+			pool[poolpos + k] = (rand() % 3) ? (rand() % 16) : rand();
+		}
+		poolpos += lengths[i];
+	}
+	return i;
+}
+
+/*
+huffbench [demofile] [iterations]
+Compares the bitwise tree codec against the table driven one. Fails on any difference.
+*/
+void Test_HuffmanBench_f()
+{
+	static int offsets[HUFFBENCH_MAXPACKETS];
+	static int lengths[HUFFBENCH_MAXPACKETS];
+	static byte comp1[MAX_MSGLEN];
+	static byte comp2[MAX_MSGLEN];
+	static byte decomp1[MAX_MSGLEN];
+	static byte decomp2[MAX_MSGLEN];
+	byte* pool;
+	int numpackets, iterations, i, k, len1, len2, totalbytes;
+	unsigned long long t, tEncTree, tEncTable, tDecTree, tDecTable;
+
+	pool = L_Malloc(HUFFBENCH_POOLSIZE);
+	if(pool == NULL)
+	{
+		return;
+	}
+	iterations = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 100;
+	if(iterations < 1)
+	{
+		iterations = 1;
+	}
+
+	numpackets = 0;
+	if(Cmd_Argc() > 1)
+	{
+		numpackets = HuffBench_LoadDemo(Cmd_Argv(1), pool, offsets, lengths);
+		if(numpackets == 0)
+		{
+			Com_Printf(CON_CHANNEL_DONT_FILTER, "No packets found in %s\n", Cmd_Argv(1));
+		}
+	}
+	if(numpackets == 0)
+	{
+		numpackets = HuffBench_GeneratePackets(pool, offsets, lengths);
+	}
+
+	tEncTree = tEncTable = tDecTree = tDecTable = 0;
+	totalbytes = 0;
+
+	for(i = 0; i < numpackets; ++i)
+	{
+		len1 = MSG_WriteBitsCompressTree(pool + offsets[i], comp1, lengths[i]);
+		len2 = MSG_WriteBitsCompress(pool + offsets[i], comp2, lengths[i]);
+		if(len1 != len2 || memcmp(comp1, comp2, len1))
+		{
+			Com_PrintError(CON_CHANNEL_DONT_FILTER, "huffbench: encoder mismatch on packet %d\n", i);
+			L_Free(pool);
+			return;
+		}
+		if(MSG_ReadBitsCompressTree(comp1, len1, decomp1, lengths[i]) != lengths[i] || MSG_ReadBitsCompress(comp1, len1, decomp2, lengths[i]) != lengths[i]
+			|| memcmp(decomp1, pool + offsets[i], lengths[i]) || memcmp(decomp2, pool + offsets[i], lengths[i]))
+		{
+			Com_PrintError(CON_CHANNEL_DONT_FILTER, "huffbench: decoder mismatch on packet %d\n", i);
+			L_Free(pool);
+			return;
+		}
+		totalbytes += lengths[i];
+
+		t = Sys_Microseconds();
+		for(k = 0; k < iterations; ++k)
+			MSG_WriteBitsCompressTree(pool + offsets[i], comp1, lengths[i]);
+		tEncTree += Sys_Microseconds() - t;
+
+		t = Sys_Microseconds();
+		for(k = 0; k < iterations; ++k)
+			MSG_WriteBitsCompress(pool + offsets[i], comp2, lengths[i]);
+		tEncTable += Sys_Microseconds() - t;
+
+		t = Sys_Microseconds();
+		for(k = 0; k < iterations; ++k)
+			MSG_ReadBitsCompressTree(comp1, len1, decomp1, sizeof(decomp1));
+		tDecTree += Sys_Microseconds() - t;
+
+		t = Sys_Microseconds();
+		for(k = 0; k < iterations; ++k)
+			MSG_ReadBitsCompress(comp1, len1, decomp2, sizeof(decomp2));
+		tDecTable += Sys_Microseconds() - t;
+	}
+	L_Free(pool);
+
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "huffbench: %d packets, %d bytes, %d iterations, output identical\n", numpackets, totalbytes, iterations);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  encode tree:  %llu usec\n  encode table: %llu usec\n", tEncTree, tEncTable);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  decode tree:  %llu usec\n  decode table: %llu usec\n", tDecTree, tDecTable);
+}
+
+/*
+Bit at a time MSG_WriteBits/MSG_ReadBits as they were before the word-at-a-time
+rewrite. Only used as reference for msgbitfuzz and msgbitbench.
+*/
+static void MSG_WriteBits_Bitwise(msg_t *msg, int bits, int bitcount)
+{
+	int i;
+
+	if ( msg->maxsize - msg->cursize < 4 )
+	{
+		msg->overflowed = 1;
+		return;
+	}
+
+	for (i = 0 ; i < bitcount; i++)
+	{
+		if ( !(msg->bit & 7) )
+		{
+			msg->bit = 8 * msg->cursize;
+			msg->data[msg->cursize] = 0;
+			msg->cursize++;
+		}
+		if ( bits & 1 )
+			msg->data[msg->bit >> 3] |= 1 << (msg->bit & 7);
+
+		msg->bit++;
+		bits >>= 1;
+	}
+}
+
+static int MSG_ReadBits_Bitwise(msg_t *msg, int numBits)
+{
+	int i;
+	signed int var;
+	int retval;
+
+	retval = 0;
+
+	for(i = 0; i < numBits; i++)
+	{
+		if ( !(msg->bit & 7) )
+		{
+			if ( msg->readcount >= msg->splitSize + msg->cursize )
+			{
+				msg->overflowed = 1;
+				return -1;
+			}
+			msg->bit = 8 * msg->readcount;
+			msg->readcount++;
+		}
+		if ( ((msg->bit / 8)) >= msg->cursize )
+		{
+			if(msg->splitData == NULL)
+				return 0;
+
+			var = msg->splitData[(msg->bit / 8) - msg->cursize];
+		}else
+			var = msg->data[msg->bit / 8];
+
+		retval |= ((var >> (msg->bit & 7)) & 1) << i;
+		msg->bit++;
+	}
+	return retval;
+}
+
+/*
+msgbitfuzz [iterations]
+Random mixes of byte and bit writes/reads, partly across a split buffer. The new
+and the old implementation have to produce the same bytes, results and msg_t state.
+*/
+void Test_MSG_BitFuzz_f()
+{
+	static byte buf1[1024];
+	static byte buf2[1024];
+	msg_t m1, m2;
+	int iterations, it, op, numops, maxsize, bits, count, split, r1, r2;
+
+	iterations = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 10000;
+
+	for(it = 0; it < iterations; ++it)
+	{
+		memset(buf1, 0xAA, sizeof(buf1));
+		memset(buf2, 0xAA, sizeof(buf2));
+		maxsize = 1 + rand() % 300;
+		MSG_Init(&m1, buf1, maxsize);
+		MSG_Init(&m2, buf2, maxsize);
+		numops = rand() % 80;
+
+		for(op = 0; op < numops; ++op)
+		{
+			bits = rand() ^ (rand() << 16);
+			count = rand() % 33;
+			if(rand() % 4 == 0)
+			{
+				MSG_WriteByte(&m1, bits);
+				MSG_WriteByte(&m2, bits);
+			}else{
+				MSG_WriteBits_Bitwise(&m1, bits, count);
+				MSG_WriteBits(&m2, bits, count);
+			}
+		}
+		if(m1.cursize != m2.cursize || m1.bit != m2.bit || m1.overflowed != m2.overflowed || memcmp(buf1, buf2, sizeof(buf1)))
+		{
+			Com_PrintError(CON_CHANNEL_DONT_FILTER, "msgbitfuzz: write mismatch in iteration %d\n", it);
+			return;
+		}
+
+		split = m1.cursize ? rand() % (m1.cursize +1) : 0;
+		MSG_InitReadOnlySplit(&m1, buf1, split, buf1 + split, m1.cursize - split);
+		MSG_InitReadOnlySplit(&m2, buf2, split, buf2 + split, m2.cursize - split);
+
+		for(op = 0; op < numops + 4; ++op)
+		{
+			count = rand() % 33;
+			if(rand() % 4 == 0)
+			{
+				r1 = MSG_ReadByte(&m1);
+				r2 = MSG_ReadByte(&m2);
+			}else{
+				r1 = MSG_ReadBits_Bitwise(&m1, count);
+				r2 = MSG_ReadBits(&m2, count);
+			}
+			if(r1 != r2 || m1.readcount != m2.readcount || m1.bit != m2.bit || m1.overflowed != m2.overflowed)
+			{
+				Com_PrintError(CON_CHANNEL_DONT_FILTER, "msgbitfuzz: read mismatch in iteration %d\n", it);
+				return;
+			}
+		}
+	}
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "msgbitfuzz: %d iterations passed\n", iterations);
+}
+
+/*
+msgbitbench
+Writes and reads back 100k fields of 0-32 bits with both implementations.
+*/
+void Test_MSG_BitBench_f()
+{
+	static byte buf[1024*1024];
+	msg_t msg;
+	int i, k, size;
+	volatile int sum;
+	unsigned long long t, tWriteOld, tWriteNew, tReadOld, tReadNew;
+
+	t = Sys_Microseconds();
+	for(k = 0; k < 20; ++k)
+	{
+		MSG_Init(&msg, buf, sizeof(buf));
+		for(i = 0; i < 100000; ++i)
+			MSG_WriteBits_Bitwise(&msg, i, (i*7) % 33);
+	}
+	tWriteOld = Sys_Microseconds() - t;
+
+	t = Sys_Microseconds();
+	for(k = 0; k < 20; ++k)
+	{
+		MSG_Init(&msg, buf, sizeof(buf));
+		for(i = 0; i < 100000; ++i)
+			MSG_WriteBits(&msg, i, (i*7) % 33);
+	}
+	tWriteNew = Sys_Microseconds() - t;
+	size = msg.cursize;
+
+	sum = 0;
+	t = Sys_Microseconds();
+	for(k = 0; k < 20; ++k)
+	{
+		MSG_InitReadOnly(&msg, buf, size);
+		for(i = 0; i < 100000; ++i)
+			sum += MSG_ReadBits_Bitwise(&msg, (i*7) % 33);
+	}
+	tReadOld = Sys_Microseconds() - t;
+
+	t = Sys_Microseconds();
+	for(k = 0; k < 20; ++k)
+	{
+		MSG_InitReadOnly(&msg, buf, size);
+		for(i = 0; i < 100000; ++i)
+			sum += MSG_ReadBits(&msg, (i*7) % 33);
+	}
+	tReadNew = Sys_Microseconds() - t;
+
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "msgbitbench: 2M fields, %d bytes per pass\n", size);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  write bitwise: %llu usec\n  write word:    %llu usec\n", tWriteOld, tWriteNew);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  read bitwise:  %llu usec\n  read word:     %llu usec\n", tReadOld, tReadNew);
+}
+
+
+/*
+querylimitbench [packets] [sources]
+Replays a getstatus flood with spoofed source addresses through a private query rate limiter
+of sv_queryIgnoreMegs size and reports the cost per packet. Simulates one packet per microsecond.
+The limiter which guards the server is left alone.
+*/
+void Test_QueryLimitBench_f()
+{
+	netadr_t adr;
+	queryLimit_t *ql;
+	unsigned long long now, t;
+	unsigned int seed, n;
+	int packets, sources, i, dropped, used, maxBuckets, period, megs;
+
+	megs = Cvar_VariableIntegerValue("sv_queryIgnoreMegs");
+	if(megs < 1)
+	{
+		megs = 1;
+	}
+
+	ql = SV_QueryLimitCreate(megs * 1024 * 1024);
+	if(ql == NULL)
+	{
+		Com_Printf(CON_CHANNEL_DONT_FILTER, "querylimitbench: Out of memory\n");
+		return;
+	}
+	SV_QueryLimitStats(ql, &used, &maxBuckets);
+
+	packets = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 1000000;
+	sources = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 2 * maxBuckets;
+	if(packets < 1)
+	{
+		packets = 1;
+	}
+	if(sources < 1)
+	{
+		sources = 1;
+	}
+
+	Com_Memset(&adr, 0, sizeof(adr));
+	adr.type = NA_IP;
+
+	period = Cvar_VariableIntegerValue("sv_queryIgnoreTime") * 1000;
+	if(period < 1)
+	{
+		period = 1;
+	}
+	now = 0;
+	seed = 0x1234567;
+	dropped = 0;
+
+	t = Sys_Microseconds();
+	for(i = 0; i < packets; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		// Spread the sources over public address space starting at 11.0.0.0
+		n = ((seed >> 8) % sources) + 0x0B000000;
+		adr.ip[0] = n >> 24;
+		adr.ip[1] = n >> 16;
+		adr.ip[2] = n >> 8;
+		adr.ip[3] = n;
+		now++;
+		if(SV_QueryLimitAddress(ql, &adr, 2, period, now))
+		{
+			dropped++;
+		}
+	}
+	t = Sys_Microseconds() - t;
+
+	SV_QueryLimitStats(ql, &used, &maxBuckets);
+	SV_QueryLimitDestroy(ql);
+
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "querylimitbench: %d packets from %d sources, %d dropped\n", packets, sources, dropped);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  %llu usec total, %.3f usec per packet, %d of %d buckets in use\n", t, (double)t / packets, used, maxBuckets);
+}
+
+static byte *timedEventBenchState;
+static int timedEventBenchLastTrigger;
+static int timedEventBenchOrderErrors;
+static int timedEventBenchExecuted;
+
+static void TimedEventBench_Callback(int index, int triggerTime)
+{
+	if(timedEventBenchState[index] != 1)
+	{
+		timedEventBenchOrderErrors++;
+	}
+	//One millisecond of slack as the trigger time got computed outside of Com_AddTimedEvent
+	if(triggerTime + 1 < timedEventBenchLastTrigger)
+	{
+		timedEventBenchOrderErrors++;
+	}
+	if(triggerTime > timedEventBenchLastTrigger)
+	{
+		timedEventBenchLastTrigger = triggerTime;
+	}
+	timedEventBenchState[index] = 2;
+	timedEventBenchExecuted++;
+}
+
+/*
+timedeventbench [count]
+Adds count timed events which are already due, cancels every 10th and runs them.
+Fails if a cancelled event runs, an event is lost or the order is wrong.
+*/
+void Test_TimedEventBench_f()
+{
+	int *handles;
+	int count, i, delay, cancelled, lost, pending;
+	unsigned long long t, tAdd, tCancel, tRun;
+
+	count = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 100000;
+	if(count < 1)
+	{
+		count = 1;
+	}
+	handles = L_Malloc(count * sizeof(int));
+	timedEventBenchState = L_Malloc(count);
+	if(handles == NULL || timedEventBenchState == NULL)
+	{
+		L_Free(handles);
+		L_Free(timedEventBenchState);
+		return;
+	}
+
+	pending = Com_NumTimedEvents();
+	srand(1234);
+
+	t = Sys_Microseconds();
+	for(i = 0; i < count; ++i)
+	{
+		delay = -1 - (rand() % 100000);
+		handles[i] = Com_AddTimedEvent(delay, TimedEventBench_Callback, 2, i, Sys_Milliseconds() + delay);
+		timedEventBenchState[i] = handles[i] < 0 ? 0 : 1;
+	}
+	tAdd = Sys_Microseconds() - t;
+
+	cancelled = 0;
+	t = Sys_Microseconds();
+	for(i = 0; i < count; i += 10)
+	{
+		if(Com_CancelTimedEvent(handles[i]))
+		{
+			timedEventBenchState[i] = 3;
+			cancelled++;
+		}
+	}
+	tCancel = Sys_Microseconds() - t;
+
+	timedEventBenchLastTrigger = 0x80000000;
+	timedEventBenchOrderErrors = 0;
+	timedEventBenchExecuted = 0;
+
+	t = Sys_Microseconds();
+	Com_TimedEventLoop();
+	tRun = Sys_Microseconds() - t;
+
+	lost = 0;
+	for(i = 0; i < count; ++i)
+	{
+		if(timedEventBenchState[i] != 2 && timedEventBenchState[i] != 3)
+		{
+			lost++;
+		}
+	}
+	//Stale handles must not cancel anything
+	if(Com_CancelTimedEvent(handles[0]) || Com_CancelTimedEvent(handles[count -1]))
+	{
+		timedEventBenchOrderErrors++;
+	}
+
+	L_Free(handles);
+	L_Free(timedEventBenchState);
+	timedEventBenchState = NULL;
+
+	if(lost || timedEventBenchOrderErrors)
+	{
+		Com_PrintError(CON_CHANNEL_DONT_FILTER, "timedeventbench: %d events lost, %d errors\n", lost, timedEventBenchOrderErrors);
+		return;
+	}
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "timedeventbench: %d events, %d cancelled, %d executed, %d were pending before\n", count, cancelled, timedEventBenchExecuted, pending);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  add:    %llu usec\n  cancel: %llu usec\n  run:    %llu usec\n", tAdd, tCancel, tRun);
+}
+
+static int cmdBenchCalls;
+
+static void CmdBench_Nop_f()
+{
+	cmdBenchCalls++;
+}
+
+/*
+cmdbench [count]
+Executes a mixed stream of count command lines: a registered command in
+different spellings, a legacy "dvar" name and a cvar assignment.
+*/
+void Test_CmdBench_f()
+{
+	int count, i, expected, lastvalue;
+	unsigned long long t;
+	cvar_t* benchvar;
+	char line[64];
+
+	count = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 100000;
+	if(count < 4)
+	{
+		count = 4;
+	}
+
+	if(!Cmd_AddCommand("cmdbench_nop", CmdBench_Nop_f) || !Cmd_AddCommand("cvarbench_nop", CmdBench_Nop_f))
+	{
+		Cmd_RemoveCommand("cmdbench_nop");
+		return;
+	}
+	benchvar = Cvar_RegisterInt("cmdbench_var", 0, 0, 0x7fffffff, 0, "Used by cmdbench");
+
+	cmdBenchCalls = 0;
+	expected = 0;
+	lastvalue = 0;
+
+	t = Sys_Microseconds();
+	for(i = 0; i < count; ++i)
+	{
+		switch(i & 3)
+		{
+			case 0:
+				Cmd_ExecuteString("cmdbench_nop arg1 \"arg 2\"");
+				expected++;
+				break;
+			case 1:
+				Cmd_ExecuteString("CMDBENCH_Nop");
+				expected++;
+				break;
+			case 2:
+				Cmd_ExecuteString("dvarbench_nop");
+				expected++;
+				break;
+			default:
+				Com_sprintf(line, sizeof(line), "cmdbench_var %d", i);
+				Cmd_ExecuteString(line);
+				lastvalue = i;
+				break;
+		}
+	}
+	t = Sys_Microseconds() - t;
+
+	Cmd_RemoveCommand("cmdbench_nop");
+	Cmd_RemoveCommand("cvarbench_nop");
+
+	if(cmdBenchCalls != expected || benchvar->integer != lastvalue)
+	{
+		Com_PrintError(CON_CHANNEL_DONT_FILTER, "cmdbench: %d of %d commands executed, cmdbench_var is %d\n", cmdBenchCalls, expected, benchvar->integer);
+		return;
+	}
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "cmdbench: %d command lines in %llu usec (%llu nsec each)\n", count, t, t * 1000 / count);
+}
+
+/*
+varstoragefuzz [operations] [keys]
+Runs random sets, removes, lookups and compactions against a private varstorage
+object and checks every lookup and a reload from the file format against a plain
+reference array.
+*/
+void Test_VarStorageFuzz_f()
+{
+	varStorage_t vs, reloaded;
+	vsValue_t value;
+	varType_t type;
+	vsStats_t stats;
+	unsigned long long t;
+	unsigned int seed;
+	int operations, keys, i, k, len, errors, lookups;
+	int *reference;
+	char name[MAX_VARNAME];
+	char *buffer, *line, *next;
+
+	operations = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 1000000;
+	keys = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 20000;
+	if(operations < 1)
+	{
+		operations = 1;
+	}
+	if(keys < 1)
+	{
+		keys = 1;
+	}
+
+	reference = L_Malloc(keys * sizeof(int));
+	if(reference == NULL || !HStorage_InitObject(&vs, 0))
+	{
+		L_Free(reference);
+		return;
+	}
+	//0 marks a missing key, stored values are never 0
+	Com_Memset(reference, 0, keys * sizeof(int));
+
+	seed = 0x2545F491;
+	errors = 0;
+	lookups = 0;
+
+	t = Sys_Microseconds();
+	for(i = 0; i < operations; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		k = (seed >> 8) % keys;
+		Com_sprintf(name, sizeof(name), "stats_%08x_kills", k);
+
+		switch((seed >> 4) & 7)
+		{
+			case 0:
+				HStorage_RemoveData(&vs, name);
+				reference[k] = 0;
+				break;
+			case 1:
+			case 2:
+			case 3:
+				value.integer = i + 1;
+				if(!HStorage_BeginData(&vs, VSVAR_INTEGER, name) || !HStorage_AddData(&vs, &value) || !HStorage_EndData(&vs))
+				{
+					errors++;
+					break;
+				}
+				reference[k] = i + 1;
+				break;
+			default:
+				lookups++;
+				if(HStorage_GetBeginData(&vs, name, &type) == 0)
+				{
+					if(reference[k] != 0)
+						errors++;
+					break;
+				}
+				if(type != VSVAR_INTEGER || !HStorage_GetData(&vs, &value) || value.integer != reference[k])
+				{
+					errors++;
+				}
+				break;
+		}
+		if((i & 0xffff) == 0xffff)
+		{
+			HStorage_Compact(&vs);
+		}
+	}
+	t = Sys_Microseconds() - t;
+
+	HStorage_GetStats(&vs, &stats);
+
+	buffer = HStorage_WriteDataToMemory(&vs, &len);
+	if(buffer && HStorage_InitObject(&reloaded, 0))
+	{
+		for(line = buffer; *line; line = next)
+		{
+			next = strchr(line, '\n');
+			*next++ = '\0';
+			HStorage_ParseLine(&reloaded, line, 0);
+		}
+		for(k = 0; k < keys; ++k)
+		{
+			Com_sprintf(name, sizeof(name), "stats_%08x_kills", k);
+			if(HStorage_GetBeginData(&reloaded, name, &type) == 0)
+			{
+				if(reference[k] != 0)
+					errors++;
+				continue;
+			}
+			if(!HStorage_GetData(&reloaded, &value) || value.integer != reference[k])
+			{
+				errors++;
+			}
+		}
+		HStorage_FreeObject(&reloaded);
+	}else{
+		errors++;
+	}
+	free(buffer);
+	HStorage_FreeObject(&vs);
+	L_Free(reference);
+
+	if(errors)
+	{
+		Com_PrintError(CON_CHANNEL_DONT_FILTER, "varstoragefuzz: %d mismatches\n", errors);
+		return;
+	}
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "varstoragefuzz: %d operations (%d lookups) on %d keys in %llu usec (%llu nsec each)\n",
+		operations, lookups, keys, t, t * 1000 / operations);
+	Com_Printf(CON_CHANNEL_DONT_FILTER, "  %d keys, %d hashtable fields, %d/%d units used, %d garbage units, %d relocations, %d bytes serialized\n",
+		stats.numEntries, stats.numTableFields, stats.usedUnits, stats.totalUnits, stats.garbageUnits, vs.relocationCount, len);
+}
 
 void Tests_Init()
 {
+	if(com_developer && com_developer->integer)
+	{
+		Cmd_AddCommand("huffbench", Test_HuffmanBench_f);
+		Cmd_AddCommand("msgbitfuzz", Test_MSG_BitFuzz_f);
+		Cmd_AddCommand("msgbitbench", Test_MSG_BitBench_f);
+		Cmd_AddCommand("querylimitbench", Test_QueryLimitBench_f);
+		Cmd_AddCommand("timedeventbench", Test_TimedEventBench_f);
+		Cmd_AddCommand("cmdbench", Test_CmdBench_f);
+		Cmd_AddCommand("varstoragefuzz", Test_VarStorageFuzz_f);
+	}
 //	Cmd_AddCommand("testpscode", MSG_TestPSCode);
 /*	Cmd_AddCommand("testmsgreadlong", Test_MSG_WriteReadLong);
 	Cmd_AddCommand("printdobj", FindAndPrintDObj_f);
@@ -48,6 +48,7 @@
 #include <sys/time.h>
 #include <pthread.h>
 #include <stdatomic.h>
+#include <fcntl.h>
 
 void Sys_InitThreadContext();
 
@@ -885,7 +886,8 @@ BOOL __cdecl _CloseHandle(HANDLE handle)
 }
 
 
-DWORD sLastError;
+//Per thread like GetLastError() on Windows
+__thread DWORD sLastError;
 
 DWORD __cdecl _GetLastError()
 {
@@ -901,34 +903,46 @@ void __cdecl _SetLastError(DWORD error_val)
   sLastError = error_val;
 }
 
+/*
+Reads synchronously. pread() doesn't touch the file position so the fastfile read-ahead
+thread can read while the loading thread queries the file size
+*/
 BOOL __cdecl _ReadFileEx(HANDLE handle, void *lpBuffer, int nNumberOfBytesToRead, struct _OVERLAPPED *lpOverlapped, void (__stdcall *lpCompletionRoutine)(long unsigned int, long unsigned int, struct _OVERLAPPED*))
 {
+  ssize_t r;
+  int numread;
+
   sLastError = 0;
   hObject_t *hObject = (hObject_t*)handle;
   if ( hObject->type != 'File' )
   {
     return FALSE;
   }
-  if ( fseek(hObject->fh, lpOverlapped->Offset, 0) )
+  numread = 0;
+  while ( numread < nNumberOfBytesToRead )
   {
-    if(feof(hObject->fh))
+    r = pread(fileno(hObject->fh), (char*)lpBuffer + numread, nNumberOfBytesToRead - numread, (off_t)lpOverlapped->Offset + numread);
+    if ( r < 0 )
     {
-        _SetLastError(38); //EOF error
-    }else{
-        _SetLastError(25); //Seek error
+      if ( errno == EINTR )
+      {
+        continue;
+      }
+      _SetLastError(30); //Read fault
+      return FALSE;
     }
-    return FALSE;
-  }
-  if((signed int)fread(lpBuffer, 1u, nNumberOfBytesToRead, hObject->fh) <= 0)
-  {
-    if(feof(hObject->fh))
+    if ( r == 0 )
     {
-        _SetLastError(38);
-    }else{
-        _SetLastError(30); //Read fault
+      break;
     }
+    numread += r;
+  }
+  if ( numread == 0 )
+  {
+    _SetLastError(38); //EOF error
     return FALSE;
   }
+  lpOverlapped->InternalHigh = numread;
   return TRUE;
 }
 
@@ -968,6 +982,9 @@ HANDLE __cdecl _CreateFileA(char *lpFileName, DWORD dwDesiredAccess, DWORD dwSha
     }
     ho->type = 'File';
     ho->fh = fh;
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fileno(fh), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
     return (HANDLE)ho;
   }
   return (HANDLE)-1;
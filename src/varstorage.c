@@ -2,32 +2,12 @@
 #include "filesystem.h"
 #include "qcommon_io.h"
 #include "murmurhash1.h"
+#include "varstorage.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
-
-#if 0
-
-typedef enum
-{
-    VSVAR_BAD,
-    VSVAR_STRING,
-    VSVAR_BOOLEAN,
-    VSVAR_INTEGER,
-    VSVAR_FLOAT,
-    VSVAR_VECTOR
-}varType_t;
-
-typedef union
-{
-    char* string;
-    qboolean boolean;
-    int32_t integer;
-    float floatVar;
-    vec3_t vector;
-}vsValue_t;
-
+#include <stddef.h>
 
 typedef struct
 {
@@ -37,8 +17,6 @@ typedef struct
     byte dataStart;
 }vsMemHeader_t;
 
-#define MAX_ARRAY_SIZE 128
-
 #define VS_UNIT_SIZE 16
 
 typedef union
@@ -48,8 +26,6 @@ typedef union
 }vsMemUnit_t;
 
 
-#define MAX_VARNAME 32
-
 typedef struct
 {
     int dataOffset;
@@ -66,6 +42,8 @@ typedef struct
     int numInUseFields;
     int numUnits;
     int nextFree;
+    int numGarbageUnits; /* Units of overwritten or removed variables */
+    int numDeletedFields; /* Hashtable fields marked with -2 */
     qboolean overflowed;
 }table_t;
 
@@ -81,19 +59,13 @@ typedef struct
 
 }memStorage_t;
 
-typedef struct
+struct vsMemObj_s
 {
     memStorage_t store;
     table_t table;
     iterator_t iter;
     const char* lastError;
-}vsMemObj_t;
-
-typedef struct
-{
-    vsMemObj_t* memObj;
-    int relocationCount;
-}varStorage_t;
+};
 
 #define VSINITIAL_STORAGE_SIZE 4096
 
@@ -228,18 +200,12 @@ qboolean HStorage_StringToValue(varType_t type, char* string, vsValue_t* value)
 
 uint32_t HStorage_GetHashFromString( const char* string )
 {
-    char hstring[MAX_VARNAME] = { 0 };
-    Q_strncpyz( hstring, string, sizeof(hstring) );
-    return MurmurHash1( hstring, MAX_VARNAME, 0x3f1ad378 );
+    return MurmurHash1( string, strlen(string), 0x3f1ad378 );
 }
 
 uint16_t HStorage_GetHeaderSize()
 {
-    uint16_t headerlen;
-    vsMemHeader_t* header;
-
-    headerlen = ((byte*)&(header->dataStart) - (byte*)&(header->type));
-    return headerlen;
+    return offsetof(vsMemHeader_t, dataStart);
 }
 
 
@@ -469,10 +435,15 @@ qboolean HStorage_AddDataFromStringInternal( vsMemObj_t* obj, char* varValue)
 
 
 
-int HStorage_GetTableDataIndex( vsMemObj_t* obj, char* name )
+/*
+Returns the hashtable field which holds name. If name is not stored the field
+to insert it into is returned: the first field marked as deleted on the probe
+sequence, otherwise the free field which ends it.
+*/
+int HStorage_GetTableDataIndex( vsMemObj_t* obj, const char* name )
 {
     unsigned int hashindex, i;
-    int tableindex;
+    int tableindex, deletedindex;
     unsigned int hash;
     int *hashtable;
     vsMemUnit_t *units;
@@ -484,6 +455,8 @@ int HStorage_GetTableDataIndex( vsMemObj_t* obj, char* name )
     hashtable = (int*)&HStorage_GetMemoryStart(obj)[ obj->store.hashtableOffset ];
     units = (vsMemUnit_t*)&HStorage_GetMemoryStart(obj)[ obj->store.memUnitsOffset ];
 
+    deletedindex = -1;
+
     for(i = 0; i < obj->table.numFields; ++i)
     {
 
@@ -491,19 +464,35 @@ int HStorage_GetTableDataIndex( vsMemObj_t* obj, char* name )
 
         if( hashtable[tableindex] == -2)
         {
-            /* Has been marked for deleting */
+            /* Has been marked for deleting. Our name can still come after it */
+            if(deletedindex == -1)
+            {
+                deletedindex = tableindex;
+            }
             continue;
         }
 
-        if( hashtable[tableindex] == -1 || strcmp( name, (char*)&(units[hashtable[tableindex]].header.dataStart)) == 0 )
+        if( hashtable[tableindex] == -1 )
         {
-            /* Found a free field or the field which has our name */
+            /* Found a free field, name is not stored */
+            if(deletedindex != -1)
+            {
+                tableindex = deletedindex;
+            }
+            break;
+        }
+
+        if( strcmp( name, (char*)&(units[hashtable[tableindex]].header.dataStart)) == 0 )
+        {
+            /* Found the field which has our name */
             break;
         }
     }
 
-    if(i == obj->table.numFields)
+    if(i == obj->table.numFields && deletedindex != -1)
     {
+        tableindex = deletedindex;
+    }else if(i == obj->table.numFields){
         obj->table.overflowed = qtrue;
         obj->lastError = "HStorage_GetTableDataIndex: Hashtable has overflowed. Should never happen!";
         return -1;
@@ -518,7 +507,7 @@ int HStorage_GetTableDataIndex( vsMemObj_t* obj, char* name )
 
 int HStorage_EndDataInternal( vsMemObj_t* obj )
 {
-    int index, tableindex, numUnits;
+    int index, tableindex, numUnits, oldUnits;
 
     int *hashtable;
     vsMemHeader_t* tmpheader;
@@ -537,12 +526,14 @@ int HStorage_EndDataInternal( vsMemObj_t* obj )
     }
 
     index = hashtable[tableindex];
+    oldUnits = 0;
 
-    if(index != -1)
+    if(index >= 0)
     {
 
         if( HStorage_GetAvailableBytesFromDatasize( units[index].header.dataSize ) < tmpheader->dataSize )
         {
+            oldUnits = HStorage_GetNumberOfUnitsFromDatasize( units[index].header.dataSize );
             index = obj->table.nextFree;
         }
 
@@ -562,16 +553,57 @@ int HStorage_EndDataInternal( vsMemObj_t* obj )
     {
         obj->table.nextFree += numUnits;
     }
+    if( hashtable[tableindex] == -1 )
+    {
+        ++obj->table.numInUseFields;
+    }else if( hashtable[tableindex] == -2 ){
+        /* Reusing a field marked as deleted */
+        ++obj->table.numInUseFields;
+        --obj->table.numDeletedFields;
+    }
+    /* The old location is too small and left behind until the next relocation */
+    obj->table.numGarbageUnits += oldUnits;
     /* Beginning modifying of our dataset */
     /* Sets the hashtable entry to our saving location */
     hashtable[tableindex] = index;
-    ++obj->table.numInUseFields;
     /* copy our temp dataset to the final destination */
     memcpy( &(units[index]), &(obj->iter.tempunits[0]), tmpheader->dataSize + HStorage_GetHeaderSize());
     obj->lastError = "HStorage_EndData: Success";
     return 1;
 }
 
+/* Marks the hashtable field as deleted, the units become garbage */
+qboolean HStorage_RemoveDataInternal( vsMemObj_t* obj, const char* name )
+{
+    int index, tableindex;
+    int *hashtable;
+    vsMemUnit_t *units;
+
+    hashtable = (int*)&HStorage_GetMemoryStart(obj)[ obj->store.hashtableOffset ];
+    units = (vsMemUnit_t*)&HStorage_GetMemoryStart(obj)[ obj->store.memUnitsOffset ];
+
+    tableindex = HStorage_GetTableDataIndex( obj, name );
+    if(tableindex == -1)
+    {
+        obj->lastError = "HStorage_RemoveData: Invalid index";
+        return qfalse;
+    }
+
+    index = hashtable[tableindex];
+    if(index < 0)
+    {
+        obj->lastError = "HStorage_RemoveData: The element which is requested is not found";
+        return qfalse;
+    }
+
+    obj->table.numGarbageUnits += HStorage_GetNumberOfUnitsFromDatasize( units[index].header.dataSize );
+    hashtable[tableindex] = -2;
+    --obj->table.numInUseFields;
+    ++obj->table.numDeletedFields;
+    obj->lastError = "HStorage_RemoveData: Success";
+    return qtrue;
+}
+
 /* Functions to retrieve an object */
 qboolean HStorage_GetBeginDataSetupIterInternal( vsMemObj_t* obj, int tableindex )
 {
@@ -695,6 +727,7 @@ int HStorage_GetDataInternal(vsMemObj_t* obj, vsValue_t* value )
     }
 
     obj->iter.dataOffset += datalen;
+    ++obj->iter.elemCount;
     obj->lastError = "HStorage_GetData: Success";
     return 1;
 }
@@ -758,22 +791,32 @@ const char* HStorage_GetLastErrorInternal( vsMemObj_t* obj )
 }
 
 
+/*
+Moves all variables into a new object. Garbage and deleted fields are left behind.
+The new object keeps the size as long as the live variables and the pending
+tempdata use at most half of its units, otherwise it grows.
+*/
 vsMemObj_t* HStorage_Relocate( vsMemObj_t* obj )
 {
-    int i, count;
+    int i, count, length, requiredUnits;
     qboolean addsuc;
-    char name[32];
+    char name[MAX_VARNAME];
     varType_t type;
     vsValue_t value;
     vsMemObj_t* newobj;
 
-    if(obj->store.length == VSINITIAL_STORAGE_SIZE)
+    requiredUnits = obj->table.nextFree - obj->table.numGarbageUnits;
+    requiredUnits += HStorage_GetNumberOfUnitsFromDatasize( obj->iter.tempunits[0].header.dataSize );
+
+    length = obj->store.length;
+    /* The hashtable takes up to half of the memory */
+    while(length / (int)sizeof(vsMemUnit_t) < 4 * requiredUnits)
     {
-        newobj = HStorage_NewObjectInternal( 4 * obj->store.length );
-    }else{
-        newobj = HStorage_NewObjectInternal( 2 * obj->store.length );
+        length *= 2;
     }
 
+    newobj = HStorage_NewObjectInternal( length );
+
     if( newobj == NULL )
     {
         obj->lastError = "HStorage_Relocate: Out of memory";
@@ -788,7 +831,7 @@ vsMemObj_t* HStorage_Relocate( vsMemObj_t* obj )
 
             if(count == 0)
             {
-                break;
+                continue;
             }
 
             if(HStorage_BeginDataInternal(newobj, type, name) != qtrue)
@@ -838,26 +881,87 @@ vsMemObj_t* HStorage_Relocate( vsMemObj_t* obj )
 }
 
 
-void HStorage_WriteDataToFile(varStorage_t* vobj, const char* filename){
-
-    fileHandle_t file;
-    char infostring[8192], buf[128];
-    int i;
-    char name[MAX_VARNAME];
+/*
+Formats the variable the iterator has been set up for as one line of the file format:
+\\name\\<name>\\type\\<type>\\count\\<count>\\v0\\<value>...\\
+*/
+int HStorage_IterEntryToInfoStringInternal( vsMemObj_t* obj, const char* name, varType_t type, int count, char* infostring, int size )
+{
+    char line[BIG_INFO_STRING], buf[128];
     char *string;
-    int count;
-    vsMemObj_t* obj;
+    int i, len;
     vsValue_t value;
-    varType_t type;
     mvabuf;
 
+    *line = 0;
+    BigInfo_SetValueForKey(line, "name", name);
+    BigInfo_SetValueForKey(line, "type", HStorage_EnumToVarType(type));
+    BigInfo_SetValueForKey(line, "count", va("%d", count));
+
+    for(i = 0; i < count; i++)
+    {
+        if(HStorage_GetDataInternal(obj, &value) == 0)
+        {
+            break;
+        }
+
+        if(type == VSVAR_STRING)
+        {
+            string = HStorage_ValueToString(type, &value, buf, sizeof(buf));
+            Info_SetEncodedValueForKey(line, va("v%d", i), string, strlen(string));
+        }else{
+            BigInfo_SetValueForKey(line, va("v%d", i), HStorage_ValueToString(type, &value, buf, sizeof(buf)));
+        }
+    }
+
+    Q_strncat(line, sizeof(line), "\\\n");
+
+    len = strlen(line);
+    if(len >= size)
+    {
+        obj->lastError = "HStorage_EntryToInfoString: Buffer is too small";
+        return 0;
+    }
+    memcpy(infostring, line, len +1);
+    return len;
+}
+
+int HStorage_EntryToInfoString( varStorage_t* vobj, const char* name, char* infostring, int size )
+{
+    char varname[MAX_VARNAME];
+    varType_t type;
+    int count;
+
+    Q_strncpyz(varname, name, sizeof(varname));
+
+    count = HStorage_GetBeginDataInternal( vobj->memObj, varname, &type );
+    if(count == 0)
+    {
+        return 0;
+    }
+    return HStorage_IterEntryToInfoStringInternal( vobj->memObj, varname, type, count, infostring, size );
+}
+
+
+char* HStorage_WriteDataToMemory( varStorage_t* vobj, int* length )
+{
+    char infostring[BIG_INFO_STRING];
+    char name[MAX_VARNAME];
+    char *buffer, *newbuffer;
+    int count, len, used, size;
+    varType_t type;
+    vsMemObj_t* obj;
+
     obj = vobj->memObj;
 
-    file = FS_SV_FOpenFileWrite(va("%s.tmp", filename));
-    if(!file){
-        Com_PrintError(CON_CHANNEL_SCRIPT,"HStorage_WriteDataToFile: Can not open %s for writing\n", filename);
-        return;
+    size = 16 * obj->table.numInUseFields + 1024;
+    buffer = malloc(size);
+    if(buffer == NULL)
+    {
+        obj->lastError = "HStorage_WriteDataToMemory: Out of memory";
+        return NULL;
     }
+    used = 0;
 
     HStorage_IterInit( obj );
 
@@ -870,31 +974,58 @@ void HStorage_WriteDataToFile(varStorage_t* vobj, const char* filename){
                 continue;
             }
 
-            *infostring = 0;
-            Info_SetValueForKey(infostring, "name", name);
-            Info_SetValueForKey(infostring, "type", HStorage_EnumToVarType(type));
-            Info_SetValueForKey(infostring, "count", va("%d", count));
-
-            for(i = 0; i < count; i++)
+            len = HStorage_IterEntryToInfoStringInternal( obj, name, type, count, infostring, sizeof(infostring) );
+            if(len == 0)
             {
-                if(HStorage_GetDataInternal(obj, &value) == 0)
-                {
-                    break;
-                }
+                continue;
+            }
 
-                if(type == VSVAR_STRING)
+            if(used + len >= size)
+            {
+                size = 2 * (used + len);
+                newbuffer = realloc(buffer, size);
+                if(newbuffer == NULL)
                 {
-                    string = HStorage_ValueToString(type, &value, buf, sizeof(buf));
-                    Info_SetEncodedValueForKey(infostring, va("v%d", i), string, strlen(string));
-                }else{
-                    Info_SetValueForKey(infostring, va("v%d", i), HStorage_ValueToString(type, &value, buf, sizeof(buf)));
+                    free(buffer);
+                    obj->lastError = "HStorage_WriteDataToMemory: Out of memory";
+                    return NULL;
                 }
+                buffer = newbuffer;
             }
+            memcpy(buffer + used, infostring, len);
+            used += len;
+    }
+    buffer[used] = '\0';
+    *length = used;
+    obj->lastError = "HStorage_WriteDataToMemory: Success";
+    return buffer;
+}
 
-            Q_strncat(infostring, sizeof(infostring), "\\\n");
-            FS_Write(infostring, strlen(infostring), file);
+
+void HStorage_WriteDataToFile(varStorage_t* vobj, const char* filename){
+
+    fileHandle_t file;
+    char *buffer;
+    int len;
+    mvabuf;
+
+    buffer = HStorage_WriteDataToMemory( vobj, &len );
+    if(buffer == NULL)
+    {
+        Com_PrintError(CON_CHANNEL_SCRIPT,"HStorage_WriteDataToFile: %s\n", HStorage_GetLastError( vobj ));
+        return;
+    }
+
+    file = FS_SV_FOpenFileWrite(va("%s.tmp", filename));
+    if(!file){
+        Com_PrintError(CON_CHANNEL_SCRIPT,"HStorage_WriteDataToFile: Can not open %s for writing\n", filename);
+        free(buffer);
+        return;
     }
+
+    FS_Write(buffer, len, file);
     FS_FCloseFile(file);
+    free(buffer);
     FS_SV_HomeCopyFile(va("%s.tmp", filename) , (char*)filename);
 }
 
@@ -904,15 +1035,27 @@ qboolean HStorage_ParseLine(varStorage_t* vobj ,char* line, int linenumber){
     int i, count, outlen;
     varType_t varType;
     char *varValue;
-    vsMemObj_t* newobj;
     vsMemObj_t* obj;
     char queryString[32];
-    char varname[32];
+    char varname[MAX_VARNAME];
     char outbuf[8192];
+    vsValue_t value;
     qboolean suc;
 
     obj = vobj->memObj;
 
+    /* Journal record of a removed variable: \\del\\1\\name\\<name>\\ */
+    if(Info_ValueForKey(line, "del")[0])
+    {
+        Q_strncpyz(varname, Info_ValueForKey(line, "name"), sizeof(varname));
+        if(varname[0] == '\0')
+        {
+            return qfalse;
+        }
+        HStorage_RemoveData(vobj, varname);
+        return qtrue;
+    }
+
     varType = HStorage_VarTypeToEnum( Info_ValueForKey(line, "type") );
 
     if(varType == VSVAR_BAD)
@@ -952,14 +1095,13 @@ qboolean HStorage_ParseLine(varStorage_t* vobj ,char* line, int linenumber){
                 outbuf[sizeof(outbuf) -1] = '\0';
             }
 
-            vsValue_t value;
             value.string = outbuf;
-            HStorage_AddDataInternal( obj, &value);
+            suc = HStorage_AddDataInternal( obj, &value);
 
         }else{
             varValue = Info_ValueForKey(line, queryString);
+            suc = HStorage_AddDataFromStringInternal( obj, varValue );
         }
-        suc = HStorage_AddDataFromStringInternal( obj, varValue );
         if(suc != qtrue)
         {
             Com_PrintError(CON_CHANNEL_SCRIPT,"HStorage_ParseLine: %s\n", HStorage_GetLastErrorInternal( obj ));
@@ -967,27 +1109,10 @@ qboolean HStorage_ParseLine(varStorage_t* vobj ,char* line, int linenumber){
         }
     }
 
-    switch(HStorage_EndDataInternal( obj ))
+    if(HStorage_EndData( vobj ) == qfalse)
     {
-        default:
-            Com_PrintError(CON_CHANNEL_SCRIPT,"HStorage_ParseLine: %s\n", HStorage_GetLastErrorInternal( obj ));
-            return qfalse;
-
-        case 0:
-            newobj = HStorage_Relocate( obj );
-            if(newobj == NULL)
-            {
-                Com_PrintError(CON_CHANNEL_SCRIPT,"HStorage_ParseLine: %s\n", HStorage_GetLastErrorInternal( newobj ));
-                return qfalse;
-            }
-            obj = newobj;
-            HStorage_EndDataInternal( obj );
-            vobj->memObj = obj;
-            vobj->relocationCount++;
-            break;
-
-        case 1:
-            break;
+        Com_PrintError(CON_CHANNEL_SCRIPT,"HStorage_ParseLine: %s\n", HStorage_GetLastError( vobj ));
+        return qfalse;
     }
 
     return qtrue;
@@ -1135,4 +1260,48 @@ const char* HStorage_GetLastError(varStorage_t* obj)
 {
     return HStorage_GetLastErrorInternal( obj->memObj );
 }
-#endif
\ No newline at end of file
+
+void HStorage_FreeObject( varStorage_t* vobj )
+{
+    free(vobj->memObj);
+    vobj->memObj = NULL;
+}
+
+qboolean HStorage_RemoveData( varStorage_t* obj, const char* name )
+{
+    return HStorage_RemoveDataInternal( obj->memObj, name );
+}
+
+qboolean HStorage_Compact( varStorage_t* vobj )
+{
+    vsMemObj_t* obj, *newobj;
+
+    obj = vobj->memObj;
+
+    if(obj->table.numGarbageUnits == 0 && obj->table.numDeletedFields == 0)
+    {
+        return qtrue;
+    }
+    /* Nothing pending to add */
+    obj->iter.tempunits[0].header.dataSize = 0;
+
+    newobj = HStorage_Relocate( obj );
+    if(newobj == NULL || newobj == obj)
+    {
+        return qfalse;
+    }
+    vobj->memObj = newobj;
+    vobj->relocationCount++;
+    return qtrue;
+}
+
+void HStorage_GetStats( varStorage_t* vobj, vsStats_t* stats )
+{
+    vsMemObj_t* obj = vobj->memObj;
+
+    stats->numEntries = obj->table.numInUseFields;
+    stats->numTableFields = obj->table.numFields;
+    stats->usedUnits = obj->table.nextFree - obj->table.numGarbageUnits;
+    stats->garbageUnits = obj->table.numGarbageUnits;
+    stats->totalUnits = obj->table.numUnits;
+}
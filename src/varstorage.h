@@ -1,7 +1,12 @@
-#include "q_shared.h"
+#ifndef __VARSTORAGE_H__
+#define __VARSTORAGE_H__
+
 #include "q_shared.h"
 #include <stdint.h>
 
+#define MAX_VARNAME 64
+#define MAX_ARRAY_SIZE 128
+
 typedef enum
 {
     VSVAR_BAD,
@@ -23,7 +28,7 @@ typedef union
     vec3_t vector;
 }vsValue_t;
 
-typedef void vsMemObj_t;
+typedef struct vsMemObj_s vsMemObj_t;
 
 typedef struct
 {
@@ -31,11 +36,20 @@ typedef struct
     int relocationCount;
 }varStorage_t;
 
+typedef struct
+{
+    int numEntries;
+    int numTableFields;
+    int usedUnits;
+    int garbageUnits;
+    int totalUnits;
+}vsStats_t;
 
 
 char* HStorage_ValueToString(varType_t type, vsValue_t* value, char* buf, int buflen);
 qboolean HStorage_StringToValue(varType_t type, char* string, vsValue_t* value);
 qboolean HStorage_InitObject( varStorage_t* obj, int bytes );
+void HStorage_FreeObject( varStorage_t* obj );
 
 /* Preparing the tempdata object */
 qboolean HStorage_BeginData( varStorage_t* obj, varType_t type, const char* name);
@@ -45,11 +59,25 @@ qboolean HStorage_AddData( varStorage_t* obj, vsValue_t* value );
 
 qboolean HStorage_EndData( varStorage_t* obj );
 
-int HStorage_GetBeginData( varStorage_t* obj, const char* name, varType_t* type);
+/* name has to be a buffer of MAX_VARNAME bytes */
+int HStorage_GetBeginData( varStorage_t* obj, char* name, varType_t* type);
 /* Gets one element */
 int HStorage_GetData(varStorage_t* obj, vsValue_t* value );
 
+qboolean HStorage_RemoveData( varStorage_t* obj, const char* name );
+/* Reclaims the memory of overwritten and removed variables */
+qboolean HStorage_Compact( varStorage_t* obj );
+void HStorage_GetStats( varStorage_t* obj, vsStats_t* stats );
+
+/* One line of the file format, returns the length of the line or 0 */
+int HStorage_EntryToInfoString( varStorage_t* obj, const char* name, char* infostring, int size );
+qboolean HStorage_ParseLine( varStorage_t* obj, char* line, int linenumber );
+/* All variables in the file format, free the buffer with free() */
+char* HStorage_WriteDataToMemory( varStorage_t* obj, int* length );
+
 void HStorage_WriteDataToFile(varStorage_t* obj, const char* filename);
-vsMemObj_t* HStorage_LoadDataFromFile(varStorage_t* obj, const char* filename);
+qboolean HStorage_LoadDataFromFile(varStorage_t* obj, const char* filename);
+
+const char* HStorage_GetLastError(varStorage_t* obj);
 
-const char* HStorage_GetLastError(varStorage_t* obj);
\ No newline at end of file
+#endif
@@ -147,6 +147,8 @@ void DB_PostLoadXZone();
 void DB_UpdateDebugZone();
 void DB_AddUserMapDir(const char *dir);
 void DB_ReferencedFastFiles(char* g_zoneSumList, char* g_zoneNameList, int maxsize);
+void DB_PreloadZone(const char *zoneName, int maxBytes);
+void DB_DiscardPreloadedZone(const char *keepZoneName);
 int __cdecl DB_GetAllXAssetOfType(enum XAssetType type, union XAssetHeader *assets, int maxCount);
 void __cdecl DB_ConvertOffsetToPointer(void *data);
 void __cdecl Load_Stream(bool atStreamStart, const void *ptr, int size);
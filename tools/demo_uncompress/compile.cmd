@@ -0,0 +1,4 @@
+@set path=C:\MinGW\bin;%path%
+gcc -Wall -O2 -o demo_uncompress.exe main.c -static -lz
+
+pause
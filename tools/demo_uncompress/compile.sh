@@ -0,0 +1,2 @@
+#!/bin/sh
+gcc -Wall -O2 -o demo_uncompress main.c -lz
@@ -0,0 +1,118 @@
+// Converts a compressed server demo (.dm_1.dmz, sv_demoCompress 1) back into a classic .dm_1 demo
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#define DMZ_VERSION 1
+
+int32_t readlittlelong(const uint8_t* b)
+{
+    return (int32_t)(b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24));
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t header[20];
+    char outname[1024];
+    uint8_t *in = NULL, *out = NULL;
+    uLongf outlen;
+    int32_t complen, uncomplen, blocks;
+    size_t len;
+    FILE *fh, *fo;
+
+    if(argc < 2 || argc > 3)
+    {
+        printf("Usage: demo_uncompress \"demo.dm_1.dmz\" [\"demo.dm_1\"]\n");
+        return 1;
+    }
+
+    if(argc == 3)
+    {
+        snprintf(outname, sizeof(outname), "%s", argv[2]);
+    }else{
+        snprintf(outname, sizeof(outname), "%s", argv[1]);
+        len = strlen(outname);
+        if(len > 4 && strcmp(outname + len - 4, ".dmz") == 0)
+        {
+            outname[len - 4] = '\0';
+        }else{
+            snprintf(outname, sizeof(outname), "%s.dm_1", argv[1]);
+        }
+    }
+
+    fh = fopen(argv[1], "rb");
+    if(fh == NULL)
+    {
+        printf("File not found or no access to it\n");
+        return 1;
+    }
+
+    if(fread(header, 1, 16, fh) != 16 || memcmp(header, "CDMZ", 4) != 0)
+    {
+        printf("Not a compressed demo\n");
+        fclose(fh);
+        return 1;
+    }
+    if(readlittlelong(header + 4) != DMZ_VERSION)
+    {
+        printf("Unsupported compressed demo version %d\n", readlittlelong(header + 4));
+        fclose(fh);
+        return 1;
+    }
+    printf("Protocol: %d\n", readlittlelong(header + 8));
+
+    fo = fopen(outname, "wb");
+    if(fo == NULL)
+    {
+        printf("Can not write to \"%s\"\n", outname);
+        fclose(fh);
+        return 1;
+    }
+
+    blocks = 0;
+    while(fread(header, 1, 20, fh) == 20)
+    {
+        complen = readlittlelong(header + 4);
+        uncomplen = readlittlelong(header + 8);
+
+        if(memcmp(header, "DMZB", 4) != 0 || complen <= 0 || uncomplen <= 0)
+        {
+            printf("Broken block header after %d blocks\n", blocks);
+            break;
+        }
+
+        in = realloc(in, complen);
+        out = realloc(out, uncomplen);
+        if(in == NULL || out == NULL)
+        {
+            printf("Out of memory\n");
+            break;
+        }
+        if(fread(in, 1, complen, fh) != (size_t)complen)
+        {
+            printf("Demo is truncated after %d blocks\n", blocks);
+            break;
+        }
+        outlen = uncomplen;
+        if(uncompress(out, &outlen, in, complen) != Z_OK || outlen != (uLongf)uncomplen)
+        {
+            printf("Broken block %d\n", blocks);
+            break;
+        }
+        if(fwrite(out, 1, outlen, fo) != outlen)
+        {
+            printf("fwrite: I/O error\n");
+            break;
+        }
+        blocks++;
+    }
+
+    printf("Wrote %d blocks to \"%s\"\n", blocks, outname);
+    free(in);
+    free(out);
+    fclose(fo);
+    fclose(fh);
+    return 0;
+}